@@ -0,0 +1,35 @@
+#!/bin/sh
+# compiles every *_bench.sc to C with -C and prints the best wall time
+# of a few runs in seconds for the interpreter, -T and the compiled
+# program, checking that all of them print the same:
+#   ./aot_bench.sh ../src 5
+src=${1:-../src}
+runs=${2:-3}
+cd "$(dirname "$0")"
+src=$(cd "$src" && pwd) || exit 1
+make -s -C "$src" scriptC libscriptc.a || exit 1
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+time_best() {
+  best=
+  for r in $(seq "$runs"); do
+    start=$(date +%s.%N)
+    "$@" > "$out/run"
+    end=$(date +%s.%N)
+    best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if($3 != "" && $3 < t) t = $3; print t }')
+  done
+  printf "%10.3f" "$best"
+}
+printf "%-22s%10s%10s%10s\n" "benchmark" "plain" "-T" "-C"
+for f in *_bench.sc; do
+  printf "%-22s" "$f"
+  "$src/scriptC" -i "$f" -C "$out/bench.c" &&
+  gcc -O2 -std=c99 -I "$src" "$out/bench.c" "$src/libscriptc.a" -lm -pthread -o "$out/bench" || exit 1
+  time_best "$src/scriptC" -i "$f"
+  mv "$out/run" "$out/plain"
+  time_best "$src/scriptC" -T -i "$f"
+  cmp -s "$out/run" "$out/plain" || printf "  -T output differs"
+  time_best "$out/bench"
+  cmp -s "$out/run" "$out/plain" || printf "  -C output differs"
+  echo
+done
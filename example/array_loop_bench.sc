@@ -0,0 +1,57 @@
+n = 100000;
+a = iarray(n);
+b = iarray(n);
+c = iarray(n);
+x = farray(n);
+y = farray(n);
+for(i = 0; i < n; i++) {
+  a[i] = i / 7 - 5000;
+  b[i] = 3 - i / 25000;
+  x[i] = a[i];
+  y[i] = b[i];
+}
+r = 0;
+while(r < 50) {
+  s = 0;
+  for(i = 0; i < n; i++) {
+    s += a[i];
+  }
+  d = 0;
+  for(i = 0; i < n; i++) {
+    d += a[i] * b[i];
+  }
+  lo = a[0];
+  hi = a[0];
+  for(i = 1; i < n; i++) {
+    if a[i] < lo {
+      lo = a[i];
+    }
+    if a[i] > hi {
+      hi = a[i];
+    }
+  }
+  for(i = 0; i < n; i++) {
+    c[i] = 1;
+  }
+  for(i = 0; i < n; i++) {
+    c[i] = c[i] + a[i];
+  }
+  for(i = 0; i < n; i++) {
+    c[i] = c[i] * 2;
+  }
+  t = 0;
+  for(i = 0; i < n; i++) {
+    t += c[i];
+  }
+  fd = 0.0;
+  for(i = 0; i < n; i++) {
+    fd += x[i] * y[i];
+  }
+  r++;
+}
+print s;
+print d;
+print lo;
+print hi;
+print t;
+print fd;
@@ -0,0 +1,31 @@
+n = 100000;
+a = iarray(n);
+b = iarray(n);
+c = iarray(n);
+x = farray(n);
+y = farray(n);
+for(i = 0; i < n; i++) {
+  a[i] = i / 7 - 5000;
+  b[i] = 3 - i / 25000;
+  x[i] = a[i];
+  y[i] = b[i];
+}
+r = 0;
+while(r < 50) {
+  s = sum(a);
+  d = dot(a, b);
+  lo = min(a);
+  hi = max(a);
+  fill(c, 1);
+  add(c, a);
+  scale(c, 2);
+  t = sum(c);
+  fd = dot(x, y);
+  r++;
+}
+print s;
+print d;
+print lo;
+print hi;
+print t;
+print fd;
@@ -0,0 +1,10 @@
+def square(x) {
+  return x * x;
+}
+
+const SIDE = 12;
+const AREA = square(SIDE);
+const BIG = AREA > 100;
+
+print AREA;
+print BIG;
@@ -0,0 +1,10 @@
+x = 0;
+y = 0;
+for(i = 0; i < 3000000; i++) {
+  a = i / 100;
+  b = a * a + a;
+  x = a * a + a - b;
+  y = (a * a + a) / 2;
+}
+print x;
+print y;
@@ -0,0 +1,27 @@
+#!/bin/sh
+# runs every *_bench.sc under each interpreter core and prints the best
+# wall time of a few runs in seconds:
+#   ./dispatch_bench.sh ../src/scriptC 5
+scriptC=${1:-../src/scriptC}
+runs=${2:-3}
+cores="direct switch call context"
+cd "$(dirname "$0")"
+printf "%-22s" "benchmark"
+for core in $cores; do
+  printf "%10s" "$core"
+done
+echo
+for f in *_bench.sc; do
+  printf "%-22s" "$f"
+  for core in $cores; do
+    best=
+    for r in $(seq "$runs"); do
+      start=$(date +%s.%N)
+      "$scriptC" -t "$core" -i "$f" > /dev/null
+      end=$(date +%s.%N)
+      best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if($3 != "" && $3 < t) t = $3; print t }')
+    done
+    printf "%10.3f" "$best"
+  done
+  echo
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+# prints the if-chain equivalent of map_bench.sc:
+#   ./ifchain_bench.sh > /tmp/ifchain_bench.sc
+#   time ./scriptC -O0 -i /tmp/ifchain_bench.sc
+# -O0 keeps the SSA passes' compile time of the 10k-branch function out
+# of the measurement
+n=${1:-10000}
+echo "def lookup(key) {"
+awk -v n="$n" 'BEGIN { for(k = 0; k < n; k++) printf("  if key == %d {\n    return %d;\n  }\n", k * 7, k * 3 + 1) }'
+echo "  return 0;"
+echo "}"
+cat <<END
+n = $n;
+s = 0;
+for(r = 0; r < 2; r++) {
+  for(k = 0; k < n; k++) {
+    s += lookup(k * 7);
+  }
+}
+print s;
+END
@@ -0,0 +1,40 @@
+#!/bin/sh
+# generates a project of many imported files and prints the wall time
+# of a run without cached objects, with all of them cached and after
+# editing the body of a function every file imports:
+#   ./import_bench.sh ../src 100 100
+src=${1:-../src}
+files=${2:-100}
+funcs=${3:-100}
+cd "$(dirname "$0")"
+src=$(cd "$src" && pwd) || exit 1
+make -s -C "$src" scriptC || exit 1
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+helper() {
+  printf 'def helper(x) {\n  return x * %d + 1;\n}\n' "$1" > "$out/helper.sc"
+}
+helper 3
+for f in $(seq "$files"); do
+  awk -v f="$f" -v n="$funcs" 'BEGIN {
+    printf "import \"helper.sc\";\n";
+    for(i = 0; i < n; i++) {
+      printf "def m%d_f%d(x) {\n  s = 0;\n  i = 0;\n  while(i < x) {\n", f, i;
+      printf "    if(i / 2 * 2 == i) { s = s + helper(i); } else { s = s - %d; }\n    i++;\n  }\n  return s;\n}\n", i;
+    }
+  }' > "$out/m$f.sc"
+  echo "import \"m$f.sc\";" >> "$out/main.sc"
+done
+echo "print m1_f0(10);" >> "$out/main.sc"
+run() {
+  printf "%-10s" "$1"
+  start=$(date +%s.%N)
+  "$src/scriptC" -i "$out/main.sc" > "$out/run" || exit 1
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{ printf "%10.3f s  ", $2 - $1 }'
+  cat "$out/run"
+}
+run "cold"
+run "cached"
+helper 5
+run "edited"
@@ -0,0 +1,44 @@
+#!/bin/sh
+# scans a generated log of about 400 MB with readline, readfield and
+# readfile and prints the wall time of each next to wc -l, which reads
+# the same bytes:
+#   ./input_bench.sh ../src/scriptC 8000000
+scriptC=${1:-../src/scriptC}
+lines=${2:-8000000}
+cd "$(dirname "$0")"
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+seq 1 "$lines" | awk '{ print "2026-10-19 host" $1 % 97 " GET /path/" $1 " 200 " $1 * 7 }' > "$out/log.txt"
+cat > "$out/lines.sc" <<SC
+s = open("$out/log.txt");
+n = 0;
+line = readline(s);
+while(eof(s) == false) {
+  n = n + 1;
+  line = readline(s);
+}
+print n;
+SC
+cat > "$out/fields.sc" <<SC
+s = open("$out/log.txt");
+n = 0;
+f = readfield(s);
+while(eof(s) == false) {
+  if(f != "") {
+    n = n + 1;
+  }
+  f = readfield(s);
+}
+print n;
+SC
+echo "print len(readfile(\"$out/log.txt\"));" > "$out/readfile.sc"
+elapsed() {
+  start=$(date +%s.%N)
+  "$@" > "$out/run"
+  end=$(date +%s.%N)
+  printf "%-12s%10.3f  %s\n" "$name" "$(echo "$start $end" | awk '{ print $2 - $1 }')" "$(cat "$out/run")"
+}
+name="wc -l" elapsed wc -l "$out/log.txt"
+for script in lines fields readfile; do
+  name=$script elapsed "$scriptC" -i "$out/$script.sc"
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+# generates a script of many functions of which a few are hot and most
+# are never reached, and prints the instructions left after the link
+# time layout and the execute time of -s for -e, -e with a -R profile
+# and the lazily linked default:
+#   ./layout_bench.sh ../src 3000 60
+src=${1:-../src}
+funcs=${2:-3000}
+hot=${3:-60}
+cd "$(dirname "$0")"
+src=$(cd "$src" && pwd) || exit 1
+make -s -C "$src" scriptC || exit 1
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+awk -v n="$funcs" -v hot="$hot" 'BEGIN {
+  step = int(n / hot);
+  for(i = 0; i < n; i++) {
+    printf "def f%d(x) {\n  y = x * 3 + %d;\n  if(y > 1000000) { y = y - 1000000; }\n", i, i;
+    printf "  z = y / 7 + x * 2 - %d;\n  w = z * z - y;\n  if(w < 0) { w = 0 - w; }\n", i % 13;
+    if(i % step == 0 && i >= step) printf "  if(x < 0) { return f%d(x + 1); }\n", i - step;
+    else if(i % 4 == 1) printf "  if(x < 0) { return f%d(x); }\n", i - 1;
+    printf "  return w / 3 + z;\n}\n";
+  }
+  printf "s = 0;\ni = 0;\nwhile(i < 20000) {\n";
+  for(k = 0; k < hot; k++) printf "  s = s + f%d(i);\n", k * step;
+  printf "  i++;\n}\nprint s;\n";
+}' > "$out/layout.sc"
+"$src/scriptC" -e -g -i "$out/layout.sc" 2>&1 | grep "Layout:"
+"$src/scriptC" -R "$out/profile" -i "$out/layout.sc" > /dev/null || exit 1
+execute() {
+  printf "%-12s" "$1"
+  shift
+  "$src/scriptC" -s "$@" -i "$out/layout.sc" 2>&1 >/dev/null | grep -o '"execute", "wall_ms": [0-9.]*' | cut -d' ' -f3
+}
+execute "-e" -e
+execute "-e -U" -e -U "$out/profile"
+execute "lazy"
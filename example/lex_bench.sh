@@ -0,0 +1,14 @@
+#!/bin/sh
+# prints a script of roughly n MB for the lexer benchmark:
+#   ./lex_bench.sh 64 > /tmp/lex_bench.sc
+#   ./scriptC -l -i /tmp/lex_bench.sc
+# -l only scans the tokens and prints the throughput
+n=${1:-16}
+awk -v n="$n" 'BEGIN {
+  line = "def update_counter_%d(value, scale) {\n  total_%d = value * 1.25 + scale - 42;\n  if total_%d >= 1000 {\n    print(\"overflow in update_counter\");\n  }\n  return total_%d;\n}\n";
+  for(k = 0; size < n * 1000000; k++) {
+    s = sprintf(line, k, k, k, k);
+    size += length(s);
+    printf("%s", s);
+  }
+}'
@@ -0,0 +1,59 @@
+def t(n) {
+  print n;
+  return true;
+}
+def f(n) {
+  print n;
+  return false;
+}
+def logic(a, b) {
+  x = a && b;
+  y = a || b;
+  z = !a;
+  w = !(a == b);
+  print x;
+  print y;
+  print z;
+  print w;
+  return 0;
+}
+def count(n) {
+  c = 0;
+  for(i = 0; i < n && !(i == 7); i++) {
+    if(i == 2 || i == 4 && !(i != 4)) {
+      continue;
+    }
+    if(!(i < 5) && i != 6) {
+      c += 100;
+    }
+    c += 1;
+  }
+  return c;
+}
+a = 1;
+b = 2;
+logic(a < b, b < a);
+logic(false, false);
+logic(true, true);
+if(t(1) || f(2)) { print "or1"; }
+if(f(3) || t(4)) { print "or2"; }
+if(f(5) && t(6)) { print "bad"; } else { print "and1"; }
+if(t(7) && t(8)) { print "and2"; }
+if(!(a < b)) { print "bad"; } else { print "not1"; }
+if(!(a == b) && !false) { print "not2"; }
+while(!true) { print "bad"; }
+print count(a + 19);
+x = a < b && b < 3;
+print x;
+print !x;
+print a == b || !(b == 2) || x && a + b == 3;
+s = 0;
+k = 0;
+while(k < 10 && s >= 0 || k == 100) {
+  s += k;
+  k++;
+  if(k == 5 && s == 10) { k = 100; }
+}
+print s;
+print k;
+print t(9) && f(10) || !t(11);
@@ -0,0 +1,10 @@
+n = 2000000;
+c = 0;
+for(i = 0; i < n; i++) {
+  a = i - i / 3 * 3;
+  b = i - i / 5 * 5;
+  if(a == 0 && b != 0 || !(a != 1) && b == 1) {
+    c++;
+  }
+}
+print c;
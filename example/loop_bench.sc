@@ -0,0 +1,14 @@
+n = 100;
+x = 0;
+for(i = 0; i < 5000000; i++) {
+  x = i * 8 + n * 4 / 2;
+}
+print x;
+
+j = 0;
+y = 0;
+while(j < 5000000) {
+  y = j * 3 - n * n;
+  j++;
+}
+print y;
@@ -0,0 +1,12 @@
+n = 10000;
+m = map(n);
+for(k = 0; k < n; k++) {
+  m[k * 7] = k * 3 + 1;
+}
+s = 0;
+for(r = 0; r < 2; r++) {
+  for(k = 0; k < n; k++) {
+    s += m[k * 7];
+  }
+}
+print s;
@@ -0,0 +1,275 @@
+#!/bin/sh
+# regression cases: each runs a small script and compares its output
+# and exit status. prints the cases that fail and exits 1 if any did:
+#   ./regression.sh ../src
+src=${1:-../src}
+cd "$(dirname "$0")"
+src=$(cd "$src" && pwd) || exit 1
+make -s -C "$src" scriptC 2> /dev/null || exit 1
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+failed=0
+
+# check name status expected-stdout [option ...] < script
+# with error set, stderr must contain it too
+error=
+check() {
+  name=$1 status=$2 expected=$3
+  shift 3
+  cat > "$out/case.sc"
+  "$src/scriptC" "$@" -i "$out/case.sc" > "$out/stdout" 2> "$out/stderr"
+  got=$?
+  if [ "$got" != "$status" ] || [ "$(cat "$out/stdout")" != "$expected" ] \
+      || { [ -n "$error" ] && ! grep -qF -- "$error" "$out/stderr"; }; then
+    echo "FAIL $name $*: status $got, output:"
+    cat "$out/stdout" "$out/stderr"
+    failed=1
+    return 1
+  fi
+}
+
+# a hoisted invariant must not fail ahead of the effects before it
+for level in 0 1; do
+  check hoist-order 0 "0" -O$level <<'SC'
+z = 0;
+i = 0;
+while(i < 2) {
+  print i;
+  y = 10 / z;
+  i++;
+}
+SC
+done
+
+# negative iinc steps survive the packed operand
+for option in -O0 -O1 -T; do
+  check negative-step 0 "8695" $option <<'SC'
+s = 0;
+for(i = 100; i > 0; i -= 3) {
+  s += i * 5;
+}
+for(j = 10; j > 0; j--) {
+  s += j * 2;
+}
+print s;
+SC
+done
+
+# int arrays hold any int value, and a bigint is refused
+error="value out of range of int array"
+for option in -O0 -O1 -T; do
+  check wide-array 0 "6852516948
+3000000299
+-4" $option <<'SC'
+a = iarray(4);
+for(i = 0; i < 300; i++) {
+  a[i / 100] = 3000000000 + i;
+}
+a[3] = -2147483649;
+print sum(a);
+print a[2];
+b = iarray(3);
+fill(b, 4294967296);
+scale(b, 4294967296);
+print min(b) - 4;
+b[0] = 9223372036854775807 + 1;
+SC
+done
+error=
+
+# an integer literal past int64 is a bigint
+for option in -O0 -O1 -e -T; do
+  check big-literal 0 "9223372036854775807
+-9223372036854775808
+123456789012345678901234567890123456789
+300000000000000000000" $option <<'SC'
+print 9223372036854775808 - 1;
+print -9223372036854775808;
+print 123456789012345678901234567890123456789;
+s = 0;
+for(i = 0; i < 3; i++) {
+  s += 100000000000000000000;
+}
+print s;
+SC
+done
+
+# a body that is never called is checked all the same
+error="variable not found (undefined_name)"
+for option in -O1 -e; do
+  check unused-body 1 "" $option <<'SC'
+def bad(a) {
+  return undefined_name + a;
+}
+if false {
+  bad(1);
+}
+SC
+done
+error="continue error"
+check unused-continue 1 "" <<'SC'
+def skip(n) {
+  switch n {
+    case 1:
+      continue;
+  }
+}
+print 1;
+SC
+error=
+
+# names a body sees only later are not errors
+check lazy-order 0 "2" <<'SC'
+def g() {
+  x = 1;
+  while true {
+    switch x {
+      case 1:
+        y = 2;
+        break;
+    }
+    break;
+  }
+  return y;
+}
+print g();
+SC
+
+# a frame holds every local, however many, and a call passes exactly
+# the parameters of its callee
+many=$(awk 'BEGIN {
+  for(i = 0; i < 300; i++) { printf "x%d = %d;\n", i, i; s = s (i ? " + " : "") "x" i }
+  print "print " s ";"
+}')
+for option in -O0 -O1 -e -T; do
+  echo "$many" | check many-locals 0 "44850" $option
+done
+error="h expects 2 argument(s)"
+for option in -O0 -O1 -e; do
+  check arity 1 "" $option <<'SC'
+def h(x, y) {
+  return x + y;
+}
+print h(3);
+SC
+done
+error="cannot verify g: stack underflow"
+check assign-argument 1 "" <<'SC'
+def f(a, b) {
+  return a + b;
+}
+def g() {
+  return f(1, x = 1);
+}
+print g();
+SC
+error=
+
+# a local read before any path assigned it stops the script
+error="variable read before assignment"
+for option in -O0 -O1 -e -T; do
+  check unset-local 0 "8" $option <<'SC'
+def f(a) {
+  if a > 1 {
+    b = 5;
+  }
+  return b + a;
+}
+print f(3);
+print f(0);
+print 9;
+SC
+done
+error=
+
+# arrays, maps and bigints that die are swept: the loop allocates about
+# 3 GB and must stay within 64 MB of address space, while what the
+# frames reach survives every collection
+heap_flat=$(cat <<'SC'
+keep = map(2);
+kept = iarray(3);
+kept[1] = 7;
+keep["array"] = kept;
+keep["big"] = 9223372036854775807 * 4;
+keep["name"] = "ke" + "ep";
+for(i = 0; i < 20000; i++) {
+  a = iarray(10000);
+  m = map(1000);
+  m[i] = a;
+  m["big"] = keep["big"] * i;
+  a[9999] = i;
+}
+print sum(keep["array"]);
+print keep["big"];
+print keep["name"];
+print a[9999] + len(m);
+SC
+)
+for option in -O0 -O1 -T; do
+  (ulimit -v 65536 && echo "$heap_flat" | check heap-flat 0 "7
+36893488147419103228
+keep
+20001" $option) || failed=1
+done
+
+# compiled name expected [option ...] < script
+# the same through -C, run within 64 MB of address space
+make -s -C "$src" libscriptc.a 2> /dev/null || exit 1
+compiled() {
+  name=$1 expected=$2
+  shift 2
+  cat > "$out/case.sc"
+  if ! "$src/scriptC" "$@" -i "$out/case.sc" -C "$out/case.c" \
+      || ! gcc -O2 -std=c99 -I "$src" "$out/case.c" "$src/libscriptc.a" -lm -pthread -o "$out/case"; then
+    echo "FAIL $name -C $*: not compiled"
+    return 1
+  fi
+  (ulimit -v 65536 && "$out/case" > "$out/stdout" 2>&1)
+  if [ "$(cat "$out/stdout")" != "$expected" ]; then
+    echo "FAIL $name -C $*: output:"
+    cat "$out/stdout"
+    return 1
+  fi
+}
+
+# compiled frames are roots, and int variables turn into bigints
+for level in 0 1; do
+  echo "$heap_flat" | compiled heap-flat "7
+36893488147419103228
+keep
+20001" -O$level || failed=1
+  compiled int-overflow "9223372036854775820
+40
+9223372036854775660
+2.500000" -O$level <<'SC' || failed=1
+x = 9223372036854775800;
+n = 0;
+for(i = 0; i < 20; i++) {
+  x = x + 1;
+  n += 2;
+}
+print x;
+print n;
+print x - n * 4;
+y = 1;
+if n > 30 {
+  y = 2.5;
+}
+print y;
+SC
+  compiled unset-local "variable read before assignment
+8" -O$level <<'SC' || failed=1
+def f(a) {
+  if a > 1 {
+    b = 5;
+  }
+  return b + a;
+}
+print f(3);
+print f(0);
+print 9;
+SC
+done
+
+[ "$failed" = 0 ] && echo "all cases pass"
+exit "$failed"
@@ -0,0 +1,46 @@
+#!/bin/sh
+# runs a synthetic mixed workload under the M:N scheduler: many short
+# request-like scripts next to a few long loops. prints the scheduler
+# report, whose per script latencies show whether the short ones wait
+# behind the long ones:
+#   ./sched_bench.sh ../src/scriptC 4 1000
+scriptC=${1:-../src/scriptC}
+workers=${2:-4}
+instances=${3:-1000}
+budget=${4:-10000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat > "$dir/short.sc" <<END
+s = 0;
+for(i = 0; i < 200; i++) {
+  s += i * i;
+}
+key = "user" + "-" + "42";
+print key;
+END
+cat > "$dir/medium.sc" <<END
+def fib(n) {
+  if n < 2 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+print fib(15);
+END
+cat > "$dir/long.sc" <<END
+m = map(16);
+x = 0;
+for(i = 0; i < 200000; i++) {
+  x += i;
+  if i - i / 1000 * 1000 == 0 {
+    m[i] = "v" + "x";
+  }
+}
+print x;
+END
+# one long script per 50 short and medium ones
+set --
+for k in $(seq 25); do
+  set -- "$@" "$dir/short.sc" "$dir/medium.sc"
+done
+"$scriptC" -w "$workers" -n "$((instances / 51 + 1))" -b "$budget" "$@" "$dir/long.sc" > /dev/null
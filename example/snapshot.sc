@@ -0,0 +1,37 @@
+def square(x) {
+  return x * x;
+}
+names = map(4);
+for(i = 0; i < 100; i++) {
+  names[i] = "n" + "ame";
+}
+inner = map(2);
+inner["self"] = inner;
+inner["pi"] = 3.5;
+names["inner"] = inner;
+a = iarray(10);
+f = farray(3);
+for(i = 0; i < 10; i++) {
+  a[i] = square(i);
+}
+f[1] = 2.25;
+big = 9223372036854775807 * 3;
+flag = 1 < 2;
+greeting = "hello " + "world";
+print "before";
+snapshot();
+print "after";
+print names[99];
+print get(names["inner"], "pi");
+print get(get(inner, "self"), "pi");
+print a[9];
+print sum(a);
+print f[1];
+print big;
+print flag;
+print greeting;
+names[5] = "changed";
+print names[5];
+a[0] = 77;
+print a[0];
+print square(12);
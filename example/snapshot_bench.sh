@@ -0,0 +1,56 @@
+#!/bin/sh
+# a script that spends its time building lookup tables before snapshot()
+# and little after it. prints the wall time of a run without -S, the
+# first run with -S (which writes the snapshot) and a run restored from
+# it, with the size of the snapshot:
+#   ./snapshot_bench.sh ../src 300000
+# n must be at least 7000
+src=${1:-../src}
+n=${2:-300000}
+cd "$(dirname "$0")"
+src=$(cd "$src" && pwd) || exit 1
+make -s -C "$src" scriptC || exit 1
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+cat > "$out/tables.sc" <<END
+def steps(x) {
+  s = 0;
+  while(x != 1) {
+    if(x / 2 * 2 == x) {
+      x = x / 2;
+    } else {
+      x = 3 * x + 1;
+    }
+    s++;
+  }
+  return s;
+}
+n = $n;
+lengths = iarray(n);
+longest = map(n);
+for(i = 1; i < n; i++) {
+  lengths[i] = steps(i);
+  longest[lengths[i]] = i;
+}
+snapshot();
+s = 0;
+for(i = 1; i < 1000; i++) {
+  s += lengths[i * 7];
+}
+print s;
+print get(longest, lengths[n - 1]);
+END
+run() {
+  printf "%-10s" "$1"
+  shift
+  start=$(date +%s.%N)
+  "$src/scriptC" "$@" -i "$out/tables.sc" > "$out/run" || exit 1
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{ printf "%10.3f s  ", $2 - $1 }'
+  tr '\n' ' ' < "$out/run"
+  echo
+}
+run "plain"
+run "write" -S "$out/tables.snap"
+run "restore" -S "$out/tables.snap"
+echo "snapshot: $(wc -c < "$out/tables.snap") bytes"
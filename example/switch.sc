@@ -0,0 +1,48 @@
+def name(n) {
+  switch n {
+    case 0:
+      return "zero";
+    case 1: case 2:
+      return "small";
+    case -1:
+      return "minus one";
+    default:
+      return "many";
+  }
+}
+
+def kind(s) {
+  switch s {
+    case "apple": case "pear":
+      return 1;
+    case "carrot":
+      return 2;
+  }
+  return 0;
+}
+
+for(i = -1; i < 5; i++) {
+  print name(i);
+}
+print kind("pear");
+print kind("carrot");
+print kind("stone");
+
+t = 0;
+for(i = 0; i < 20; i++) {
+  switch i - i / 3 * 3 {
+    case 0:
+      continue;
+    case 1:
+      t += 10;
+    default:
+      t += 1;
+      break;
+    case 100000:
+      t += 1000;
+  }
+  if(i == 16) {
+    break;
+  }
+}
+print t;
@@ -0,0 +1,73 @@
+#!/bin/sh
+# times a function of n cases written as a switch and as an if chain,
+# for dense int keys (tableswitch), sparse int keys (lookupswitch) and
+# string keys (hashswitch), with 200000 lookups each, and prints the
+# best wall time of a few runs in seconds:
+#   ./switch_bench.sh ../src/scriptC 3
+# -O0 keeps the SSA passes' compile time of the 1000-case functions out
+# of the measurement, as in ifchain_bench.sh
+scriptC=${1:-../src/scriptC}
+runs=${2:-3}
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+# key of case k as a script expression
+key() {
+  case $1 in
+    dense) echo "$2" ;;
+    sparse) echo "$(($2 * 7919))" ;;
+    string) echo "\"key$2\"" ;;
+  esac
+}
+write() {
+  kind=$1 n=$2 form=$3
+  echo "def lookup(key) {"
+  [ "$form" = switch ] && echo "  switch key {"
+  for k in $(seq 0 $((n - 1))); do
+    if [ "$form" = switch ]; then
+      printf "    case %s:\n      return %d;\n" "$(key "$kind" "$k")" $((k * 3 + 1))
+    else
+      printf "  if key == %s {\n    return %d;\n  }\n" "$(key "$kind" "$k")" $((k * 3 + 1))
+    fi
+  done
+  [ "$form" = switch ] && echo "  }"
+  echo "  return 0;"
+  echo "}"
+  # the string keys come out of a map so that no call is folded
+  echo "n = $n;"
+  echo "keys = map(n);"
+  for k in $(seq 0 $((n - 1))); do
+    echo "keys[$k] = $(key "$kind" "$k");"
+  done
+  cat <<END
+s = 0;
+for(r = 0; r < $((200000 / n)); r++) {
+  for(k = 0; k < n; k++) {
+    s += lookup(keys[k]);
+  }
+}
+print s;
+END
+}
+time_best() {
+  best=
+  for r in $(seq "$runs"); do
+    start=$(date +%s.%N)
+    "$scriptC" -O0 -i "$1" > "$out/run"
+    end=$(date +%s.%N)
+    best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if($3 != "" && $3 < t) t = $3; print t }')
+  done
+  printf "%10.3f" "$best"
+}
+printf "%-8s%8s%10s%10s\n" "keys" "cases" "switch" "if"
+for kind in dense sparse string; do
+  for n in 10 100 1000; do
+    printf "%-8s%8d" "$kind" "$n"
+    write "$kind" "$n" switch > "$out/switch.sc"
+    write "$kind" "$n" if > "$out/if.sc"
+    time_best "$out/switch.sc"
+    mv "$out/run" "$out/switch"
+    time_best "$out/if.sc"
+    cmp -s "$out/run" "$out/switch" || printf "  output differs"
+    echo
+  done
+done
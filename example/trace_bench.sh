@@ -0,0 +1,25 @@
+#!/bin/sh
+# runs every *_bench.sc with and without -T and prints the best wall
+# time of a few runs in seconds, checking that both print the same:
+#   ./trace_bench.sh ../src/scriptC 5
+scriptC=${1:-../src/scriptC}
+runs=${2:-3}
+cd "$(dirname "$0")"
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+printf "%-22s%10s%10s\n" "benchmark" "plain" "-T"
+for f in *_bench.sc; do
+  printf "%-22s" "$f"
+  for opt in "" "-T"; do
+    best=
+    for r in $(seq "$runs"); do
+      start=$(date +%s.%N)
+      "$scriptC" $opt -i "$f" > "$out/out$opt"
+      end=$(date +%s.%N)
+      best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if($3 != "" && $3 < t) t = $3; print t }')
+    done
+    printf "%10.3f" "$best"
+  done
+  cmp -s "$out/out" "$out/out-T" || printf "  output differs"
+  echo
+done
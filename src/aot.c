@@ -0,0 +1,1048 @@
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "aot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+static const char* op_names[] = {
+#define DEFINE_NAME(NAME) #NAME,
+  IR_EACH(DEFINE_NAME)
+#undef DEFINE_NAME
+};
+
+/* one function of the module: its code, its signature and the operand
+ * stack depth before each instruction, -1 where it is unreachable. types
+ * holds the type of each local and stack slot before each instruction,
+ * locals the type a local has wherever it is read, VT_ANY where the C
+ * code keeps it boxed, and temps a bit per type a stack slot takes */
+struct CFunction {
+  long begin;
+  long end;
+  int params;
+  int returns;
+  int var_size;
+  int stack_size;
+  int* depth;
+  char* label;
+  int* types;
+  int* locals;
+  unsigned char* temps;
+  int deopts;
+};
+
+typedef struct CFunction* CFunction;
+
+static const char* aot_error;
+
+/* a slot of no single type, and a local not stored on every path */
+#define VT_ANY -1
+#define VT_UNDEF -2
+
+/* jump targets of the fast body, and instructions it leaves from */
+#define LABEL_JUMP 1
+#define LABEL_DEOPT 2
+
+static int findFunction(Module module, long call_point) {
+  for(int i = 1; i < module->size; i++) {
+    if(module->codePoints[i] == call_point) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int calleeOf(ScriptCInstruction inst, Module module) {
+  return inst->op == Icall ? findFunction(module, inst->call_point) : inst->func_id;
+}
+
+static int isStorea(int op) {
+  return op == Istorea || op == Istorea_u;
+}
+
+static void scanFunction(ScriptCInstruction insts, CFunction func) {
+  func->params = 0;
+  while(func->begin + func->params < func->end && isStorea(insts[func->begin + func->params].op)) {
+    func->params++;
+  }
+  for(long i = func->begin; i < func->end; i++) {
+    int var_id = -1;
+    switch(insts[i].op) {
+      case Iloadl: case Istorel: case Istorea:
+      case Iloadl_u: case Istorel_u: case Istorea_u:
+        var_id = insts[i].var_id;
+        break;
+      case Iiinc:
+        var_id = insts[i].inc_var;
+        break;
+      case Iret:
+        func->returns = 1;
+        break;
+    }
+    if(var_id >= func->var_size) {
+      func->var_size = var_id + 1;
+    }
+  }
+}
+
+/* pops and pushes of one instruction, 0 when it has no C form */
+static int stackEffect(ScriptCInstruction inst, Module module, CFunction funcs, int* pops, int* push) {
+  *pops = 0;
+  *push = 0;
+  switch(inst->op) {
+    case Iiconst: case Ilconst: case Idconst: case Isconst: case Ibconst:
+    case Iloadl: case Iloadl_u:
+      *push = 1;
+      break;
+    case Istorel: case Istorel_u: case Iwrite: case Iret: case Iifcmp: case Iifcmp_u:
+    case Itableswitch: case Ilookupswitch: case Ihashswitch:
+      *pops = 1;
+      break;
+    case Istorea: case Istorea_u: case Iiinc: case Ijump: case Icase: case Iret_void: case Isnapshot:
+      break;
+    case Icall: case Ifcall: {
+      int id = calleeOf(inst, module);
+      if(id < 1 || id >= module->size) {
+        return 0;
+      }
+      *pops = funcs[id].params;
+      *push = funcs[id].returns;
+      break;
+    }
+    case Incall:
+      *pops = inst->arg_size;
+      *push = getNativeRetType(inst->func_id) != NATIVE_VOID;
+      break;
+    case Iminus:
+      *pops = 1;
+      *push = 1;
+      break;
+    case Iastore: case Imput:
+      *pops = 3;
+      break;
+    case Imdel:
+      *pops = 2;
+      break;
+    case Iaload: case Imget: case Imhas:
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+    case Iadd: case Isub: case Imul: case Idiv:
+    case Iiadd: case Iisub: case Iimul: case Iidiv:
+    case Iilt: case Iigt: case Iile: case Iige: case Iieq: case Iine:
+    case Idadd: case Idsub: case Idmul: case Iddiv:
+    case Idlt: case Idgt: case Idle: case Idge: case Ideq: case Idne:
+      *pops = 2;
+      *push = 1;
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+static int successors(ScriptCInstruction insts, long i, long* succ) {
+  switch(insts[i].op) {
+    case Ijump:
+      succ[0] = insts[i].jump;
+      return 1;
+    case Iifcmp: case Iifcmp_u:
+      succ[0] = i + 1;
+      succ[1] = insts[i].jump;
+      return 2;
+    case Icase:
+      succ[0] = i + 1;
+      succ[1] = insts[i].case_jump;
+      return 2;
+    case Iret: case Iret_void: case Iexit:
+      return 0;
+  }
+  succ[0] = i + 1;
+  return 1;
+}
+
+/* the depth of each stack slot names a C variable, so it must be the
+ * same on every path, as the verifier demands of verified code */
+static int computeDepth(ScriptCInstruction insts, Module module, CFunction funcs, CFunction func) {
+  long size = func->end - func->begin;
+  int* depth = func->depth = (int*)malloc(sizeof(int)*size);
+  func->label = (char*)calloc(size, 1);
+  long* worklist = (long*)malloc(sizeof(long)*(size+1));
+  int top = 0;
+  for(long i = 0; i < size; i++) {
+    depth[i] = -1;
+  }
+  depth[0] = 0;
+  worklist[top++] = func->begin;
+  while(top > 0) {
+    long i = worklist[--top];
+    int pops, push;
+    if(!stackEffect(&insts[i], module, funcs, &pops, &push)) {
+      aot_error = op_names[insts[i].op];
+      break;
+    }
+    int d = depth[i - func->begin];
+    if(pops > d) {
+      aot_error = "stack underflow";
+      break;
+    }
+    d = d - pops + push;
+    if(d > func->stack_size) {
+      func->stack_size = d;
+    }
+    long succ[2];
+    int succ_size = successors(insts, i, succ);
+    for(int j = 0; j < succ_size; j++) {
+      long s = succ[j] - func->begin;
+      if(s < 0 || s >= size) {
+        aot_error = "jump out of the function";
+        break;
+      }
+      if(depth[s] == -1) {
+        depth[s] = d;
+        worklist[top++] = succ[j];
+      } else if(depth[s] != d) {
+        aot_error = "stack depth differs at a merge";
+        break;
+      }
+    }
+    if(aot_error) {
+      break;
+    }
+    if(succ_size == 2 || insts[i].op == Ijump) {
+      func->label[succ[succ_size-1] - func->begin] = LABEL_JUMP;
+    }
+  }
+  free(worklist);
+  return aot_error == NULL;
+}
+
+static int isTyped(int type) {
+  return type == TYPE_INT || type == TYPE_FLOAT || type == TYPE_BOOL;
+}
+
+static int* typesAt(CFunction func, long i) {
+  return func->types + (i - func->begin) * (func->var_size + func->stack_size);
+}
+
+/* the types after one instruction, its result in place of its operands */
+static void transferTypes(ScriptCInstruction inst, CFunction func, int* types, int d, int pops, int push) {
+  int* stack = types + func->var_size;
+  int type = VT_ANY;
+  switch(inst->op) {
+    case Iiconst: case Ilconst:
+      type = TYPE_INT;
+      break;
+    case Idconst:
+      type = TYPE_FLOAT;
+      break;
+    case Ibconst:
+      type = TYPE_BOOL;
+      break;
+    case Iloadl: case Iloadl_u:
+      type = types[inst->var_id];
+      break;
+    case Istorel: case Istorel_u:
+      types[inst->var_id] = stack[d-1];
+      break;
+    case Istorea: case Istorea_u:
+      types[inst->var_id] = VT_ANY;
+      break;
+    case Iiinc:
+      types[inst->inc_var] = types[inst->inc_var] == TYPE_INT ? TYPE_INT : VT_ANY;
+      break;
+    case Incall: {
+      /* an int native may return a bigint */
+      int ret_type = getNativeRetType(inst->func_id);
+      type = ret_type == TYPE_FLOAT || ret_type == TYPE_BOOL ? ret_type : VT_ANY;
+      break;
+    }
+    case Iminus:
+      type = stack[d-1] == TYPE_INT || stack[d-1] == TYPE_FLOAT ? stack[d-1] : VT_ANY;
+      break;
+    case Iiadd: case Iisub: case Iimul: case Iidiv:
+      type = stack[d-2] == TYPE_INT && stack[d-1] == TYPE_INT ? TYPE_INT : VT_ANY;
+      break;
+    case Idadd: case Idsub: case Idmul: case Iddiv:
+      type = TYPE_FLOAT;
+      break;
+    case Imhas:
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+    case Iilt: case Iigt: case Iile: case Iige: case Iieq: case Iine:
+    case Idlt: case Idgt: case Idle: case Idge: case Ideq: case Idne:
+      type = TYPE_BOOL;
+      break;
+  }
+  if(push) {
+    stack[d-pops] = type == VT_UNDEF ? VT_ANY : type;
+  }
+}
+
+/* an int operation on int operands leaves the fast body on overflow */
+static int isDeopt(ScriptCInstruction inst, CFunction func, int* types, int d) {
+  int* stack = types + func->var_size;
+  switch(inst->op) {
+    case Iiadd: case Iisub: case Iimul: case Iidiv:
+      return stack[d-2] == TYPE_INT && stack[d-1] == TYPE_INT;
+    case Iminus:
+      return stack[d-1] == TYPE_INT;
+    case Iiinc:
+      return types[inst->inc_var] == TYPE_INT;
+  }
+  return 0;
+}
+
+static int typeBit(int type) {
+  return type == TYPE_INT ? 1 : type == TYPE_FLOAT ? 2 : type == TYPE_BOOL ? 4 : 8;
+}
+
+static int mergeType(int left, int right) {
+  if(left == VT_UNDEF || right == VT_UNDEF) {
+    return VT_UNDEF;
+  }
+  return left == right ? left : VT_ANY;
+}
+
+/* a worklist over the types of the slots, as the verifier runs over its
+ * own: a merge of two types is VT_ANY and a local not stored on every
+ * path is VT_UNDEF. a local gets a C variable of its type when every
+ * store stores that type and every load sees it */
+static void inferTypes(ScriptCInstruction insts, Module module, CFunction funcs, CFunction func) {
+  long size = func->end - func->begin;
+  int width = func->var_size + func->stack_size;
+  int* types = func->types = (int*)malloc(sizeof(int)*(size*width+1));
+  int* locals = func->locals = (int*)malloc(sizeof(int)*(func->var_size+1));
+  char* seen = (char*)calloc(size, 1);
+  char* queued = (char*)calloc(size, 1);
+  long* worklist = (long*)malloc(sizeof(long)*(size+1));
+  int* state = (int*)malloc(sizeof(int)*(width+1));
+  int top = 0;
+  func->temps = (unsigned char*)calloc(func->stack_size+1, 1);
+  for(int k = 0; k < width; k++) {
+    types[k] = k < func->var_size ? VT_UNDEF : VT_ANY;
+  }
+  seen[0] = queued[0] = 1;
+  worklist[top++] = func->begin;
+  while(top > 0) {
+    long i = worklist[--top];
+    int pops, push;
+    queued[i - func->begin] = 0;
+    memcpy(state, typesAt(func, i), sizeof(int)*width);
+    stackEffect(&insts[i], module, funcs, &pops, &push);
+    transferTypes(&insts[i], func, state, func->depth[i - func->begin], pops, push);
+    long succ[2];
+    int succ_size = successors(insts, i, succ);
+    for(int j = 0; j < succ_size; j++) {
+      long s = succ[j] - func->begin;
+      int* target = typesAt(func, succ[j]);
+      int changed = !seen[s];
+      for(int k = 0; k < func->var_size + func->depth[s]; k++) {
+        int type = seen[s] ? mergeType(target[k], state[k]) : state[k];
+        changed |= type != target[k];
+        target[k] = type;
+      }
+      for(int k = func->var_size + func->depth[s]; k < width && !seen[s]; k++) {
+        target[k] = VT_ANY;
+      }
+      seen[s] = 1;
+      if(changed && !queued[s]) {
+        queued[s] = 1;
+        worklist[top++] = succ[j];
+      }
+    }
+  }
+  /* the type every store of a local stores, then what its loads see */
+  for(int k = 0; k < func->var_size; k++) {
+    locals[k] = VT_UNDEF;
+  }
+  for(long i = func->begin; i < func->end; i++) {
+    int d = func->depth[i - func->begin];
+    int* in = typesAt(func, i);
+    int var_id, type;
+    if(d == -1) {
+      continue;
+    }
+    switch(insts[i].op) {
+      case Istorel: case Istorel_u:
+        var_id = insts[i].var_id;
+        type = in[func->var_size + d - 1];
+        break;
+      case Istorea: case Istorea_u:
+        var_id = insts[i].var_id;
+        type = VT_ANY;
+        break;
+      case Iiinc:
+        var_id = insts[i].inc_var;
+        type = in[var_id] == TYPE_INT ? TYPE_INT : VT_ANY;
+        break;
+      default:
+        continue;
+    }
+    locals[var_id] = locals[var_id] == VT_UNDEF || locals[var_id] == type ? type : VT_ANY;
+  }
+  for(long i = func->begin; i < func->end; i++) {
+    int* in = typesAt(func, i);
+    int var_id;
+    if(func->depth[i - func->begin] == -1) {
+      continue;
+    }
+    switch(insts[i].op) {
+      case Iloadl: case Iloadl_u:
+        var_id = insts[i].var_id;
+        break;
+      case Iiinc:
+        var_id = insts[i].inc_var;
+        break;
+      default:
+        continue;
+    }
+    if(in[var_id] != locals[var_id]) {
+      locals[var_id] = VT_ANY;
+    }
+  }
+  for(int k = 0; k < func->var_size; k++) {
+    if(!isTyped(locals[k])) {
+      locals[k] = VT_ANY;
+    }
+  }
+  /* the stack slots that need a C variable of a type, and the
+   * instructions that may leave for the generic body */
+  for(long i = func->begin; i < func->end; i++) {
+    int d = func->depth[i - func->begin];
+    int pops, push;
+    if(d == -1) {
+      continue;
+    }
+    memcpy(state, typesAt(func, i), sizeof(int)*width);
+    for(int j = 0; j < d; j++) {
+      func->temps[j] |= typeBit(state[func->var_size + j]);
+    }
+    if(isDeopt(&insts[i], func, state, d)) {
+      func->label[i - func->begin] |= LABEL_DEOPT;
+      func->deopts = 1;
+    }
+    stackEffect(&insts[i], module, funcs, &pops, &push);
+    transferTypes(&insts[i], func, state, d, pops, push);
+    if(push) {
+      func->temps[d - pops] |= typeBit(state[func->var_size + d - pops]);
+    }
+  }
+  free(state);
+  free(worklist);
+  free(queued);
+  free(seen);
+}
+
+static void writeName(FILE* out, Module module, int id) {
+  fprintf(out, "sc_f%d_%s", id, module->names[id] ? module->names[id] : "main");
+}
+
+static void writeSignature(FILE* out, Module module, CFunction funcs, int id) {
+  fprintf(out, "static %s ", funcs[id].returns ? "struct Type" : "void");
+  writeName(out, module, id);
+  fprintf(out, "(");
+  for(int i = 0; i < funcs[id].params; i++) {
+    fprintf(out, "%sstruct Type a%d", i > 0 ? ", " : "", i);
+  }
+  fprintf(out, funcs[id].params == 0 ? "void)" : ")");
+}
+
+/* a C string literal; ? is escaped against trigraphs */
+static void writeString(FILE* out, const char* str) {
+  fputc('"', out);
+  for(const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    if(*c == '"' || *c == '\\' || *c == '?') {
+      fprintf(out, "\\%c", *c);
+    } else if(*c < 0x20 || *c >= 0x7f) {
+      fprintf(out, "\\%03o", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void writeDouble(FILE* out, double val) {
+  if(isnan(val)) {
+    fprintf(out, "NAN");
+  } else if(isinf(val)) {
+    fprintf(out, val > 0 ? "HUGE_VAL" : "-HUGE_VAL");
+  } else {
+    fprintf(out, "%a", val);
+  }
+}
+
+/* one body of a function. the fast body keeps the slots of a single
+ * type in C variables and leaves at D<i> for the generic body, where
+ * every slot is a struct Type of the rooted frame, when an int
+ * operation overflows */
+struct Body {
+  FILE* out;
+  ScriptCInstruction insts;
+  Module module;
+  CFunction funcs;
+  CFunction func;
+  int generic;
+  /* the types after the instruction being written */
+  int* after;
+};
+
+static char typeLetter(int type) {
+  return type == TYPE_INT ? 'i' : type == TYPE_FLOAT ? 'd' : 'b';
+}
+
+static const char* typeField(int type) {
+  return type == TYPE_INT ? "int_val" : type == TYPE_FLOAT ? "double_val" : "bool_val";
+}
+
+static const char* typeBox(int type) {
+  return type == TYPE_INT ? "sc_int" : type == TYPE_FLOAT ? "sc_float" : "sc_bool";
+}
+
+/* how a body keeps a slot: its type, or VT_ANY when boxed */
+static int localForm(struct Body* body, int var_id) {
+  return body->generic ? VT_ANY : body->func->locals[var_id];
+}
+
+static int stackForm(struct Body* body, int* types, int j) {
+  int type = types[body->func->var_size + j];
+  return !body->generic && isTyped(type) ? type : VT_ANY;
+}
+
+/* slot index of v (locals) or s (the stack) as a value of type want:
+ * its C value when want is a type, its struct Type when VT_ANY */
+static void writeSlot(FILE* out, char space, int index, int form, int want) {
+  if(isTyped(form)) {
+    if(!isTyped(want)) {
+      fprintf(out, "%s(%c%c%d)", typeBox(form), space, typeLetter(form), index);
+    } else {
+      fprintf(out, "%c%c%d", space, typeLetter(form), index);
+    }
+  } else {
+    fprintf(out, "%c[%d]", space, index);
+    if(isTyped(want)) {
+      fprintf(out, ".%s", typeField(want));
+    }
+  }
+}
+
+static void writeOperand(struct Body* body, int* types, int j, int want) {
+  writeSlot(body->out, 's', j, stackForm(body, types, j), want);
+}
+
+/* operands s<d-n> .. s<d-1> as a C argument list */
+static void writeOperands(struct Body* body, int* types, int d, int n) {
+  for(int j = d - n; j < d; j++) {
+    fprintf(body->out, "%s", j > d - n ? ", " : "");
+    writeOperand(body, types, j, VT_ANY);
+  }
+}
+
+/* the result slot r, assigned a C value of type or a struct Type when
+ * type is VT_ANY, then the value, then closeResult */
+static void openResult(struct Body* body, int r, int type) {
+  int form = stackForm(body, body->after, r);
+  if(isTyped(form)) {
+    fprintf(body->out, "s%c%d = ", typeLetter(form), r);
+  } else if(isTyped(type)) {
+    fprintf(body->out, "s[%d] = %s(", r, typeBox(type));
+  } else {
+    fprintf(body->out, "s[%d] = ", r);
+  }
+}
+
+static void closeResult(struct Body* body, int r, int type) {
+  int form = stackForm(body, body->after, r);
+  if(isTyped(form) && !isTyped(type)) {
+    fprintf(body->out, ".%s", typeField(form));
+  } else if(!isTyped(form) && isTyped(type)) {
+    fprintf(body->out, ")");
+  }
+}
+
+static void writeLabel(struct Body* body, long i) {
+  fprintf(body->out, "%c%ld", body->generic ? 'G' : 'L', i);
+}
+
+/* a jump hands the slots kept in C variables to the target boxed where
+ * the target may see another type */
+static int writeEdge(struct Body* body, int* types, long target, int write) {
+  CFunction func = body->func;
+  int* in = typesAt(func, target);
+  int count = 0;
+  for(int j = 0; j < func->depth[target - func->begin]; j++) {
+    int form = stackForm(body, types, j);
+    if(isTyped(form) && stackForm(body, in, j) != form) {
+      if(write) {
+        fprintf(body->out, "s[%d] = %s(s%c%d); ", j, typeBox(form), typeLetter(form), j);
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+static void writeJump(struct Body* body, int* types, long target) {
+  if(writeEdge(body, types, target, 0) > 0) {
+    fprintf(body->out, "{ ");
+    writeEdge(body, types, target, 1);
+    fprintf(body->out, "goto ");
+    writeLabel(body, target);
+    fprintf(body->out, "; }\n");
+  } else {
+    fprintf(body->out, "goto ");
+    writeLabel(body, target);
+    fprintf(body->out, ";\n");
+  }
+}
+
+static void writeLeave(struct Body* body) {
+  if(body->func->var_size + body->func->stack_size > 0) {
+    fprintf(body->out, "sc_leave(&frame); ");
+  }
+}
+
+static void writeInstruction(struct Body* body, long i) {
+  FILE* out = body->out;
+  ScriptCInstruction inst = &body->insts[i];
+  Module module = body->module;
+  CFunction funcs = body->funcs;
+  CFunction func = body->func;
+  ConstPool pool = module->pool;
+  int d = func->depth[i - func->begin];
+  int* in = typesAt(func, i);
+  int pops, push;
+  const char* name = op_names[inst->op];
+  if(inst->op == Icase) {
+    /* written by its switch */
+    return;
+  }
+  memcpy(body->after, in, sizeof(int)*(func->var_size + func->stack_size));
+  stackEffect(inst, module, funcs, &pops, &push);
+  transferTypes(inst, func, body->after, d, pops, push);
+  int r = d - pops;
+  int unboxed = !body->generic && isDeopt(inst, func, in, d);
+  fprintf(out, "  ");
+  switch(inst->op) {
+    case Iiconst:
+      openResult(body, r, TYPE_INT);
+      fprintf(out, "%" PRId64, inst->int_val);
+      closeResult(body, r, TYPE_INT);
+      fprintf(out, ";\n");
+      break;
+    case Ilconst: {
+      int64_t val = pool->longs[inst->const_id];
+      openResult(body, r, TYPE_INT);
+      if(val == INT64_MIN) {
+        fprintf(out, "INT64_MIN");
+      } else {
+        fprintf(out, "INT64_C(%" PRId64 ")", val);
+      }
+      closeResult(body, r, TYPE_INT);
+      fprintf(out, ";\n");
+      break;
+    }
+    case Idconst:
+      openResult(body, r, TYPE_FLOAT);
+      writeDouble(out, pool->doubles[inst->const_id]);
+      closeResult(body, r, TYPE_FLOAT);
+      fprintf(out, ";\n");
+      break;
+    case Isconst:
+      openResult(body, r, VT_ANY);
+      fprintf(out, "sc_string(");
+      writeString(out, pool->strings[inst->const_id]);
+      fprintf(out, ")");
+      closeResult(body, r, VT_ANY);
+      fprintf(out, ";\n");
+      break;
+    case Ibconst:
+      openResult(body, r, TYPE_BOOL);
+      fprintf(out, "%d", inst->bool_val);
+      closeResult(body, r, TYPE_BOOL);
+      fprintf(out, ";\n");
+      break;
+    case Iloadl: case Iloadl_u: {
+      int want = stackForm(body, body->after, r);
+      if(in[inst->var_id] == VT_UNDEF) {
+        fprintf(out, "s[%d] = sc_loadl(v[%d]);\n", r, inst->var_id);
+        break;
+      }
+      openResult(body, r, want);
+      writeSlot(out, 'v', inst->var_id, localForm(body, inst->var_id), want);
+      closeResult(body, r, want);
+      fprintf(out, ";\n");
+      break;
+    }
+    case Istorel: case Istorel_u: {
+      int form = localForm(body, inst->var_id);
+      writeSlot(out, 'v', inst->var_id, form, form);
+      fprintf(out, " = ");
+      writeOperand(body, in, d - 1, form);
+      fprintf(out, ";\n");
+      break;
+    }
+    case Istorea: case Istorea_u:
+      /* the last argument is on top of the caller's stack */
+      fprintf(out, "v[%d] = a%ld;\n", inst->var_id, func->params - 1 - (i - func->begin));
+      break;
+    case Iiinc: {
+      int form = localForm(body, inst->inc_var);
+      if(unboxed) {
+        fprintf(out, "{ int64_t t; if(__builtin_add_overflow(");
+        writeSlot(out, 'v', inst->inc_var, form, TYPE_INT);
+        fprintf(out, ", (int64_t)%d, &t)) goto D%ld; ", inst->inc_val, i);
+        writeSlot(out, 'v', inst->inc_var, form, TYPE_INT);
+        fprintf(out, " = t; }\n");
+      } else {
+        fprintf(out, "v[%d] = sc_inc(v[%d], %d);\n", inst->inc_var, inst->inc_var, inst->inc_val);
+      }
+      break;
+    }
+    case Ijump:
+      writeJump(body, body->after, inst->jump);
+      return;
+    case Iifcmp: case Iifcmp_u:
+      if(inst->op == Iifcmp) {
+        fprintf(out, "if(!sc_truth(");
+        writeOperand(body, in, d - 1, VT_ANY);
+        fprintf(out, ")) ");
+      } else {
+        fprintf(out, "if(!");
+        writeOperand(body, in, d - 1, TYPE_BOOL);
+        fprintf(out, ") ");
+      }
+      writeJump(body, body->after, inst->jump);
+      break;
+    case Itableswitch: case Ilookupswitch: case Ihashswitch: {
+      /* the cases that reach the default are left to the jump after them */
+      long end = i + 1;
+      while(body->insts[end].op == Icase) {
+        end++;
+      }
+      if(inst->op != Ihashswitch && stackForm(body, in, d - 1) == TYPE_INT) {
+        fprintf(out, "switch(");
+        writeOperand(body, in, d - 1, TYPE_INT);
+      } else {
+        fprintf(out, "switch(%s(", inst->op == Ihashswitch ? "sc_switchHash" : "sc_switchInt");
+        writeOperand(body, in, d - 1, VT_ANY);
+        fprintf(out, ")");
+      }
+      fprintf(out, ") {\n");
+      for(long j = i + 1; j < end; j++) {
+        if(body->insts[j].case_jump != body->insts[end].jump) {
+          fprintf(out, "    case %d: ", body->insts[j].case_key);
+          writeJump(body, body->after, body->insts[j].case_jump);
+        }
+      }
+      fprintf(out, "  }\n");
+      break;
+    }
+    case Iret:
+      writeLeave(body);
+      fprintf(out, "return ");
+      writeOperand(body, in, d - 1, VT_ANY);
+      fprintf(out, ";\n");
+      return;
+    case Iret_void:
+      writeLeave(body);
+      fprintf(out, "return;\n");
+      return;
+    case Icall: case Ifcall: {
+      int id = calleeOf(inst, module);
+      if(push) {
+        openResult(body, r, VT_ANY);
+      }
+      writeName(out, module, id);
+      fprintf(out, "(");
+      writeOperands(body, in, d, pops);
+      fprintf(out, ")");
+      if(push) {
+        closeResult(body, r, VT_ANY);
+      }
+      fprintf(out, ";\n");
+      break;
+    }
+    case Incall:
+      if(pops > 0) {
+        fprintf(out, "{ struct Type args[] = {");
+        writeOperands(body, in, d, pops);
+        fprintf(out, "}; ");
+      }
+      if(push) {
+        openResult(body, r, VT_ANY);
+      }
+      fprintf(out, "sc_ncall(sc_natives[%d], %s, %d)", inst->func_id, pops > 0 ? "args" : "NULL", pops);
+      if(push) {
+        closeResult(body, r, VT_ANY);
+      }
+      fprintf(out, ";%s\n", pops > 0 ? " }" : "");
+      break;
+    case Iminus: {
+      int form = stackForm(body, in, d - 1);
+      if(unboxed) {
+        fprintf(out, "{ if(si%d == INT64_MIN) goto D%ld; si%d = -si%d; }\n", r, i, r, r);
+      } else if(form == TYPE_FLOAT) {
+        fprintf(out, "sd%d = -sd%d;\n", r, r);
+      } else {
+        openResult(body, r, VT_ANY);
+        fprintf(out, "sc_minus(");
+        writeOperand(body, in, d - 1, VT_ANY);
+        fprintf(out, ")");
+        closeResult(body, r, VT_ANY);
+        fprintf(out, ";\n");
+      }
+      break;
+    }
+    case Iwrite:
+      fprintf(out, "sc_write(");
+      writeOperand(body, in, d - 1, VT_ANY);
+      fprintf(out, ");\n");
+      break;
+    case Isnapshot:
+      /* compiled code starts over every run */
+      fprintf(out, ";\n");
+      break;
+    case Iastore: case Imput: case Imdel:
+      fprintf(out, "sc_%s(", name);
+      writeOperands(body, in, d, pops);
+      fprintf(out, ");\n");
+      break;
+    case Iiadd: case Iisub: case Iimul:
+      if(unboxed) {
+        static const char* ops[] = {"add", "sub", "mul"};
+        fprintf(out, "{ int64_t t; if(__builtin_%s_overflow(si%d, si%d, &t)) goto D%ld; si%d = t; }\n", ops[inst->op - Iiadd], r, r + 1, i, r);
+        break;
+      }
+      goto call;
+    case Iidiv:
+      if(unboxed) {
+        /* divisors 0 and -1 take the slow path, as in the vm */
+        fprintf(out, "{ if((uint64_t)si%d + 1 <= 1) goto D%ld; si%d = si%d / si%d; }\n", r + 1, i, r, r, r + 1);
+        break;
+      }
+      goto call;
+    case Iilt: case Iigt: case Iile: case Iige: case Iieq: case Iine:
+      if(stackForm(body, in, r) == TYPE_INT && stackForm(body, in, r + 1) == TYPE_INT) {
+        static const char* ops[] = {"<", ">", "<=", ">=", "==", "!="};
+        openResult(body, r, TYPE_BOOL);
+        fprintf(out, "si%d %s si%d", r, ops[inst->op - Iilt], r + 1);
+        closeResult(body, r, TYPE_BOOL);
+        fprintf(out, ";\n");
+        break;
+      }
+      goto call;
+    case Idadd: case Idsub: case Idmul: case Iddiv:
+    case Idlt: case Idgt: case Idle: case Idge: case Ideq: case Idne: {
+      static const char* ops[] = {"+", "-", "*", "/", "<", ">", "<=", ">=", "==", "!="};
+      int type = inst->op <= Iddiv ? TYPE_FLOAT : TYPE_BOOL;
+      openResult(body, r, type);
+      writeOperand(body, in, r, TYPE_FLOAT);
+      fprintf(out, " %s ", ops[inst->op <= Iddiv ? inst->op - Idadd : inst->op - Idlt + 4]);
+      writeOperand(body, in, r + 1, TYPE_FLOAT);
+      closeResult(body, r, type);
+      fprintf(out, ";\n");
+      break;
+    }
+    default:
+    call:
+      /* aload, the map lookups and the binary operations, checked or
+       * with an int fast path */
+      openResult(body, r, VT_ANY);
+      fprintf(out, "sc_%s(", name);
+      writeOperands(body, in, d, pops);
+      fprintf(out, ")");
+      closeResult(body, r, VT_ANY);
+      fprintf(out, ";\n");
+      break;
+  }
+  if(inst->op != Iexit && writeEdge(body, body->after, i + 1, 0) > 0) {
+    fprintf(out, "  ");
+    writeEdge(body, body->after, i + 1, 1);
+    fprintf(out, "\n");
+  }
+}
+
+static void writeBody(struct Body* body, int generic) {
+  CFunction func = body->func;
+  body->generic = generic;
+  for(long i = func->begin; i < func->end; i++) {
+    char label = func->label[i - func->begin];
+    if(generic ? label : label & LABEL_JUMP) {
+      fprintf(body->out, "%c%ld:\n", generic ? 'G' : 'L', i);
+    }
+    if(func->depth[i - func->begin] != -1) {
+      writeInstruction(body, i);
+    } else if(label) {
+      fprintf(body->out, "  ;\n");
+    }
+  }
+}
+
+/* boxes what the fast body keeps in C variables and goes on in the
+ * generic body at the instruction that overflowed */
+static void writeDeopt(struct Body* body, long i) {
+  CFunction func = body->func;
+  int* in = typesAt(func, i);
+  fprintf(body->out, "D%ld:\n  ", i);
+  for(int k = 0; k < func->var_size; k++) {
+    if(isTyped(func->locals[k])) {
+      fprintf(body->out, "v[%d] = %s(v%c%d); ", k, typeBox(func->locals[k]), typeLetter(func->locals[k]), k);
+    }
+  }
+  for(int j = 0; j < func->depth[i - func->begin]; j++) {
+    int form = stackForm(body, in, j);
+    if(isTyped(form)) {
+      fprintf(body->out, "s[%d] = %s(s%c%d); ", j, typeBox(form), typeLetter(form), j);
+    }
+  }
+  fprintf(body->out, "goto G%ld;\n", i);
+}
+
+/* the C variables of one type, 0 where a path reads them unset */
+static void writeTyped(FILE* out, CFunction func, int type, const char* c_type) {
+  int count = 0;
+  for(int k = 0; k < func->var_size; k++) {
+    if(func->locals[k] == type) {
+      fprintf(out, "%s v%c%d = 0", count++ > 0 ? "," : c_type, typeLetter(type), k);
+    }
+  }
+  for(int j = 0; j < func->stack_size; j++) {
+    if(func->temps[j] & typeBit(type)) {
+      fprintf(out, "%s s%c%d = 0", count++ > 0 ? "," : c_type, typeLetter(type), j);
+    }
+  }
+  if(count > 0) {
+    fprintf(out, ";\n");
+  }
+}
+
+/* the slots of the generic body and the boxed slots of the fast one
+ * are the frame f, linked into sc_frames as the roots of a collection */
+static void writeFunction(FILE* out, ScriptCInstruction insts, Module module, CFunction funcs, int id) {
+  CFunction func = &funcs[id];
+  int slots = func->var_size + func->stack_size;
+  struct Body body = {out, insts, module, funcs, func, 0, (int*)malloc(sizeof(int)*(slots+1))};
+  char* unset = (char*)calloc(func->var_size+1, 1);
+  writeSignature(out, module, funcs, id);
+  fprintf(out, " {\n");
+  int boxed_locals = func->deopts, boxed_stack = func->deopts;
+  for(int k = 0; k < func->var_size; k++) {
+    boxed_locals |= func->locals[k] == VT_ANY;
+  }
+  for(int j = 0; j < func->stack_size; j++) {
+    boxed_stack |= (func->temps[j] & typeBit(VT_ANY)) != 0;
+  }
+  if(slots > 0) {
+    fprintf(out, "  struct Type f[%d] = {{0}};\n", slots);
+    if(func->var_size > 0 && boxed_locals) {
+      fprintf(out, "  struct Type* v = f;\n");
+    }
+    if(func->stack_size > 0 && boxed_stack) {
+      fprintf(out, "  struct Type* s = f + %d;\n", func->var_size);
+    }
+    fprintf(out, "  struct VMContext frame;\n");
+  }
+  writeTyped(out, func, TYPE_INT, "  int64_t");
+  writeTyped(out, func, TYPE_FLOAT, "  double");
+  writeTyped(out, func, TYPE_BOOL, "  int");
+  /* a local some path reads before assigning it starts unset */
+  for(long i = func->begin; i < func->end; i++) {
+    int var_id = insts[i].op == Iiinc ? insts[i].inc_var : insts[i].var_id;
+    if(func->depth[i - func->begin] != -1 && (insts[i].op == Iloadl || insts[i].op == Iloadl_u || insts[i].op == Iiinc)
+        && typesAt(func, i)[var_id] == VT_UNDEF && !unset[var_id]) {
+      fprintf(out, "  v[%d].type = TYPE_UNSET;\n", var_id);
+      unset[var_id] = 1;
+    }
+  }
+  if(slots > 0) {
+    fprintf(out, "  sc_enter(&frame, f, %d);\n", slots);
+  }
+  writeBody(&body, 0);
+  if(func->deopts) {
+    for(long i = func->begin; i < func->end; i++) {
+      if(func->label[i - func->begin] & LABEL_DEOPT) {
+        writeDeopt(&body, i);
+      }
+    }
+    writeBody(&body, 1);
+  }
+  fprintf(out, "}\n\n");
+  free(body.after);
+  free(unset);
+}
+
+int compileToC(const char* path, const char* script, ScriptCInstruction insts, Module module) {
+  CFunction funcs = (CFunction)calloc(module->size, sizeof(struct CFunction));
+  int native_size = 0;
+  int status = 1;
+  aot_error = NULL;
+  for(int i = 0; i < module->size; i++) {
+    /* index 0 of the top level code is the exit its ret_void returns to */
+    funcs[i].begin = i == 0 ? 1 : module->codePoints[i];
+    funcs[i].end = i + 1 < module->size ? module->codePoints[i+1] : module->code_length;
+    scanFunction(insts, &funcs[i]);
+  }
+  for(int i = 0; i < module->size; i++) {
+    if(!computeDepth(insts, module, funcs, &funcs[i])) {
+      fprintf(stderr, "cannot compile %s to C: %s\n", module->names[i] ? module->names[i] : "the top level code", aot_error);
+      goto done;
+    }
+    inferTypes(insts, module, funcs, &funcs[i]);
+  }
+  for(long i = 0; i < module->code_length; i++) {
+    if(insts[i].op == Incall && insts[i].func_id >= native_size) {
+      native_size = insts[i].func_id + 1;
+    }
+  }
+  FILE* out = fopen(path, "w");
+  if(out == NULL) {
+    fprintf(stderr, "cannot write %s\n", path);
+    goto done;
+  }
+  fprintf(out, "/* generated by scriptC -C from %s */\n", script ? script : "stdin");
+  fprintf(out, "#include <math.h>\n#include \"runtime.h\"\n\n");
+  /* the runtime library reads the options of scriptC */
+  fprintf(out, "int sc_debug;\n\n");
+  if(native_size > 0) {
+    fprintf(out, "static int sc_natives[%d];\n\n", native_size);
+  }
+  for(int i = 0; i < module->size; i++) {
+    writeSignature(out, module, funcs, i);
+    fprintf(out, ";\n");
+  }
+  fprintf(out, "\n");
+  for(int i = 0; i < module->size; i++) {
+    writeFunction(out, insts, module, funcs, i);
+  }
+  fprintf(out, "int main(void) {\n  sc_init();\n");
+  for(int id = 0; id < native_size; id++) {
+    for(long i = 0; i < module->code_length; i++) {
+      if(insts[i].op == Incall && insts[i].func_id == id) {
+        fprintf(out, "  sc_natives[%d] = getNative(", id);
+        writeString(out, getNativeName(id));
+        fprintf(out, ");\n");
+        break;
+      }
+    }
+  }
+  fprintf(out, "  ");
+  writeName(out, module, 0);
+  fprintf(out, "();\n  sc_exit();\n  return 0;\n}\n");
+  status = fclose(out) != 0;
+  if(status) {
+    fprintf(stderr, "cannot write %s\n", path);
+  }
+done:
+  for(int i = 0; i < module->size; i++) {
+    free(funcs[i].depth);
+    free(funcs[i].label);
+    free(funcs[i].types);
+    free(funcs[i].locals);
+    free(funcs[i].temps);
+  }
+  free(funcs);
+  return status;
+}
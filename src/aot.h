@@ -0,0 +1,26 @@
+#ifndef __AOT__
+#define __AOT__
+
+#include "compiler.h"
+
+/* -C: ahead of time compilation to C. every function of the linked
+ * module becomes a C function with its arguments as parameters and its
+ * jumps as gotos; the top level code becomes main. a local or stack
+ * slot that holds one type, int, float or bool, wherever it is read
+ * becomes an int64_t, double or int C variable, and the other slots
+ * struct Type values of a frame the runtime collects from. the
+ * instructions the verifier made unchecked turn into plain C, the rest
+ * into calls of the runtime library (runtime.h, libscriptc.a) that
+ * check the type tags like the vm. an int operation that overflows
+ * boxes the C variables and goes on in a second copy of the function
+ * that keeps every slot in the frame and turns into bigints as the vm
+ * does. build the output with
+ *
+ *   gcc -O2 -std=c99 -I src out.c src/libscriptc.a -lm -pthread
+ *
+ * script names are resolved against the natives at startup, so any
+ * native registered by initNatives() can be called */
+
+int compileToC(const char* path, const char* script, ScriptCInstruction insts, Module module);
+
+#endif
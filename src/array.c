@@ -0,0 +1,725 @@
+#include "compiler.h"
+#include "array.h"
+#include "vm.h"
+#include "native.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ARRAY_X86 1
+#endif
+
+/* one zero element past the end */
+ScriptCArray createArray(VMContext ctx, int elem_type, int length) {
+  size_t elem = elem_type == ARRAY_INT ? sizeof(int64_t) : sizeof(double);
+  ScriptCArray array = (ScriptCArray)allocObject(ctx, BLOCK_ARRAY, sizeof(struct ScriptCArray) + elem * ((size_t)length + 1));
+  array->elem_type = elem_type;
+  array->length = length;
+  array->ints = (int64_t*)(array + 1);
+  return array;
+}
+
+/* scalar kernels: the fallback on every host and the tail loop of the
+ * vector kernels. int arithmetic wraps like the vector lanes do */
+
+static int64_t isum_scalar(const int64_t* a, int n) {
+  uint64_t sum = 0;
+  for(int i = 0; i < n; i++) {
+    sum += (uint64_t)a[i];
+  }
+  return (int64_t)sum;
+}
+
+static double dsum_scalar(const double* a, int n) {
+  double sum = 0;
+  for(int i = 0; i < n; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static int64_t idot_scalar(const int64_t* a, const int64_t* b, int n) {
+  uint64_t sum = 0;
+  for(int i = 0; i < n; i++) {
+    sum += (uint64_t)a[i] * (uint64_t)b[i];
+  }
+  return (int64_t)sum;
+}
+
+static double ddot_scalar(const double* a, const double* b, int n) {
+  double sum = 0;
+  for(int i = 0; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static int64_t imin_scalar(const int64_t* a, int n) {
+  int64_t val = a[0];
+  for(int i = 1; i < n; i++) {
+    if(a[i] < val) {
+      val = a[i];
+    }
+  }
+  return val;
+}
+
+static double dmin_scalar(const double* a, int n) {
+  double val = a[0];
+  for(int i = 1; i < n; i++) {
+    if(a[i] < val) {
+      val = a[i];
+    }
+  }
+  return val;
+}
+
+static int64_t imax_scalar(const int64_t* a, int n) {
+  int64_t val = a[0];
+  for(int i = 1; i < n; i++) {
+    if(a[i] > val) {
+      val = a[i];
+    }
+  }
+  return val;
+}
+
+static double dmax_scalar(const double* a, int n) {
+  double val = a[0];
+  for(int i = 1; i < n; i++) {
+    if(a[i] > val) {
+      val = a[i];
+    }
+  }
+  return val;
+}
+
+static void iscale_scalar(int64_t* a, int n, int64_t k) {
+  for(int i = 0; i < n; i++) {
+    a[i] = (int64_t)((uint64_t)a[i] * (uint64_t)k);
+  }
+}
+
+static void dscale_scalar(double* a, int n, double k) {
+  for(int i = 0; i < n; i++) {
+    a[i] *= k;
+  }
+}
+
+static void iadd_scalar(int64_t* dst, const int64_t* src, int n) {
+  for(int i = 0; i < n; i++) {
+    dst[i] = (int64_t)((uint64_t)dst[i] + (uint64_t)src[i]);
+  }
+}
+
+static void dadd_scalar(double* dst, const double* src, int n) {
+  for(int i = 0; i < n; i++) {
+    dst[i] += src[i];
+  }
+}
+
+static void ifill_scalar(int64_t* a, int n, int64_t v) {
+  for(int i = 0; i < n; i++) {
+    a[i] = v;
+  }
+}
+
+static void dfill_scalar(double* a, int n, double v) {
+  for(int i = 0; i < n; i++) {
+    a[i] = v;
+  }
+}
+
+static const struct ArrayKernels scalar_kernels = {
+  "scalar",
+  isum_scalar, dsum_scalar, idot_scalar, ddot_scalar,
+  imin_scalar, dmin_scalar, imax_scalar, dmax_scalar,
+  iscale_scalar, dscale_scalar, iadd_scalar, dadd_scalar,
+  ifill_scalar, dfill_scalar
+};
+
+#ifdef ARRAY_X86
+
+/* SSE4.1 kernels: 2 ints or 2 doubles per step. there is no 64 bit
+ * compare before SSE4.2, so min and max of ints stay scalar */
+
+__attribute__((target("sse4.1")))
+static int64_t hsum_epi64_sse(__m128i v) {
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, v);
+  return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1]);
+}
+
+__attribute__((target("sse4.1")))
+static int64_t isum_sse(const int64_t* a, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*)(a+i)));
+  }
+  return (int64_t)((uint64_t)hsum_epi64_sse(acc) + (uint64_t)isum_scalar(a+i, n-i));
+}
+
+__attribute__((target("sse4.1")))
+static double dsum_sse(const double* a, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_loadu_pd(a+i));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + dsum_scalar(a+i, n-i);
+}
+
+/* the low 64 bits of a 64 bit product from 32 bit halves: lo*lo plus
+ * the cross products shifted up. mul_epu32 multiplies the low halves */
+__attribute__((target("sse4.1")))
+static __m128i mullo_epi64_sse(__m128i x, __m128i y) {
+  __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y), _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+  return _mm_add_epi64(_mm_mul_epu32(x, y), _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("sse4.1")))
+static int64_t idot_sse(const int64_t* a, const int64_t* b, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+    acc = _mm_add_epi64(acc, mullo_epi64_sse(x, y));
+  }
+  return (int64_t)((uint64_t)hsum_epi64_sse(acc) + (uint64_t)idot_scalar(a+i, b+i, n-i));
+}
+
+__attribute__((target("sse4.1")))
+static double ddot_sse(const double* a, const double* b, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(b+i)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  return lanes[0] + lanes[1] + ddot_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("sse4.1")))
+static double dmin_sse(const double* a, int n) {
+  if(n < 2) {
+    return dmin_scalar(a, n);
+  }
+  __m128d acc = _mm_loadu_pd(a);
+  int i = 2;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_min_pd(acc, _mm_loadu_pd(a+i));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double val = dmin_scalar(lanes, 2);
+  if(i < n) {
+    double tail = dmin_scalar(a+i, n-i);
+    val = tail < val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("sse4.1")))
+static double dmax_sse(const double* a, int n) {
+  if(n < 2) {
+    return dmax_scalar(a, n);
+  }
+  __m128d acc = _mm_loadu_pd(a);
+  int i = 2;
+  for(; i + 2 <= n; i += 2) {
+    acc = _mm_max_pd(acc, _mm_loadu_pd(a+i));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  double val = dmax_scalar(lanes, 2);
+  if(i < n) {
+    double tail = dmax_scalar(a+i, n-i);
+    val = tail > val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("sse4.1")))
+static void iscale_sse(int64_t* a, int n, int64_t k) {
+  __m128i factor = _mm_set1_epi64x(k);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+    _mm_storeu_si128((__m128i*)(a+i), mullo_epi64_sse(x, factor));
+  }
+  iscale_scalar(a+i, n-i, k);
+}
+
+__attribute__((target("sse4.1")))
+static void dscale_sse(double* a, int n, double k) {
+  __m128d factor = _mm_set1_pd(k);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(a+i, _mm_mul_pd(_mm_loadu_pd(a+i), factor));
+  }
+  dscale_scalar(a+i, n-i, k);
+}
+
+__attribute__((target("sse4.1")))
+static void iadd_sse(int64_t* dst, const int64_t* src, int n) {
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(dst+i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(src+i));
+    _mm_storeu_si128((__m128i*)(dst+i), _mm_add_epi64(x, y));
+  }
+  iadd_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse4.1")))
+static void dadd_sse(double* dst, const double* src, int n) {
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(dst+i, _mm_add_pd(_mm_loadu_pd(dst+i), _mm_loadu_pd(src+i)));
+  }
+  dadd_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("sse4.1")))
+static void ifill_sse(int64_t* a, int n, int64_t v) {
+  __m128i val = _mm_set1_epi64x(v);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_si128((__m128i*)(a+i), val);
+  }
+  ifill_scalar(a+i, n-i, v);
+}
+
+__attribute__((target("sse4.1")))
+static void dfill_sse(double* a, int n, double v) {
+  __m128d val = _mm_set1_pd(v);
+  int i = 0;
+  for(; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(a+i, val);
+  }
+  dfill_scalar(a+i, n-i, v);
+}
+
+static const struct ArrayKernels sse_kernels = {
+  "sse4.1",
+  isum_sse, dsum_sse, idot_sse, ddot_sse,
+  imin_scalar, dmin_sse, imax_scalar, dmax_sse,
+  iscale_sse, dscale_sse, iadd_sse, dadd_sse,
+  ifill_sse, dfill_sse
+};
+
+/* AVX2 kernels: 4 ints or 4 doubles per step */
+
+__attribute__((target("avx2")))
+static int64_t hsum_epi64_avx2(__m256i v) {
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, v);
+  return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2] + (uint64_t)lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static double hsum_pd_avx2(__m256d v) {
+  double lanes[4];
+  _mm256_storeu_pd(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+static int64_t isum_avx2(const int64_t* a, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i*)(a+i)));
+  }
+  return (int64_t)((uint64_t)hsum_epi64_avx2(acc) + (uint64_t)isum_scalar(a+i, n-i));
+}
+
+__attribute__((target("avx2")))
+static double dsum_avx2(const double* a, int n) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a+i));
+    acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a+i+4));
+  }
+  for(; i + 4 <= n; i += 4) {
+    acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a+i));
+  }
+  return hsum_pd_avx2(_mm256_add_pd(acc0, acc1)) + dsum_scalar(a+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static __m256i mullo_epi64_avx2(__m256i x, __m256i y) {
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y), _mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+  return _mm256_add_epi64(_mm256_mul_epu32(x, y), _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static int64_t idot_avx2(const int64_t* a, const int64_t* b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+    acc = _mm256_add_epi64(acc, mullo_epi64_avx2(x, y));
+  }
+  return (int64_t)((uint64_t)hsum_epi64_avx2(acc) + (uint64_t)idot_scalar(a+i, b+i, n-i));
+}
+
+__attribute__((target("avx2")))
+static double ddot_avx2(const double* a, const double* b, int n) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+    acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a+i+4), _mm256_loadu_pd(b+i+4)));
+  }
+  for(; i + 4 <= n; i += 4) {
+    acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+  }
+  return hsum_pd_avx2(_mm256_add_pd(acc0, acc1)) + ddot_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static int64_t imin_avx2(const int64_t* a, int n) {
+  if(n < 4) {
+    return imin_scalar(a, n);
+  }
+  __m256i acc = _mm256_loadu_si256((const __m256i*)a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(a+i));
+    acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(acc, v));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  int64_t val = imin_scalar(lanes, 4);
+  if(i < n) {
+    int64_t tail = imin_scalar(a+i, n-i);
+    val = tail < val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("avx2")))
+static double dmin_avx2(const double* a, int n) {
+  if(n < 4) {
+    return dmin_scalar(a, n);
+  }
+  __m256d acc = _mm256_loadu_pd(a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    acc = _mm256_min_pd(acc, _mm256_loadu_pd(a+i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double val = dmin_scalar(lanes, 4);
+  if(i < n) {
+    double tail = dmin_scalar(a+i, n-i);
+    val = tail < val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("avx2")))
+static int64_t imax_avx2(const int64_t* a, int n) {
+  if(n < 4) {
+    return imax_scalar(a, n);
+  }
+  __m256i acc = _mm256_loadu_si256((const __m256i*)a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(a+i));
+    acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(v, acc));
+  }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  int64_t val = imax_scalar(lanes, 4);
+  if(i < n) {
+    int64_t tail = imax_scalar(a+i, n-i);
+    val = tail > val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("avx2")))
+static double dmax_avx2(const double* a, int n) {
+  if(n < 4) {
+    return dmax_scalar(a, n);
+  }
+  __m256d acc = _mm256_loadu_pd(a);
+  int i = 4;
+  for(; i + 4 <= n; i += 4) {
+    acc = _mm256_max_pd(acc, _mm256_loadu_pd(a+i));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  double val = dmax_scalar(lanes, 4);
+  if(i < n) {
+    double tail = dmax_scalar(a+i, n-i);
+    val = tail > val ? tail : val;
+  }
+  return val;
+}
+
+__attribute__((target("avx2")))
+static void iscale_avx2(int64_t* a, int n, int64_t k) {
+  __m256i factor = _mm256_set1_epi64x(k);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+    _mm256_storeu_si256((__m256i*)(a+i), mullo_epi64_avx2(x, factor));
+  }
+  iscale_scalar(a+i, n-i, k);
+}
+
+__attribute__((target("avx2")))
+static void dscale_avx2(double* a, int n, double k) {
+  __m256d factor = _mm256_set1_pd(k);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(a+i, _mm256_mul_pd(_mm256_loadu_pd(a+i), factor));
+  }
+  dscale_scalar(a+i, n-i, k);
+}
+
+__attribute__((target("avx2")))
+static void iadd_avx2(int64_t* dst, const int64_t* src, int n) {
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(dst+i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(src+i));
+    _mm256_storeu_si256((__m256i*)(dst+i), _mm256_add_epi64(x, y));
+  }
+  iadd_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void dadd_avx2(double* dst, const double* src, int n) {
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(dst+i, _mm256_add_pd(_mm256_loadu_pd(dst+i), _mm256_loadu_pd(src+i)));
+  }
+  dadd_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void ifill_avx2(int64_t* a, int n, int64_t v) {
+  __m256i val = _mm256_set1_epi64x(v);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_si256((__m256i*)(a+i), val);
+  }
+  ifill_scalar(a+i, n-i, v);
+}
+
+__attribute__((target("avx2")))
+static void dfill_avx2(double* a, int n, double v) {
+  __m256d val = _mm256_set1_pd(v);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(a+i, val);
+  }
+  dfill_scalar(a+i, n-i, v);
+}
+
+static const struct ArrayKernels avx2_kernels = {
+  "avx2",
+  isum_avx2, dsum_avx2, idot_avx2, ddot_avx2,
+  imin_avx2, dmin_avx2, imax_avx2, dmax_avx2,
+  iscale_avx2, dscale_avx2, iadd_avx2, dadd_avx2,
+  ifill_avx2, dfill_avx2
+};
+
+#endif
+
+const struct ArrayKernels* array_kernels = &scalar_kernels;
+
+void initArrayKernels() {
+  array_kernels = &scalar_kernels;
+#ifdef ARRAY_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    array_kernels = &avx2_kernels;
+  } else if(__builtin_cpu_supports("sse4.1")) {
+    array_kernels = &sse_kernels;
+  }
+#endif
+  if(sc_debug) {
+    fprintf(stderr, "array kernels: %s\n", array_kernels->name);
+  }
+}
+
+/* natives over the kernel table. kernels that update an array in place
+ * return nothing, like a call to a void function */
+
+static int createArrayNative(Type args, Type ret, int elem_type, const char* name) {
+  if(args[0].type != TYPE_INT || args[0].int_val < 0 || args[0].int_val >= INT32_MAX) {
+    fprintf(stderr, "%s expects a non-negative length\n", name);
+    return 1;
+  }
+  ret->type = TYPE_ARRAY;
+  ret->array = createArray(getHeapRoots(), elem_type, args[0].int_val);
+  return 0;
+}
+
+static int native_iarray(Type args, int arg_size, Type ret) {
+  return createArrayNative(args, ret, ARRAY_INT, "iarray");
+}
+
+static int native_farray(Type args, int arg_size, Type ret) {
+  return createArrayNative(args, ret, ARRAY_FLOAT, "farray");
+}
+
+static ScriptCArray getArrayArg(Type args, const char* name) {
+  if(args[0].type != TYPE_ARRAY) {
+    fprintf(stderr, "type error of %s: first argument is not an array\n", name);
+    return NULL;
+  }
+  return args[0].array;
+}
+
+static ScriptCArray getPairArg(Type args, const char* name) {
+  ScriptCArray a = getArrayArg(args, name);
+  if(a == NULL) {
+    return NULL;
+  }
+  if(args[1].type != TYPE_ARRAY || args[1].array->elem_type != a->elem_type
+      || args[1].array->length != a->length) {
+    fprintf(stderr, "type error of %s: arrays differ in type or length\n", name);
+    return NULL;
+  }
+  return args[1].array;
+}
+
+static int native_sum(Type args, int arg_size, Type ret) {
+  ScriptCArray a = getArrayArg(args, "sum");
+  if(a == NULL) {
+    return 1;
+  }
+  if(a->elem_type == ARRAY_INT) {
+    ret->type = TYPE_INT;
+    ret->int_val = array_kernels->isum(a->ints, a->length);
+  } else {
+    ret->type = TYPE_FLOAT;
+    ret->double_val = array_kernels->dsum(a->doubles, a->length);
+  }
+  return 0;
+}
+
+static int native_dot(Type args, int arg_size, Type ret) {
+  ScriptCArray b = getPairArg(args, "dot");
+  if(b == NULL) {
+    return 1;
+  }
+  ScriptCArray a = args[0].array;
+  if(a->elem_type == ARRAY_INT) {
+    ret->type = TYPE_INT;
+    ret->int_val = array_kernels->idot(a->ints, b->ints, a->length);
+  } else {
+    ret->type = TYPE_FLOAT;
+    ret->double_val = array_kernels->ddot(a->doubles, b->doubles, a->length);
+  }
+  return 0;
+}
+
+static int minMaxNative(Type args, Type ret, int is_min) {
+  const char* name = is_min ? "min" : "max";
+  ScriptCArray a = getArrayArg(args, name);
+  if(a == NULL) {
+    return 1;
+  }
+  if(a->length == 0) {
+    fprintf(stderr, "%s of empty array\n", name);
+    return 1;
+  }
+  if(a->elem_type == ARRAY_INT) {
+    ret->type = TYPE_INT;
+    ret->int_val = is_min ? array_kernels->imin(a->ints, a->length) : array_kernels->imax(a->ints, a->length);
+  } else {
+    ret->type = TYPE_FLOAT;
+    ret->double_val = is_min ? array_kernels->dmin(a->doubles, a->length) : array_kernels->dmax(a->doubles, a->length);
+  }
+  return 0;
+}
+
+static int native_min(Type args, int arg_size, Type ret) {
+  return minMaxNative(args, ret, 1);
+}
+
+static int native_max(Type args, int arg_size, Type ret) {
+  return minMaxNative(args, ret, 0);
+}
+
+static int native_add(Type args, int arg_size, Type ret) {
+  ScriptCArray b = getPairArg(args, "add");
+  if(b == NULL) {
+    return 1;
+  }
+  ScriptCArray a = args[0].array;
+  if(a->elem_type == ARRAY_INT) {
+    array_kernels->iadd(a->ints, b->ints, a->length);
+  } else {
+    array_kernels->dadd(a->doubles, b->doubles, a->length);
+  }
+  return 0;
+}
+
+static int scaleFillNative(Type args, int is_scale) {
+  const char* name = is_scale ? "scale" : "fill";
+  ScriptCArray a = getArrayArg(args, name);
+  if(a == NULL) {
+    return 1;
+  }
+  Type v = &args[1];
+  if(a->elem_type == ARRAY_INT && v->type == TYPE_INT) {
+    if(is_scale) {
+      array_kernels->iscale(a->ints, a->length, v->int_val);
+    } else {
+      array_kernels->ifill(a->ints, a->length, v->int_val);
+    }
+  } else if(a->elem_type == ARRAY_FLOAT && (v->type == TYPE_FLOAT || v->type == TYPE_INT)) {
+    double d = v->type == TYPE_FLOAT ? v->double_val : v->int_val;
+    if(is_scale) {
+      array_kernels->dscale(a->doubles, a->length, d);
+    } else {
+      array_kernels->dfill(a->doubles, a->length, d);
+    }
+  } else {
+    fprintf(stderr, "type error of %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+static int native_scale(Type args, int arg_size, Type ret) {
+  return scaleFillNative(args, 1);
+}
+
+static int native_fill(Type args, int arg_size, Type ret) {
+  return scaleFillNative(args, 0);
+}
+
+void registerArrayNatives() {
+  initArrayKernels();
+  registerNative("iarray", 1, TYPE_ARRAY, native_iarray);
+  registerNative("farray", 1, TYPE_ARRAY, native_farray);
+  registerNative("sum", 1, NATIVE_ANY, native_sum);
+  registerNative("dot", 2, NATIVE_ANY, native_dot);
+  registerNative("min", 1, NATIVE_ANY, native_min);
+  registerNative("max", 1, NATIVE_ANY, native_max);
+  registerNative("scale", 2, NATIVE_VOID, native_scale);
+  registerNative("add", 2, NATIVE_VOID, native_add);
+  registerNative("fill", 2, NATIVE_VOID, native_fill);
+}
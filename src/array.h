@@ -0,0 +1,51 @@
+#ifndef __ARRAY__
+#define __ARRAY__
+
+#include <stdint.h>
+
+struct VMContext;
+
+/* contiguous typed arrays and the native kernels behind the array
+ * builtins; the kernel set is chosen once from the host CPU features.
+ * int arrays hold 64 bit elements, the range of an int value; a bigint
+ * does not fit one. an array is one heap block with its elements right
+ * after the header */
+
+#define ARRAY_INT 0
+#define ARRAY_FLOAT 1
+
+struct ScriptCArray {
+  int elem_type;
+  int length;
+  union {
+    int64_t* ints;
+    double* doubles;
+  };
+};
+
+typedef struct ScriptCArray* ScriptCArray;
+
+struct ArrayKernels {
+  const char* name;
+  int64_t (*isum)(const int64_t* a, int n);
+  double (*dsum)(const double* a, int n);
+  int64_t (*idot)(const int64_t* a, const int64_t* b, int n);
+  double (*ddot)(const double* a, const double* b, int n);
+  int64_t (*imin)(const int64_t* a, int n);
+  double (*dmin)(const double* a, int n);
+  int64_t (*imax)(const int64_t* a, int n);
+  double (*dmax)(const double* a, int n);
+  void (*iscale)(int64_t* a, int n, int64_t k);
+  void (*dscale)(double* a, int n, double k);
+  void (*iadd)(int64_t* dst, const int64_t* src, int n);
+  void (*dadd)(double* dst, const double* src, int n);
+  void (*ifill)(int64_t* a, int n, int64_t v);
+  void (*dfill)(double* a, int n, double v);
+};
+
+extern const struct ArrayKernels* array_kernels;
+
+void initArrayKernels();
+ScriptCArray createArray(struct VMContext* ctx, int elem_type, int length);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "ast.h"
 
 Node createNode(int type) {
@@ -28,6 +29,13 @@ Node createListNode(int type, Node child) {
   return node;
 }
 
+Node createEmptyListNode(int type) {
+  Node node = (Node) malloc(sizeof(struct Node));
+  node->type = type;
+  node->list = createList(NULL);
+  return node;
+}
+
 List createList(ListEntry entry) {
   List list = (List) malloc(sizeof(struct List));
   list->elements = entry;
@@ -108,7 +116,7 @@ Node createUnaryNode(int type, Node child) {
   return node;
 }
 
-Node createIntNode(int val) {
+Node createIntNode(int64_t val) {
   Node node = (Node) malloc(sizeof(struct Node));
   node->type = SC_INT;
   node->int_val = val;
@@ -129,21 +137,19 @@ Node createBoolNode(int val) {
   return node;
 }
 
+/* str and name point into the source held by the lexer and are not
+ * copied */
 Node createStringNode(char* str) {
   Node node = (Node) malloc(sizeof(struct Node));
   node->type = SC_STRING;
-  node->string = (char *) malloc(strlen(str));
-  strcpy(node->string, str);
+  node->string = str;
   return node;
 }
 
 Node createNameNode(const char* name) {
   Node node = (Node) malloc(sizeof(struct Node));
   node->type = SC_NAME;
-  size_t len = strlen(name)+1;
-  node->name = (char *) malloc(len);
-  strcpy(node->name, name);
-  node->name[len-1] = 0;
+  node->name = (char *) name;
   return node;
 }
 
@@ -190,8 +196,8 @@ Node createWhileNode(Node cond, Node block) {
 Node createForNode(Node first, Node second, Node third, Node block) {
   Node node = (Node) malloc(sizeof(struct Node));
   node->type = SC_FOR;
-  node->child_size = 3;
-  node->child = (Node *) calloc(sizeof(struct Node), 3);
+  node->child_size = 4;
+  node->child = (Node *) calloc(sizeof(struct Node), 4);
   node->child[0] = first;
   node->child[1] = second;
   node->child[2] = third;
@@ -199,6 +205,18 @@ Node createForNode(Node first, Node second, Node third, Node block) {
   return node;
 }
 
+/* body is a statement list in which case nodes mark the entries; the
+ * case of default has no label */
+Node createSwitchNode(Node value, Node body) {
+  Node node = (Node) malloc(sizeof(struct Node));
+  node->type = SC_SWITCH;
+  node->child_size = 2;
+  node->child = (Node *) calloc(sizeof(struct Node), 2);
+  node->child[0] = value;
+  node->child[1] = body;
+  return node;
+}
+
 Node createBlockNode(Node child) {
   Node node = (Node) malloc(sizeof(struct Node));
   node->type = SC_BLOCK;
@@ -217,6 +235,16 @@ Node createReturnNode(Node child) {
   return node;
 }
 
+Node createIndexNode(Node array, Node index) {
+  Node node = (Node) malloc(sizeof(struct Node));
+  node->type = SC_INDEX;
+  node->child_size = 2;
+  node->child = (Node *) calloc(sizeof(struct Node), 2);
+  node->child[0] = array;
+  node->child[1] = index;
+  return node;
+}
+
 void disposeNode(Node node) {
   if(node) {
     switch (node->type) {
@@ -224,7 +252,6 @@ void disposeNode(Node node) {
         disposeList(node->list);
         break;
       case SC_STRING:
-        free(node->string);
         break;
       case SC_ADD:
         disposeNode(node->child[0]);
@@ -308,6 +335,25 @@ void disposeNode(Node node) {
         disposeNode(node->child[1]);
         free(node->child);
         break;
+      case SC_AND:
+        disposeNode(node->child[0]);
+        disposeNode(node->child[1]);
+        free(node->child);
+        break;
+      case SC_OR:
+        disposeNode(node->child[0]);
+        disposeNode(node->child[1]);
+        free(node->child);
+        break;
+      case SC_NOT:
+        disposeNode(node->child[0]);
+        free(node->child);
+        break;
+      case SC_INDEX:
+        disposeNode(node->child[0]);
+        disposeNode(node->child[1]);
+        free(node->child);
+        break;
       case SC_FUNCDEF:
         disposeNode(node->child[0]);
         disposeNode(node->child[1]);
@@ -321,9 +367,9 @@ void disposeNode(Node node) {
         disposeList(node->list);
         break;
       case SC_NAME:
-        free(node->name);
         break;
       case SC_ASSIGN:
+      case SC_CONST:
         disposeNode(node->child[0]);
         disposeNode(node->child[1]);
         free(node->child);
@@ -334,6 +380,8 @@ void disposeNode(Node node) {
         free(node->child);
         break;
       case SC_PRINT:
+      case SC_IMPORT:
+      case SC_CASE:
         disposeNode(node->child[0]);
         free(node->child);
         break;
@@ -344,6 +392,7 @@ void disposeNode(Node node) {
         free(node->child);
         break;
       case SC_WHILE:
+      case SC_SWITCH:
         disposeNode(node->child[0]);
         disposeNode(node->child[1]);
         free(node->child);
@@ -388,7 +437,7 @@ void printNode(Node node, int level) {
         printf("]\n");
         break;
       case SC_INT:
-        printf("#Int[%d]\n", node->int_val);
+        printf("#Int[%" PRId64 "]\n", node->int_val);
         break;
       case SC_FLOAT:
         printf("#Float[%f]\n", node->double_val);
@@ -522,6 +571,33 @@ void printNode(Node node, int level) {
         indent(level);
         printf("]\n");
         break;
+      case SC_AND:
+        printf("#AND\n");
+        printNode(node->child[0], level+1);
+        printNode(node->child[1], level+1);
+        indent(level);
+        printf("]\n");
+        break;
+      case SC_OR:
+        printf("#OR\n");
+        printNode(node->child[0], level+1);
+        printNode(node->child[1], level+1);
+        indent(level);
+        printf("]\n");
+        break;
+      case SC_NOT:
+        printf("#NOT\n");
+        printNode(node->child[0], level+1);
+        indent(level);
+        printf("]\n");
+        break;
+      case SC_INDEX:
+        printf("#Index\n");
+        printNode(node->child[0], level+1);
+        printNode(node->child[1], level+1);
+        indent(level);
+        printf("]\n");
+        break;
       case SC_FUNCDEF:
         printf("#FuncDef\n");
         printNode(node->child[0], level+1);
@@ -552,6 +628,19 @@ void printNode(Node node, int level) {
         indent(level);
         printf("]\n");
         break;
+      case SC_IMPORT:
+        printf("#Import[\n");
+        printNode(node->child[0], level+1);
+        indent(level);
+        printf("]\n");
+        break;
+      case SC_CONST:
+        printf("#Const[\n");
+        printNode(node->child[0], level+1);
+        printNode(node->child[1], level+1);
+        indent(level);
+        printf("]\n");
+        break;
       case SC_FUNCCALL:
         printf("#FuncCall\n");
         printNode(node->child[0], level+1);
@@ -589,6 +678,23 @@ void printNode(Node node, int level) {
         indent(level);
         printf("]\n");
         break;
+      case SC_SWITCH:
+        printf("#Switch[\n");
+        printNode(node->child[0], level+1);
+        printNode(node->child[1], level+1);
+        indent(level);
+        printf("]\n");
+        break;
+      case SC_CASE:
+        if(node->child[0] == NULL) {
+          printf("#Default[]\n");
+          break;
+        }
+        printf("#Case[\n");
+        printNode(node->child[0], level+1);
+        indent(level);
+        printf("]\n");
+        break;
       case SC_BLOCK:
         printf("#Block[\n");
         printNode(node->child[0], level+1);
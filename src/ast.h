@@ -1,6 +1,8 @@
 #ifndef __AST__
 #define __AST__
 
+#include <stdint.h>
+
 #define SC_NONE 0
 #define SC_INT 1
 #define SC_FLOAT 2
@@ -40,6 +42,14 @@
 #define SC_ASSIGNDIV 36
 #define SC_INC 37
 #define SC_DEC 38
+#define SC_INDEX 39
+#define SC_CONST 40
+#define SC_IMPORT 41
+#define SC_SWITCH 42
+#define SC_CASE 43
+#define SC_AND 44
+#define SC_OR 45
+#define SC_NOT 46
 
 #define NODE_EACH(NODE)\
   NODE(NONE)\
@@ -80,14 +90,22 @@
   NODE(ASSIGNMUL)\
   NODE(ASSIGNDIV)\
   NODE(INC)\
-  NODE(DEC)
+  NODE(DEC)\
+  NODE(INDEX)\
+  NODE(CONST)\
+  NODE(IMPORT)\
+  NODE(SWITCH)\
+  NODE(CASE)\
+  NODE(AND)\
+  NODE(OR)\
+  NODE(NOT)
 
 struct Node {
   int type;
   int child_size;
   union {
     struct Node **child;
-    int int_val;
+    int64_t int_val;
     double double_val;
     char* string;
     int bool_val;
@@ -117,6 +135,7 @@ void disposeNode(Node node);
 void printNode(Node node, int level);
 Node createFuncDefNode(Node name, Node args, Node body);
 Node createListNode(int type, Node child);
+Node createEmptyListNode(int type);
 List createList(ListEntry entry);
 ListEntry createListEntry(Node node, ListEntry prev);
 void disposeList(List list);
@@ -125,7 +144,7 @@ List appendList(List list, Node node);
 Node createExprNode(int type, Node left, Node right);
 Node createArithNode(int type, Node left, Node right);
 Node createUnaryNode(int type, Node child);
-Node createIntNode(int val);
+Node createIntNode(int64_t val);
 Node createFloatNode(double val);
 Node createBoolNode(int val);
 Node createStringNode(char* str);
@@ -135,7 +154,9 @@ Node createPrintNode(Node child);
 Node createIfNode(Node cond, Node thenStmt, Node elseStmt);
 Node createWhileNode(Node cond, Node block);
 Node createForNode(Node first, Node second, Node third, Node block);
+Node createSwitchNode(Node value, Node body);
 Node createBlockNode(Node child);
 Node createReturnNode(Node child);
+Node createIndexNode(Node array, Node index);
 
 #endif
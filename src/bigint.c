@@ -0,0 +1,277 @@
+#include "compiler.h"
+#include "vm.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* an operand unpacked into sign and magnitude; ints borrow buf */
+struct BigView {
+  int sign;
+  int size;
+  const uint32_t* limbs;
+  uint32_t buf[2];
+};
+
+static void viewOf(Type val, struct BigView* view) {
+  if(val->type == TYPE_BIGINT) {
+    view->sign = val->bigint->sign;
+    view->size = val->bigint->size;
+    view->limbs = val->bigint->limbs;
+    return;
+  }
+  int64_t v = val->int_val;
+  uint64_t mag = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  view->sign = v < 0 ? -1 : v > 0;
+  view->buf[0] = (uint32_t)mag;
+  view->buf[1] = (uint32_t)(mag >> 32);
+  view->size = view->buf[1] ? 2 : view->buf[0] ? 1 : 0;
+  view->limbs = view->buf;
+}
+
+static ScriptCBigInt allocBigInt(int size) {
+  ScriptCBigInt big = (ScriptCBigInt)allocObject(NULL, BLOCK_BIGINT, sizeof(struct ScriptCBigInt) + sizeof(uint32_t)*(size+1));
+  big->size = size;
+  return big;
+}
+
+/* strips leading zero limbs and demotes to an int when it fits */
+static void setResult(Type ret, int sign, ScriptCBigInt big) {
+  int size = big->size;
+  while(size > 0 && big->limbs[size-1] == 0) {
+    size--;
+  }
+  if(size <= 2) {
+    uint64_t mag = size == 0 ? 0 : big->limbs[0];
+    if(size == 2) {
+      mag |= (uint64_t)big->limbs[1] << 32;
+    }
+    if(mag <= INT64_MAX || (sign < 0 && mag == (uint64_t)INT64_MAX + 1)) {
+      ret->type = TYPE_INT;
+      ret->int_val = sign < 0 ? (int64_t)(0 - mag) : (int64_t)mag;
+      return;
+    }
+  }
+  big->sign = sign;
+  big->size = size;
+  ret->type = TYPE_BIGINT;
+  ret->bigint = big;
+}
+
+static int magCompare(const uint32_t* a, int an, const uint32_t* b, int bn) {
+  if(an != bn) {
+    return an < bn ? -1 : 1;
+  }
+  for(int i = an - 1; i >= 0; i--) {
+    if(a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static void magAdd(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+  uint64_t carry = 0;
+  int size = an > bn ? an : bn;
+  for(int i = 0; i < size; i++) {
+    carry += (uint64_t)(i < an ? a[i] : 0) + (i < bn ? b[i] : 0);
+    out[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  out[size] = (uint32_t)carry;
+}
+
+/* a - b where |a| >= |b| */
+static void magSub(const uint32_t* a, int an, const uint32_t* b, int bn, uint32_t* out) {
+  int64_t borrow = 0;
+  for(int i = 0; i < an; i++) {
+    int64_t t = (int64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+    borrow = t < 0;
+    out[i] = (uint32_t)t;
+  }
+}
+
+static void addViews(struct BigView* a, struct BigView* b, Type ret) {
+  int size = (a->size > b->size ? a->size : b->size) + 1;
+  ScriptCBigInt big = allocBigInt(size);
+  int sign;
+  if(b->sign == 0 || a->sign == b->sign) {
+    magAdd(a->limbs, a->size, b->limbs, b->size, big->limbs);
+    sign = a->sign ? a->sign : b->sign;
+  } else if(magCompare(a->limbs, a->size, b->limbs, b->size) >= 0) {
+    magSub(a->limbs, a->size, b->limbs, b->size, big->limbs);
+    sign = a->sign;
+  } else {
+    magSub(b->limbs, b->size, a->limbs, a->size, big->limbs);
+    sign = b->sign;
+  }
+  setResult(ret, sign, big);
+}
+
+void bigAdd(Type left, Type right, Type ret) {
+  struct BigView a, b;
+  viewOf(left, &a);
+  viewOf(right, &b);
+  addViews(&a, &b, ret);
+}
+
+void bigSub(Type left, Type right, Type ret) {
+  struct BigView a, b;
+  viewOf(left, &a);
+  viewOf(right, &b);
+  b.sign = -b.sign;
+  addViews(&a, &b, ret);
+}
+
+void bigMul(Type left, Type right, Type ret) {
+  struct BigView a, b;
+  viewOf(left, &a);
+  viewOf(right, &b);
+  ScriptCBigInt big = allocBigInt(a.size + b.size);
+  for(int i = 0; i < a.size; i++) {
+    uint64_t carry = 0;
+    for(int j = 0; j < b.size; j++) {
+      carry += (uint64_t)a.limbs[i] * b.limbs[j] + big->limbs[i+j];
+      big->limbs[i+j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    big->limbs[i+b.size] = (uint32_t)carry;
+  }
+  setResult(ret, a.sign * b.sign, big);
+}
+
+/* Knuth's algorithm D: q = u / v for m >= n >= 2, v[n-1] != 0 */
+static void magDivide(const uint32_t* u, int m, const uint32_t* v, int n, uint32_t* q) {
+  int s = __builtin_clz(v[n-1]);
+  uint32_t* vn = (uint32_t*)malloc(sizeof(uint32_t)*n);
+  uint32_t* un = (uint32_t*)malloc(sizeof(uint32_t)*(m+1));
+  for(int i = n - 1; i > 0; i--) {
+    vn[i] = (uint32_t)((((uint64_t)v[i] << 32) | v[i-1]) >> (32 - s));
+  }
+  vn[0] = v[0] << s;
+  un[m] = (uint32_t)((uint64_t)u[m-1] >> (32 - s));
+  for(int i = m - 1; i > 0; i--) {
+    un[i] = (uint32_t)((((uint64_t)u[i] << 32) | u[i-1]) >> (32 - s));
+  }
+  un[0] = u[0] << s;
+  for(int j = m - n; j >= 0; j--) {
+    uint64_t num = ((uint64_t)un[j+n] << 32) | un[j+n-1];
+    uint64_t qhat = num / vn[n-1];
+    uint64_t rhat = num - qhat * vn[n-1];
+    while(qhat > UINT32_MAX || qhat * vn[n-2] > ((rhat << 32) | un[j+n-2])) {
+      qhat--;
+      rhat += vn[n-1];
+      if(rhat > UINT32_MAX) {
+        break;
+      }
+    }
+    int64_t borrow = 0;
+    int64_t t;
+    for(int i = 0; i < n; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i+j] - borrow - (int64_t)(p & UINT32_MAX);
+      un[i+j] = (uint32_t)t;
+      borrow = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j+n] - borrow;
+    un[j+n] = (uint32_t)t;
+    q[j] = (uint32_t)qhat;
+    if(t < 0) {
+      /* qhat was one too large: add the divisor back */
+      uint64_t carry = 0;
+      q[j]--;
+      for(int i = 0; i < n; i++) {
+        carry += (uint64_t)un[i+j] + vn[i];
+        un[i+j] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      un[j+n] += (uint32_t)carry;
+    }
+  }
+  free(vn);
+  free(un);
+}
+
+/* truncates toward zero like int division; 1 on division by zero */
+int bigDiv(Type left, Type right, Type ret) {
+  struct BigView a, b;
+  viewOf(left, &a);
+  viewOf(right, &b);
+  if(b.sign == 0) {
+    return 1;
+  }
+  ScriptCBigInt big = allocBigInt(a.size);
+  if(magCompare(a.limbs, a.size, b.limbs, b.size) < 0) {
+    big->size = 0;
+  } else if(b.size == 1) {
+    uint64_t rem = 0;
+    for(int i = a.size - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | a.limbs[i];
+      big->limbs[i] = (uint32_t)(cur / b.limbs[0]);
+      rem = cur % b.limbs[0];
+    }
+  } else {
+    magDivide(a.limbs, a.size, b.limbs, b.size, big->limbs);
+  }
+  setResult(ret, a.sign * b.sign, big);
+  return 0;
+}
+
+void bigNeg(Type val, Type ret) {
+  struct BigView a;
+  viewOf(val, &a);
+  ScriptCBigInt big = allocBigInt(a.size);
+  memcpy(big->limbs, a.limbs, sizeof(uint32_t)*a.size);
+  setResult(ret, -a.sign, big);
+}
+
+int bigCompare(Type left, Type right) {
+  struct BigView a, b;
+  viewOf(left, &a);
+  viewOf(right, &b);
+  if(a.sign != b.sign) {
+    return a.sign < b.sign ? -1 : 1;
+  }
+  return a.sign * magCompare(a.limbs, a.size, b.limbs, b.size);
+}
+
+double bigToDouble(Type val) {
+  struct BigView a;
+  viewOf(val, &a);
+  double d = 0;
+  for(int i = a.size - 1; i >= 0; i--) {
+    d = d * 4294967296.0 + a.limbs[i];
+  }
+  return a.sign < 0 ? -d : d;
+}
+
+/* peels off base 10^9 digits by short division of a scratch copy */
+void printBigInt(ScriptCBigInt val) {
+  int size = val->size;
+  uint32_t* mag = (uint32_t*)malloc(sizeof(uint32_t)*(size+1));
+  uint32_t* digits = (uint32_t*)malloc(sizeof(uint32_t)*(size*2+1));
+  int count = 0;
+  memcpy(mag, val->limbs, sizeof(uint32_t)*size);
+  while(size > 0) {
+    uint64_t rem = 0;
+    for(int i = size - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | mag[i];
+      mag[i] = (uint32_t)(cur / 1000000000);
+      rem = cur % 1000000000;
+    }
+    digits[count++] = (uint32_t)rem;
+    while(size > 0 && mag[size-1] == 0) {
+      size--;
+    }
+  }
+  if(val->sign < 0) {
+    printf("-");
+  }
+  printf("%u", count ? digits[count-1] : 0);
+  for(int i = count - 2; i >= 0; i--) {
+    printf("%09u", digits[i]);
+  }
+  free(mag);
+  free(digits);
+}
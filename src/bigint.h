@@ -0,0 +1,35 @@
+#ifndef __BIGINT__
+#define __BIGINT__
+
+#include <stdint.h>
+
+/* arbitrary precision integers, the slow path of int arithmetic. a
+ * value is a sign and a magnitude in base 2^32 limbs, least significant
+ * first. results are normalized: anything that fits in 64 bits comes
+ * back as a plain TYPE_INT, so only values past int64 ever live here.
+ * bigints are immutable heap blocks; the operations never collect, the
+ * vm does once the result is on its stack.
+ *
+ * the operations take TYPE_INT or TYPE_BIGINT operands and ret may
+ * alias either of them */
+
+struct ScriptCBigInt {
+  int sign;
+  int size;
+  uint32_t limbs[];
+};
+
+typedef struct ScriptCBigInt* ScriptCBigInt;
+
+struct Type;
+
+void bigAdd(struct Type* left, struct Type* right, struct Type* ret);
+void bigSub(struct Type* left, struct Type* right, struct Type* ret);
+void bigMul(struct Type* left, struct Type* right, struct Type* ret);
+int bigDiv(struct Type* left, struct Type* right, struct Type* ret);
+void bigNeg(struct Type* val, struct Type* ret);
+int bigCompare(struct Type* left, struct Type* right);
+double bigToDouble(struct Type* val);
+void printBigInt(ScriptCBigInt val);
+
+#endif
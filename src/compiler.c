@@ -1,15 +1,28 @@
 #include "ast.h"
 #include "compiler.h"
 #include "vm.h"
+#include "ir.h"
+#include "native.h"
+#include "consteval.h"
+#include "layout.h"
+#include "import.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
-
-static CompilerContext c_context;
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* function bodies are lowered on several threads, each with its own
+ * current context */
+static __thread CompilerContext c_context;
 static Module module;
 
+static unsigned hashConst(const void* data, size_t len);
+
 VarEntry getVarEntry(char* name) {
   for(int i = 0; i < c_context->var_count; i++) {
     if(!strcmp(name, c_context->vars[i]->name)) {
@@ -25,27 +38,49 @@ void setVarEntry(char* name) {
   c_context->vars[c_context->var_count]->id = c_context->var_count;
   c_context->var_count++;
   if((c_context->var_count % VAR_MAX) == 0) {
-    c_context->vars = (VarEntry*)realloc(c_context->vars, sizeof(c_context->vars)*2);
+    c_context->vars = (VarEntry*)realloc(c_context->vars, sizeof(VarEntry)*(c_context->var_count+VAR_MAX));
   }
 }
 
-int containsFunc(char* name) {
-  for(int i = 0; i < c_context->func_count; i++) {
-    if(!strcmp(name, c_context->funcs[i]->name)) {
-      return 1;
+/* the functions of a context are indexed by name in an open addressing
+ * table of positions in funcs */
+static int findFunc(CompilerContext ctx, const char* name) {
+  unsigned mask = ctx->func_table_size - 1;
+  unsigned slot = hashConst(name, strlen(name)) & mask;
+  for(; ctx->func_table[slot] != -1; slot = (slot+1) & mask) {
+    if(!strcmp(name, ctx->funcs[ctx->func_table[slot]]->name)) {
+      return ctx->func_table[slot];
     }
   }
-  return 0;
+  return -1;
 }
 
+static void insertFunc(CompilerContext ctx, int index) {
+  unsigned mask = ctx->func_table_size - 1;
+  const char* name = ctx->funcs[index]->name;
+  unsigned slot = hashConst(name, strlen(name)) & mask;
+  while(ctx->func_table[slot] != -1) {
+    slot = (slot+1) & mask;
+  }
+  ctx->func_table[slot] = index;
+}
+
+int containsFunc(char* name) {
+  return findFunc(c_context, name) != -1;
+}
+
+/* a body sees the functions defined before the current point of its own
+ * context, and in each enclosing context the ones defined up to and
+ * including the function that encloses it */
 FuncEntry getFuncEntry(char* name) {
   CompilerContext c_ctx = c_context;
+  int visible = c_context->func_visible;
   for(; c_ctx; c_ctx = c_ctx->prev) {
-    for(int i = 0; i < c_ctx->func_count; i++) {
-      if(!strcmp(name, c_ctx->funcs[i]->name)) {
-        return c_ctx->funcs[i];
-      }
+    int i = findFunc(c_ctx, name);
+    if(i != -1 && i < visible) {
+      return c_ctx->funcs[i];
     }
+    visible = c_ctx->def_index + 1;
   }
   return NULL;
 }
@@ -58,11 +93,24 @@ void setFuncEntry(char* name, int arg_size) {
   c_context->funcs[c_context->func_count]->arg_size = arg_size;
   c_context->func_count++;
   if((c_context->func_count % FUNC_MAX) == 0) {
-    c_context->vars = (VarEntry*)realloc(c_context->funcs, sizeof(c_context->funcs)*2);
+    c_context->funcs = (FuncEntry*)realloc(c_context->funcs, sizeof(FuncEntry)*(c_context->func_count+FUNC_MAX));
+  }
+  if(c_context->func_count * 2 > c_context->func_table_size) {
+    c_context->func_table_size *= 2;
+    c_context->func_table = (int*)realloc(c_context->func_table, sizeof(int)*c_context->func_table_size);
+    memset(c_context->func_table, -1, sizeof(int)*c_context->func_table_size);
+    for(int i = 0; i < c_context->func_count; i++) {
+      insertFunc(c_context, i);
+    }
+  } else {
+    insertFunc(c_context, c_context->func_count-1);
   }
 }
 
 static inline int createLabel() {
+  if(c_context->label_count % 256 == 0 && c_context->label_count > 0) {
+    c_context->label_list = (int*)realloc(c_context->label_list, sizeof(int)*(c_context->label_count+256));
+  }
   return c_context->label_count++;
 }
 
@@ -84,8 +132,10 @@ static inline int get_break_label() {
   return c_context->breakLabels[c_context->bc_id];
 }
 
+/* a switch passes on the continue label of the loop around it, -1 when
+ * there is none */
 static inline int get_continue_label() {
-  if(c_context->bc_id == -1) {
+  if(c_context->bc_id == -1 || c_context->continueLabels[c_context->bc_id] == -1) {
     fprintf(stderr, "continue error\n");
     exit(1);
   }
@@ -115,9 +165,11 @@ InstList createInstList(InstList prev, ScriptCInstruction inst) {
 }
 
 void disposeInstList(InstList list) {
-  for(; list; list = list->next) {
+  while(list) {
+    InstList next = list->next;
     free(list->inst);
     free(list);
+    list = next;
   }
 }
 
@@ -140,7 +192,7 @@ static void dumpInstruction(ScriptCInstruction inst, int index) {
   switch (inst->op) {
 #define OP_DUMPCASE(OP) case I##OP:
     OP_DUMPCASE(iconst) {
-      fprintf(stderr, "%d", inst->int_val);
+      fprintf(stderr, "%" PRId64, inst->int_val);
       break;
     }
     OP_DUMPCASE(dconst) {
@@ -159,23 +211,44 @@ static void dumpInstruction(ScriptCInstruction inst, int index) {
       }
       break;
     }
-    OP_DUMPCASE(loadl) {
+    OP_DUMPCASE(loadl)
+    OP_DUMPCASE(loadl_u) {
       fprintf(stderr, "%d", inst->var_id);
       break;
     }
-    OP_DUMPCASE(storel) {
+    OP_DUMPCASE(storel)
+    OP_DUMPCASE(storel_u)
+    OP_DUMPCASE(storea_u) {
       fprintf(stderr, "%d", inst->var_id);
       break;
     }
+    OP_DUMPCASE(iinc) {
+      fprintf(stderr, "%d %d", inst->inc_var, inst->inc_val);
+      break;
+    }
     OP_DUMPCASE(call) {
       fprintf(stderr, "%ld", inst->call_point);
       break;
     }
+    OP_DUMPCASE(ncall) {
+      fprintf(stderr, "%s %d", getNativeName(inst->func_id), inst->arg_size);
+      break;
+    }
+    OP_DUMPCASE(lcall)
+    OP_DUMPCASE(fcall) {
+      fprintf(stderr, "%d", inst->func_id);
+      break;
+    }
     OP_DUMPCASE(jump)
-    OP_DUMPCASE(ifcmp) {
+    OP_DUMPCASE(ifcmp)
+    OP_DUMPCASE(ifcmp_u) {
       fprintf(stderr, "%ld", inst->jump);
       break;
     }
+    OP_DUMPCASE(case) {
+      fprintf(stderr, "%d %d", inst->case_key, inst->case_jump);
+      break;
+    }
   default:
     break;
   }
@@ -183,6 +256,7 @@ static void dumpInstruction(ScriptCInstruction inst, int index) {
 }
 
 static inline void convert(Node node);
+static inline int getHoistedVar(Node node);
 
 void convertNONE(Node node) {
 }
@@ -258,19 +332,14 @@ int countListSize(List list) {
   return count;
 }
 
+/* the body was given its own context by registerFunction and is lowered
+ * separately; here the function only comes into scope */
 void convertFUNCDEF(Node node) {
-  if(node->child[0]->type != SC_NAME) {
-    fprintf(stderr, "Error: first argument of assign expression is expected name node\n");
-    exit(1);
-  }
-  if(containsFunc(node->child[0]->name)) {
-    fprintf(stderr, "function '%s' is re-defined\n", node->child[0]->name);
-    exit(1);
-  }
+  c_context->func_visible++;
+}
+
+static void compileFunction(Node node) {
   Node args = node->child[1];
-  int count = countListSize(args->list);
-  setFuncEntry(node->child[0]->name, count);
-  createCompilerContext(c_context);
   ListEntry entry = args->list->elements;
   for(; entry; entry = entry->next) {
     ScriptCInstruction inst = createInstruction(Istorea);
@@ -281,12 +350,20 @@ void convertFUNCDEF(Node node) {
       c_context->root = c_context->list;
     }
   }
-  convert(node->child[2]);
+  if(node->child[2]) {
+    convert(node->child[2]);
+  }
   if(!c_context->ret) {
     ScriptCInstruction inst = createInstruction(Iret_void);
     c_context->list = createInstList(c_context->list, inst);
   }
-  c_context = disposeCompilerContext(c_context);
+  if(c_context->root == NULL) {
+    InstList list = c_context->list;
+    while(list->prev) {
+      list = list->prev;
+    }
+    c_context->root = list;
+  }
 }
 
 void convertARGS(Node node) {
@@ -312,6 +389,14 @@ void convertNAME(Node node) {
 }
 
 void convertASSIGN(Node node) {
+  if(node->child[0]->type == SC_INDEX) {
+    convert(node->child[0]->child[0]);
+    convert(node->child[0]->child[1]);
+    convert(node->child[1]);
+    ScriptCInstruction inst = createInstruction(Iastore);
+    c_context->list = createInstList(c_context->list, inst);
+    return;
+  }
   if(node->child[0]->type != SC_NAME) {
     fprintf(stderr, "Error: first argument of assign expression is expected name node\n");
     exit(1);
@@ -337,6 +422,51 @@ void convertSOURCE(Node node) {
   }
 }
 
+/* a script call passes exactly the parameters of the callee */
+static void checkArgCount(FuncEntry func, Node args) {
+  if(countListSize(args->list) != func->arg_size) {
+    fprintf(stderr, "Error: %s expects %d argument(s)\n", func->name, func->arg_size);
+    exit(1);
+  }
+}
+
+/* functions not defined in the script bind to a builtin opcode or to
+ * the native registry; their arguments are pushed in source order */
+static int convertNativeCall(char* name, Node args) {
+  int count = countListSize(args->list);
+  int op = Incall;
+  int id = getBuiltin(name);
+  int arg_size;
+  if(id != -1) {
+    op = getBuiltinOp(id);
+    arg_size = getBuiltinArgSize(id);
+  } else {
+    id = getNative(name);
+    if(id == -1) {
+      return 0;
+    }
+    arg_size = getNativeArgSize(id);
+  }
+  if(arg_size != NATIVE_VARARGS && count != arg_size) {
+    fprintf(stderr, "Error: %s expects %d argument(s)\n", name, arg_size);
+    exit(1);
+  }
+  /* a snapshot saves the top level frame alone */
+  if(op == Isnapshot && c_context->prev != NULL) {
+    fprintf(stderr, "Error: snapshot() outside of the top level code\n");
+    exit(1);
+  }
+  ListEntry entry = args->list->elements;
+  for(; entry; entry = entry->next) {
+    convert(entry->node);
+  }
+  ScriptCInstruction inst = createInstruction(op);
+  inst->func_id = id;
+  inst->arg_size = count;
+  c_context->list = createInstList(c_context->list, inst);
+  return 1;
+}
+
 void convertFUNCCALL(Node node) {
   if(node->child[0]->type != SC_NAME) {
     fprintf(stderr, "Error: first argument of function definition is expected name node\n");
@@ -345,7 +475,15 @@ void convertFUNCCALL(Node node) {
   FuncEntry func = getFuncEntry(node->child[0]->name);
   Node args = node->child[1];
   ListEntry entry = args->list->elements;
-  while(entry->next) {
+  if(func == NULL) {
+    if(!convertNativeCall(node->child[0]->name, args)) {
+      fprintf(stderr, "Error: function not found (%s)\n", node->child[0]->name);
+      exit(1);
+    }
+    return;
+  }
+  checkArgCount(func, args);
+  while(entry && entry->next) {
     entry = entry->next;
   }
   for(; entry; entry = entry->prev) {
@@ -353,6 +491,7 @@ void convertFUNCCALL(Node node) {
   }
   ScriptCInstruction inst = createInstruction(Icall);
   inst->func_id = func->id;
+  inst->arg_size = func->arg_size;
   c_context->list = createInstList(c_context->list, inst);
 }
 
@@ -362,15 +501,126 @@ void convertPRINT(Node node) {
   c_context->list = createInstList(c_context->list, inst);
 }
 
+static void emitOp(int op) {
+  c_context->list = createInstList(c_context->list, createInstruction(op));
+}
+
+static void emitBranch(int op, int label) {
+  ScriptCInstruction inst = createInstruction(op);
+  inst->label_id = label;
+  c_context->list = createInstList(c_context->list, inst);
+}
+
+/* a condition is lowered into branches: convertBranch jumps to label
+ * when node is taken (true or false) and falls through otherwise. &&
+ * and || branch on their left operand before the right one runs and !
+ * swaps the sense, so the condition of an if or a loop never makes a
+ * bool. ifcmp branches on false; a branch on true inverts == and != and
+ * otherwise steps over a jump */
+/* a comparison that a loop hoisted is loaded as it is */
+static int isInvertible(Node node) {
+  return (node->type == SC_EQ || node->type == SC_NE) && getHoistedVar(node) == -1;
+}
+
+static void convertBranch(Node node, int label, int taken) {
+  int skip;
+  switch(node->type) {
+    case SC_NOT:
+      convertBranch(node->child[0], label, !taken);
+      return;
+    case SC_AND: case SC_OR:
+      if((node->type == SC_AND) != taken) {
+        /* a false operand decides &&, a true one || */
+        convertBranch(node->child[0], label, taken);
+        convertBranch(node->child[1], label, taken);
+      } else {
+        skip = createLabel();
+        convertBranch(node->child[0], skip, !taken);
+        convertBranch(node->child[1], label, taken);
+        setLabel(skip);
+      }
+      return;
+    case SC_BOOL:
+      if(node->bool_val == taken) {
+        emitBranch(Ijump, label);
+      }
+      return;
+  }
+  if(taken && isInvertible(node)) {
+    convert(node->child[0]);
+    convert(node->child[1]);
+    emitOp(node->type == SC_EQ ? Ine : Ieq);
+    emitBranch(Iifcmp, label);
+    return;
+  }
+  convert(node);
+  if(taken) {
+    skip = createLabel();
+    emitBranch(Iifcmp, skip);
+    emitBranch(Ijump, label);
+    setLabel(skip);
+  } else {
+    emitBranch(Iifcmp, label);
+  }
+}
+
+/* a condition used as a value; the bool goes through a local so that
+ * no stack value lives across its branches */
+static void convertCondition(Node node) {
+  int falseLabel = createLabel();
+  int endLabel = createLabel();
+  VarEntry var = getVarEntry("%cond");
+  if(var == NULL) {
+    setVarEntry("%cond");
+    var = getVarEntry("%cond");
+  }
+  convertBranch(node, falseLabel, 0);
+  ScriptCInstruction inst = createInstruction(Ibconst);
+  inst->bool_val = 1;
+  c_context->list = createInstList(c_context->list, inst);
+  inst = createInstruction(Istorel);
+  inst->var_id = var->id;
+  c_context->list = createInstList(c_context->list, inst);
+  emitBranch(Ijump, endLabel);
+  setLabel(falseLabel);
+  inst = createInstruction(Ibconst);
+  inst->bool_val = 0;
+  c_context->list = createInstList(c_context->list, inst);
+  inst = createInstruction(Istorel);
+  inst->var_id = var->id;
+  c_context->list = createInstList(c_context->list, inst);
+  setLabel(endLabel);
+  inst = createInstruction(Iloadl);
+  inst->var_id = var->id;
+  c_context->list = createInstList(c_context->list, inst);
+}
+
+void convertAND(Node node) {
+  convertCondition(node);
+}
+
+void convertOR(Node node) {
+  convertCondition(node);
+}
+
+/* !(a == b) is a != b */
+void convertNOT(Node node) {
+  Node child = node->child[0];
+  if(isInvertible(child)) {
+    convert(child->child[0]);
+    convert(child->child[1]);
+    emitOp(child->type == SC_EQ ? Ine : Ieq);
+    return;
+  }
+  convertCondition(node);
+}
+
 void convertIF(Node node) {
   int elseLabel = createLabel();
   int mergeLabel = createLabel();
-  convert(node->child[0]);
-  ScriptCInstruction inst = createInstruction(Iifcmp);
-  inst->label_id = elseLabel;
-  c_context->list = createInstList(c_context->list, inst);
+  convertBranch(node->child[0], elseLabel, 0);
   convert(node->child[1]);
-  inst = createInstruction(Ijump);
+  ScriptCInstruction inst = createInstruction(Ijump);
   inst->label_id = mergeLabel;
   c_context->list = createInstList(c_context->list, inst);
   setLabel(elseLabel);
@@ -382,17 +632,465 @@ void convertELSE(Node node) {
 
 }
 
+/* loop optimization:
+ * invariant expressions are hoisted into a preheader and products of an
+ * induction variable with a constant are replaced by a temporary that is
+ * updated additively. Optimized loops are rotated so that the preheader
+ * only runs once the first test has passed:
+ *
+ *   cond; ifcmp end; preheader; body: block; continue: step; cond; ifcmp end; jump body; end:
+ */
+
+#define LOOP_OPT_MAX 32
+
+struct NameSet {
+  char** names;
+  int count;
+};
+
+struct LoopOpt {
+  Node hoist[LOOP_OPT_MAX];
+  int hoist_size;
+  Node reduce[LOOP_OPT_MAX];
+  int reduce_size;
+  char* iv_name;
+  int iv_step;
+};
+
+static int containsName(struct NameSet* set, char* name) {
+  for(int i = 0; i < set->count; i++) {
+    if(!strcmp(name, set->names[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void addName(struct NameSet* set, char* name) {
+  if(containsName(set, name)) {
+    return;
+  }
+  set->names = (char**)realloc(set->names, sizeof(char*)*(set->count+1));
+  set->names[set->count++] = name;
+}
+
+static int isLeafNode(Node node) {
+  switch(node->type) {
+    case SC_NONE: case SC_INT: case SC_FLOAT: case SC_STRING: case SC_BOOL:
+    case SC_NAME: case SC_BREAK: case SC_CONTINUE:
+      return 1;
+  }
+  return 0;
+}
+
+static int isListNode(Node node) {
+  return node->type == SC_SOURCE || node->type == SC_STATEMENTLIST || node->type == SC_ARGS;
+}
+
+typedef void (*node_visitor_t)(Node, void*);
+
+static void visitChildren(Node node, node_visitor_t visit, void* data) {
+  if(isLeafNode(node)) {
+    return;
+  }
+  if(isListNode(node)) {
+    if(node->list) {
+      ListEntry entry = node->list->elements;
+      for(; entry; entry = entry->next) {
+        if(entry->node) {
+          visit(entry->node, data);
+        }
+      }
+    }
+    return;
+  }
+  for(int i = 0; i < node->child_size; i++) {
+    if(node->child[i]) {
+      visit(node->child[i], data);
+    }
+  }
+}
+
+static void collectAssigned(Node node, void* data) {
+  switch(node->type) {
+    case SC_FUNCDEF:
+      return;
+    case SC_ASSIGN: case SC_ASSIGNADD: case SC_ASSIGNSUB:
+    case SC_ASSIGNMUL: case SC_ASSIGNDIV: case SC_INC: case SC_DEC:
+      if(node->child[0]->type == SC_NAME) {
+        addName((struct NameSet*)data, node->child[0]->name);
+      }
+      break;
+  }
+  visitChildren(node, collectAssigned, data);
+}
+
+static int isLoopInvariant(Node node, struct NameSet* assigned) {
+  switch(node->type) {
+    case SC_INT: case SC_FLOAT: case SC_BOOL:
+      return 1;
+    case SC_NAME:
+      return !containsName(assigned, node->name) && getVarEntry(node->name) != NULL;
+    case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV:
+    case SC_LT: case SC_GT: case SC_LE: case SC_GE: case SC_EQ: case SC_NE:
+      return isLoopInvariant(node->child[0], assigned) && isLoopInvariant(node->child[1], assigned);
+    case SC_PLUS: case SC_MINUS:
+      return isLoopInvariant(node->child[0], assigned);
+  }
+  return 0;
+}
+
+/* the type every value of an expression has, or -1. a name has one
+ * when every assignment to it in the function gives it that type; the
+ * parameters have none. an int may be a bigint at run time, which the
+ * arithmetic takes as well. DEPTH bounds the chase through names */
+#define STATIC_TYPE_DEPTH 4
+
+static int staticType(Node node, int depth);
+
+struct NameTypeScan {
+  char* name;
+  int depth;
+  int type;
+};
+
+static void collectNameType(Node node, void* data) {
+  struct NameTypeScan* scan = (struct NameTypeScan*)data;
+  int type = -2;
+  switch(node->type) {
+    case SC_FUNCDEF:
+      return;
+    case SC_ASSIGN: case SC_ASSIGNADD: case SC_ASSIGNSUB:
+    case SC_ASSIGNMUL: case SC_ASSIGNDIV:
+      if(node->child[0]->type == SC_NAME && !strcmp(node->child[0]->name, scan->name)) {
+        type = staticType(node->child[1], scan->depth);
+      }
+      break;
+    case SC_INC: case SC_DEC:
+      if(node->child[0]->type == SC_NAME && !strcmp(node->child[0]->name, scan->name)) {
+        type = TYPE_INT;
+      }
+      break;
+  }
+  if(type != -2 && type != scan->type) {
+    scan->type = scan->type == -2 ? type : -1;
+  }
+  visitChildren(node, collectNameType, data);
+}
+
+static int nameType(char* name, int depth) {
+  Node func = c_context->node;
+  if(func == NULL || depth >= STATIC_TYPE_DEPTH) {
+    return -1;
+  }
+  Node body = func;
+  if(func->type == SC_FUNCDEF) {
+    for(ListEntry entry = func->child[1]->list->elements; entry; entry = entry->next) {
+      if(!strcmp(entry->node->name, name)) {
+        return -1;
+      }
+    }
+    body = func->child[2];
+  }
+  struct NameTypeScan scan = {name, depth + 1, -2};
+  collectNameType(body, &scan);
+  return scan.type < 0 ? -1 : scan.type;
+}
+
+static int staticType(Node node, int depth) {
+  int left, right;
+  switch(node->type) {
+    case SC_INT:
+      return TYPE_INT;
+    case SC_FLOAT:
+      return TYPE_FLOAT;
+    case SC_NAME:
+      return nameType(node->name, depth);
+    case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV:
+      left = staticType(node->child[0], depth);
+      right = staticType(node->child[1], depth);
+      return left == right ? left : -1;
+    case SC_PLUS: case SC_MINUS:
+      return staticType(node->child[0], depth);
+  }
+  return -1;
+}
+
+/* arithmetic and compares fail on operands of other types and int
+ * division on a zero divisor */
+static int canFault(Node node) {
+  int type;
+  switch(node->type) {
+    case SC_INT: case SC_FLOAT: case SC_BOOL: case SC_NAME:
+      return 0;
+    case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV:
+    case SC_LT: case SC_GT: case SC_LE: case SC_GE: case SC_EQ: case SC_NE:
+      type = staticType(node->child[0], 0);
+      if(type < 0 || type != staticType(node->child[1], 0)
+          || canFault(node->child[0]) || canFault(node->child[1])) {
+        return 1;
+      }
+      return node->type == SC_DIV && type == TYPE_INT
+        && (node->child[1]->type != SC_INT || node->child[1]->int_val == 0);
+    case SC_PLUS: case SC_MINUS:
+      return staticType(node->child[0], 0) < 0 || canFault(node->child[0]);
+  }
+  return 1;
+}
+
+struct InvariantScan {
+  struct NameSet* assigned;
+  struct LoopOpt* opt;
+  /* whether an expression that may fail must stay where it is */
+  int safe_only;
+};
+
+static void collectInvariants(Node node, void* data) {
+  struct InvariantScan* scan = (struct InvariantScan*)data;
+  switch(node->type) {
+    case SC_FUNCDEF:
+      return;
+    case SC_AND: case SC_OR:
+      /* the right operand may not run */
+      collectInvariants(node->child[0], data);
+      return;
+    case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV: case SC_MINUS:
+    case SC_LT: case SC_GT: case SC_LE: case SC_GE: case SC_EQ: case SC_NE:
+      if(isLoopInvariant(node, scan->assigned) && !(scan->safe_only && canFault(node))) {
+        if(scan->opt->hoist_size < LOOP_OPT_MAX) {
+          scan->opt->hoist[scan->opt->hoist_size++] = node;
+        }
+        return;
+      }
+      break;
+  }
+  visitChildren(node, collectInvariants, data);
+}
+
+/* only statements that run on every iteration are scanned, so hoisting
+ * never evaluates an expression that the loop would have skipped. the
+ * preheader runs them ahead of the statements before them, so they must
+ * not fail either: an error would come before the effects of those */
+static void collectBodyInvariants(Node block, struct InvariantScan* scan) {
+  Node stmts = block->child[0];
+  scan->safe_only = 1;
+  ListEntry entry = stmts->list->elements;
+  for(; entry; entry = entry->next) {
+    Node stmt = entry->node;
+    if(stmt == NULL) {
+      continue;
+    }
+    switch(stmt->type) {
+      case SC_IF: case SC_WHILE: case SC_FOR: case SC_BLOCK: case SC_SWITCH:
+      case SC_BREAK: case SC_CONTINUE: case SC_RETURN:
+        return;
+    }
+    collectInvariants(stmt, scan);
+  }
+}
+
+static int isInductionProduct(Node node, char* iv_name) {
+  if(node->type != SC_MUL) {
+    return 0;
+  }
+  Node left = node->child[0];
+  Node right = node->child[1];
+  if(left->type == SC_INT && right->type == SC_NAME) {
+    Node tmp = left;
+    left = right;
+    right = tmp;
+  }
+  return left->type == SC_NAME && right->type == SC_INT && !strcmp(left->name, iv_name);
+}
+
+static int64_t getInductionFactor(Node node) {
+  if(node->child[0]->type == SC_INT) {
+    return node->child[0]->int_val;
+  }
+  return node->child[1]->int_val;
+}
+
+static void collectInductionProducts(Node node, void* data) {
+  struct LoopOpt* opt = (struct LoopOpt*)data;
+  if(node->type == SC_FUNCDEF) {
+    return;
+  }
+  if(isInductionProduct(node, opt->iv_name)) {
+    int64_t factor = getInductionFactor(node);
+    int64_t delta = factor * opt->iv_step;
+    if(factor >= -INC_VAL_MAX && factor <= INC_VAL_MAX
+        && delta >= -INC_VAL_MAX && delta <= INC_VAL_MAX && opt->reduce_size < LOOP_OPT_MAX) {
+      opt->reduce[opt->reduce_size++] = node;
+    }
+    return;
+  }
+  visitChildren(node, collectInductionProducts, data);
+}
+
+/* for(i = <int>; ...; i++ / i-- / i += <int> / i -= <int>) */
+static int findInductionVariable(Node init, Node step, struct LoopOpt* opt) {
+  if(init == NULL || step == NULL || init->type != SC_ASSIGN) {
+    return 0;
+  }
+  if(init->child[0]->type != SC_NAME || init->child[1]->type != SC_INT) {
+    return 0;
+  }
+  if(step->child[0]->type != SC_NAME || strcmp(step->child[0]->name, init->child[0]->name)) {
+    return 0;
+  }
+  switch(step->type) {
+    case SC_INC:
+      opt->iv_step = 1;
+      break;
+    case SC_DEC:
+      opt->iv_step = -1;
+      break;
+    case SC_ASSIGNADD:
+    case SC_ASSIGNSUB:
+      if(step->child[1]->type != SC_INT
+          || step->child[1]->int_val < -INC_VAL_MAX || step->child[1]->int_val > INC_VAL_MAX) {
+        return 0;
+      }
+      opt->iv_step = step->type == SC_ASSIGNADD ? step->child[1]->int_val : -step->child[1]->int_val;
+      break;
+    default:
+      return 0;
+  }
+  opt->iv_name = init->child[0]->name;
+  return 1;
+}
+
+static int analyzeLoop(Node init, Node cond, Node step, Node block, struct LoopOpt* opt) {
+  struct NameSet assigned = {NULL, 0};
+  opt->hoist_size = 0;
+  opt->reduce_size = 0;
+  collectAssigned(cond, &assigned);
+  collectAssigned(block, &assigned);
+  if(step) {
+    collectAssigned(step, &assigned);
+  }
+  /* the test has run once before the preheader, so its invariants
+   * have already been evaluated without failing */
+  struct InvariantScan scan = {&assigned, opt, 0};
+  collectInvariants(cond, &scan);
+  collectBodyInvariants(block, &scan);
+  if(findInductionVariable(init, step, opt)) {
+    /* the induction variable must only be updated by the step expression */
+    struct NameSet inner = {NULL, 0};
+    collectAssigned(cond, &inner);
+    collectAssigned(block, &inner);
+    if(!containsName(&inner, opt->iv_name)) {
+      collectInductionProducts(cond, opt);
+      collectInductionProducts(block, opt);
+    }
+    free(inner.names);
+  }
+  free(assigned.names);
+  if(c_context->var_count + opt->hoist_size + opt->reduce_size >= VAR_MAX) {
+    return 0;
+  }
+  if(c_context->hoist_count + opt->hoist_size + opt->reduce_size > 256) {
+    return 0;
+  }
+  return opt->hoist_size + opt->reduce_size > 0;
+}
+
+int createTempVar() {
+  int id = c_context->var_count;
+  setVarEntry("%tmp");
+  return id;
+}
+
+static inline void pushHoist(Node node, int var_id) {
+  c_context->hoistNodes[c_context->hoist_count] = node;
+  c_context->hoistVars[c_context->hoist_count] = var_id;
+  c_context->hoist_count++;
+}
+
+static inline int getHoistedVar(Node node) {
+  for(int i = c_context->hoist_count - 1; i >= 0; i--) {
+    if(c_context->hoistNodes[i] == node) {
+      return c_context->hoistVars[i];
+    }
+  }
+  return -1;
+}
+
+static void convertOptimizedLoop(Node cond, Node step, Node block, struct LoopOpt* opt) {
+  int bodyLabel = createLabel();
+  int endLabel = createLabel();
+  int continueLabel = createLabel();
+  int hoist_base = c_context->hoist_count;
+  int reduceVars[LOOP_OPT_MAX];
+  convertBranch(cond, endLabel, 0);
+  ScriptCInstruction inst;
+  for(int i = 0; i < opt->hoist_size; i++) {
+    convert(opt->hoist[i]);
+    inst = createInstruction(Istorel);
+    inst->var_id = createTempVar();
+    c_context->list = createInstList(c_context->list, inst);
+    pushHoist(opt->hoist[i], inst->var_id);
+  }
+  for(int i = 0; i < opt->reduce_size; i++) {
+    Node node = opt->reduce[i];
+    int var_id = -1;
+    for(int j = 0; j < i; j++) {
+      if(getInductionFactor(opt->reduce[j]) == getInductionFactor(node)) {
+        var_id = reduceVars[j];
+        break;
+      }
+    }
+    if(var_id == -1) {
+      convert(node);
+      inst = createInstruction(Istorel);
+      inst->var_id = var_id = createTempVar();
+      c_context->list = createInstList(c_context->list, inst);
+    }
+    reduceVars[i] = var_id;
+    pushHoist(node, var_id);
+  }
+  push_break_continue(endLabel, continueLabel);
+  setLabel(bodyLabel);
+  convert(block);
+  setLabel(continueLabel);
+  if(step) {
+    convert(step);
+  }
+  for(int i = 0; i < opt->reduce_size; i++) {
+    int shared = 0;
+    for(int j = 0; j < i; j++) {
+      shared |= reduceVars[j] == reduceVars[i];
+    }
+    if(shared) {
+      continue;
+    }
+    inst = createInstruction(Iiinc);
+    inst->inc_var = reduceVars[i];
+    inst->inc_val = getInductionFactor(opt->reduce[i]) * opt->iv_step;
+    c_context->list = createInstList(c_context->list, inst);
+  }
+  convertBranch(cond, endLabel, 0);
+  inst = createInstruction(Ijump);
+  inst->label_id = bodyLabel;
+  c_context->list = createInstList(c_context->list, inst);
+  setLabel(endLabel);
+  pop_break_continue();
+  c_context->hoist_count = hoist_base;
+}
+
 void convertWHILE(Node node) {
+  struct LoopOpt opt;
+  if(sc_optimize && analyzeLoop(NULL, node->child[0], NULL, node->child[1], &opt)) {
+    convertOptimizedLoop(node->child[0], NULL, node->child[1], &opt);
+    return;
+  }
   int topLabel = createLabel();
   int endLabel = createLabel();
   push_break_continue(endLabel, topLabel);
   setLabel(topLabel);
-  convert(node->child[0]);
-  ScriptCInstruction inst = createInstruction(Iifcmp);
-  inst->label_id = endLabel;
-  c_context->list = createInstList(c_context->list, inst);
+  convertBranch(node->child[0], endLabel, 0);
   convert(node->child[1]);
-  inst = createInstruction(Ijump);
+  ScriptCInstruction inst = createInstruction(Ijump);
   inst->label_id = topLabel;
   c_context->list = createInstList(c_context->list, inst);
   setLabel(endLabel);
@@ -424,25 +1122,218 @@ void convertCONTINUE(Node node) {
 
 void convertFOR(Node node) {
   convert(node->child[0]);
+  struct LoopOpt opt;
+  if(sc_optimize && analyzeLoop(node->child[0], node->child[1], node->child[2], node->child[3], &opt)) {
+    convertOptimizedLoop(node->child[1], node->child[2], node->child[3], &opt);
+    return;
+  }
   int topLabel = createLabel();
   int endLabel = createLabel();
   int continueLabel = createLabel();
   push_break_continue(endLabel, continueLabel);
   setLabel(topLabel);
-  convert(node->child[1]);
-  ScriptCInstruction inst = createInstruction(Iifcmp);
-  inst->label_id = endLabel;
-  c_context->list = createInstList(c_context->list, inst);
+  convertBranch(node->child[1], endLabel, 0);
   convert(node->child[3]);
   setLabel(continueLabel);
   convert(node->child[2]);
-  inst = createInstruction(Ijump);
+  ScriptCInstruction inst = createInstruction(Ijump);
   inst->label_id = topLabel;
   c_context->list = createInstList(c_context->list, inst);
   setLabel(endLabel);
   pop_break_continue();
 }
 
+/* a switch compares its value with the cases in order and enters its
+ * body at the first one equal to it, or at default. when every case is
+ * an int literal of 32 bits the compares become a table, a tableswitch
+ * indexed by the value when the keys are dense and a lookupswitch that
+ * searches them otherwise, whichever costs less by the weights javac
+ * uses. when every case is a string literal they become a hashswitch
+ * whose targets compare the string. anything else is an if chain */
+
+struct SwitchCase {
+  Node label;
+  int64_t key;
+  int order;
+  int target;
+};
+
+static int compareCases(const void* a, const void* b) {
+  const struct SwitchCase* left = (const struct SwitchCase*)a;
+  const struct SwitchCase* right = (const struct SwitchCase*)b;
+  if(left->key != right->key) {
+    return left->key < right->key ? -1 : 1;
+  }
+  return left->order - right->order;
+}
+
+static int getIntCase(Node label, int64_t* key) {
+  int negate = label->type == SC_MINUS;
+  if(negate) {
+    label = label->child[0];
+  }
+  if(label->type != SC_INT || label->int_val < -INT32_MAX || label->int_val > INT32_MAX) {
+    return 0;
+  }
+  *key = negate ? -label->int_val : label->int_val;
+  return 1;
+}
+
+static void emitCase(int64_t key, int label) {
+  ScriptCInstruction inst = createInstruction(Icase);
+  inst->label_id = label;
+  inst->case_key = (int)key;
+  c_context->list = createInstList(c_context->list, inst);
+}
+
+static void emitLocal(int op, int var_id) {
+  ScriptCInstruction inst = createInstruction(op);
+  inst->var_id = var_id;
+  c_context->list = createInstList(c_context->list, inst);
+}
+
+/* cases are sorted by key and the first case of a key wins */
+static int uniqueCases(struct SwitchCase* cases, int size) {
+  qsort(cases, size, sizeof(struct SwitchCase), compareCases);
+  int unique = 0;
+  for(int i = 0; i < size; i++) {
+    if(unique == 0 || cases[i].key != cases[unique-1].key) {
+      cases[unique++] = cases[i];
+    }
+  }
+  return unique;
+}
+
+static void convertCaseTable(struct SwitchCase* cases, int size, int defaultLabel) {
+  size = uniqueCases(cases, size);
+  int64_t low = cases[0].key;
+  int64_t high = cases[size-1].key;
+  /* the cost rule of javac: space plus three times the time */
+  if(4 + (high - low + 1) + 3 * 3 <= 3 + 2 * size + 3 * size) {
+    int i = 0;
+    emitOp(Itableswitch);
+    for(int64_t key = low; key <= high; key++) {
+      emitCase(key, key == cases[i].key ? cases[i++].target : defaultLabel);
+    }
+  } else {
+    emitOp(Ilookupswitch);
+    for(int i = 0; i < size; i++) {
+      emitCase(cases[i].key, cases[i].target);
+    }
+  }
+  emitBranch(Ijump, defaultLabel);
+}
+
+/* strings of the same hash share an entry, which tries them in order */
+static void convertHashSwitch(struct SwitchCase* cases, int size, int defaultLabel) {
+  int var_id = createTempVar();
+  emitLocal(Istorel, var_id);
+  emitLocal(Iloadl, var_id);
+  qsort(cases, size, sizeof(struct SwitchCase), compareCases);
+  int* entries = (int*)malloc(sizeof(int)*size);
+  emitOp(Ihashswitch);
+  for(int i = 0; i < size; i++) {
+    if(i == 0 || cases[i].key != cases[i-1].key) {
+      entries[i] = createLabel();
+      emitCase(cases[i].key, entries[i]);
+    }
+  }
+  emitBranch(Ijump, defaultLabel);
+  for(int i = 0; i < size; i++) {
+    if(i == 0 || cases[i].key != cases[i-1].key) {
+      setLabel(entries[i]);
+    }
+    emitLocal(Iloadl, var_id);
+    convert(cases[i].label);
+    emitOp(Ine);
+    emitBranch(Iifcmp, cases[i].target);
+    if(i + 1 == size || cases[i].key != cases[i+1].key) {
+      emitBranch(Ijump, defaultLabel);
+    }
+  }
+  free(entries);
+}
+
+static void convertCaseChain(struct SwitchCase* cases, int size, int defaultLabel) {
+  int var_id = createTempVar();
+  emitLocal(Istorel, var_id);
+  for(int i = 0; i < size; i++) {
+    emitLocal(Iloadl, var_id);
+    convert(cases[i].label);
+    emitOp(Ine);
+    emitBranch(Iifcmp, cases[i].target);
+  }
+  emitBranch(Ijump, defaultLabel);
+}
+
+void convertSWITCH(Node node) {
+  ListEntry entry = node->child[1]->list->elements;
+  int entry_size = 0;
+  for(; entry; entry = entry->next) {
+    entry_size += entry->node && entry->node->type == SC_CASE;
+  }
+  struct SwitchCase* cases = (struct SwitchCase*)malloc(sizeof(struct SwitchCase)*(entry_size+1));
+  int* targets = (int*)malloc(sizeof(int)*(entry_size+1));
+  int endLabel = createLabel();
+  int defaultLabel = endLabel;
+  int size = 0;
+  int ints = 0;
+  int strings = 0;
+  int index = 0;
+  for(entry = node->child[1]->list->elements; entry; entry = entry->next) {
+    if(entry->node == NULL || entry->node->type != SC_CASE) {
+      continue;
+    }
+    Node label = entry->node->child[0];
+    int target = targets[index++] = createLabel();
+    if(label == NULL) {
+      if(defaultLabel != endLabel) {
+        fprintf(stderr, "Error: switch has more than one default\n");
+        exit(1);
+      }
+      defaultLabel = target;
+      continue;
+    }
+    struct SwitchCase* c = &cases[size];
+    c->label = label;
+    c->key = 0;
+    c->order = size++;
+    c->target = target;
+    if(getIntCase(label, &c->key)) {
+      ints++;
+    } else if(label->type == SC_STRING) {
+      c->key = caseHash(label->string);
+      strings++;
+    }
+  }
+  convert(node->child[0]);
+  if(size > 0 && ints == size) {
+    convertCaseTable(cases, size, defaultLabel);
+  } else if(size > 0 && strings == size) {
+    convertHashSwitch(cases, size, defaultLabel);
+  } else {
+    convertCaseChain(cases, size, defaultLabel);
+  }
+  int bc_id = c_context->bc_id;
+  push_break_continue(endLabel, bc_id >= 0 ? c_context->continueLabels[bc_id] : -1);
+  index = 0;
+  for(entry = node->child[1]->list->elements; entry; entry = entry->next) {
+    if(entry->node && entry->node->type == SC_CASE) {
+      setLabel(targets[index++]);
+    } else if(entry->node) {
+      convert(entry->node);
+    }
+  }
+  setLabel(endLabel);
+  pop_break_continue();
+  free(cases);
+  free(targets);
+}
+
+/* the entries of a switch, placed by convertSWITCH */
+void convertCASE(Node node) {
+}
+
 void convertLT(Node node) {
   convert(node->child[0]);
   convert(node->child[1]);
@@ -485,11 +1376,29 @@ void convertNE(Node node) {
   c_context->list = createInstList(c_context->list, inst);
 }
 
+/* v++, v--, v += k and v -= k with a small literal k update the local
+ * in place with iinc: one dispatch, and the value makes one trip
+ * through memory instead of three */
+static int convertIncrement(Node name, int64_t step) {
+  VarEntry var = getVarEntry(name->name);
+  if(var == NULL || var->id > INC_VAR_MAX || step < -INC_VAL_MAX || step > INC_VAL_MAX) {
+    return 0;
+  }
+  ScriptCInstruction inst = createInstruction(Iiinc);
+  inst->inc_var = var->id;
+  inst->inc_val = (int)step;
+  c_context->list = createInstList(c_context->list, inst);
+  return 1;
+}
+
 void convertASSIGNADD(Node node) {
   if(node->child[0]->type != SC_NAME) {
     fprintf(stderr, "Error: first argument of assign expression is expected name node\n");
     exit(1);
   }
+  if(node->child[1]->type == SC_INT && convertIncrement(node->child[0], node->child[1]->int_val)) {
+    return;
+  }
   convert(node->child[0]);
   convert(node->child[1]);
   ScriptCInstruction inst = createInstruction(Iadd);
@@ -510,6 +1419,9 @@ void convertASSIGNSUB(Node node) {
     fprintf(stderr, "Error: first argument of assign expression is expected name node\n");
     exit(1);
   }
+  if(node->child[1]->type == SC_INT && convertIncrement(node->child[0], -node->child[1]->int_val)) {
+    return;
+  }
   convert(node->child[0]);
   convert(node->child[1]);
   ScriptCInstruction inst = createInstruction(Isub);
@@ -570,6 +1482,9 @@ void convertINC(Node node) {
     fprintf(stderr, "Error: first argument of inc expression is expected name node\n");
     exit(1);
   }
+  if(convertIncrement(node->child[0], 1)) {
+    return;
+  }
   convert(node->child[0]);
   ScriptCInstruction inst = createInstruction(Iiconst);
   inst->int_val = 1;
@@ -592,6 +1507,9 @@ void convertDEC(Node node) {
     fprintf(stderr, "Error: first argument of dec expression is expected name node\n");
     exit(1);
   }
+  if(convertIncrement(node->child[0], -1)) {
+    return;
+  }
   convert(node->child[0]);
   ScriptCInstruction inst = createInstruction(Iiconst);
   inst->int_val = 1;
@@ -609,12 +1527,151 @@ void convertDEC(Node node) {
   c_context->list = createInstList(c_context->list, inst);
 }
 
+void convertINDEX(Node node) {
+  convert(node->child[0]);
+  convert(node->child[1]);
+  ScriptCInstruction inst = createInstruction(Iaload);
+  c_context->list = createInstList(c_context->list, inst);
+}
+
+/* evaluateConstants has put the value into every use already */
+void convertCONST(Node node) {
+}
+
+/* the exported functions were registered by importObject and come into
+ * scope here */
+void convertIMPORT(Node node) {
+  c_context->func_visible += getImport(node)->export_size;
+}
+
+/* doubles, strings and ints too wide for the 32 bit immediate (which
+ * become lconst) are moved to a deduplicated per-module pool and the
+ * instructions keep the pool index. the hash indexes of the sections
+ * are kept, so functions linked later share the entries of earlier ones */
+
+static unsigned hashConst(const void* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  unsigned hash = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static struct ConstIndex {
+  int* longs;
+  int* doubles;
+  int* strings;
+  int capacity;
+} const_index;
+
+static int* rehashConstIndex(int* index, int size, const void* values, size_t width, int string) {
+  int mask = const_index.capacity - 1;
+  index = (int*)realloc(index, sizeof(int)*const_index.capacity);
+  memset(index, -1, sizeof(int)*const_index.capacity);
+  for(int i = 0; i < size; i++) {
+    const void* val = string ? ((char* const*)values)[i] : (const char*)values + i*width;
+    unsigned slot = hashConst(val, string ? strlen((const char*)val) : width) & mask;
+    while(index[slot] != -1) {
+      slot = (slot+1) & mask;
+    }
+    index[slot] = i;
+  }
+  return index;
+}
+
+/* makes room for size more entries in every section */
+static void growConstPool(ConstPool pool, long size) {
+  long need = pool->long_size;
+  if(pool->double_size > need) {
+    need = pool->double_size;
+  }
+  if(pool->string_size > need) {
+    need = pool->string_size;
+  }
+  need += size;
+  if(need <= pool->capacity) {
+    return;
+  }
+  while(pool->capacity < need) {
+    pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+  }
+  pool->longs = (int64_t*)realloc(pool->longs, sizeof(int64_t)*pool->capacity);
+  pool->doubles = (double*)realloc(pool->doubles, sizeof(double)*pool->capacity);
+  pool->strings = (char**)realloc(pool->strings, sizeof(char*)*pool->capacity);
+  const_index.capacity = pool->capacity * 2;
+  const_index.longs = rehashConstIndex(const_index.longs, pool->long_size, pool->longs, sizeof(int64_t), 0);
+  const_index.doubles = rehashConstIndex(const_index.doubles, pool->double_size, pool->doubles, sizeof(double), 0);
+  const_index.strings = rehashConstIndex(const_index.strings, pool->string_size, pool->strings, 0, 1);
+}
+
+static void createConstPool(ScriptCInstruction insts, long size) {
+  ConstPool pool = module->pool;
+  growConstPool(pool, size);
+  int capacity = const_index.capacity;
+  int* longIndex = const_index.longs;
+  int* doubleIndex = const_index.doubles;
+  int* stringIndex = const_index.strings;
+  for(long i = 0; i < size; i++) {
+    if(insts[i].op == Iiconst && (insts[i].int_val < INT32_MIN || insts[i].int_val > INT32_MAX)) {
+      int64_t val = insts[i].int_val;
+      unsigned slot = hashConst(&val, sizeof(int64_t)) & (capacity-1);
+      while(longIndex[slot] != -1 && pool->longs[longIndex[slot]] != val) {
+        slot = (slot+1) & (capacity-1);
+      }
+      if(longIndex[slot] == -1) {
+        longIndex[slot] = pool->long_size;
+        pool->longs[pool->long_size++] = val;
+      }
+      insts[i].op = Ilconst;
+      insts[i].const_id = longIndex[slot];
+    } else if(insts[i].op == Idconst) {
+      double val = insts[i].double_val;
+      unsigned slot = hashConst(&val, sizeof(double)) & (capacity-1);
+      while(doubleIndex[slot] != -1 && memcmp(&pool->doubles[doubleIndex[slot]], &val, sizeof(double))) {
+        slot = (slot+1) & (capacity-1);
+      }
+      if(doubleIndex[slot] == -1) {
+        doubleIndex[slot] = pool->double_size;
+        pool->doubles[pool->double_size++] = val;
+      }
+      insts[i].const_id = doubleIndex[slot];
+    } else if(insts[i].op == Isconst) {
+      char* str = insts[i].string;
+      unsigned slot = hashConst(str, strlen(str)) & (capacity-1);
+      while(stringIndex[slot] != -1 && strcmp(pool->strings[stringIndex[slot]], str)) {
+        slot = (slot+1) & (capacity-1);
+      }
+      if(stringIndex[slot] == -1) {
+        stringIndex[slot] = pool->string_size;
+        pool->strings[pool->string_size++] = str;
+      }
+      insts[i].const_id = stringIndex[slot];
+    } else if(insts[i].op == Itableswitch || insts[i].op == Ilookupswitch || insts[i].op == Ihashswitch) {
+      /* the keys of a switch are a run of their own */
+      long size = 0;
+      while(insts[i+1+size].op == Icase) {
+        size++;
+      }
+      long keys = insts[i].op == Itableswitch ? 1 : size;
+      insts[i].const_id = pool->long_size;
+      pool->longs[pool->long_size++] = size;
+      for(long j = 0; j < keys; j++) {
+        pool->longs[pool->long_size++] = insts[i+1+j].case_key;
+      }
+    }
+  }
+}
+
 ScriptCInstruction createISeq(InstList list) {
+  if(sc_optimize) {
+    layoutModule(module);
+  }
   int size = 0;
   for(int i = 0; i < module->size; i++) {
     size += module->ctxList[i]->id;
   }
-  c_context->code_length = size;
+  module->code_length = size;
   ScriptCInstruction insts = (ScriptCInstruction)malloc(sizeof(struct ScriptCInstruction)*size);
   ScriptCInstruction root = insts;
   long index = 0;
@@ -626,11 +1683,17 @@ ScriptCInstruction createISeq(InstList list) {
       insts[index] = *list->inst;
       if(insts[index].op == Ijump || insts[index].op == Iifcmp) {
         insts[index].jump = module->codePoints[i] + c_ctx->label_list[insts[index].label_id];
+      } else if(insts[index].op == Icase) {
+        insts[index].case_jump = module->codePoints[i] + c_ctx->label_list[insts[index].label_id];
       }
       index++;
     }
     disposeInstList(c_ctx->root);
+    free(c_ctx->label_list);
+    disposeCompilerContext(c_ctx);
+    free(c_ctx);
   }
+  c_context = NULL;
   if(sc_debug) {
     fprintf(stderr, "@@@@ Dump ByteCode @@@@\n");
   }
@@ -645,6 +1708,7 @@ ScriptCInstruction createISeq(InstList list) {
   if(sc_debug) {
     fprintf(stderr, "\n");
   }
+  createConstPool(insts, size);
   return root;
 }
 
@@ -655,6 +1719,15 @@ static convert_to_lir_func_t f_convert[] = {
 };
 
 static inline void convert(Node node) {
+  if(c_context->hoist_count > 0) {
+    int var_id = getHoistedVar(node);
+    if(var_id != -1) {
+      ScriptCInstruction inst = createInstruction(Iloadl);
+      inst->var_id = var_id;
+      c_context->list = createInstList(c_context->list, inst);
+      return;
+    }
+  }
   f_convert[node->type](node);
 }
 
@@ -662,17 +1735,29 @@ void setCCToModule(CompilerContext cctx);
 
 CompilerContext createCompilerContext(CompilerContext prev) {
   c_context = (CompilerContext)malloc(sizeof(struct CompilerContext));
-  c_context->vars = (VarEntry*)malloc(sizeof(VarEntry)*VAR_MAX);
+  c_context->vars = NULL;
   c_context->funcs = (FuncEntry*)malloc(sizeof(FuncEntry)*FUNC_MAX);
-  c_context->label_list = (int*)malloc(sizeof(int)*256);
-  c_context->breakLabels = (int*)malloc(sizeof(int)*256);
-  c_context->continueLabels = (int*)malloc(sizeof(int)*256);
+  c_context->label_list = NULL;
+  c_context->breakLabels = NULL;
+  c_context->continueLabels = NULL;
+  c_context->hoistNodes = NULL;
+  c_context->hoistVars = NULL;
+  c_context->hoist_count = 0;
+  c_context->id = 0;
+  c_context->root = NULL;
+  c_context->list = NULL;
   c_context->var_count = 0;
   c_context->func_count = 0;
   c_context->prev = prev;
   c_context->ret = 0;
   c_context->label_count = 0;
   c_context->bc_id = -1;
+  c_context->node = NULL;
+  c_context->def_index = prev ? prev->func_count-1 : 0;
+  c_context->func_visible = 0;
+  c_context->func_table_size = 2*FUNC_MAX;
+  c_context->func_table = (int*)malloc(sizeof(int)*c_context->func_table_size);
+  memset(c_context->func_table, -1, sizeof(int)*c_context->func_table_size);
   setCCToModule(c_context);
   return c_context;
 }
@@ -686,37 +1771,326 @@ CompilerContext disposeCompilerContext(CompilerContext ctx) {
     free(ctx->funcs[i]);
   }
   free(ctx->funcs);
-  free(ctx->label_list);
+  free(ctx->func_table);
   free(ctx->breakLabels);
   free(ctx->continueLabels);
-  CompilerContext prev = ctx->prev;
-  free(ctx);
-  return prev;
+  free(ctx->hoistNodes);
+  free(ctx->hoistVars);
+  return ctx->prev;
 }
 
-void createModule() {
+Module createModule() {
+  /* the constant index belongs to the pool of the previous module */
+  free(const_index.longs);
+  free(const_index.doubles);
+  free(const_index.strings);
+  memset(&const_index, 0, sizeof(const_index));
   module = (Module)malloc(sizeof(struct Module));
   module->ctxList = (CompilerContext*)malloc(sizeof(CompilerContext)*CC_MAX);
   module->codePoints = (long*)malloc(sizeof(long)*CC_MAX);
   module->size = 0;
+  module->pool = (ConstPool)calloc(1, sizeof(struct ConstPool));
+  module->returns = (int*)malloc(sizeof(int)*CC_MAX);
+  module->names = (char**)malloc(sizeof(char*)*CC_MAX);
+  module->code_length = 0;
+  return module;
 }
 
 void setCCToModule(CompilerContext cctx) {
+  module->returns[module->size] = 0;
+  module->names[module->size] = NULL;
   module->ctxList[module->size++] = cctx;
   if(module->size % CC_MAX == 0) {
-    module->ctxList = (CompilerContext*)realloc(module->ctxList, sizeof(module->ctxList)*2);
-    module->codePoints = (long*)realloc(module->codePoints, sizeof(module->codePoints)*2);
+    module->ctxList = (CompilerContext*)realloc(module->ctxList, sizeof(CompilerContext)*(module->size+CC_MAX));
+    module->codePoints = (long*)realloc(module->codePoints, sizeof(long)*(module->size+CC_MAX));
+    module->returns = (int*)realloc(module->returns, sizeof(int)*(module->size+CC_MAX));
+    module->names = (char**)realloc(module->names, sizeof(char*)*(module->size+CC_MAX));
+  }
+}
+
+/* a body ends in ret_void unless it has a return statement of its own */
+static void findReturn(Node node, void* data) {
+  if(node->type == SC_RETURN) {
+    *(int*)data = 1;
+  } else if(node->type != SC_FUNCDEF) {
+    visitChildren(node, findReturn, data);
+  }
+}
+
+/* an object is linked into the module once, after its imports. its
+ * functions get contexts whose code is already lowered, with the jumps
+ * turned back into labels and the symbols resolved */
+static void linkObject(Object obj) {
+  if(obj->linked_module == module) {
+    return;
+  }
+  for(int i = 0; i < obj->import_size; i++) {
+    linkObject(obj->imports[i]);
+  }
+  obj->linked_module = module;
+  obj->link_base = module->size;
+  CompilerContext parent = c_context;
+  for(int i = 0; i < obj->func_size; i++) {
+    struct ObjectFunction* func = &obj->funcs[i];
+    createCompilerContext(parent);
+    module->names[module->size-1] = func->name;
+    module->returns[module->size-1] = func->returns;
+    c_context->label_list = (int*)malloc(sizeof(int)*(func->size+1));
+    for(int j = 0; j < func->size; j++) {
+      ScriptCInstruction inst = createInstruction(func->code[j].op);
+      *inst = func->code[j];
+      if(inst->op == Ijump || inst->op == Iifcmp) {
+        c_context->label_list[c_context->label_count] = (int)func->code[j].jump;
+        inst->label_id = c_context->label_count++;
+      } else if(inst->op == Icase) {
+        c_context->label_list[c_context->label_count] = func->code[j].case_jump;
+        inst->label_id = c_context->label_count++;
+      } else if(inst->op == Icall) {
+        inst->func_id = inst->func_id >= 0 ? obj->link_base + inst->func_id
+          : findImportSymbol(obj, obj->symbols[-1-inst->func_id]);
+      } else if(inst->op == Incall) {
+        inst->func_id = getNative(obj->symbols[inst->func_id]);
+        if(inst->func_id == -1) {
+          fprintf(stderr, "Error: native %s used by %s is not registered\n", obj->symbols[func->code[j].func_id], obj->path);
+          exit(1);
+        }
+      }
+      c_context->list = createInstList(c_context->list, inst);
+      if(c_context->root == NULL) {
+        c_context->root = c_context->list;
+      }
+    }
   }
+  c_context = parent;
+}
+
+static void importObject(Node node) {
+  Object obj = getImport(node);
+  if(c_context->prev || obj == NULL) {
+    fprintf(stderr, "Error: import must be at the top level\n");
+    exit(1);
+  }
+  linkObject(obj);
+  for(int i = 0; i < obj->func_size; i++) {
+    if(!obj->funcs[i].exported) {
+      continue;
+    }
+    if(containsFunc(obj->funcs[i].name)) {
+      fprintf(stderr, "function '%s' is re-defined\n", obj->funcs[i].name);
+      exit(1);
+    }
+    setFuncEntry(obj->funcs[i].name, obj->funcs[i].arg_size);
+    c_context->funcs[c_context->func_count-1]->id = obj->link_base + i;
+  }
+}
+
+/* first phase: every function definition, nested ones included, gets
+ * its context and module index in source order, and its signature is
+ * registered in the enclosing context */
+static void registerFunction(Node node, void* data) {
+  if(node->type == SC_IMPORT) {
+    importObject(node);
+    return;
+  }
+  if(node->type != SC_FUNCDEF) {
+    visitChildren(node, registerFunction, data);
+    return;
+  }
+  if(node->child[0]->type != SC_NAME) {
+    fprintf(stderr, "Error: first argument of assign expression is expected name node\n");
+    exit(1);
+  }
+  if(containsFunc(node->child[0]->name)) {
+    fprintf(stderr, "function '%s' is re-defined\n", node->child[0]->name);
+    exit(1);
+  }
+  CompilerContext parent = c_context;
+  setFuncEntry(node->child[0]->name, countListSize(node->child[1]->list));
+  createCompilerContext(parent);
+  c_context->node = node;
+  module->names[module->size-1] = node->child[0]->name;
+  if(node->child[2]) {
+    findReturn(node->child[2], &module->returns[module->size-1]);
+    registerFunction(node->child[2], data);
+  }
+  c_context = parent;
+}
+
+/* the tables used while lowering a body are only allocated once it is
+ * lowered, which for a lazily linked function may be never */
+static void openBody(CompilerContext ctx) {
+  ctx->vars = (VarEntry*)malloc(sizeof(VarEntry)*VAR_MAX);
+  ctx->label_list = (int*)malloc(sizeof(int)*256);
+  ctx->breakLabels = (int*)malloc(sizeof(int)*256);
+  ctx->continueLabels = (int*)malloc(sizeof(int)*256);
+  ctx->hoistNodes = (Node*)malloc(sizeof(Node)*256);
+  ctx->hoistVars = (int*)malloc(sizeof(int)*256);
+}
+
+static void lowerBody(CompilerContext ctx) {
+  c_context = ctx;
+  openBody(ctx);
+  if(ctx->node->type == SC_FUNCDEF) {
+    compileFunction(ctx->node);
+  } else {
+    c_context->list = createInstList(NULL, createInstruction(Iexit));
+    c_context->root = c_context->list;
+    f_convert[ctx->node->type](ctx->node);
+    c_context->list = createInstList(c_context->list, createInstruction(Iret_void));
+  }
+}
+
+static void compileContext(CompilerContext ctx) {
+  /* the code of an imported function is linked in lowered */
+  if(ctx->node == NULL) {
+    return;
+  }
+  lowerBody(ctx);
+  if(sc_optimize) {
+    optimizeContext(c_context);
+  }
+}
+
+/* second phase: the contexts only read their enclosing contexts' function
+ * tables, so the bodies are lowered in parallel. the threads take the
+ * next context from a shared counter; the instruction lists stay per
+ * context and createISeq links them in module order, so the bytecode
+ * does not depend on the schedule */
+static int next_context;
+
+static void* compileWorker(void* data) {
+  for(;;) {
+    int i = __atomic_fetch_add(&next_context, 1, __ATOMIC_RELAXED);
+    if(i >= module->size) {
+      return NULL;
+    }
+    compileContext(module->ctxList[i]);
+  }
+}
+
+static int getCompileThreads() {
+  int threads = sc_threads;
+  if(threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  /* the -g dumps of the passes are printed in module order */
+  if(sc_debug || threads < 1) {
+    threads = 1;
+  }
+  return threads < module->size ? threads : module->size;
+}
+
+/* lowers every function of the source into its context; compile links
+ * them, an import writes them to its object */
+void lowerModule(Node node) {
+  evaluateConstants(node);
+  c_context->node = node;
+  registerFunction(node, NULL);
+  int threads = getCompileThreads();
+  pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t)*threads);
+  next_context = 0;
+  for(int i = 1; i < threads; i++) {
+    if(pthread_create(&workers[i], NULL, compileWorker, NULL)) {
+      threads = i;
+      break;
+    }
+  }
+  compileWorker(NULL);
+  for(int i = 1; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  c_context = module->ctxList[0];
 }
 
 ScriptCInstruction compile(Node node) {
-  c_context->list = createInstList(NULL, createInstruction(Iexit));
-  c_context->root = c_context->list;
-  f_convert[node->type](node);
-  c_context->list = createInstList(c_context->list, createInstruction(Iret_void));
+  lowerModule(node);
   return createISeq(c_context->root);
 }
 
+/* frees what lowering left in a context, so that its body can be
+ * lowered again. functions nested in it look names up in its function
+ * table when they are linked, so the table stays */
+static void closeBody(CompilerContext ctx) {
+  disposeInstList(ctx->root);
+  free(ctx->label_list);
+  for(int i = 0; i < ctx->var_count; i++) {
+    free(ctx->vars[i]);
+  }
+  free(ctx->vars);
+  free(ctx->breakLabels);
+  free(ctx->continueLabels);
+  free(ctx->hoistNodes);
+  free(ctx->hoistVars);
+  ctx->vars = NULL;
+  ctx->label_list = NULL;
+  ctx->breakLabels = NULL;
+  ctx->continueLabels = NULL;
+  ctx->hoistNodes = NULL;
+  ctx->hoistVars = NULL;
+  ctx->root = NULL;
+  ctx->list = NULL;
+  ctx->var_count = 0;
+  ctx->label_count = 0;
+  ctx->id = 0;
+  ctx->bc_id = -1;
+  ctx->hoist_count = 0;
+  ctx->ret = 0;
+  ctx->func_visible = 0;
+}
+
+/* lazy linking: compileLazy registers the functions and linkFunction
+ * lowers one of them when it is first called. its code has jumps
+ * relative to its first instruction and every script call as lcall of
+ * the callee index, so it can be appended anywhere. every body is
+ * lowered once up front and the code thrown away, so that a body fails
+ * the same way as with -e whether or not it is ever called */
+void compileLazy(Node node) {
+  evaluateConstants(node);
+  c_context->node = node;
+  registerFunction(node, NULL);
+  for(int i = 0; i < module->size; i++) {
+    CompilerContext ctx = module->ctxList[i];
+    if(ctx->node) {
+      lowerBody(ctx);
+      closeBody(ctx);
+    }
+  }
+  c_context = NULL;
+}
+
+ScriptCInstruction linkFunction(int id, long* length) {
+  CompilerContext ctx = module->ctxList[id];
+  compileContext(ctx);
+  ScriptCInstruction insts = (ScriptCInstruction)malloc(sizeof(struct ScriptCInstruction)*ctx->id);
+  long size = 0;
+  for(InstList list = ctx->root; list; list = list->next) {
+    insts[size] = *list->inst;
+    if(insts[size].op == Ijump || insts[size].op == Iifcmp) {
+      insts[size].jump = ctx->label_list[insts[size].label_id];
+    } else if(insts[size].op == Icase) {
+      insts[size].case_jump = ctx->label_list[insts[size].label_id];
+    } else if(insts[size].op == Icall) {
+      insts[size].op = Ilcall;
+    }
+    size++;
+  }
+  module->codePoints[id] = module->code_length;
+  module->code_length += size;
+  if(sc_debug) {
+    fprintf(stderr, "@@@@ Link function %d at %ld @@@@\n", id, module->codePoints[id]);
+    for(long i = 0; i < size; i++) {
+      dumpInstruction(&insts[i], i);
+    }
+    fprintf(stderr, "\n");
+  }
+  createConstPool(insts, size);
+  closeBody(ctx);
+  c_context = NULL;
+  *length = size;
+  return insts;
+}
+
 void disposeInstruction(ScriptCInstruction inst) {
   free(inst);
 }
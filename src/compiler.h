@@ -1,8 +1,11 @@
 #ifndef __COMPILER__
 #define __COMPILER__
 
+#include <stdint.h>
 #include "ast.h"
 
+extern int sc_threads;
+
 struct VarEntry {
   int id;
   char* name;
@@ -20,17 +23,29 @@ typedef struct FuncEntry* FuncEntry;
 
 struct ScriptCInstruction {
   int op;
-  const void* addr;
   union {
-    int int_val;
+    int64_t int_val;
     double double_val;
     char* string;
     int bool_val;
     int var_id;
-    int func_id;
+    struct {
+      int func_id;
+      int arg_size;
+    };
     long call_point;
     int label_id;
+    int const_id;
     long jump;
+    /* a switch table entry: the label, then the code index, and its key */
+    struct {
+      int case_jump;
+      int case_key;
+    };
+    struct {
+      int inc_var;
+      int inc_val;
+    };
   };
 };
 
@@ -42,6 +57,8 @@ struct InstList {
 };
 
 #define VAR_MAX 128
+#define INC_VAL_MAX ((1 << 23) - 1)
+#define INC_VAR_MAX 0xff
 #define FUNC_MAX 128
 struct CompilerContext {
   int ret;
@@ -49,7 +66,6 @@ struct CompilerContext {
   struct FuncEntry** funcs;
   int var_count;
   int func_count;
-  long code_length;
   struct CompilerContext* prev;
   struct InstList* root;
   struct InstList* list;
@@ -59,6 +75,27 @@ struct CompilerContext {
   int* breakLabels;
   int* continueLabels;
   int bc_id;
+  Node* hoistNodes;
+  int* hoistVars;
+  int hoist_count;
+  /* the function definition lowered into this context (the source for
+   * main) and its position in prev->funcs */
+  Node node;
+  int def_index;
+  /* funcs[0..func_visible) are in scope at the current point of the body */
+  int func_visible;
+  int* func_table;
+  int func_table_size;
+};
+
+struct ConstPool {
+  int64_t* longs;
+  int long_size;
+  double* doubles;
+  int double_size;
+  char** strings;
+  int string_size;
+  int capacity;
 };
 
 #define CC_MAX 128
@@ -66,17 +103,29 @@ struct Module {
   int size;
   struct CompilerContext** ctxList;
   long* codePoints;
+  long code_length;
+  struct ConstPool* pool;
+  /* whether each function returns a value, known before it is lowered */
+  int* returns;
+  /* function names for profilers, NULL for the top level code */
+  char** names;
 };
 
 typedef struct CompilerContext* CompilerContext;
 typedef struct ScriptCInstruction* ScriptCInstruction;
 typedef struct InstList* InstList;
 typedef struct Module* Module;
+typedef struct ConstPool* ConstPool;
 
-void createModule();
+Module createModule();
 CompilerContext createCompilerContext(CompilerContext prev);
 CompilerContext disposeCompilerContext(CompilerContext ctx);
+void lowerModule(Node node);
 ScriptCInstruction compile(Node node);
+void compileLazy(Node node);
+ScriptCInstruction linkFunction(int id, long* length);
 void disposeInstruction(ScriptCInstruction inst);
+void disposeInstList(InstList list);
+int createTempVar();
 
 #endif
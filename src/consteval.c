@@ -0,0 +1,694 @@
+#include "ast.h"
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "consteval.h"
+#include "import.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* evaluations of one compile share this budget, so scripts full of
+ * calls that do not fold compile in bounded time */
+#define CONST_EVAL_TOTAL (16 * (long)CONST_EVAL_STEPS)
+#define CONST_EVAL_DEPTH 256
+#define CONST_EVAL_VARS 64
+
+/* how a statement ends */
+#define FLOW_NEXT 0
+#define FLOW_BREAK 1
+#define FLOW_CONTINUE 2
+#define FLOW_RETURN 3
+#define FLOW_FAIL 4
+
+struct EvalFrame {
+  const char* names[CONST_EVAL_VARS];
+  struct Type values[CONST_EVAL_VARS];
+  int size;
+  /* the top level functions the code can call */
+  int visible;
+  struct Type ret;
+};
+
+typedef struct EvalFrame* EvalFrame;
+
+/* natives without effects, called only with the tags they accept */
+static const char* pure_natives[] = {"sqrt", "abs", "float", "floor", "len", NULL};
+
+static Node top_source;
+static Node* top_funcs;
+static int top_size;
+static const char** func_names;
+static int* func_counts;
+static int func_name_size;
+static const char** const_names;
+static struct Type* const_values;
+static int const_size;
+static long steps;
+static long total_steps;
+static int depth;
+
+static int isLeaf(int type) {
+  return type == SC_NONE || type == SC_INT || type == SC_FLOAT || type == SC_STRING || type == SC_BOOL
+    || type == SC_NAME || type == SC_BREAK || type == SC_CONTINUE;
+}
+
+static int isList(int type) {
+  return type == SC_SOURCE || type == SC_ARGS || type == SC_STATEMENTLIST;
+}
+
+/* imported functions have no AST here, so calls of them stay */
+static int isImported(const char* name) {
+  for(ListEntry entry = top_source->list->elements; entry; entry = entry->next) {
+    Object obj = entry->node && entry->node->type == SC_IMPORT ? getImport(entry->node) : NULL;
+    for(int i = 0; obj && i < obj->func_size; i++) {
+      if(obj->funcs[i].exported && !strcmp(obj->funcs[i].name, name)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void countFunctions(Node node) {
+  if(node == NULL || isLeaf(node->type)) {
+    return;
+  }
+  if(isList(node->type)) {
+    for(ListEntry entry = node->list->elements; entry; entry = entry->next) {
+      countFunctions(entry->node);
+    }
+    return;
+  }
+  if(node->type == SC_FUNCDEF) {
+    const char* name = node->child[0]->name;
+    int i = 0;
+    while(i < func_name_size && strcmp(func_names[i], name)) {
+      i++;
+    }
+    if(i == func_name_size) {
+      func_names = (const char**)realloc(func_names, sizeof(const char*)*(func_name_size+1));
+      func_counts = (int*)realloc(func_counts, sizeof(int)*(func_name_size+1));
+      func_names[i] = name;
+      func_counts[i] = 0;
+      func_name_size++;
+    }
+    func_counts[i]++;
+  }
+  for(int i = 0; i < node->child_size; i++) {
+    countFunctions(node->child[i]);
+  }
+}
+
+/* -1 for no script function of that name, 0 for one that cannot be
+ * resolved here, 1 with the top level definition */
+static int findFunction(const char* name, int visible, Node* def) {
+  int i = 0;
+  while(i < func_name_size && strcmp(func_names[i], name)) {
+    i++;
+  }
+  if(i == func_name_size) {
+    return isImported(name) ? 0 : -1;
+  }
+  if(func_counts[i] > 1) {
+    return 0;
+  }
+  for(int j = 0; j < visible && j < top_size; j++) {
+    if(!strcmp(top_funcs[j]->child[0]->name, name)) {
+      *def = top_funcs[j];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static struct Type* findConst(const char* name) {
+  for(int i = 0; i < const_size; i++) {
+    if(!strcmp(const_names[i], name)) {
+      return &const_values[i];
+    }
+  }
+  return NULL;
+}
+
+static struct Type* findVar(EvalFrame frame, const char* name) {
+  for(int i = 0; i < frame->size; i++) {
+    if(!strcmp(frame->names[i], name)) {
+      return &frame->values[i];
+    }
+  }
+  return NULL;
+}
+
+static int setVar(EvalFrame frame, const char* name, struct Type* val) {
+  struct Type* var = findVar(frame, name);
+  if(var == NULL) {
+    if(frame->size == CONST_EVAL_VARS) {
+      return 0;
+    }
+    frame->names[frame->size] = name;
+    var = &frame->values[frame->size++];
+  }
+  *var = *val;
+  return 1;
+}
+
+/* the vm's arithmetic, failing where it would make a bigint or a new
+ * string or report an error */
+static int arith(int op, struct Type* left, struct Type* right, struct Type* out) {
+  if(left->type == TYPE_INT && right->type == TYPE_INT) {
+    int64_t l = left->int_val;
+    int64_t r = right->int_val;
+    out->type = TYPE_INT;
+    switch(op) {
+      case SC_ADD:
+        return !__builtin_add_overflow(l, r, &out->int_val);
+      case SC_SUB:
+        return !__builtin_sub_overflow(l, r, &out->int_val);
+      case SC_MUL:
+        return !__builtin_mul_overflow(l, r, &out->int_val);
+      default:
+        if(r == 0 || (r == -1 && l == INT64_MIN)) {
+          return 0;
+        }
+        out->int_val = l / r;
+        return 1;
+    }
+  }
+  if(left->type == TYPE_FLOAT && right->type == TYPE_FLOAT) {
+    double l = left->double_val;
+    double r = right->double_val;
+    out->type = TYPE_FLOAT;
+    out->double_val = op == SC_ADD ? l + r : op == SC_SUB ? l - r : op == SC_MUL ? l * r : l / r;
+    return 1;
+  }
+  return 0;
+}
+
+static int compare(int op, struct Type* left, struct Type* right, struct Type* out) {
+  int lt, eq;
+  if(left->type == TYPE_INT && right->type == TYPE_INT) {
+    lt = left->int_val < right->int_val;
+    eq = left->int_val == right->int_val;
+  } else if(left->type == TYPE_FLOAT && right->type == TYPE_FLOAT) {
+    /* unordered floats compare false, except for != */
+    double l = left->double_val;
+    double r = right->double_val;
+    out->type = TYPE_BOOL;
+    out->bool_val = op == SC_LT ? l < r : op == SC_GT ? l > r : op == SC_LE ? l <= r
+      : op == SC_GE ? l >= r : op == SC_EQ ? l == r : l != r;
+    return 1;
+  } else if((op == SC_EQ || op == SC_NE) && left->type == TYPE_STRING && right->type == TYPE_STRING) {
+    lt = 0;
+    eq = !strcmp(left->string, right->string);
+  } else if((op == SC_EQ || op == SC_NE) && left->type == TYPE_BOOL && right->type == TYPE_BOOL) {
+    lt = 0;
+    eq = left->bool_val == right->bool_val;
+  } else {
+    return 0;
+  }
+  out->type = TYPE_BOOL;
+  out->bool_val = op == SC_LT ? lt : op == SC_GT ? !lt && !eq : op == SC_LE ? lt || eq
+    : op == SC_GE ? !lt : op == SC_EQ ? eq : !eq;
+  return 1;
+}
+
+static int evalExpr(Node node, EvalFrame frame, struct Type* out);
+static int evalCondition(Node node, EvalFrame frame, int* cond);
+static int evalStatement(Node node, EvalFrame frame);
+
+static int callNative(const char* name, Node args, EvalFrame frame, struct Type* out) {
+  int i = 0;
+  while(pure_natives[i] && strcmp(pure_natives[i], name)) {
+    i++;
+  }
+  int id = getNative(name);
+  if(pure_natives[i] == NULL || id == -1 || args->list->elements == NULL || args->list->elements->next) {
+    return 0;
+  }
+  struct Type arg;
+  if(!evalExpr(args->list->elements->node, frame, &arg)) {
+    return 0;
+  }
+  if(!strcmp(name, "len")) {
+    if(arg.type != TYPE_STRING) {
+      return 0;
+    }
+  } else if(arg.type != TYPE_INT && arg.type != TYPE_FLOAT) {
+    return 0;
+  } else if(!strcmp(name, "floor")) {
+    double x = floor(arg.type == TYPE_INT ? (double)arg.int_val : arg.double_val);
+    if(!(x >= -9223372036854775808.0 && x < 9223372036854775808.0)) {
+      return 0;
+    }
+  }
+  return native_table[id].func(&arg, 1, out) == 0;
+}
+
+static int evalCall(Node node, EvalFrame frame, struct Type* out) {
+  const char* name = node->child[0]->name;
+  Node args = node->child[1];
+  Node def = NULL;
+  int found = findFunction(name, frame->visible, &def);
+  if(found == -1) {
+    return callNative(name, args, frame, out);
+  }
+  if(found == 0 || depth == CONST_EVAL_DEPTH || def->child[2] == NULL) {
+    return 0;
+  }
+  struct EvalFrame callee;
+  callee.size = 0;
+  callee.visible = 0;
+  while(top_funcs[callee.visible] != def) {
+    callee.visible++;
+  }
+  callee.visible++;
+  ListEntry param = def->child[1]->list->elements;
+  ListEntry arg = args->list->elements;
+  for(; param && arg; param = param->next, arg = arg->next) {
+    struct Type val;
+    if(!evalExpr(arg->node, frame, &val) || !setVar(&callee, param->node->name, &val)) {
+      return 0;
+    }
+  }
+  if(param || arg) {
+    return 0;
+  }
+  depth++;
+  int flow = evalStatement(def->child[2], &callee);
+  depth--;
+  if(flow != FLOW_RETURN) {
+    return 0;
+  }
+  *out = callee.ret;
+  return 1;
+}
+
+static int evalExpr(Node node, EvalFrame frame, struct Type* out) {
+  if(node == NULL || --steps < 0) {
+    return 0;
+  }
+  struct Type left, right;
+  struct Type* var;
+  int cond;
+  switch(node->type) {
+    case SC_INT:
+      out->type = TYPE_INT;
+      out->int_val = node->int_val;
+      return 1;
+    case SC_FLOAT:
+      out->type = TYPE_FLOAT;
+      out->double_val = node->double_val;
+      return 1;
+    case SC_STRING:
+      out->type = TYPE_STRING;
+      out->string = node->string;
+      return 1;
+    case SC_BOOL:
+      out->type = TYPE_BOOL;
+      out->bool_val = node->bool_val;
+      return 1;
+    case SC_NAME:
+      var = findVar(frame, node->name);
+      if(var == NULL) {
+        return 0;
+      }
+      *out = *var;
+      return 1;
+    case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV:
+      return evalExpr(node->child[0], frame, &left) && evalExpr(node->child[1], frame, &right)
+        && arith(node->type, &left, &right, out);
+    case SC_LT: case SC_GT: case SC_LE: case SC_GE: case SC_EQ: case SC_NE:
+      return evalExpr(node->child[0], frame, &left) && evalExpr(node->child[1], frame, &right)
+        && compare(node->type, &left, &right, out);
+    case SC_AND: case SC_OR:
+      /* the right operand only runs when the left one does not decide */
+      if(!evalCondition(node->child[0], frame, &cond)
+          || (cond != (node->type == SC_OR) && !evalCondition(node->child[1], frame, &cond))) {
+        return 0;
+      }
+      out->type = TYPE_BOOL;
+      out->bool_val = cond;
+      return 1;
+    case SC_NOT:
+      if(!evalCondition(node->child[0], frame, &cond)) {
+        return 0;
+      }
+      out->type = TYPE_BOOL;
+      out->bool_val = !cond;
+      return 1;
+    case SC_PLUS:
+      return evalExpr(node->child[0], frame, out);
+    case SC_MINUS:
+      if(!evalExpr(node->child[0], frame, &left)) {
+        return 0;
+      }
+      if(left.type == TYPE_INT && left.int_val != INT64_MIN) {
+        out->type = TYPE_INT;
+        out->int_val = -left.int_val;
+        return 1;
+      }
+      if(left.type == TYPE_FLOAT) {
+        out->type = TYPE_FLOAT;
+        out->double_val = -left.double_val;
+        return 1;
+      }
+      return 0;
+    case SC_FUNCCALL:
+      return evalCall(node, frame, out);
+  }
+  return 0;
+}
+
+static int evalCondition(Node node, EvalFrame frame, int* cond) {
+  struct Type val;
+  if(!evalExpr(node, frame, &val) || val.type != TYPE_BOOL) {
+    return 0;
+  }
+  *cond = val.bool_val;
+  return 1;
+}
+
+/* name op= value, with op one of the arithmetic node types */
+static int evalUpdate(Node target, int op, struct Type* right, EvalFrame frame) {
+  if(target->type != SC_NAME) {
+    return 0;
+  }
+  struct Type* var = findVar(frame, target->name);
+  struct Type val;
+  return var != NULL && arith(op, var, right, &val) && setVar(frame, target->name, &val);
+}
+
+static int evalLoop(Node cond, Node step, Node body, EvalFrame frame) {
+  for(;;) {
+    int taken;
+    if(!evalCondition(cond, frame, &taken)) {
+      return FLOW_FAIL;
+    }
+    if(!taken) {
+      return FLOW_NEXT;
+    }
+    int flow = evalStatement(body, frame);
+    if(flow == FLOW_BREAK) {
+      return FLOW_NEXT;
+    }
+    if(flow == FLOW_RETURN || flow == FLOW_FAIL) {
+      return flow;
+    }
+    if(step && evalStatement(step, frame) != FLOW_NEXT) {
+      return FLOW_FAIL;
+    }
+  }
+}
+
+/* the statements from the first case equal to the value on, or from
+ * the default; break leaves the switch */
+static int evalSwitch(Node node, EvalFrame frame) {
+  struct Type val, label, eq;
+  if(!evalExpr(node->child[0], frame, &val)) {
+    return FLOW_FAIL;
+  }
+  ListEntry target = NULL;
+  ListEntry fallback = NULL;
+  ListEntry entry = node->child[1]->list->elements;
+  for(; entry && target == NULL; entry = entry->next) {
+    Node c = entry->node;
+    if(c == NULL || c->type != SC_CASE) {
+      continue;
+    }
+    if(c->child[0] == NULL) {
+      fallback = entry;
+    } else if(!evalExpr(c->child[0], frame, &label) || !compare(SC_EQ, &val, &label, &eq)) {
+      return FLOW_FAIL;
+    } else if(eq.bool_val) {
+      target = entry;
+    }
+  }
+  for(entry = target ? target : fallback; entry; entry = entry->next) {
+    if(entry->node == NULL || entry->node->type == SC_CASE) {
+      continue;
+    }
+    int flow = evalStatement(entry->node, frame);
+    if(flow == FLOW_BREAK) {
+      return FLOW_NEXT;
+    }
+    if(flow != FLOW_NEXT) {
+      return flow;
+    }
+  }
+  return FLOW_NEXT;
+}
+
+static int evalStatement(Node node, EvalFrame frame) {
+  if(node == NULL) {
+    return FLOW_NEXT;
+  }
+  if(--steps < 0) {
+    return FLOW_FAIL;
+  }
+  struct Type val;
+  int cond;
+  switch(node->type) {
+    case SC_NONE:
+      return FLOW_NEXT;
+    case SC_STATEMENTLIST:
+      for(ListEntry entry = node->list->elements; entry; entry = entry->next) {
+        int flow = evalStatement(entry->node, frame);
+        if(flow != FLOW_NEXT) {
+          return flow;
+        }
+      }
+      return FLOW_NEXT;
+    case SC_BLOCK:
+      return evalStatement(node->child[0], frame);
+    case SC_IF:
+      if(!evalCondition(node->child[0], frame, &cond)) {
+        return FLOW_FAIL;
+      }
+      return evalStatement(node->child[cond ? 1 : 2], frame);
+    case SC_WHILE:
+      return evalLoop(node->child[0], NULL, node->child[1], frame);
+    case SC_FOR:
+      if(evalStatement(node->child[0], frame) != FLOW_NEXT) {
+        return FLOW_FAIL;
+      }
+      return evalLoop(node->child[1], node->child[2], node->child[3], frame);
+    case SC_ASSIGN:
+      if(node->child[0]->type != SC_NAME || !evalExpr(node->child[1], frame, &val)) {
+        return FLOW_FAIL;
+      }
+      return setVar(frame, node->child[0]->name, &val) ? FLOW_NEXT : FLOW_FAIL;
+    case SC_ASSIGNADD: case SC_ASSIGNSUB: case SC_ASSIGNMUL: case SC_ASSIGNDIV: {
+      int op = SC_ADD + (node->type - SC_ASSIGNADD);
+      if(!evalExpr(node->child[1], frame, &val)) {
+        return FLOW_FAIL;
+      }
+      return evalUpdate(node->child[0], op, &val, frame) ? FLOW_NEXT : FLOW_FAIL;
+    }
+    case SC_INC: case SC_DEC:
+      val.type = TYPE_INT;
+      val.int_val = 1;
+      return evalUpdate(node->child[0], node->type == SC_INC ? SC_ADD : SC_SUB, &val, frame) ? FLOW_NEXT : FLOW_FAIL;
+    case SC_RETURN:
+      return evalExpr(node->child[0], frame, &frame->ret) ? FLOW_RETURN : FLOW_FAIL;
+    case SC_SWITCH:
+      return evalSwitch(node, frame);
+    case SC_BREAK:
+      return FLOW_BREAK;
+    case SC_CONTINUE:
+      return FLOW_CONTINUE;
+    case SC_PRINT: case SC_FUNCDEF: case SC_CONST:
+      return FLOW_FAIL;
+  }
+  /* an expression statement; its value is dropped */
+  return evalExpr(node, frame, &val) ? FLOW_NEXT : FLOW_FAIL;
+}
+
+static void disposeChildren(Node node) {
+  if(isList(node->type)) {
+    disposeList(node->list);
+  } else if(!isLeaf(node->type)) {
+    for(int i = 0; i < node->child_size; i++) {
+      disposeNode(node->child[i]);
+    }
+    free(node->child);
+  }
+}
+
+static void setLiteral(Node node, struct Type* val) {
+  disposeChildren(node);
+  if(val->type == TYPE_INT) {
+    node->type = SC_INT;
+    node->int_val = val->int_val;
+  } else if(val->type == TYPE_FLOAT) {
+    node->type = SC_FLOAT;
+    node->double_val = val->double_val;
+  } else if(val->type == TYPE_STRING) {
+    node->type = SC_STRING;
+    node->string = val->string;
+  } else {
+    node->type = SC_BOOL;
+    node->bool_val = val->bool_val;
+  }
+}
+
+/* an evaluation in a frame without variables, within the budgets */
+static int evalClosed(Node node, int visible, struct Type* out) {
+  struct EvalFrame frame;
+  frame.size = 0;
+  frame.visible = visible;
+  steps = total_steps < CONST_EVAL_STEPS ? total_steps : CONST_EVAL_STEPS;
+  long budget = steps;
+  depth = 0;
+  int ok = evalExpr(node, &frame, out);
+  total_steps -= budget - (steps > 0 ? steps : 0);
+  return ok;
+}
+
+static void foldCalls(Node node, int visible) {
+  if(node == NULL || isLeaf(node->type)) {
+    return;
+  }
+  if(isList(node->type)) {
+    for(ListEntry entry = node->list->elements; entry; entry = entry->next) {
+      foldCalls(entry->node, visible);
+    }
+    return;
+  }
+  if(node->type == SC_FUNCCALL) {
+    struct Type val;
+    if(total_steps > 0 && evalClosed(node, visible, &val)) {
+      if(sc_debug) {
+        fprintf(stderr, "const eval: folded a call of %s\n", node->child[0]->name);
+      }
+      setLiteral(node, &val);
+      return;
+    }
+    foldCalls(node->child[1], visible);
+    return;
+  }
+  for(int i = 0; i < node->child_size; i++) {
+    foldCalls(node->child[i], visible);
+  }
+}
+
+static void checkAssignable(Node target) {
+  if(target->type == SC_NAME && findConst(target->name)) {
+    fprintf(stderr, "Error: cannot assign to const %s\n", target->name);
+    exit(1);
+  }
+}
+
+/* later uses of the consts become their literals */
+static void substituteConsts(Node node) {
+  if(node == NULL) {
+    return;
+  }
+  struct Type* val;
+  switch(node->type) {
+    case SC_NAME:
+      if((val = findConst(node->name)) != NULL) {
+        setLiteral(node, val);
+      }
+      return;
+    case SC_CONST:
+      fprintf(stderr, "Error: const %s is not at the top level\n", node->child[0]->name);
+      exit(1);
+    case SC_ASSIGN: case SC_ASSIGNADD: case SC_ASSIGNSUB: case SC_ASSIGNMUL: case SC_ASSIGNDIV:
+      checkAssignable(node->child[0]);
+      if(node->child[0]->type != SC_NAME) {
+        substituteConsts(node->child[0]);
+      }
+      substituteConsts(node->child[1]);
+      return;
+    case SC_INC: case SC_DEC:
+      checkAssignable(node->child[0]);
+      return;
+    case SC_FUNCCALL:
+      substituteConsts(node->child[1]);
+      return;
+    case SC_FUNCDEF:
+      for(ListEntry entry = node->child[1]->list->elements; entry; entry = entry->next) {
+        if(findConst(entry->node->name)) {
+          fprintf(stderr, "Error: parameter %s of %s is a const\n", entry->node->name, node->child[0]->name);
+          exit(1);
+        }
+      }
+      substituteConsts(node->child[2]);
+      return;
+  }
+  if(isLeaf(node->type)) {
+    return;
+  }
+  if(isList(node->type)) {
+    for(ListEntry entry = node->list->elements; entry; entry = entry->next) {
+      substituteConsts(entry->node);
+    }
+    return;
+  }
+  for(int i = 0; i < node->child_size; i++) {
+    substituteConsts(node->child[i]);
+  }
+}
+
+static void declareConst(Node node) {
+  const char* name = node->child[0]->name;
+  if(findConst(name)) {
+    fprintf(stderr, "Error: const %s is declared twice\n", name);
+    exit(1);
+  }
+  substituteConsts(node->child[1]);
+  struct Type val;
+  /* a const folds even without optimization, within the whole budget */
+  long total = total_steps;
+  total_steps = CONST_EVAL_TOTAL;
+  int ok = evalClosed(node->child[1], top_size, &val);
+  total_steps = total;
+  if(!ok) {
+    fprintf(stderr, "Error: const %s is not a constant expression\n", name);
+    exit(1);
+  }
+  setLiteral(node->child[1], &val);
+  const_names = (const char**)realloc(const_names, sizeof(const char*)*(const_size+1));
+  const_values = (struct Type*)realloc(const_values, sizeof(struct Type)*(const_size+1));
+  const_names[const_size] = name;
+  const_values[const_size] = val;
+  const_size++;
+}
+
+void evaluateConstants(Node source) {
+  if(source == NULL || source->list == NULL) {
+    return;
+  }
+  top_source = source;
+  countFunctions(source);
+  total_steps = CONST_EVAL_TOTAL;
+  for(ListEntry entry = source->list->elements; entry; entry = entry->next) {
+    Node node = entry->node;
+    if(node && node->type == SC_CONST) {
+      declareConst(node);
+      continue;
+    }
+    substituteConsts(node);
+    if(node && node->type == SC_FUNCDEF) {
+      top_funcs = (Node*)realloc(top_funcs, sizeof(Node)*(top_size+1));
+      top_funcs[top_size++] = node;
+    }
+    if(sc_optimize) {
+      foldCalls(node, top_size);
+    }
+  }
+  free(top_funcs);
+  free(func_names);
+  free(func_counts);
+  free(const_names);
+  free(const_values);
+  top_funcs = NULL;
+  func_names = NULL;
+  func_counts = NULL;
+  const_names = NULL;
+  const_values = NULL;
+  top_size = func_name_size = const_size = 0;
+}
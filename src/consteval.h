@@ -0,0 +1,27 @@
+#ifndef __CONSTEVAL__
+#define __CONSTEVAL__
+
+#include "ast.h"
+
+/* compile time evaluation on the AST, before it is lowered.
+ *
+ * const NAME = expr; at the top level binds NAME to the value of expr,
+ * which must evaluate at compile time. every later use of NAME becomes
+ * that literal, in function bodies too, and NAME cannot be assigned or
+ * name a parameter. with optimization on, a call whose arguments need
+ * no variables is evaluated as well and replaced by its result.
+ *
+ * the evaluator is an AST interpreter over ints, floats, bools and
+ * string literals with a step budget. anything with an effect or a
+ * result it cannot write as a literal stops it: print, arrays and maps,
+ * natives other than the pure ones, strings made at run time, an int
+ * overflow to a bigint, a division the vm would report, a type error or
+ * an exhausted budget. the call is then left as it is, for the vm */
+
+#ifndef CONST_EVAL_STEPS
+#define CONST_EVAL_STEPS 1000000
+#endif
+
+void evaluateConstants(Node source);
+
+#endif
@@ -0,0 +1,596 @@
+/* posix_memalign and clock_gettime */
+#define _DEFAULT_SOURCE
+
+#include "compiler.h"
+#include "vm.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define BLOCK_ALIGN 16
+#define SMALL_MAX 1024
+/* class i holds free blocks of (i+1)*BLOCK_ALIGN bytes, the last one
+ * every block of SMALL_MAX bytes or more */
+#define CLASS_COUNT 64
+
+/* header in front of every managed string and object */
+struct Block {
+  uint32_t size;
+  uint16_t mark;
+  uint16_t kind;
+};
+
+struct FreeBlock {
+  struct Block block;
+  struct FreeBlock* next;
+};
+
+/* chunks are CHUNK_SIZE aligned, so a string finds its chunk by masking */
+struct Chunk {
+  struct Chunk* next;
+  char* top;
+};
+
+struct Large {
+  struct Large* next;
+  size_t size;
+  struct Block block;
+};
+
+/* a buffer strings point into anywhere: a chunk of input or a mapped
+ * file. length is the mapped length, 0 for a malloc'd buffer */
+struct View {
+  char* data;
+  size_t size;
+  size_t length;
+  int mark;
+  int pinned;
+};
+
+/* open addressing set of addresses, rebuilt after every sweep */
+struct AddressSet {
+  uintptr_t* slots;
+  size_t mask;
+  size_t size;
+};
+
+struct Heap {
+  struct Chunk* chunks;
+  struct Chunk* current;
+  struct Large* larges;
+  struct FreeBlock* free_lists[CLASS_COUNT];
+  uint64_t free_classes;
+  struct AddressSet chunk_set;
+  struct AddressSet large_set;
+  struct View* views;
+  int view_size;
+  int view_capacity;
+  /* the frames of the running native call, see setHeapRoots */
+  VMContext roots;
+  size_t allocated;
+  size_t threshold;
+  size_t heap_size;
+  /* statistics */
+  size_t peak_size;
+  size_t total_bytes;
+  long total_blocks[BLOCK_KINDS];
+  size_t live_bytes;
+  size_t live_kinds[BLOCK_KINDS];
+  long chunk_count;
+  long large_count;
+  long collections;
+  double total_pause;
+  double max_pause;
+};
+
+/* the heap strings go to on this thread; the scheduler swaps in the
+ * heap of the script it runs */
+static struct Heap process_heap = { .threshold = HEAP_MIN_THRESHOLD };
+static __thread struct Heap* heap = &process_heap;
+
+static inline size_t hashAddress(uintptr_t addr) {
+  addr ^= addr >> 33;
+  addr *= 0xff51afd7ed558ccdull;
+  addr ^= addr >> 33;
+  return (size_t)addr;
+}
+
+static void insertAddress(struct AddressSet* set, uintptr_t addr) {
+  if((set->size + 1) * 2 > set->mask + 1) {
+    struct AddressSet old = *set;
+    set->mask = old.mask ? old.mask * 2 + 1 : 15;
+    set->slots = (uintptr_t*)calloc(set->mask + 1, sizeof(uintptr_t));
+    set->size = 0;
+    for(size_t i = 0; old.slots && i <= old.mask; i++) {
+      if(old.slots[i]) {
+        insertAddress(set, old.slots[i]);
+      }
+    }
+    free(old.slots);
+  }
+  size_t i = hashAddress(addr) & set->mask;
+  while(set->slots[i]) {
+    i = (i + 1) & set->mask;
+  }
+  set->slots[i] = addr;
+  set->size++;
+}
+
+static int hasAddress(struct AddressSet* set, uintptr_t addr) {
+  if(set->size == 0) {
+    return 0;
+  }
+  for(size_t i = hashAddress(addr) & set->mask; set->slots[i]; i = (i + 1) & set->mask) {
+    if(set->slots[i] == addr) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void clearAddresses(struct AddressSet* set) {
+  if(set->slots) {
+    memset(set->slots, 0, sizeof(uintptr_t) * (set->mask + 1));
+  }
+  set->size = 0;
+}
+
+static void updatePeak(void) {
+  if(heap->heap_size > heap->peak_size) {
+    heap->peak_size = heap->heap_size;
+  }
+}
+
+static void pushFree(struct Block* block) {
+  int cls = block->size >= SMALL_MAX ? CLASS_COUNT - 1 : (int)(block->size / BLOCK_ALIGN) - 1;
+  struct FreeBlock* free_block = (struct FreeBlock*)block;
+  block->mark = 0;
+  free_block->next = heap->free_lists[cls];
+  heap->free_lists[cls] = free_block;
+  heap->free_classes |= 1ull << cls;
+}
+
+static struct Block* popFree(size_t need) {
+  int cls = (int)(need / BLOCK_ALIGN) - 1;
+  uint64_t classes = heap->free_classes & (~0ull << cls);
+  if(classes == 0) {
+    return NULL;
+  }
+  cls = __builtin_ctzll(classes);
+  struct FreeBlock* free_block = heap->free_lists[cls];
+  heap->free_lists[cls] = free_block->next;
+  if(free_block->next == NULL) {
+    heap->free_classes &= ~(1ull << cls);
+  }
+  struct Block* block = &free_block->block;
+  size_t rest = block->size - need;
+  if(rest) {
+    struct Block* tail = (struct Block*)((char*)block + need);
+    tail->size = (uint32_t)rest;
+    pushFree(tail);
+  }
+  block->size = (uint32_t)need;
+  return block;
+}
+
+static struct Block* bumpBlock(size_t need) {
+  struct Chunk* chunk = heap->current;
+  if(chunk == NULL || chunk->top + need > (char*)chunk + CHUNK_SIZE) {
+    void* mem;
+    if(posix_memalign(&mem, CHUNK_SIZE, CHUNK_SIZE)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    chunk = (struct Chunk*)mem;
+    chunk->top = (char*)(chunk + 1);
+    chunk->next = heap->chunks;
+    heap->chunks = chunk;
+    heap->current = chunk;
+    heap->chunk_count++;
+    heap->heap_size += CHUNK_SIZE;
+    updatePeak();
+    insertAddress(&heap->chunk_set, (uintptr_t)chunk);
+  }
+  struct Block* block = (struct Block*)chunk->top;
+  chunk->top += need;
+  block->size = (uint32_t)need;
+  return block;
+}
+
+static struct Block* allocLarge(size_t size) {
+  struct Large* large = (struct Large*)malloc(sizeof(struct Large) + size);
+  if(large == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  large->size = sizeof(struct Large) + size;
+  large->next = heap->larges;
+  heap->larges = large;
+  heap->large_count++;
+  heap->heap_size += large->size;
+  updatePeak();
+  insertAddress(&heap->large_set, (uintptr_t)(large + 1));
+  return &large->block;
+}
+
+static struct Block* allocBlock(VMContext ctx, int kind, size_t size) {
+  size_t need = (size + sizeof(struct Block) + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+  if(ctx != NULL && heap->allocated >= heap->threshold) {
+    collectHeap(ctx);
+  }
+  heap->allocated += need;
+  heap->total_bytes += need;
+  heap->total_blocks[kind]++;
+  struct Block* block;
+  if(need > SMALL_MAX) {
+    block = allocLarge(size);
+  } else {
+    block = popFree(need);
+    if(block == NULL) {
+      block = bumpBlock(need);
+    }
+  }
+  block->mark = 0;
+  block->kind = (uint16_t)kind;
+  return block;
+}
+
+/* size counts the terminating NUL */
+char* allocString(VMContext ctx, size_t size) {
+  return (char*)(allocBlock(ctx, BLOCK_STRING, size) + 1);
+}
+
+/* objects come zeroed */
+void* allocObject(VMContext ctx, int kind, size_t size) {
+  struct Block* block = allocBlock(ctx, kind, size);
+  memset(block + 1, 0, size);
+  return block + 1;
+}
+
+void heapSafepoint(VMContext ctx) {
+  if(heap->allocated >= heap->threshold) {
+    collectHeap(ctx);
+  }
+}
+
+static struct Block* findBlock(void* data) {
+  uintptr_t chunk = (uintptr_t)data & ~(uintptr_t)(CHUNK_SIZE - 1);
+  if(hasAddress(&heap->chunk_set, chunk) || hasAddress(&heap->large_set, (uintptr_t)data)) {
+    return (struct Block*)data - 1;
+  }
+  return NULL;
+}
+
+static void addView(char* data, size_t size, size_t length) {
+  if(heap->view_size == heap->view_capacity) {
+    heap->view_capacity = heap->view_capacity ? heap->view_capacity * 2 : 16;
+    heap->views = (struct View*)realloc(heap->views, sizeof(struct View)*heap->view_capacity);
+  }
+  struct View* view = &heap->views[heap->view_size++];
+  view->data = data;
+  view->size = size;
+  view->length = length;
+  view->mark = 0;
+  view->pinned = 1;
+}
+
+static int compareViews(const void* left, const void* right) {
+  const char* l = ((const struct View*)left)->data;
+  const char* r = ((const struct View*)right)->data;
+  return (l > r) - (l < r);
+}
+
+/* the views are sorted by address while a collection marks */
+static struct View* findView(char* str) {
+  int low = 0;
+  int high = heap->view_size - 1;
+  while(low <= high) {
+    int mid = (low + high) / 2;
+    struct View* view = &heap->views[mid];
+    if(str < view->data) {
+      high = mid - 1;
+    } else if(str > view->data + view->size) {
+      low = mid + 1;
+    } else {
+      return view;
+    }
+  }
+  return NULL;
+}
+
+/* size counts the terminating NUL. a collection may run first, with the
+ * frames of the native call being made as the roots */
+char* allocView(size_t size) {
+  if(heap->roots != NULL && heap->allocated >= heap->threshold) {
+    collectHeap(heap->roots);
+  }
+  char* data = (char*)malloc(size);
+  if(data == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  heap->allocated += size;
+  heap->total_bytes += size;
+  heap->heap_size += size;
+  updatePeak();
+  addView(data, size - 1, 0);
+  return data;
+}
+
+/* the file is mapped behind an anonymous zero page or the zero tail of
+ * its last page, so the byte after its end is always a NUL */
+char* mapView(int fd, size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t length = (size + page) & ~(page - 1);
+  char* data = (char*)mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(data == MAP_FAILED) {
+    return NULL;
+  }
+  if(size > 0 && mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(data, length);
+    return NULL;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  addView(data, size, length);
+  /* a mapped view is only held by the strings into it */
+  heap->views[heap->view_size - 1].pinned = 0;
+  return data;
+}
+
+void releaseView(char* data) {
+  for(int i = 0; i < heap->view_size; i++) {
+    if(heap->views[i].data == data) {
+      heap->views[i].pinned = 0;
+      return;
+    }
+  }
+}
+
+void setHeapRoots(VMContext ctx) {
+  heap->roots = ctx;
+}
+
+VMContext getHeapRoots(void) {
+  return heap->roots;
+}
+
+static void freeView(struct View* view) {
+  if(view->length) {
+    munmap(view->data, view->length);
+  } else {
+    free(view->data);
+    heap->heap_size -= view->size + 1;
+  }
+}
+
+static void markValue(Type val);
+
+/* returns whether the block was marked before; an object restored from
+ * a snapshot is not a block and is never freed */
+static int markBlock(void* data) {
+  struct Block* block = findBlock(data);
+  if(block == NULL || block->mark) {
+    return 1;
+  }
+  block->mark = 1;
+  return 0;
+}
+
+static void markMap(ScriptCMap map) {
+  if(markBlock(map)) {
+    return;
+  }
+  markBlock(map->entries);
+  struct Type key;
+  for(struct MapEntry* entry = nextMapEntry(map, NULL); entry; entry = nextMapEntry(map, entry)) {
+    markValue(getMapEntryKey(entry, &key));
+    markValue(getMapEntryValue(entry));
+  }
+  if(map->hashed_key) {
+    key.type = TYPE_STRING;
+    key.string = map->hashed_key;
+    markValue(&key);
+  }
+}
+
+static void markValue(Type val) {
+  if(val->type == TYPE_STRING) {
+    struct Block* block = findBlock(val->string);
+    struct View* view;
+    if(block) {
+      block->mark = 1;
+    } else if(heap->view_size && (view = findView(val->string)) != NULL) {
+      view->mark = 1;
+    }
+  } else if(val->type == TYPE_MAP) {
+    markMap(val->map);
+  } else if(val->type == TYPE_ARRAY) {
+    /* the elements are ints or doubles, in the block of the array */
+    markBlock(val->array);
+  } else if(val->type == TYPE_BIGINT) {
+    markBlock(val->bigint);
+  }
+}
+
+/* dead neighbours are merged before they go to the free lists */
+static void sweepChunk(struct Chunk* chunk) {
+  struct Block* dead = NULL;
+  char* end = chunk->top;
+  for(char* p = (char*)(chunk + 1); p < end; p += ((struct Block*)p)->size) {
+    struct Block* block = (struct Block*)p;
+    if(block->mark) {
+      block->mark = 0;
+      heap->live_bytes += block->size;
+      heap->live_kinds[block->kind] += block->size;
+      if(dead) {
+        pushFree(dead);
+        dead = NULL;
+      }
+    } else if(dead) {
+      dead->size += block->size;
+    } else {
+      dead = block;
+    }
+  }
+  if(dead && chunk == heap->current) {
+    /* a dead run at the top goes back to the bump pointer */
+    chunk->top = (char*)dead;
+  } else if(dead) {
+    pushFree(dead);
+  }
+}
+
+static int isChunkLive(struct Chunk* chunk) {
+  for(char* p = (char*)(chunk + 1); p < chunk->top; p += ((struct Block*)p)->size) {
+    if(((struct Block*)p)->mark) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void sweep(void) {
+  memset(heap->free_lists, 0, sizeof(heap->free_lists));
+  heap->free_classes = 0;
+  heap->live_bytes = 0;
+  memset(heap->live_kinds, 0, sizeof(heap->live_kinds));
+  clearAddresses(&heap->chunk_set);
+  clearAddresses(&heap->large_set);
+  struct Chunk** chunk_link = &heap->chunks;
+  while(*chunk_link) {
+    struct Chunk* chunk = *chunk_link;
+    if(!isChunkLive(chunk)) {
+      *chunk_link = chunk->next;
+      if(chunk == heap->current) {
+        heap->current = NULL;
+      }
+      free(chunk);
+      heap->chunk_count--;
+      heap->heap_size -= CHUNK_SIZE;
+      continue;
+    }
+    sweepChunk(chunk);
+    insertAddress(&heap->chunk_set, (uintptr_t)chunk);
+    chunk_link = &chunk->next;
+  }
+  struct Large** large_link = &heap->larges;
+  while(*large_link) {
+    struct Large* large = *large_link;
+    if(!large->block.mark) {
+      *large_link = large->next;
+      heap->large_count--;
+      heap->heap_size -= large->size;
+      free(large);
+      continue;
+    }
+    large->block.mark = 0;
+    heap->live_bytes += large->size;
+    heap->live_kinds[large->block.kind] += large->size;
+    insertAddress(&heap->large_set, (uintptr_t)(large + 1));
+    large_link = &large->next;
+  }
+  int live = 0;
+  for(int i = 0; i < heap->view_size; i++) {
+    struct View* view = &heap->views[i];
+    if(!view->mark && !view->pinned) {
+      freeView(view);
+      continue;
+    }
+    view->mark = 0;
+    if(!view->length) {
+      heap->live_bytes += view->size + 1;
+      heap->live_kinds[BLOCK_STRING] += view->size + 1;
+    }
+    heap->views[live++] = *view;
+  }
+  heap->view_size = live;
+}
+
+void collectHeap(VMContext ctx) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(heap->view_size > 1) {
+    qsort(heap->views, heap->view_size, sizeof(struct View), compareViews);
+  }
+  for(; ctx; ctx = ctx->prev) {
+    /* the locals and the operand stack are one contiguous range */
+    for(Type val = ctx->var_list_base; val < ctx->stack_pointer; val++) {
+      markValue(val);
+    }
+  }
+  sweep();
+  heap->allocated = 0;
+  heap->threshold = heap->live_bytes > HEAP_MIN_THRESHOLD ? heap->live_bytes : HEAP_MIN_THRESHOLD;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double pause = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+  heap->collections++;
+  heap->total_pause += pause;
+  if(pause > heap->max_pause) {
+    heap->max_pause = pause;
+  }
+}
+
+void printHeapStats(void) {
+  fprintf(stderr, "@@@@ Heap @@@@\n");
+  fprintf(stderr, "allocated   : %zu bytes in %ld strings, %ld arrays, %ld maps, %ld bigints\n", heap->total_bytes,
+    heap->total_blocks[BLOCK_STRING], heap->total_blocks[BLOCK_ARRAY], heap->total_blocks[BLOCK_MAP], heap->total_blocks[BLOCK_BIGINT]);
+  fprintf(stderr, "collections : %ld (pause total %.3f ms, max %.3f ms)\n", heap->collections, heap->total_pause, heap->max_pause);
+  fprintf(stderr, "heap        : %zu bytes at exit, %zu bytes peak (%ld chunks, %ld large)\n", heap->heap_size, heap->peak_size, heap->chunk_count, heap->large_count);
+  fprintf(stderr, "live        : %zu bytes after the last collection (strings %zu, arrays %zu, maps %zu, bigints %zu)\n", heap->live_bytes,
+    heap->live_kinds[BLOCK_STRING], heap->live_kinds[BLOCK_ARRAY], heap->live_kinds[BLOCK_MAP] + heap->live_kinds[BLOCK_ENTRIES], heap->live_kinds[BLOCK_BIGINT]);
+}
+
+size_t heapAllocatedBytes(void) {
+  return heap->total_bytes;
+}
+
+/* the whole region goes at once, nothing is swept */
+void disposeHeap(void) {
+  while(heap->chunks) {
+    struct Chunk* next = heap->chunks->next;
+    free(heap->chunks);
+    heap->chunks = next;
+  }
+  while(heap->larges) {
+    struct Large* next = heap->larges->next;
+    free(heap->larges);
+    heap->larges = next;
+  }
+  for(int i = 0; i < heap->view_size; i++) {
+    freeView(&heap->views[i]);
+  }
+  free(heap->views);
+  free(heap->chunk_set.slots);
+  free(heap->large_set.slots);
+  memset(heap, 0, sizeof(struct Heap));
+  heap->threshold = HEAP_MIN_THRESHOLD;
+}
+
+struct Heap* createHeap(void) {
+  struct Heap* new_heap = (struct Heap*)calloc(1, sizeof(struct Heap));
+  new_heap->threshold = HEAP_MIN_THRESHOLD;
+  return new_heap;
+}
+
+void setHeap(struct Heap* new_heap) {
+  heap = new_heap ? new_heap : &process_heap;
+}
+
+struct Heap* getHeap(void) {
+  return heap;
+}
+
+void freeHeap(struct Heap* old_heap) {
+  struct Heap* current = heap;
+  heap = old_heap;
+  disposeHeap();
+  heap = current;
+  free(old_heap);
+}
@@ -0,0 +1,70 @@
+#ifndef __HEAP__
+#define __HEAP__
+
+#include <stddef.h>
+
+/* managed heap for the strings, arrays, maps and bigints made at run
+ * time; literals point into the source and are never managed. every
+ * block carries the kind of what it holds. small blocks are bump
+ * allocated from aligned chunks, and after a collection dead blocks are
+ * reused through size class free lists. large blocks get an allocation
+ * each.
+ *
+ * a collection is a precise mark-sweep. the roots are the locals and
+ * operand stacks of the VMContext chain plus the entries of the maps
+ * found there, so a value the vm still needs must sit in one of those
+ * slots while allocString or allocObject runs. allocObject with a NULL
+ * ctx never collects, and the vm calls heapSafepoint once the result
+ * of such an allocation is on its stack. a collection starts once the
+ * bytes allocated since the last one pass the bytes that survived it
+ * (at least HEAP_MIN_THRESHOLD), which keeps the heap within a small
+ * factor of the live data. short scripts never collect: their chunks
+ * are released in one shot by disposeHeap. without a chain (ctx NULL,
+ * as in code compiled to C) there are no roots and nothing is collected.
+ *
+ * every thread allocates from its current heap, the process heap unless
+ * setHeap picked another. a heap is only ever used by one thread at a
+ * time and its collections see only the VMContext chain passed in, so a
+ * scheduler gives each script a heap of its own.
+ *
+ * views are buffers that strings point into anywhere, for input read
+ * without a copy per string. allocView buffers are pinned until
+ * releaseView, mapView maps a file read only; either lives on while a
+ * string into it is reachable. natives have no frames of their own, so
+ * the vm names its frames with setHeapRoots before a native call; a view
+ * allocated then may collect, and so may an object a native allocates
+ * with getHeapRoots as its ctx */
+
+#define BLOCK_STRING 0
+#define BLOCK_ARRAY 1
+#define BLOCK_MAP 2
+#define BLOCK_BIGINT 3
+/* the entry table of a map, reached through the map */
+#define BLOCK_ENTRIES 4
+#define BLOCK_KINDS 5
+
+#ifndef HEAP_MIN_THRESHOLD
+#define HEAP_MIN_THRESHOLD (4 * 1024 * 1024)
+#endif
+
+struct VMContext;
+struct Heap;
+
+char* allocString(struct VMContext* ctx, size_t size);
+void* allocObject(struct VMContext* ctx, int kind, size_t size);
+void heapSafepoint(struct VMContext* ctx);
+char* allocView(size_t size);
+char* mapView(int fd, size_t size);
+void releaseView(char* data);
+void setHeapRoots(struct VMContext* ctx);
+struct VMContext* getHeapRoots(void);
+void collectHeap(struct VMContext* ctx);
+void printHeapStats(void);
+size_t heapAllocatedBytes(void);
+void disposeHeap(void);
+struct Heap* createHeap(void);
+void setHeap(struct Heap* heap);
+struct Heap* getHeap(void);
+void freeHeap(struct Heap* heap);
+
+#endif
@@ -0,0 +1,485 @@
+/* realpath, st_mtim, open_memstream and fmemopen */
+#define _DEFAULT_SOURCE
+
+#include "ast.h"
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "lexer.h"
+#include "import.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define OBJECT_MAGIC "SCO2"
+/* objects of another build of scriptC may number the ops differently */
+#define OBJECT_BUILD __DATE__ " " __TIME__
+
+extern Node ast;
+extern int yyparse(void);
+
+/* every object loaded by this process, and the import nodes of the
+ * sources compiled so far with the object each one names */
+static Object* objects;
+static int object_size;
+static Node* import_nodes;
+static Object* import_objects;
+static int import_size;
+
+int stampSource(const char* path, struct SourceStamp* stamp) {
+  struct stat st;
+  if(stat(path, &st)) {
+    return 1;
+  }
+  stamp->size = st.st_size;
+  stamp->sec = st.st_mtim.tv_sec;
+  stamp->nsec = st.st_mtim.tv_nsec;
+  return 0;
+}
+
+static unsigned hashBytes(unsigned hash, const void* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  for(size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static unsigned hashInterface(Object obj) {
+  unsigned hash = 2166136261u;
+  for(int i = 0; i < obj->func_size; i++) {
+    struct ObjectFunction* func = &obj->funcs[i];
+    if(func->exported) {
+      hash = hashBytes(hash, func->name, strlen(func->name)+1);
+      hash = hashBytes(hash, &func->arg_size, sizeof(int));
+      hash = hashBytes(hash, &func->returns, sizeof(int));
+    }
+  }
+  return hash;
+}
+
+const char* getObjectPath(int index) {
+  return index < object_size ? objects[index]->path : NULL;
+}
+
+int findImportSymbol(Object obj, const char* name) {
+  for(int i = 0; i < obj->import_size; i++) {
+    Object import = obj->imports[i];
+    for(int j = 0; j < import->func_size; j++) {
+      if(import->funcs[j].exported && !strcmp(import->funcs[j].name, name)) {
+        return import->link_base + j;
+      }
+    }
+  }
+  fprintf(stderr, "Error: %s calls %s, which none of its imports exports\n", obj->path, name);
+  exit(1);
+}
+
+/* the newest entry first: a node of a source disposed since may have
+ * had the same address */
+Object getImport(Node node) {
+  for(int i = import_size - 1; i >= 0; i--) {
+    if(import_nodes[i] == node) {
+      return import_objects[i];
+    }
+  }
+  return NULL;
+}
+
+/* the object file format: the header, the imports with the interface
+ * hash each had when this one was compiled, the symbols and the
+ * functions. it is a cache for this machine, in its byte order */
+
+static void writeInt(FILE* file, int32_t val) {
+  fwrite(&val, sizeof(val), 1, file);
+}
+
+static void writeString(FILE* file, const char* str) {
+  int32_t len = strlen(str);
+  writeInt(file, len);
+  fwrite(str, 1, len, file);
+}
+
+static int readInt(FILE* file, int32_t* val) {
+  return fread(val, sizeof(*val), 1, file) != 1;
+}
+
+static char* readString(FILE* file) {
+  int32_t len;
+  if(readInt(file, &len) || len < 0 || len > PATH_MAX * 16) {
+    return NULL;
+  }
+  char* str = (char*)malloc(len+1);
+  if(fread(str, 1, len, file) != (size_t)len) {
+    free(str);
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+static void writeObject(FILE* file, Object obj, struct SourceStamp* stamp) {
+  fwrite(OBJECT_MAGIC, 1, 4, file);
+  writeString(file, OBJECT_BUILD);
+  writeInt(file, sc_optimize);
+  fwrite(stamp, sizeof(*stamp), 1, file);
+  writeInt(file, obj->import_size);
+  for(int i = 0; i < obj->import_size; i++) {
+    writeString(file, obj->imports[i]->path);
+    writeInt(file, obj->imports[i]->interface);
+  }
+  writeInt(file, obj->symbol_size);
+  for(int i = 0; i < obj->symbol_size; i++) {
+    writeString(file, obj->symbols[i]);
+  }
+  writeInt(file, obj->func_size);
+  for(int i = 0; i < obj->func_size; i++) {
+    struct ObjectFunction* func = &obj->funcs[i];
+    writeString(file, func->name);
+    writeInt(file, func->arg_size);
+    writeInt(file, func->returns);
+    writeInt(file, func->exported);
+    writeInt(file, func->size);
+    for(int j = 0; j < func->size; j++) {
+      writeInt(file, func->code[j].op);
+      fwrite(&func->code[j].int_val, sizeof(int64_t), 1, file);
+      if(func->code[j].op == Isconst) {
+        writeString(file, func->code[j].string);
+      }
+    }
+  }
+}
+
+static Object loadObject(const char* path);
+
+/* the imports of a cached object are loaded first; it is stale when
+ * the source changed or an import's interface differs from the one it
+ * was compiled against */
+static int readObject(FILE* file, Object obj, struct SourceStamp* stamp) {
+  char magic[4];
+  int32_t level, size, val;
+  struct SourceStamp recorded;
+  if(fread(magic, 1, 4, file) != 4 || memcmp(magic, OBJECT_MAGIC, 4)) {
+    return 1;
+  }
+  char* build = readString(file);
+  int same_build = build && !strcmp(build, OBJECT_BUILD);
+  free(build);
+  if(!same_build || readInt(file, &level) || level != sc_optimize
+    || fread(&recorded, sizeof(recorded), 1, file) != 1 || (stamp && memcmp(&recorded, stamp, sizeof(recorded)))
+    || readInt(file, &size)) {
+    return 1;
+  }
+  obj->imports = (Object*)calloc(size, sizeof(Object));
+  for(obj->import_size = 0; obj->import_size < size; obj->import_size++) {
+    char* path = readString(file);
+    if(path == NULL || readInt(file, &val)) {
+      free(path);
+      return 1;
+    }
+    Object import = loadObject(path);
+    free(path);
+    obj->imports[obj->import_size] = import;
+    if(import->interface != (unsigned)val) {
+      return 1;
+    }
+  }
+  if(readInt(file, &size)) {
+    return 1;
+  }
+  obj->symbols = (char**)calloc(size, sizeof(char*));
+  for(obj->symbol_size = 0; obj->symbol_size < size; obj->symbol_size++) {
+    if((obj->symbols[obj->symbol_size] = readString(file)) == NULL) {
+      return 1;
+    }
+  }
+  if(readInt(file, &size)) {
+    return 1;
+  }
+  obj->funcs = (struct ObjectFunction*)calloc(size, sizeof(struct ObjectFunction));
+  for(obj->func_size = 0; obj->func_size < size; obj->func_size++) {
+    struct ObjectFunction* func = &obj->funcs[obj->func_size];
+    if((func->name = readString(file)) == NULL || readInt(file, &func->arg_size) || readInt(file, &func->returns)
+      || readInt(file, &func->exported) || readInt(file, &func->size) || func->size < 0) {
+      return 1;
+    }
+    func->code = (struct ScriptCInstruction*)calloc(func->size, sizeof(struct ScriptCInstruction));
+    for(int j = 0; j < func->size; j++) {
+      int32_t op;
+      if(readInt(file, &op) || fread(&func->code[j].int_val, sizeof(int64_t), 1, file) != 1) {
+        return 1;
+      }
+      func->code[j].op = op;
+      if(op == Isconst && (func->code[j].string = readString(file)) == NULL) {
+        return 1;
+      }
+    }
+    obj->export_size += func->exported;
+  }
+  obj->interface = hashInterface(obj);
+  return 0;
+}
+
+static void clearObject(Object obj) {
+  for(int i = 0; i < obj->func_size; i++) {
+    for(int j = 0; j < obj->funcs[i].size; j++) {
+      if(obj->funcs[i].code[j].op == Isconst) {
+        free(obj->funcs[i].code[j].string);
+      }
+    }
+    free(obj->funcs[i].name);
+    free(obj->funcs[i].code);
+  }
+  free(obj->funcs);
+  for(int i = 0; i < obj->symbol_size; i++) {
+    free(obj->symbols[i]);
+  }
+  free(obj->symbols);
+  free(obj->imports);
+  obj->funcs = NULL;
+  obj->func_size = 0;
+  obj->export_size = 0;
+  obj->symbols = NULL;
+  obj->symbol_size = 0;
+  obj->imports = NULL;
+  obj->import_size = 0;
+}
+
+static int addSymbol(Object obj, const char* name) {
+  for(int i = 0; i < obj->symbol_size; i++) {
+    if(!strcmp(obj->symbols[i], name)) {
+      return i;
+    }
+  }
+  obj->symbols = (char**)realloc(obj->symbols, sizeof(char*)*(obj->symbol_size+1));
+  obj->symbols[obj->symbol_size] = (char*)name;
+  return obj->symbol_size++;
+}
+
+/* the functions lowered from the file's own source become the object;
+ * the ones linked in from its imports become symbols */
+static void collectObject(Object obj, Module module) {
+  int* index = (int*)malloc(sizeof(int)*module->size);
+  obj->funcs = (struct ObjectFunction*)calloc(module->size, sizeof(struct ObjectFunction));
+  for(int i = 1; i < module->size; i++) {
+    CompilerContext ctx = module->ctxList[i];
+    index[i] = -1;
+    if(ctx->node == NULL) {
+      continue;
+    }
+    struct ObjectFunction* func = &obj->funcs[obj->func_size];
+    index[i] = obj->func_size++;
+    func->name = module->names[i];
+    for(ListEntry entry = ctx->node->child[1]->list->elements; entry; entry = entry->next) {
+      func->arg_size++;
+    }
+    func->returns = module->returns[i];
+    func->exported = ctx->prev == module->ctxList[0];
+    obj->export_size += func->exported;
+  }
+  for(int i = 1; i < module->size; i++) {
+    CompilerContext ctx = module->ctxList[i];
+    if(index[i] == -1) {
+      continue;
+    }
+    struct ObjectFunction* func = &obj->funcs[index[i]];
+    func->size = ctx->id;
+    func->code = (struct ScriptCInstruction*)malloc(sizeof(struct ScriptCInstruction)*ctx->id);
+    int j = 0;
+    for(InstList list = ctx->root; list; list = list->next, j++) {
+      func->code[j] = *list->inst;
+      if(list->inst->op == Ijump || list->inst->op == Iifcmp) {
+        func->code[j].jump = ctx->label_list[list->inst->label_id];
+      } else if(list->inst->op == Icase) {
+        func->code[j].case_jump = ctx->label_list[list->inst->label_id];
+      } else if(list->inst->op == Icall) {
+        int callee = list->inst->func_id;
+        func->code[j].func_id = index[callee] != -1 ? index[callee] : -1-addSymbol(obj, module->names[callee]);
+      } else if(list->inst->op == Incall) {
+        func->code[j].func_id = addSymbol(obj, getNativeName(list->inst->func_id));
+      }
+    }
+  }
+  free(index);
+}
+
+static void disposeModule(Module module) {
+  for(int i = 0; i < module->size; i++) {
+    CompilerContext ctx = module->ctxList[i];
+    disposeInstList(ctx->root);
+    free(ctx->label_list);
+    disposeCompilerContext(ctx);
+    free(ctx);
+  }
+  free(module->ctxList);
+  free(module->codePoints);
+  free(module->returns);
+  free(module->names);
+  free(module->pool);
+  free(module);
+}
+
+static void checkImportedSource(Node source, const char* path) {
+  for(ListEntry entry = source->list->elements; entry; entry = entry->next) {
+    Node node = entry->node;
+    if(node && node->type != SC_FUNCDEF && node->type != SC_CONST && node->type != SC_IMPORT) {
+      fprintf(stderr, "Error: %s: an imported file holds only def, const and import\n", path);
+      exit(1);
+    }
+  }
+}
+
+/* parses and lowers the file while the importing one is put aside, and
+ * returns the object as written to the cache */
+static char* compileObject(Object obj, struct SourceStamp* stamp, size_t* length) {
+  Node importer = ast;
+  void* saved = saveSource();
+  if(openSource(obj->path)) {
+    fprintf(stderr, "File [%s] is not found!\n", obj->path);
+    exit(1);
+  }
+  if(yyparse()) {
+    fprintf(stderr, "Error ! Error ! Error !\n");
+    exit(1);
+  }
+  Node source = ast;
+  int imports_before = import_size;
+  checkImportedSource(source, obj->path);
+  if(loadImports(source, obj->path)) {
+    exit(1);
+  }
+  for(ListEntry entry = source->list->elements; entry; entry = entry->next) {
+    if(entry->node && entry->node->type == SC_IMPORT) {
+      obj->imports = (Object*)realloc(obj->imports, sizeof(Object)*(obj->import_size+1));
+      obj->imports[obj->import_size++] = getImport(entry->node);
+    }
+  }
+  Module module = createModule();
+  createCompilerContext(NULL);
+  lowerModule(source);
+  collectObject(obj, module);
+  obj->interface = hashInterface(obj);
+  char* buffer = NULL;
+  FILE* file = open_memstream(&buffer, length);
+  writeObject(file, obj, stamp);
+  fclose(file);
+  disposeModule(module);
+  /* names and strings still point into the source */
+  free(obj->funcs);
+  free(obj->symbols);
+  free(obj->imports);
+  obj->funcs = NULL;
+  obj->func_size = obj->export_size = 0;
+  obj->symbols = NULL;
+  obj->symbol_size = 0;
+  obj->imports = NULL;
+  obj->import_size = 0;
+  import_size = imports_before;
+  disposeNode(source);
+  closeSource();
+  restoreSource(saved);
+  ast = importer;
+  return buffer;
+}
+
+static Object loadObject(const char* path) {
+  for(int i = 0; i < object_size; i++) {
+    if(!strcmp(objects[i]->path, path)) {
+      if(objects[i]->loading) {
+        fprintf(stderr, "Error: %s imports itself\n", path);
+        exit(1);
+      }
+      return objects[i];
+    }
+  }
+  Object obj = (Object)calloc(1, sizeof(struct Object));
+  obj->path = (char*)malloc(strlen(path)+1);
+  strcpy(obj->path, path);
+  obj->loading = 1;
+  objects = (Object*)realloc(objects, sizeof(Object)*(object_size+1));
+  objects[object_size++] = obj;
+  struct SourceStamp stamp;
+  if(stampSource(path, &stamp)) {
+    fprintf(stderr, "File [%s] is not found!\n", path);
+    exit(1);
+  }
+  char* cache = (char*)malloc(strlen(path)+2);
+  sprintf(cache, "%so", path);
+  FILE* file = fopen(cache, "rb");
+  int stale = file == NULL || readObject(file, obj, &stamp);
+  if(file) {
+    fclose(file);
+  }
+  if(stale) {
+    clearObject(obj);
+    if(sc_debug) {
+      fprintf(stderr, "import: compile %s\n", path);
+    }
+    size_t length;
+    char* buffer = compileObject(obj, &stamp, &length);
+    /* written aside and renamed, so a reader never sees half a file */
+    char* temp = (char*)malloc(strlen(cache)+5);
+    sprintf(temp, "%s.tmp", cache);
+    file = fopen(temp, "wb");
+    if(file && fwrite(buffer, 1, length, file) == length && fclose(file) == 0) {
+      rename(temp, cache);
+    } else {
+      if(file) {
+        fclose(file);
+      }
+      remove(temp);
+    }
+    free(temp);
+    file = fmemopen(buffer, length, "rb");
+    if(readObject(file, obj, NULL)) {
+      fprintf(stderr, "Error: cannot read the object of %s\n", path);
+      exit(1);
+    }
+    fclose(file);
+    free(buffer);
+  } else if(sc_debug) {
+    fprintf(stderr, "import: %s from %s\n", path, cache);
+  }
+  free(cache);
+  obj->loading = 0;
+  return obj;
+}
+
+/* resolves each top level import against the directory of the file that
+ * imports it, or the working directory for stdin */
+int loadImports(Node source, const char* path) {
+  if(source == NULL || source->list == NULL) {
+    return 0;
+  }
+  for(ListEntry entry = source->list->elements; entry; entry = entry->next) {
+    Node node = entry->node;
+    if(node == NULL || node->type != SC_IMPORT) {
+      continue;
+    }
+    const char* name = node->child[0]->string;
+    const char* slash = path ? strrchr(path, '/') : NULL;
+    char* joined = (char*)malloc(strlen(name) + (slash ? slash - path + 1 : 0) + 1);
+    if(slash && name[0] != '/') {
+      sprintf(joined, "%.*s%s", (int)(slash - path + 1), path, name);
+    } else {
+      strcpy(joined, name);
+    }
+    char resolved[PATH_MAX];
+    if(realpath(joined, resolved) == NULL) {
+      fprintf(stderr, "File [%s] is not found!\n", joined);
+      free(joined);
+      return 1;
+    }
+    free(joined);
+    Object obj = loadObject(resolved);
+    import_nodes = (Node*)realloc(import_nodes, sizeof(Node)*(import_size+1));
+    import_objects = (Object*)realloc(import_objects, sizeof(Object)*(import_size+1));
+    import_nodes[import_size] = node;
+    import_objects[import_size] = obj;
+    import_size++;
+  }
+  return 0;
+}
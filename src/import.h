@@ -0,0 +1,63 @@
+#ifndef __IMPORT__
+#define __IMPORT__
+
+#include "ast.h"
+#include "compiler.h"
+
+/* import "file.sc"; compiles file.sc on its own into an object of
+ * relocatable functions and caches it next to the source as file.sco.
+ * an imported file holds only def, const and import; its top level
+ * functions are exported, the ones nested in them are not. in the code
+ * of an object a jump is an index into its function, a call of its own
+ * functions is an index into funcs and any other call names a symbol:
+ * a function exported by one of its imports, or a native. the compiler
+ * links an object into the module once, after its imports, and resolves
+ * the symbols then.
+ *
+ * a cached object is reused while its source is unchanged and every
+ * import still exports the same interface (names, arities and whether
+ * they return), so editing the body of a shared function only compiles
+ * that file again */
+
+struct ObjectFunction {
+  char* name;
+  int arg_size;
+  int returns;
+  int exported;
+  int size;
+  struct ScriptCInstruction* code;
+};
+
+struct Object {
+  char* path;
+  struct ObjectFunction* funcs;
+  int func_size;
+  int export_size;
+  char** symbols;
+  int symbol_size;
+  struct Object** imports;
+  int import_size;
+  unsigned interface;
+  int loading;
+  /* where funcs start in the module it was last linked into */
+  Module linked_module;
+  int link_base;
+};
+
+typedef struct Object* Object;
+
+/* the size and modification time of a source a cache was made from */
+struct SourceStamp {
+  int64_t size;
+  int64_t sec;
+  int64_t nsec;
+};
+
+int loadImports(Node source, const char* path);
+Object getImport(Node node);
+int findImportSymbol(Object obj, const char* name);
+int stampSource(const char* path, struct SourceStamp* stamp);
+/* the source of every object loaded so far, NULL past the last */
+const char* getObjectPath(int index);
+
+#endif
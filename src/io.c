@@ -0,0 +1,327 @@
+/* posix read, open and fstat */
+#define _DEFAULT_SOURCE
+
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* input natives. a stream reads a file or stdin (stream 0) in chunks of
+ * STREAM_CHUNK bytes into heap views, and readline and readfield return
+ * strings into the chunk: the delimiter is overwritten with a NUL, so a
+ * line costs no allocation and no copy. only a line that straddles two
+ * chunks is moved to the front of the next one. a chunk stays alive as
+ * long as a string into it does, so lines can be kept in locals and
+ * maps like any other string.
+ *
+ * the chunks live in the heap of the script that opened the stream, so
+ * under -w a stream belongs to that script and the others get an error.
+ * stdin belongs to the first script that reads it, until that one ends;
+ * the next reader goes on after the last chunk the first one read */
+
+#ifndef STREAM_CHUNK
+#define STREAM_CHUNK (1024 * 1024)
+#endif
+#define STREAM_MAX 64
+
+struct Stream {
+  int fd;
+  char* buffer;
+  size_t capacity;
+  char* pos;
+  char* end;
+  /* read returned 0, and then no data is left either */
+  int drained;
+  int eof;
+  /* readfield ended a field at a newline; the next call ends the line */
+  int line_end;
+  /* the heap of the chunks, NULL while stdin is unclaimed */
+  struct Heap* owner;
+};
+
+static struct Stream stdin_stream;
+/* the lock guards open and close taking a slot and claiming stdin */
+static struct Stream* streams[STREAM_MAX] = { &stdin_stream };
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct Stream* createStream(int fd) {
+  struct Stream* stream = (struct Stream*)calloc(1, sizeof(struct Stream));
+  stream->fd = fd;
+  stream->owner = getHeap();
+  return stream;
+}
+
+static struct Stream* getStream(Type arg, const char* name) {
+  if(arg->type != TYPE_INT || arg->int_val < 0 || arg->int_val >= STREAM_MAX) {
+    fprintf(stderr, "type error of %s: not a stream\n", name);
+    return NULL;
+  }
+  struct Heap* owner = NULL;
+  pthread_mutex_lock(&stream_lock);
+  struct Stream* stream = streams[arg->int_val];
+  if(stream == &stdin_stream && stream->owner == NULL) {
+    stream->owner = getHeap();
+  }
+  if(stream) {
+    owner = stream->owner;
+  }
+  pthread_mutex_unlock(&stream_lock);
+  if(stream == NULL) {
+    fprintf(stderr, "%s: stream %d is not open\n", name, (int)arg->int_val);
+  } else if(owner != getHeap()) {
+    fprintf(stderr, "%s: stream %d belongs to another script\n", name, (int)arg->int_val);
+    return NULL;
+  }
+  return stream;
+}
+
+/* keeps the unread bytes and reads more behind them, into a new chunk
+ * because strings may still point into the old one. 0 at the end */
+static int fillStream(struct Stream* stream) {
+  if(stream->drained) {
+    return 0;
+  }
+  size_t rest = stream->end - stream->pos;
+  size_t capacity = STREAM_CHUNK;
+  while(capacity < rest * 2) {
+    capacity *= 2;
+  }
+  /* one more byte for the NUL after a last line without a newline */
+  char* buffer = allocView(capacity + 1);
+  memcpy(buffer, stream->pos, rest);
+  if(stream->buffer) {
+    releaseView(stream->buffer);
+  }
+  stream->buffer = buffer;
+  stream->capacity = capacity;
+  stream->pos = buffer;
+  stream->end = buffer + rest;
+  while(stream->end < buffer + capacity) {
+    ssize_t n = read(stream->fd, stream->end, buffer + capacity - stream->end);
+    if(n <= 0) {
+      stream->drained = 1;
+      break;
+    }
+    stream->end += n;
+  }
+  return stream->end > buffer + rest;
+}
+
+static void setString(Type ret, char* str) {
+  ret->type = TYPE_STRING;
+  ret->string = str;
+}
+
+/* the next line without its newline, "" and eof at the end */
+static int native_readline(Type args, int arg_size, Type ret) {
+  struct Stream* stream = getStream(&args[0], "readline");
+  if(stream == NULL) {
+    return 1;
+  }
+  stream->line_end = 0;
+  char* newline = NULL;
+  size_t scanned = 0;
+  while(stream->pos == NULL || (newline = memchr(stream->pos + scanned, '\n', stream->end - stream->pos - scanned)) == NULL) {
+    scanned = stream->end - stream->pos;
+    if(!fillStream(stream)) {
+      break;
+    }
+  }
+  if(newline == NULL) {
+    if(stream->pos == stream->end) {
+      stream->eof = 1;
+      setString(ret, "");
+      return 0;
+    }
+    newline = stream->end;
+  }
+  *newline = '\0';
+  setString(ret, stream->pos);
+  stream->pos = newline < stream->end ? newline + 1 : newline;
+  return 0;
+}
+
+static inline int isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* the next field of the current line, separated by blanks. "" when the
+ * line has no more fields; the call after that starts the next line */
+static int native_readfield(Type args, int arg_size, Type ret) {
+  struct Stream* stream = getStream(&args[0], "readfield");
+  if(stream == NULL) {
+    return 1;
+  }
+  if(stream->line_end) {
+    stream->line_end = 0;
+    setString(ret, "");
+    return 0;
+  }
+  for(;;) {
+    while(stream->pos < stream->end && isBlank(*stream->pos)) {
+      stream->pos++;
+    }
+    if(stream->pos < stream->end || !fillStream(stream)) {
+      break;
+    }
+  }
+  if(stream->pos == stream->end) {
+    stream->eof = 1;
+    setString(ret, "");
+    return 0;
+  }
+  if(*stream->pos == '\n') {
+    stream->pos++;
+    setString(ret, "");
+    return 0;
+  }
+  char* field_end = stream->pos;
+  for(;;) {
+    while(field_end < stream->end && !isBlank(*field_end) && *field_end != '\n') {
+      field_end++;
+    }
+    if(field_end < stream->end) {
+      break;
+    }
+    size_t scanned = field_end - stream->pos;
+    if(!fillStream(stream)) {
+      field_end = stream->end;
+      break;
+    }
+    field_end = stream->pos + scanned;
+  }
+  if(field_end < stream->end) {
+    stream->line_end = *field_end == '\n';
+    *field_end = '\0';
+    setString(ret, stream->pos);
+    stream->pos = field_end + 1;
+  } else {
+    *field_end = '\0';
+    setString(ret, stream->pos);
+    stream->pos = field_end;
+  }
+  return 0;
+}
+
+static int native_eof(Type args, int arg_size, Type ret) {
+  struct Stream* stream = getStream(&args[0], "eof");
+  if(stream == NULL) {
+    return 1;
+  }
+  ret->type = TYPE_BOOL;
+  ret->bool_val = stream->eof;
+  return 0;
+}
+
+static int native_open(Type args, int arg_size, Type ret) {
+  if(args[0].type != TYPE_STRING) {
+    fprintf(stderr, "type error of open\n");
+    return 1;
+  }
+  int fd = open(args[0].string, O_RDONLY);
+  if(fd == -1) {
+    fprintf(stderr, "cannot open %s\n", args[0].string);
+    return 1;
+  }
+  pthread_mutex_lock(&stream_lock);
+  int id = 1;
+  while(id < STREAM_MAX && streams[id] != NULL) {
+    id++;
+  }
+  if(id < STREAM_MAX) {
+    streams[id] = createStream(fd);
+  }
+  pthread_mutex_unlock(&stream_lock);
+  if(id == STREAM_MAX) {
+    close(fd);
+    fprintf(stderr, "too many open streams\n");
+    return 1;
+  }
+  ret->type = TYPE_INT;
+  ret->int_val = id;
+  return 0;
+}
+
+/* the strings read stay valid, their chunks are collected as usual.
+ * stdin stays open */
+static int native_close(Type args, int arg_size, Type ret) {
+  struct Stream* stream = getStream(&args[0], "close");
+  if(stream == NULL) {
+    return 1;
+  }
+  if(stream == &stdin_stream) {
+    return 0;
+  }
+  pthread_mutex_lock(&stream_lock);
+  streams[args[0].int_val] = NULL;
+  pthread_mutex_unlock(&stream_lock);
+  if(stream->buffer) {
+    releaseView(stream->buffer);
+  }
+  close(stream->fd);
+  free(stream);
+  return 0;
+}
+
+/* the whole file as one read only string, mapped rather than read */
+static int native_readfile(Type args, int arg_size, Type ret) {
+  if(args[0].type != TYPE_STRING) {
+    fprintf(stderr, "type error of readfile\n");
+    return 1;
+  }
+  int fd = open(args[0].string, O_RDONLY);
+  struct stat st;
+  if(fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "cannot open %s\n", args[0].string);
+    if(fd != -1) {
+      close(fd);
+    }
+    return 1;
+  }
+  char* data = mapView(fd, (size_t)st.st_size);
+  close(fd);
+  if(data == NULL) {
+    fprintf(stderr, "cannot map %s\n", args[0].string);
+    return 1;
+  }
+  setString(ret, data);
+  return 0;
+}
+
+/* the chunks go with the heap, so stdin is left after its last chunk */
+void closeHeapStreams(struct Heap* heap) {
+  pthread_mutex_lock(&stream_lock);
+  for(int id = 0; id < STREAM_MAX; id++) {
+    struct Stream* stream = streams[id];
+    if(stream == NULL || stream->owner != heap) {
+      continue;
+    }
+    if(stream == &stdin_stream) {
+      stream->buffer = stream->pos = stream->end = NULL;
+      stream->line_end = 0;
+      stream->owner = NULL;
+      continue;
+    }
+    streams[id] = NULL;
+    close(stream->fd);
+    free(stream);
+  }
+  pthread_mutex_unlock(&stream_lock);
+}
+
+void registerIoNatives() {
+  registerNative("open", 1, TYPE_INT, native_open);
+  registerNative("close", 1, NATIVE_VOID, native_close);
+  registerNative("readline", 1, TYPE_STRING, native_readline);
+  registerNative("readfield", 1, TYPE_STRING, native_readfield);
+  registerNative("eof", 1, TYPE_BOOL, native_eof);
+  registerNative("readfile", 1, TYPE_STRING, native_readfile);
+}
@@ -0,0 +1,855 @@
+#include "ast.h"
+#include "compiler.h"
+#include "vm.h"
+#include "ir.h"
+#include "native.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static const char* ir_opnames[] = {
+#define DEFINE_NAME(NAME) #NAME,
+  IR_EACH(DEFINE_NAME)
+#undef DEFINE_NAME
+};
+
+static IRValue createValue(IRFunction func, int kind, IRBlock block) {
+  IRValue val = (IRValue)calloc(1, sizeof(struct IRValue));
+  val->id = func->value_size;
+  val->kind = kind;
+  val->block = block;
+  val->var_id = -1;
+  val->temp = -1;
+  if(func->value_size % 256 == 0) {
+    func->values = (IRValue*)realloc(func->values, sizeof(IRValue)*(func->value_size+256));
+  }
+  func->values[func->value_size++] = val;
+  return val;
+}
+
+static void appendValue(IRBlock block, IRValue val) {
+  if(block->tail) {
+    block->tail->next = val;
+  } else {
+    block->head = val;
+  }
+  block->tail = val;
+}
+
+static void addArg(IRValue val, IRValue arg) {
+  val->args = (IRValue*)realloc(val->args, sizeof(IRValue)*(val->arg_size+1));
+  val->args[val->arg_size++] = arg;
+}
+
+static inline IRValue resolve(IRValue val) {
+  while(val->replaced) {
+    val = val->replaced;
+  }
+  return val;
+}
+
+static inline int isTerminator(int op) {
+  return op == Ijump || op == Iifcmp || op == Icase || op == Iret || op == Iret_void || op == Iexit;
+}
+
+static inline int isConstant(IRValue val) {
+  if(val->kind != IR_INST) {
+    return 0;
+  }
+  int op = val->inst.op;
+  return op == Iiconst || op == Idconst || op == Isconst || op == Ibconst;
+}
+
+/* SSA construction (Braun et al., "Simple and Efficient Construction of
+ * Static Single Assignment Form") */
+
+static IRValue readVariable(IRFunction func, int var, IRBlock block);
+
+static void writeVariable(int var, IRBlock block, IRValue val) {
+  block->defs[var] = val;
+}
+
+static IRValue createPhi(IRFunction func, int var, IRBlock block) {
+  IRValue phi = createValue(func, IR_PHI, block);
+  phi->var_id = var;
+  block->phis = (IRValue*)realloc(block->phis, sizeof(IRValue)*(block->phi_size+1));
+  block->phis[block->phi_size++] = phi;
+  return phi;
+}
+
+static void addPhiOperands(IRFunction func, IRValue phi) {
+  IRBlock block = phi->block;
+  for(int i = 0; i < block->pred_size; i++) {
+    addArg(phi, readVariable(func, phi->var_id, block->preds[i]));
+  }
+}
+
+static IRValue readVariableRecursive(IRFunction func, int var, IRBlock block) {
+  IRValue val;
+  if(!block->sealed) {
+    val = createPhi(func, var, block);
+    block->incomplete = (IRValue*)realloc(block->incomplete, sizeof(IRValue)*(block->incomplete_size+1));
+    block->incomplete[block->incomplete_size++] = val;
+  } else if(block->pred_size == 0) {
+    val = func->undefs[var];
+  } else if(block->pred_size == 1) {
+    val = readVariable(func, var, block->preds[0]);
+  } else {
+    val = createPhi(func, var, block);
+    writeVariable(var, block, val);
+    addPhiOperands(func, val);
+  }
+  writeVariable(var, block, val);
+  return val;
+}
+
+static IRValue readVariable(IRFunction func, int var, IRBlock block) {
+  if(block->defs[var]) {
+    return block->defs[var];
+  }
+  return readVariableRecursive(func, var, block);
+}
+
+static void sealBlock(IRFunction func, IRBlock block) {
+  for(int i = 0; i < block->incomplete_size; i++) {
+    addPhiOperands(func, block->incomplete[i]);
+  }
+  block->incomplete_size = 0;
+  block->sealed = 1;
+}
+
+static void trySealBlock(IRFunction func, IRBlock block) {
+  if(block->sealed) {
+    return;
+  }
+  for(int i = 0; i < block->pred_size; i++) {
+    if(!block->preds[i]->filled) {
+      return;
+    }
+  }
+  sealBlock(func, block);
+}
+
+static void removeTrivialPhis(IRFunction func) {
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    for(int i = 0; i < func->value_size; i++) {
+      IRValue phi = func->values[i];
+      if(phi->kind != IR_PHI || phi->replaced) {
+        continue;
+      }
+      IRValue same = NULL;
+      int trivial = 1;
+      for(int j = 0; j < phi->arg_size; j++) {
+        IRValue op = resolve(phi->args[j]);
+        if(op == same || op == phi) {
+          continue;
+        }
+        if(same != NULL) {
+          trivial = 0;
+          break;
+        }
+        same = op;
+      }
+      if(trivial) {
+        phi->replaced = same ? same : func->undefs[phi->var_id];
+        changed = 1;
+      }
+    }
+  }
+}
+
+static int fillBlock(IRFunction func, IRBlock block, ScriptCInstruction* insts, long end) {
+  IRValue* stack = (IRValue*)malloc(sizeof(IRValue)*(end-block->start+1));
+  int sp = 0;
+  for(int v = 0; v < func->var_count; v++) {
+    block->entry[v] = readVariable(func, v, block);
+  }
+  for(long i = block->start; i < end; i++) {
+    ScriptCInstruction inst = insts[i];
+    IRValue val;
+    if(inst->op == Iloadl) {
+      val = createValue(func, IR_COPY, block);
+      val->var_id = inst->var_id;
+      addArg(val, readVariable(func, inst->var_id, block));
+    } else {
+      val = createValue(func, IR_INST, block);
+    }
+    val->inst = *inst;
+    appendValue(block, val);
+    int pops = 0;
+    int push = 0;
+    switch(inst->op) {
+      case Iiconst: case Idconst: case Isconst: case Ibconst: case Iloadl:
+        push = 1;
+        break;
+      case Istorel:
+        pops = 1;
+        break;
+      case Istorea:
+        writeVariable(inst->var_id, block, val);
+        break;
+      case Iiinc:
+        addArg(val, readVariable(func, inst->inc_var, block));
+        writeVariable(inst->inc_var, block, val);
+        break;
+      case Iwrite: case Iret: case Iifcmp:
+      case Itableswitch: case Ilookupswitch: case Ihashswitch:
+        pops = 1;
+        break;
+      case Ijump: case Icase: case Iret_void: case Iexit:
+        break;
+      case Icall:
+        pops = inst->arg_size;
+        push = 1;
+        break;
+      case Incall:
+        pops = inst->arg_size;
+        push = getNativeRetType(inst->func_id) != NATIVE_VOID;
+        break;
+      case Iaload: case Imget: case Imhas:
+        pops = 2;
+        push = 1;
+        break;
+      case Iastore: case Imput:
+        pops = 3;
+        break;
+      case Imdel:
+        pops = 2;
+        break;
+      case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+      case Iadd: case Isub: case Imul: case Idiv:
+        pops = 2;
+        push = 1;
+        break;
+      case Iminus:
+        pops = 1;
+        push = 1;
+        break;
+      default:
+        free(stack);
+        return 0;
+    }
+    if(pops > sp) {
+      free(stack);
+      return 0;
+    }
+    sp -= pops;
+    for(int j = 0; j < pops; j++) {
+      stack[sp+j]->owner = val;
+      addArg(val, stack[sp+j]);
+    }
+    if(inst->op == Istorel) {
+      writeVariable(inst->var_id, block, val->args[0]);
+    }
+    if(push) {
+      stack[sp++] = val;
+    }
+  }
+  free(stack);
+  return 1;
+}
+
+static void addEdge(IRBlock from, IRBlock to) {
+  from->succs[from->succ_size++] = to;
+  to->preds = (IRBlock*)realloc(to->preds, sizeof(IRBlock)*(to->pred_size+1));
+  to->preds[to->pred_size++] = from;
+}
+
+IRFunction buildIR(CompilerContext ctx) {
+  long size = 0;
+  InstList list = ctx->root;
+  for(; list; list = list->next) {
+    size++;
+  }
+  ScriptCInstruction* insts = (ScriptCInstruction*)malloc(sizeof(ScriptCInstruction)*(size+1));
+  long index = 0;
+  for(list = ctx->root; list; list = list->next) {
+    insts[index++] = list->inst;
+  }
+  char* leader = (char*)calloc(size+1, 1);
+  leader[0] = 1;
+  for(int i = 0; i < ctx->label_count; i++) {
+    long target = ctx->label_list[i];
+    if(target < 0 || target > size) {
+      free(leader);
+      free(insts);
+      return NULL;
+    }
+    leader[target] = 1;
+  }
+  for(long i = 0; i + 1 < size; i++) {
+    if(isTerminator(insts[i]->op)) {
+      leader[i+1] = 1;
+    }
+  }
+  if(size > 0 && (insts[size-1]->op == Iifcmp || insts[size-1]->op == Icase)) {
+    leader[size] = 1;
+  }
+
+  IRFunction func = (IRFunction)calloc(1, sizeof(struct IRFunction));
+  func->ctx = ctx;
+  func->var_count = ctx->var_count;
+  func->undefs = (IRValue*)malloc(sizeof(IRValue)*(func->var_count+1));
+  for(int v = 0; v < func->var_count; v++) {
+    func->undefs[v] = createValue(func, IR_UNDEF, NULL);
+    func->undefs[v]->var_id = v;
+  }
+  IRBlock* blockAt = (IRBlock*)calloc(size+1, sizeof(IRBlock));
+  func->blocks = (IRBlock*)malloc(sizeof(IRBlock)*(size+1));
+  for(long i = 0; i <= size; i++) {
+    if(!leader[i]) {
+      continue;
+    }
+    IRBlock block = (IRBlock)calloc(1, sizeof(struct IRBlock));
+    block->id = func->block_size;
+    block->start = i;
+    block->defs = (IRValue*)calloc(func->var_count+1, sizeof(IRValue));
+    block->entry = (IRValue*)calloc(func->var_count+1, sizeof(IRValue));
+    func->blocks[func->block_size++] = block;
+    blockAt[i] = block;
+  }
+  for(int b = 0; b < func->block_size; b++) {
+    IRBlock block = func->blocks[b];
+    long end = b + 1 < func->block_size ? func->blocks[b+1]->start : size;
+    if(end == block->start) {
+      continue;
+    }
+    ScriptCInstruction last = insts[end-1];
+    if(last->op == Ijump) {
+      addEdge(block, blockAt[ctx->label_list[last->label_id]]);
+    } else if(last->op == Iifcmp || last->op == Icase) {
+      addEdge(block, blockAt[end]);
+      addEdge(block, blockAt[ctx->label_list[last->label_id]]);
+    } else if(!isTerminator(last->op) && b + 1 < func->block_size) {
+      addEdge(block, func->blocks[b+1]);
+    }
+  }
+  for(int b = 0; b < func->block_size; b++) {
+    if(func->blocks[b]->pred_size == 0) {
+      func->blocks[b]->sealed = 1;
+    }
+  }
+  int ok = 1;
+  for(int b = 0; b < func->block_size && ok; b++) {
+    IRBlock block = func->blocks[b];
+    long end = b + 1 < func->block_size ? func->blocks[b+1]->start : size;
+    ok = fillBlock(func, block, insts, end);
+    block->filled = 1;
+    for(int i = 0; i < block->succ_size; i++) {
+      trySealBlock(func, block->succs[i]);
+    }
+  }
+  free(blockAt);
+  free(leader);
+  free(insts);
+  if(!ok) {
+    disposeIR(func);
+    return NULL;
+  }
+  removeTrivialPhis(func);
+  return func;
+}
+
+void disposeIR(IRFunction func) {
+  for(int i = 0; i < func->value_size; i++) {
+    free(func->values[i]->args);
+    free(func->values[i]);
+  }
+  for(int b = 0; b < func->block_size; b++) {
+    IRBlock block = func->blocks[b];
+    free(block->phis);
+    free(block->preds);
+    free(block->defs);
+    free(block->entry);
+    free(block->incomplete);
+    free(block);
+  }
+  free(func->values);
+  free(func->blocks);
+  free(func->undefs);
+  free(func);
+}
+
+static void dumpValueRef(IRValue val) {
+  val = resolve(val);
+  if(val->kind == IR_UNDEF) {
+    fprintf(stderr, " undef");
+  } else {
+    fprintf(stderr, " %%%d", val->id);
+  }
+}
+
+void dumpIR(IRFunction func) {
+  for(int b = 0; b < func->block_size; b++) {
+    IRBlock block = func->blocks[b];
+    fprintf(stderr, "B%d:", block->id);
+    for(int i = 0; i < block->pred_size; i++) {
+      fprintf(stderr, " B%d", block->preds[i]->id);
+    }
+    fprintf(stderr, "\n");
+    for(int i = 0; i < block->phi_size; i++) {
+      IRValue phi = block->phis[i];
+      if(phi->replaced) {
+        continue;
+      }
+      fprintf(stderr, "  %%%d = phi v%d", phi->id, phi->var_id);
+      for(int j = 0; j < phi->arg_size; j++) {
+        dumpValueRef(phi->args[j]);
+      }
+      fprintf(stderr, "\n");
+    }
+    for(IRValue val = block->head; val; val = val->next) {
+      if(val->replaced) {
+        fprintf(stderr, "  %%%d ->", val->id);
+        dumpValueRef(val);
+        fprintf(stderr, "\n");
+        continue;
+      }
+      if(val->kind == IR_COPY) {
+        fprintf(stderr, "  %%%d = copy v%d", val->id, val->var_id);
+      } else {
+        fprintf(stderr, "  %%%d = %s", val->id, ir_opnames[val->inst.op]);
+      }
+      for(int j = 0; j < val->arg_size; j++) {
+        dumpValueRef(val->args[j]);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+}
+
+/* copy propagation: loads refer to the value stored in the variable */
+
+static int runCopyPropagation(IRFunction func) {
+  int changed = 0;
+  for(int i = 0; i < func->value_size; i++) {
+    IRValue val = func->values[i];
+    if(val->kind == IR_COPY && !val->replaced) {
+      val->replaced = resolve(val->args[0]);
+      changed++;
+    }
+  }
+  return changed;
+}
+
+/* global value numbering over the dominator tree */
+
+static IRValue valueOf(IRValue val) {
+  val = resolve(val);
+  while(val->kind == IR_COPY) {
+    val = resolve(val->args[0]);
+  }
+  return val;
+}
+
+static int isPureOp(IRValue val) {
+  if(val->kind != IR_INST) {
+    return 0;
+  }
+  switch(val->inst.op) {
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+    case Iadd: case Isub: case Imul: case Idiv: case Iminus:
+      return 1;
+  }
+  return 0;
+}
+
+static int sameConstant(IRValue a, IRValue b) {
+  if(a->inst.op != b->inst.op) {
+    return 0;
+  }
+  switch(a->inst.op) {
+    case Iiconst:
+      return a->inst.int_val == b->inst.int_val;
+    case Idconst:
+      return !memcmp(&a->inst.double_val, &b->inst.double_val, sizeof(double));
+    case Isconst:
+      return a->inst.string == b->inst.string;
+    case Ibconst:
+      return a->inst.bool_val == b->inst.bool_val;
+  }
+  return 0;
+}
+
+static int sameOperand(IRValue a, IRValue b) {
+  a = valueOf(a);
+  b = valueOf(b);
+  return a == b || (isConstant(a) && isConstant(b) && sameConstant(a, b));
+}
+
+static int isCongruent(IRValue a, IRValue b) {
+  if(a->inst.op != b->inst.op || a->arg_size != b->arg_size) {
+    return 0;
+  }
+  if(a->arg_size == 1) {
+    return sameOperand(a->args[0], b->args[0]);
+  }
+  if(sameOperand(a->args[0], b->args[0]) && sameOperand(a->args[1], b->args[1])) {
+    return 1;
+  }
+  switch(a->inst.op) {
+    case Iadd: case Imul: case Ieq: case Ine:
+      return sameOperand(a->args[0], b->args[1]) && sameOperand(a->args[1], b->args[0]);
+  }
+  return 0;
+}
+
+static int isOwnedArg(IRValue val, IRValue arg) {
+  return arg->owner == val && resolve(arg) == arg;
+}
+
+static int treeSize(IRValue val) {
+  int size = 1;
+  for(int i = 0; i < val->arg_size; i++) {
+    size += isOwnedArg(val, val->args[i]) ? treeSize(val->args[i]) : 1;
+  }
+  return size;
+}
+
+static int isPureTree(IRValue val) {
+  for(int i = 0; i < val->arg_size; i++) {
+    IRValue arg = val->args[i];
+    if(!isOwnedArg(val, arg) || arg->kind == IR_COPY || isConstant(arg)) {
+      continue;
+    }
+    if(!isPureOp(arg) || !isPureTree(arg)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+struct ValueTable {
+  IRValue* leaders;
+  int size;
+  int changed;
+};
+
+static void numberBlock(IRFunction func, IRBlock block, struct ValueTable* table) {
+  int mark = table->size;
+  for(IRValue val = block->head; val; val = val->next) {
+    if(val->replaced || !isPureOp(val)) {
+      continue;
+    }
+    IRValue leader = NULL;
+    for(int i = table->size - 1; i >= 0; i--) {
+      if(isCongruent(table->leaders[i], val)) {
+        leader = table->leaders[i];
+        break;
+      }
+    }
+    if(leader == NULL) {
+      table->leaders[table->size++] = val;
+    } else if(treeSize(val) >= 3 && isPureTree(val)) {
+      val->replaced = leader;
+      table->changed++;
+    }
+  }
+  for(int b = 0; b < func->block_size; b++) {
+    if(func->blocks[b]->idom == block && func->blocks[b] != block) {
+      numberBlock(func, func->blocks[b], table);
+    }
+  }
+  table->size = mark;
+}
+
+static void computeDominators(IRFunction func) {
+  int n = func->block_size;
+  int words = (n + 63) / 64;
+  uint64_t* dom = (uint64_t*)calloc((size_t)n * words, sizeof(uint64_t));
+  IRBlock* worklist = (IRBlock*)malloc(sizeof(IRBlock)*(n+1));
+  int top = 0;
+  for(int b = 0; b < n; b++) {
+    if(func->blocks[b]->pred_size == 0) {
+      func->blocks[b]->reachable = 1;
+      worklist[top++] = func->blocks[b];
+    }
+  }
+  while(top > 0) {
+    IRBlock block = worklist[--top];
+    for(int i = 0; i < block->succ_size; i++) {
+      if(!block->succs[i]->reachable) {
+        block->succs[i]->reachable = 1;
+        worklist[top++] = block->succs[i];
+      }
+    }
+  }
+  for(int b = 0; b < n; b++) {
+    uint64_t* set = dom + (size_t)b * words;
+    if(func->blocks[b]->pred_size == 0) {
+      set[b / 64] |= 1ULL << (b % 64);
+    } else {
+      memset(set, 0xff, sizeof(uint64_t)*words);
+    }
+  }
+  uint64_t* tmp = (uint64_t*)malloc(sizeof(uint64_t)*words);
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    for(int b = 0; b < n; b++) {
+      IRBlock block = func->blocks[b];
+      if(!block->reachable || block->pred_size == 0) {
+        continue;
+      }
+      memset(tmp, 0xff, sizeof(uint64_t)*words);
+      for(int i = 0; i < block->pred_size; i++) {
+        if(!block->preds[i]->reachable) {
+          continue;
+        }
+        uint64_t* pred = dom + (size_t)block->preds[i]->id * words;
+        for(int w = 0; w < words; w++) {
+          tmp[w] &= pred[w];
+        }
+      }
+      tmp[b / 64] |= 1ULL << (b % 64);
+      uint64_t* set = dom + (size_t)b * words;
+      if(memcmp(tmp, set, sizeof(uint64_t)*words)) {
+        memcpy(set, tmp, sizeof(uint64_t)*words);
+        changed = 1;
+      }
+    }
+  }
+  for(int b = 0; b < n; b++) {
+    IRBlock block = func->blocks[b];
+    block->idom = NULL;
+    if(!block->reachable || block->pred_size == 0) {
+      continue;
+    }
+    uint64_t* set = dom + (size_t)b * words;
+    int best = -1;
+    int bestCount = -1;
+    for(int d = 0; d < n; d++) {
+      if(d == b || !(set[d / 64] & (1ULL << (d % 64)))) {
+        continue;
+      }
+      int count = 0;
+      uint64_t* dset = dom + (size_t)d * words;
+      for(int w = 0; w < words; w++) {
+        count += __builtin_popcountll(dset[w]);
+      }
+      if(count > bestCount) {
+        best = d;
+        bestCount = count;
+      }
+    }
+    if(best >= 0) {
+      block->idom = func->blocks[best];
+    }
+  }
+  free(tmp);
+  free(worklist);
+  free(dom);
+}
+
+static int runGlobalValueNumbering(IRFunction func) {
+  computeDominators(func);
+  struct ValueTable table;
+  table.leaders = (IRValue*)malloc(sizeof(IRValue)*(func->value_size+1));
+  table.size = 0;
+  table.changed = 0;
+  for(int b = 0; b < func->block_size; b++) {
+    IRBlock block = func->blocks[b];
+    if(block->reachable && block->pred_size == 0) {
+      numberBlock(func, block, &table);
+    }
+  }
+  free(table.leaders);
+  return table.changed;
+}
+
+/* lowering back to stack code: every store is kept, so a local holds the
+ * same value it held in the original code and any use of that value can
+ * load it from there; values that no local holds get a temporary */
+
+struct Lowering {
+  IRFunction func;
+  int emit;
+  IRValue* holds;
+  InstList root;
+  InstList list;
+  long index;
+  int failed;
+};
+
+static void emitInstruction(struct Lowering* lw, struct ScriptCInstruction* proto) {
+  if(lw->emit) {
+    InstList list = (InstList)malloc(sizeof(struct InstList));
+    list->index = lw->index;
+    list->prev = lw->list;
+    list->next = NULL;
+    list->inst = (ScriptCInstruction)malloc(sizeof(struct ScriptCInstruction));
+    *list->inst = *proto;
+    if(lw->list) {
+      lw->list->next = list;
+    } else {
+      lw->root = list;
+    }
+    lw->list = list;
+  }
+  lw->index++;
+}
+
+static void emitLocal(struct Lowering* lw, int op, int var_id) {
+  struct ScriptCInstruction inst;
+  memset(&inst, 0, sizeof(inst));
+  inst.op = op;
+  inst.var_id = var_id;
+  emitInstruction(lw, &inst);
+}
+
+static void emitTree(struct Lowering* lw, IRValue val);
+
+static void emitReference(struct Lowering* lw, IRValue val, int prefer) {
+  if(isConstant(val)) {
+    emitInstruction(lw, &val->inst);
+    return;
+  }
+  if(prefer >= 0 && lw->holds[prefer] == val) {
+    emitLocal(lw, Iloadl, prefer);
+    return;
+  }
+  for(int v = 0; v < lw->func->var_count; v++) {
+    if(lw->holds[v] == val) {
+      emitLocal(lw, Iloadl, v);
+      return;
+    }
+  }
+  if(val->temp >= 0) {
+    emitLocal(lw, Iloadl, val->temp);
+    return;
+  }
+  if(lw->emit || val->kind != IR_INST || val->inst.op == Istorea || val->inst.op == Iiinc) {
+    lw->failed = 1;
+    return;
+  }
+  val->temp = -2;
+  lw->index++;
+}
+
+static void emitOperand(struct Lowering* lw, IRValue user, IRValue arg) {
+  if(isOwnedArg(user, arg)) {
+    emitTree(lw, arg);
+  } else {
+    emitReference(lw, resolve(arg), arg->kind == IR_COPY ? arg->var_id : -1);
+  }
+}
+
+static void emitTree(struct Lowering* lw, IRValue val) {
+  if(val->kind == IR_COPY) {
+    emitLocal(lw, Iloadl, val->var_id);
+    return;
+  }
+  int op = val->inst.op;
+  if(op != Iiinc) {
+    for(int i = 0; i < val->arg_size; i++) {
+      emitOperand(lw, val, val->args[i]);
+    }
+  }
+  emitInstruction(lw, &val->inst);
+  if(op == Istorel) {
+    lw->holds[val->inst.var_id] = resolve(val->args[0]);
+  } else if(op == Istorea) {
+    lw->holds[val->inst.var_id] = val;
+  } else if(op == Iiinc) {
+    lw->holds[val->inst.inc_var] = val;
+  }
+  if(val->temp >= 0 || val->temp == -2) {
+    emitLocal(lw, Istorel, val->temp);
+    emitLocal(lw, Iloadl, val->temp);
+  }
+}
+
+static void lowerBlocks(struct Lowering* lw) {
+  IRFunction func = lw->func;
+  for(int b = 0; b < func->block_size && !lw->failed; b++) {
+    IRBlock block = func->blocks[b];
+    block->new_start = lw->index;
+    for(int v = 0; v < func->var_count; v++) {
+      lw->holds[v] = resolve(block->entry[v]);
+    }
+    for(IRValue val = block->head; val; val = val->next) {
+      if(val->owner == NULL && !val->replaced) {
+        emitTree(lw, val);
+      }
+    }
+  }
+}
+
+int lowerIR(IRFunction func) {
+  CompilerContext ctx = func->ctx;
+  struct Lowering lw;
+  memset(&lw, 0, sizeof(lw));
+  lw.func = func;
+  lw.holds = (IRValue*)malloc(sizeof(IRValue)*(func->var_count+1));
+  lowerBlocks(&lw);
+  int temps = 0;
+  for(int i = 0; i < func->value_size; i++) {
+    temps += func->values[i]->temp == -2;
+  }
+  if(lw.failed || ctx->var_count + temps >= VAR_MAX) {
+    free(lw.holds);
+    return 0;
+  }
+  for(int i = 0; i < func->value_size; i++) {
+    if(func->values[i]->temp == -2) {
+      func->values[i]->temp = createTempVar();
+    }
+  }
+  lw.emit = 1;
+  lw.index = 0;
+  lowerBlocks(&lw);
+  free(lw.holds);
+  if(lw.failed) {
+    disposeInstList(lw.root);
+    return 0;
+  }
+  for(int i = 0; i < ctx->label_count; i++) {
+    long target = ctx->label_list[i];
+    for(int b = 0; b < func->block_size; b++) {
+      if(func->blocks[b]->start == target) {
+        ctx->label_list[i] = func->blocks[b]->new_start;
+        break;
+      }
+    }
+  }
+  disposeInstList(ctx->root);
+  ctx->root = lw.root;
+  ctx->list = lw.list;
+  ctx->id = lw.index;
+  return 1;
+}
+
+/* pass manager */
+
+static struct IRPass ir_passes[] = {
+  {"copyprop", runCopyPropagation},
+  {"gvn", runGlobalValueNumbering},
+  {NULL, NULL}
+};
+
+void optimizeContext(CompilerContext ctx) {
+  IRFunction func = buildIR(ctx);
+  if(func == NULL) {
+    return;
+  }
+  int changed = 0;
+  for(struct IRPass* pass = ir_passes; pass->name; pass++) {
+    int count = pass->run(func);
+    if(sc_debug) {
+      fprintf(stderr, "@@@@ IR pass %s: %d changes @@@@\n", pass->name, count);
+    }
+    changed += count;
+  }
+  if(sc_debug) {
+    dumpIR(func);
+    fprintf(stderr, "\n");
+  }
+  if(changed) {
+    lowerIR(func);
+  }
+  disposeIR(func);
+}
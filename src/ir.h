@@ -0,0 +1,79 @@
+#ifndef __IR__
+#define __IR__
+
+#include "compiler.h"
+
+/* mid-level IR: basic blocks of SSA values built from the InstList of
+ * a CompilerContext, optimized by a pass manager and lowered back */
+
+#define IR_INST 0
+#define IR_PHI 1
+#define IR_COPY 2
+#define IR_UNDEF 3
+
+struct IRBlock;
+
+struct IRValue {
+  int id;
+  int kind;
+  struct ScriptCInstruction inst;
+  struct IRValue** args;
+  int arg_size;
+  int var_id;
+  struct IRValue* owner;    /* instruction that pops this value, NULL for roots */
+  struct IRValue* replaced; /* forwarding pointer set by passes */
+  struct IRBlock* block;
+  struct IRValue* next;
+  int temp;
+};
+
+struct IRBlock {
+  int id;
+  long start;
+  struct IRValue* head;
+  struct IRValue* tail;
+  struct IRValue** phis;
+  int phi_size;
+  struct IRBlock** preds;
+  int pred_size;
+  struct IRBlock* succs[2];
+  int succ_size;
+  struct IRValue** defs;
+  struct IRValue** entry;
+  struct IRValue** incomplete;
+  int incomplete_size;
+  int sealed;
+  int filled;
+  int reachable;
+  struct IRBlock* idom;
+  long new_start;
+};
+
+struct IRFunction {
+  CompilerContext ctx;
+  struct IRBlock** blocks;
+  int block_size;
+  int var_count;
+  struct IRValue** values;
+  int value_size;
+  struct IRValue** undefs;
+};
+
+typedef struct IRValue* IRValue;
+typedef struct IRBlock* IRBlock;
+typedef struct IRFunction* IRFunction;
+
+typedef int (*ir_pass_func_t)(IRFunction);
+
+struct IRPass {
+  const char* name;
+  ir_pass_func_t run;
+};
+
+IRFunction buildIR(CompilerContext ctx);
+void disposeIR(IRFunction func);
+void dumpIR(IRFunction func);
+int lowerIR(IRFunction func);
+void optimizeContext(CompilerContext ctx);
+
+#endif
@@ -0,0 +1,221 @@
+#include "compiler.h"
+#include "vm.h"
+#include "ir.h"
+#include "layout.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a call site in a loop counts as LOOP_WEIGHT calls per nesting level */
+#define LOOP_WEIGHT 8
+#define LOOP_DEPTH_MAX 6
+#define PROFILE_NAME_MAX 256
+
+struct CallEdge {
+  int callee;
+  long weight;
+};
+
+struct CallNode {
+  struct CallEdge* edges;
+  int edge_size;
+};
+
+static char** profile_names;
+static long* profile_counts;
+static int profile_size;
+
+int loadProfile(const char* path) {
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    fprintf(stderr, "cannot open profile %s\n", path);
+    return 1;
+  }
+  char name[PROFILE_NAME_MAX];
+  long count;
+  while(fscanf(file, "%ld %255s", &count, name) == 2) {
+    profile_names = (char**)realloc(profile_names, sizeof(char*)*(profile_size+1));
+    profile_counts = (long*)realloc(profile_counts, sizeof(long)*(profile_size+1));
+    profile_names[profile_size] = (char*)malloc(strlen(name)+1);
+    strcpy(profile_names[profile_size], name);
+    profile_counts[profile_size] = count;
+    profile_size++;
+  }
+  fclose(file);
+  return 0;
+}
+
+/* one line per function with the calls of its entry point */
+int writeProfile(const char* path, Module module, const long* calls) {
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    fprintf(stderr, "cannot write profile %s\n", path);
+    return 1;
+  }
+  for(int i = 1; i < module->size; i++) {
+    fprintf(file, "%ld %s\n", calls[module->codePoints[i]], module->names[i]);
+  }
+  fclose(file);
+  return 0;
+}
+
+static long getProfileCount(const char* name) {
+  long count = 0;
+  for(int i = 0; i < profile_size; i++) {
+    if(!strcmp(profile_names[i], name)) {
+      count += profile_counts[i];
+    }
+  }
+  return count;
+}
+
+static void addCallEdge(struct CallNode* node, int callee, long weight) {
+  for(int i = 0; i < node->edge_size; i++) {
+    if(node->edges[i].callee == callee) {
+      node->edges[i].weight += weight;
+      return;
+    }
+  }
+  node->edges = (struct CallEdge*)realloc(node->edges, sizeof(struct CallEdge)*(node->edge_size+1));
+  node->edges[node->edge_size].callee = callee;
+  node->edges[node->edge_size].weight = weight;
+  node->edge_size++;
+}
+
+/* the instructions between a backward jump and its target are a loop */
+static void buildCallNode(CompilerContext ctx, struct CallNode* node) {
+  int* depth = (int*)calloc(ctx->id + 1, sizeof(int));
+  int index = 0;
+  for(InstList list = ctx->root; list; list = list->next, index++) {
+    int op = list->inst->op;
+    if(op == Ijump || op == Iifcmp) {
+      int target = ctx->label_list[list->inst->label_id];
+      for(int i = target; i <= index; i++) {
+        depth[i]++;
+      }
+    }
+  }
+  index = 0;
+  for(InstList list = ctx->root; list; list = list->next, index++) {
+    if(list->inst->op == Icall) {
+      long weight = 1;
+      for(int i = 0; i < depth[index] && i < LOOP_DEPTH_MAX; i++) {
+        weight *= LOOP_WEIGHT;
+      }
+      addCallEdge(node, list->inst->func_id, weight);
+    }
+  }
+  free(depth);
+}
+
+static int compareEdges(const void* a, const void* b) {
+  const struct CallEdge* left = (const struct CallEdge*)a;
+  const struct CallEdge* right = (const struct CallEdge*)b;
+  if(left->weight != right->weight) {
+    return left->weight > right->weight ? -1 : 1;
+  }
+  return left->callee - right->callee;
+}
+
+/* depth first from the caller, hottest callee first. the first pass
+ * only follows edges the profile saw taken */
+static void placeFunction(struct CallNode* graph, int id, int* order, int* size, int* placed, int cold) {
+  placed[id] = 1;
+  order[(*size)++] = id;
+  struct CallNode* node = &graph[id];
+  for(int i = 0; i < node->edge_size; i++) {
+    int callee = node->edges[i].callee;
+    if(!placed[callee] && (cold || node->edges[i].weight > 0)) {
+      placeFunction(graph, callee, order, size, placed, cold);
+    }
+  }
+}
+
+void layoutModule(Module module) {
+  int size = module->size;
+  struct CallNode* graph = (struct CallNode*)calloc(size, sizeof(struct CallNode));
+  for(int i = 0; i < size; i++) {
+    buildCallNode(module->ctxList[i], &graph[i]);
+  }
+  for(int i = 0; i < size; i++) {
+    for(int j = 0; profile_size > 0 && j < graph[i].edge_size; j++) {
+      graph[i].edges[j].weight = getProfileCount(module->names[graph[i].edges[j].callee]);
+    }
+    /* a leaf has no edge array at all */
+    if(graph[i].edge_size > 1) {
+      qsort(graph[i].edges, graph[i].edge_size, sizeof(struct CallEdge), compareEdges);
+    }
+  }
+  int* order = (int*)malloc(sizeof(int)*size);
+  int* placed = (int*)calloc(size, sizeof(int));
+  int placed_size = 0;
+  placeFunction(graph, 0, order, &placed_size, placed, 0);
+  /* then what the profile never saw called, behind the hot code */
+  for(int i = 0; i < placed_size; i++) {
+    struct CallNode* node = &graph[order[i]];
+    for(int j = 0; j < node->edge_size; j++) {
+      if(!placed[node->edges[j].callee]) {
+        placeFunction(graph, node->edges[j].callee, order, &placed_size, placed, 1);
+      }
+    }
+  }
+
+  int* new_id = (int*)malloc(sizeof(int)*size);
+  for(int i = 0; i < size; i++) {
+    new_id[i] = -1;
+  }
+  for(int i = 0; i < placed_size; i++) {
+    new_id[order[i]] = i;
+  }
+  long total = 0;
+  long kept = 0;
+  for(int i = 0; i < size; i++) {
+    CompilerContext ctx = module->ctxList[i];
+    total += ctx->id;
+    if(new_id[i] == -1) {
+      if(sc_debug) {
+        fprintf(stderr, "layout: drop %s\n", module->names[i]);
+      }
+      disposeInstList(ctx->root);
+      free(ctx->label_list);
+      disposeCompilerContext(ctx);
+      free(ctx);
+      continue;
+    }
+    kept += ctx->id;
+    for(InstList list = ctx->root; list; list = list->next) {
+      if(list->inst->op == Icall) {
+        list->inst->func_id = new_id[list->inst->func_id];
+      }
+    }
+  }
+  CompilerContext* ctxList = (CompilerContext*)malloc(sizeof(CompilerContext)*size);
+  int* returns = (int*)malloc(sizeof(int)*size);
+  char** names = (char**)malloc(sizeof(char*)*size);
+  for(int i = 0; i < placed_size; i++) {
+    ctxList[i] = module->ctxList[order[i]];
+    returns[i] = module->returns[order[i]];
+    names[i] = module->names[order[i]];
+  }
+  memcpy(module->ctxList, ctxList, sizeof(CompilerContext)*placed_size);
+  memcpy(module->returns, returns, sizeof(int)*placed_size);
+  memcpy(module->names, names, sizeof(char*)*placed_size);
+  module->size = placed_size;
+  if(sc_debug) {
+    fprintf(stderr, "@@@@ Layout: %d of %d functions, %ld of %ld instructions @@@@\n", placed_size, size, kept, total);
+    for(int i = 1; i < placed_size; i++) {
+      fprintf(stderr, "[%d] %s (was %d)\n", i, module->names[i], order[i]);
+    }
+  }
+  free(ctxList);
+  free(returns);
+  free(names);
+  free(new_id);
+  free(order);
+  free(placed);
+  for(int i = 0; i < size; i++) {
+    free(graph[i].edges);
+  }
+  free(graph);
+}
@@ -0,0 +1,19 @@
+#ifndef __LAYOUT__
+#define __LAYOUT__
+
+#include "compiler.h"
+
+/* link time layout of an eagerly compiled module. layoutModule builds
+ * the call graph from the call instructions, drops the functions the
+ * top level code never reaches and renumbers the rest, so that createISeq
+ * places every function right after its caller, hottest callee first.
+ * a call site weighs more the deeper it is nested in loops, or by the
+ * callee's count in a profile loaded with loadProfile. the profile is
+ * written by writeProfile after a run with vm_calls set (-R) and keys
+ * functions by name, so functions sharing a name share a count */
+
+int loadProfile(const char* path);
+int writeProfile(const char* path, Module module, const long* calls);
+void layoutModule(Module module);
+
+#endif
@@ -0,0 +1,457 @@
+/* MAP_ANONYMOUS and clock_gettime */
+#define _DEFAULT_SOURCE
+
+#include "ast.h"
+#include "lexer.h"
+#include "y.tab.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LEX_SSE2 1
+#endif
+
+/* zero bytes after the text, so vector loads may run past its end and
+ * the scan always stops at a NUL */
+#define SOURCE_PADDING 64
+
+static struct Source {
+  char* text;
+  size_t size;
+  size_t map_size; /* 0 when the text was read into the heap */
+  char* cur;
+  char* held_pos; /* the NUL written after the last name */
+  char held; /* and the byte it replaced */
+  const char* token;
+  int token_length;
+} source;
+
+struct Keyword {
+  const char* name;
+  int length;
+  int token;
+};
+
+static const struct Keyword keywords[] = {
+  {"def", 3, DEF},
+  {"if", 2, IF},
+  {"else", 4, ELSE},
+  {"while", 5, WHILE},
+  {"for", 3, FOR},
+  {"return", 6, RETURN},
+  {"break", 5, BREAK},
+  {"continue", 8, CONTINUE},
+  {"switch", 6, SWITCH},
+  {"case", 4, CASE},
+  {"default", 7, DEFAULT},
+  {"print", 5, PRINT},
+  {"const", 5, CONST},
+  {"import", 6, IMPORT},
+  {"None", 4, NONE},
+  {"true", 4, TRUE},
+  {"false", 5, FALSE},
+  {NULL, 0, 0}
+};
+
+static int setSource(char* text, size_t size, size_t map_size) {
+  source.text = text;
+  source.size = size;
+  source.map_size = map_size;
+  source.cur = text;
+  source.held_pos = NULL;
+  source.token = text;
+  source.token_length = 0;
+  return 0;
+}
+
+static int readStdin(void) {
+  size_t cap = 1 << 16;
+  size_t size = 0;
+  size_t n;
+  char* text = (char*)malloc(cap + SOURCE_PADDING);
+  while((n = fread(text + size, 1, cap - size, stdin)) > 0) {
+    size += n;
+    if(size == cap) {
+      cap *= 2;
+      text = (char*)realloc(text, cap + SOURCE_PADDING);
+    }
+  }
+  memset(text + size, 0, SOURCE_PADDING);
+  return setSource(text, size, 0);
+}
+
+/* the file is mapped over an anonymous reservation a little larger than
+ * it, so the padding after the text is zero even when the file ends on a
+ * page boundary */
+int openSource(const char* file) {
+  if(file == NULL) {
+    return readStdin();
+  }
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st)) {
+    return 1;
+  }
+  size_t size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t map_size = (size + SOURCE_PADDING + page - 1) / page * page;
+  char* text = (char*)mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(text == MAP_FAILED) {
+    close(fd);
+    return 1;
+  }
+  if(size > 0 && mmap(text, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(text, map_size);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  return setSource(text, size, map_size);
+}
+
+void closeSource(void) {
+  if(source.map_size) {
+    munmap(source.text, source.map_size);
+  } else {
+    free(source.text);
+  }
+  source.text = NULL;
+}
+
+void* saveSource(void) {
+  struct Source* saved = (struct Source*)malloc(sizeof(struct Source));
+  *saved = source;
+  memset(&source, 0, sizeof(source));
+  return saved;
+}
+
+void restoreSource(void* saved) {
+  source = *(struct Source*)saved;
+  free(saved);
+}
+
+const char* tokenText(void) {
+  return source.token;
+}
+
+int tokenLength(void) {
+  return source.token_length;
+}
+
+static inline int isSpace(int c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline int isDigit(int c) {
+  return c >= '0' && c <= '9';
+}
+
+static inline int isNameStart(int c) {
+  return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+}
+
+static inline int isName(int c) {
+  return isNameStart(c) || isDigit(c);
+}
+
+/* the scanners below look at 16 bytes at a time and stop at the first
+ * byte outside their class; the NUL after the text ends every run */
+
+static char* skipSpace(char* p) {
+#ifdef LEX_SSE2
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  while(isSpace(*p)) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, newline)),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)));
+    unsigned rest = ~_mm_movemask_epi8(hit) & 0xffff;
+    if(rest) {
+      return p + __builtin_ctz(rest);
+    }
+    p += 16;
+  }
+#else
+  while(isSpace(*p)) {
+    p++;
+  }
+#endif
+  return p;
+}
+
+static char* skipName(char* p) {
+#ifdef LEX_SSE2
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i before_a = _mm_set1_epi8('a' - 1);
+  const __m128i after_z = _mm_set1_epi8('z' + 1);
+  const __m128i before_0 = _mm_set1_epi8('0' - 1);
+  const __m128i after_9 = _mm_set1_epi8('9' + 1);
+  const __m128i underscore = _mm_set1_epi8('_');
+  for(;;) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i lower = _mm_or_si128(v, case_bit);
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, before_a), _mm_cmplt_epi8(lower, after_z));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, before_0), _mm_cmplt_epi8(v, after_9));
+    __m128i hit = _mm_or_si128(_mm_or_si128(letter, digit), _mm_cmpeq_epi8(v, underscore));
+    unsigned rest = ~_mm_movemask_epi8(hit) & 0xffff;
+    if(rest) {
+      return p + __builtin_ctz(rest);
+    }
+    p += 16;
+  }
+#else
+  while(isName(*p)) {
+    p++;
+  }
+  return p;
+#endif
+}
+
+/* stops at the closing quote or the end of the text, stepping over a
+ * backslash and the byte after it */
+static char* skipString(char* p, char quote) {
+#ifdef LEX_SSE2
+  const __m128i q = _mm_set1_epi8(quote);
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i zero = _mm_setzero_si128();
+  for(;;) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, backslash)), _mm_cmpeq_epi8(v, zero));
+    unsigned mask = _mm_movemask_epi8(hit);
+    if(!mask) {
+      p += 16;
+      continue;
+    }
+    p += __builtin_ctz(mask);
+    if(*p == '\\' && p[1] != 0) {
+      p += 2;
+      continue;
+    }
+    return p;
+  }
+#else
+  while(*p != quote && *p != 0) {
+    p += *p == '\\' && p[1] != 0 ? 2 : 1;
+  }
+  return p;
+#endif
+}
+
+/* powers of ten that are exact doubles */
+static const double exact_powers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static char* scanDigits(char* p, uint64_t* val, int* wide) {
+  for(; isDigit(*p); p++) {
+    unsigned digit = *p - '0';
+    if(*val > (UINT64_MAX - digit) / 10) {
+      *wide = 1;
+    } else if(!*wide) {
+      *val = *val * 10 + digit;
+    }
+  }
+  return p;
+}
+
+/* an integer literal past int64 is built at run time from parts of 18
+ * digits, ((p0 * 10^18) + p1) * 10^18 + p2 ..., whose int arithmetic
+ * promotes to a bigint */
+#define LITERAL_PART_DIGITS 18
+#define LITERAL_PART 1000000000000000000LL
+
+static Node createBigLiteral(char* p, char* end) {
+  Node node = NULL;
+  long digits = (end - p) % LITERAL_PART_DIGITS;
+  if(digits == 0) {
+    digits = LITERAL_PART_DIGITS;
+  }
+  for(; p < end; p += digits, digits = LITERAL_PART_DIGITS) {
+    int64_t part = 0;
+    for(long i = 0; i < digits; i++) {
+      part = part * 10 + (p[i] - '0');
+    }
+    if(node == NULL) {
+      node = createIntNode(part);
+    } else {
+      node = createArithNode(SC_MUL, node, createIntNode(LITERAL_PART));
+      node = createArithNode(SC_ADD, node, createIntNode(part));
+    }
+  }
+  return node;
+}
+
+/* 0|[1-9][0-9]* with an optional fraction. a float of at most 2^53
+ * significant value and 22 decimals is one exact division; longer ones
+ * go through strtod */
+static int scanNumber(char* p, char** end) {
+  uint64_t val = 0;
+  int wide = 0;
+  char* q = p;
+  if(*q == '0') {
+    q++;
+  } else {
+    q = scanDigits(q, &val, &wide);
+  }
+  if(*q == '.' && isDigit(q[1])) {
+    char* frac = q + 1;
+    q = scanDigits(frac, &val, &wide);
+    long decimals = q - frac;
+    double d;
+    if(!wide && val <= (1ULL << 53) && decimals <= 22) {
+      d = (double)val / exact_powers[decimals];
+    } else {
+      char* text = (char*)malloc(q - p + 1);
+      memcpy(text, p, q - p);
+      text[q - p] = 0;
+      d = strtod(text, NULL);
+      free(text);
+    }
+    *end = q;
+    yylval.node = createFloatNode(d);
+    return FLOAT;
+  }
+  *end = q;
+  yylval.node = wide || val > INT64_MAX ? createBigLiteral(p, q) : createIntNode((int64_t)val);
+  return INT;
+}
+
+static int findKeyword(const char* name, int length) {
+  for(const struct Keyword* k = keywords; k->name; k++) {
+    if(k->length == length && !memcmp(k->name, name, length)) {
+      return k->token;
+    }
+  }
+  return 0;
+}
+
+static int scanName(char* p, char** end) {
+  char* q = skipName(p + 1);
+  int token = findKeyword(p, q - p);
+  *end = q;
+  switch(token) {
+    case 0:
+      /* the byte after a name is never part of another name, so the
+       * next token starts there and reads it back from held */
+      source.held = *q;
+      source.held_pos = q;
+      *q = 0;
+      yylval.node = createNameNode(p);
+      return IDENTIFIER;
+    case NONE:
+      yylval.node = createNode(SC_NONE);
+      break;
+    case TRUE:
+      yylval.node = createBoolNode(1);
+      break;
+    case FALSE:
+      yylval.node = createBoolNode(0);
+      break;
+  }
+  return token;
+}
+
+/* one or two byte operator: c, or with2 when followed by next2 */
+#define OPERATOR2(c, next2, with2) (p[1] == (next2) ? (q = p + 2, (with2)) : (q = p + 1, (c)))
+
+int yylex(void) {
+  char* p = source.cur;
+  char* q;
+  int c = (unsigned char)*p;
+  int token;
+  if(p == source.held_pos) {
+    c = (unsigned char)source.held;
+    source.held_pos = NULL;
+  }
+  if(isSpace(c)) {
+    p = skipSpace(p + 1);
+    c = (unsigned char)*p;
+  }
+  source.token = p;
+  if(isNameStart(c)) {
+    token = scanName(p, &q);
+  } else if(isDigit(c)) {
+    token = scanNumber(p, &q);
+  } else {
+    switch(c) {
+      case 0:
+        source.token_length = 0;
+        source.cur = p;
+        return 0;
+      case '"':
+      case '\'':
+        q = skipString(p + 1, c);
+        if(*q != c) {
+          fprintf(stderr, "unterminated string\n");
+          exit(1);
+        }
+        *q++ = 0;
+        yylval.node = createStringNode(p + 1);
+        token = STRING;
+        break;
+      case '+':
+        token = p[1] == '+' ? (q = p + 2, INC) : OPERATOR2('+', '=', ADDEQ);
+        break;
+      case '-':
+        token = p[1] == '-' ? (q = p + 2, DEC) : OPERATOR2('-', '=', SUBEQ);
+        break;
+      case '*':
+        token = OPERATOR2('*', '=', MULEQ);
+        break;
+      case '/':
+        token = OPERATOR2('/', '=', DIVEQ);
+        break;
+      case '<':
+        token = OPERATOR2('<', '=', LE);
+        break;
+      case '>':
+        token = OPERATOR2('>', '=', GE);
+        break;
+      case '=':
+        token = OPERATOR2('=', '=', EQ);
+        break;
+      case '!':
+        token = OPERATOR2('!', '=', NE);
+        break;
+      case '&':
+        token = OPERATOR2('&', '&', AND);
+        break;
+      case '|':
+        token = OPERATOR2('|', '|', OR);
+        break;
+      default:
+        /* punctuation, and any other byte for the parser to reject */
+        q = p + 1;
+        token = c;
+        break;
+    }
+  }
+  source.token_length = q - p;
+  source.cur = q;
+  return token;
+}
+
+void benchmarkLexer(void) {
+  struct timespec start, end;
+  long tokens = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while(yylex()) {
+    tokens++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  fprintf(stderr, "lexed %zu bytes, %ld tokens in %.3f ms: %.1f MB/s\n",
+          source.size, tokens, sec * 1e3, source.size / sec / 1e6);
+}
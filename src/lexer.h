@@ -0,0 +1,20 @@
+#ifndef __LEXER__
+#define __LEXER__
+
+/* hand-written scanner over the source mapped in memory. the mapping is
+ * private and writable: the byte after every name and string is
+ * overwritten with a NUL, so the nodes point into the source instead of
+ * holding copies. the mapping lives until closeSource */
+
+int openSource(const char* file);
+void closeSource(void);
+/* an import is parsed while the importing file is open: saveSource
+ * takes its source aside and restoreSource puts it back */
+void* saveSource(void);
+void restoreSource(void* saved);
+int yylex(void);
+const char* tokenText(void);
+int tokenLength(void);
+void benchmarkLexer(void);
+
+#endif
@@ -0,0 +1,213 @@
+#include "compiler.h"
+#include "vm.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_MIN_CAPACITY 8
+
+/* hash 0 marks an empty slot; 32 bytes per entry, two per cache line */
+struct MapEntry {
+  uint32_t hash;
+  int key_type;
+  union {
+    int64_t int_key;
+    char* string_key;
+  };
+  struct Type value;
+};
+
+static inline uint32_t hashInt(int64_t key) {
+  uint32_t h = (uint32_t)key ^ (uint32_t)((uint64_t)key >> 32);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+static inline uint32_t hashString(const char* str) {
+  uint32_t h = 2166136261u;
+  for(; *str; str++) {
+    h = (h ^ (unsigned char)*str) * 16777619u;
+  }
+  return h;
+}
+
+/* 0 is reserved for empty slots */
+static inline uint32_t hashKey(ScriptCMap map, Type key) {
+  if(key->type == TYPE_INT) {
+    uint32_t h = hashInt(key->int_val);
+    return h ? h : 1;
+  }
+  if(key->string != map->hashed_key) {
+    uint32_t h = hashString(key->string);
+    map->hashed_key = key->string;
+    map->hashed = h ? h : 1;
+  }
+  return map->hashed;
+}
+
+int isMapKey(Type key) {
+  return key->type == TYPE_INT || key->type == TYPE_STRING;
+}
+
+/* the table is allocated right after the map, before a collection
+ * could miss it. a capacity above MAP_MAX_CAPACITY is cut to it */
+ScriptCMap createMap(VMContext ctx, int capacity) {
+  uint64_t need = capacity < MAP_MAX_CAPACITY ? (uint64_t)capacity : MAP_MAX_CAPACITY;
+  uint32_t size = MAP_MIN_CAPACITY;
+  while(size < need + need / 2) {
+    size *= 2;
+  }
+  ScriptCMap map = (ScriptCMap)allocObject(ctx, BLOCK_MAP, sizeof(struct ScriptCMap));
+  map->entries = (struct MapEntry*)allocObject(NULL, BLOCK_ENTRIES, sizeof(struct MapEntry) * size);
+  map->mask = size - 1;
+  map->size = 0;
+  map->hashed_key = NULL;
+  map->hashed = 0;
+  return map;
+}
+
+/* int fast path: a word compare per probe, no string handling */
+static struct MapEntry* findInt(ScriptCMap map, int64_t key, uint32_t hash) {
+  uint32_t slot = hash & map->mask;
+  for(;;) {
+    struct MapEntry* entry = &map->entries[slot];
+    if(entry->hash == 0) {
+      return NULL;
+    }
+    if(entry->hash == hash && entry->key_type == TYPE_INT && entry->int_key == key) {
+      return entry;
+    }
+    slot = (slot + 1) & map->mask;
+  }
+}
+
+static struct MapEntry* findString(ScriptCMap map, const char* key, uint32_t hash) {
+  uint32_t slot = hash & map->mask;
+  for(;;) {
+    struct MapEntry* entry = &map->entries[slot];
+    if(entry->hash == 0) {
+      return NULL;
+    }
+    if(entry->hash == hash && entry->key_type == TYPE_STRING
+        && (entry->string_key == key || !strcmp(entry->string_key, key))) {
+      return entry;
+    }
+    slot = (slot + 1) & map->mask;
+  }
+}
+
+static struct MapEntry* findEntry(ScriptCMap map, Type key, uint32_t hash) {
+  if(key->type == TYPE_INT) {
+    return findInt(map, key->int_val, hash);
+  }
+  return findString(map, key->string, hash);
+}
+
+static struct MapEntry* findFreeSlot(ScriptCMap map, uint32_t hash) {
+  uint32_t slot = hash & map->mask;
+  while(map->entries[slot].hash != 0) {
+    slot = (slot + 1) & map->mask;
+  }
+  return &map->entries[slot];
+}
+
+static void growMap(ScriptCMap map) {
+  struct MapEntry* old = map->entries;
+  uint32_t old_size = map->mask + 1;
+  uint32_t size = old_size * 2;
+  map->entries = (struct MapEntry*)allocObject(NULL, BLOCK_ENTRIES, sizeof(struct MapEntry) * size);
+  map->mask = size - 1;
+  for(uint32_t i = 0; i < old_size; i++) {
+    if(old[i].hash != 0) {
+      *findFreeSlot(map, old[i].hash) = old[i];
+    }
+  }
+}
+
+Type getMap(ScriptCMap map, Type key) {
+  struct MapEntry* entry = findEntry(map, key, hashKey(map, key));
+  return entry ? &entry->value : NULL;
+}
+
+int putMap(ScriptCMap map, Type key, Type value) {
+  uint32_t hash = hashKey(map, key);
+  struct MapEntry* entry = findEntry(map, key, hash);
+  if(entry) {
+    entry->value = *value;
+    return 0;
+  }
+  if(map->size == MAP_MAX_CAPACITY) {
+    return -1;
+  }
+  if((uint32_t)(map->size + 1) * 4 > (map->mask + 1) * 3) {
+    growMap(map);
+  }
+  entry = findFreeSlot(map, hash);
+  entry->hash = hash;
+  entry->key_type = key->type;
+  if(key->type == TYPE_INT) {
+    entry->int_key = key->int_val;
+  } else {
+    entry->string_key = key->string;
+  }
+  entry->value = *value;
+  map->size++;
+  return 1;
+}
+
+/* backward shift deletion: later entries of the probe run move into
+ * the hole, so lookups never need tombstones */
+int deleteMap(ScriptCMap map, Type key) {
+  struct MapEntry* entry = findEntry(map, key, hashKey(map, key));
+  if(entry == NULL) {
+    return 0;
+  }
+  uint32_t hole = (uint32_t)(entry - map->entries);
+  uint32_t slot = hole;
+  for(;;) {
+    slot = (slot + 1) & map->mask;
+    struct MapEntry* next = &map->entries[slot];
+    if(next->hash == 0) {
+      break;
+    }
+    uint32_t home = next->hash & map->mask;
+    if(((slot - home) & map->mask) >= ((slot - hole) & map->mask)) {
+      map->entries[hole] = *next;
+      hole = slot;
+    }
+  }
+  memset(&map->entries[hole], 0, sizeof(struct MapEntry));
+  map->size--;
+  return 1;
+}
+
+struct MapEntry* nextMapEntry(ScriptCMap map, struct MapEntry* entry) {
+  struct MapEntry* end = map->entries + map->mask + 1;
+  entry = entry ? entry + 1 : map->entries;
+  for(; entry < end; entry++) {
+    if(entry->hash != 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+Type getMapEntryKey(struct MapEntry* entry, Type buf) {
+  buf->type = entry->key_type;
+  if(entry->key_type == TYPE_INT) {
+    buf->int_val = entry->int_key;
+  } else {
+    buf->string = entry->string_key;
+  }
+  return buf;
+}
+
+Type getMapEntryValue(struct MapEntry* entry) {
+  return &entry->value;
+}
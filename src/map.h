@@ -0,0 +1,43 @@
+#ifndef __MAP__
+#define __MAP__
+
+#include <stdint.h>
+
+/* open addressing hash map with linear probing. entries keep their
+ * hash, so probing compares hashes before keys and growing never
+ * rehashes a string. the map also keeps the last string key it hashed,
+ * so m[k] = m[k] + 1 hashes k once; the collector marks that string,
+ * so its address is not reused for other text while it is cached. the
+ * map and its entry table are heap blocks; a table that grows is left
+ * to the collector */
+
+struct Type;
+struct VMContext;
+
+/* the most entries a map holds, so its table stays within 2^27 slots
+ * of 32 bytes */
+#define MAP_MAX_CAPACITY (1 << 26)
+
+struct MapEntry;
+
+struct ScriptCMap {
+  struct MapEntry* entries;
+  uint32_t mask;
+  int size;
+  char* hashed_key;
+  uint32_t hashed;
+};
+
+typedef struct ScriptCMap* ScriptCMap;
+
+ScriptCMap createMap(struct VMContext* ctx, int capacity);
+struct Type* getMap(ScriptCMap map, struct Type* key);
+/* 1 for a new key, 0 for a replaced value and -1 when the map is full */
+int putMap(ScriptCMap map, struct Type* key, struct Type* value);
+int deleteMap(ScriptCMap map, struct Type* key);
+int isMapKey(struct Type* key);
+struct MapEntry* nextMapEntry(ScriptCMap map, struct MapEntry* entry);
+struct Type* getMapEntryKey(struct MapEntry* entry, struct Type* buf);
+struct Type* getMapEntryValue(struct MapEntry* entry);
+
+#endif
@@ -0,0 +1,232 @@
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "heap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct NativeEntry* native_table;
+static int native_size;
+static int native_capacity;
+
+int registerNative(const char* name, int arg_size, int ret_type, native_func_t func) {
+  int id = getNative(name);
+  if(id != -1) {
+    native_table[id].arg_size = arg_size;
+    native_table[id].ret_type = ret_type;
+    native_table[id].func = func;
+    return id;
+  }
+  if(native_size == NATIVE_MAX) {
+    fprintf(stderr, "too many native functions\n");
+    exit(1);
+  }
+  if(native_size == native_capacity) {
+    native_capacity = native_capacity ? native_capacity * 2 : 64;
+    native_table = (struct NativeEntry*)realloc(native_table, sizeof(struct NativeEntry)*native_capacity);
+  }
+  native_table[native_size].name = name;
+  native_table[native_size].arg_size = arg_size;
+  native_table[native_size].ret_type = ret_type;
+  native_table[native_size].func = func;
+  return native_size++;
+}
+
+int getNative(const char* name) {
+  for(int i = 0; i < native_size; i++) {
+    if(!strcmp(name, native_table[i].name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int getNativeRetType(int id) {
+  return native_table[id].ret_type;
+}
+
+int getNativeArgSize(int id) {
+  return native_table[id].arg_size;
+}
+
+const char* getNativeName(int id) {
+  return native_table[id].name;
+}
+
+static int toDouble(Type val, double* out) {
+  if(val->type == TYPE_FLOAT) {
+    *out = val->double_val;
+    return 1;
+  }
+  if(val->type == TYPE_INT) {
+    *out = val->int_val;
+    return 1;
+  }
+  if(val->type == TYPE_BIGINT) {
+    *out = bigToDouble(val);
+    return 1;
+  }
+  return 0;
+}
+
+static int native_len(Type args, int arg_size, Type ret) {
+  ret->type = TYPE_INT;
+  if(args[0].type == TYPE_ARRAY) {
+    ret->int_val = args[0].array->length;
+  } else if(args[0].type == TYPE_MAP) {
+    ret->int_val = args[0].map->size;
+  } else if(args[0].type == TYPE_STRING) {
+    ret->int_val = (int)strlen(args[0].string);
+  } else {
+    fprintf(stderr, "type error of len\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int native_map(Type args, int arg_size, Type ret) {
+  if(args[0].type != TYPE_INT || args[0].int_val < 0 || args[0].int_val > MAP_MAX_CAPACITY) {
+    fprintf(stderr, "map expects a capacity from 0 to %d\n", MAP_MAX_CAPACITY);
+    return 1;
+  }
+  ret->type = TYPE_MAP;
+  ret->map = createMap(getHeapRoots(), args[0].int_val);
+  return 0;
+}
+
+static int native_sqrt(Type args, int arg_size, Type ret) {
+  double x;
+  if(!toDouble(&args[0], &x)) {
+    fprintf(stderr, "type error of sqrt\n");
+    return 1;
+  }
+  ret->type = TYPE_FLOAT;
+  ret->double_val = sqrt(x);
+  return 0;
+}
+
+static int native_floor(Type args, int arg_size, Type ret) {
+  double x;
+  if(!toDouble(&args[0], &x)) {
+    fprintf(stderr, "type error of floor\n");
+    return 1;
+  }
+  /* 2^63 is exact as a double; larger results would not fit */
+  x = floor(x);
+  if(!(x >= -9223372036854775808.0 && x < 9223372036854775808.0)) {
+    fprintf(stderr, "floor result out of range\n");
+    return 1;
+  }
+  ret->type = TYPE_INT;
+  ret->int_val = (int64_t)x;
+  return 0;
+}
+
+static int native_abs(Type args, int arg_size, Type ret) {
+  if(args[0].type == TYPE_INT || args[0].type == TYPE_BIGINT) {
+    struct Type zero;
+    zero.type = TYPE_INT;
+    zero.int_val = 0;
+    if(bigCompare(&args[0], &zero) < 0) {
+      bigNeg(&args[0], ret);
+    } else {
+      *ret = args[0];
+    }
+  } else if(args[0].type == TYPE_FLOAT) {
+    ret->type = TYPE_FLOAT;
+    ret->double_val = fabs(args[0].double_val);
+  } else {
+    fprintf(stderr, "type error of abs\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* a decimal integer, optionally signed, as an int or a bigint */
+static int parseInt(const char* str, Type ret) {
+  int negative = *str == '-';
+  if(*str == '-' || *str == '+') {
+    str++;
+  }
+  if(*str == '\0') {
+    return 0;
+  }
+  struct Type ten;
+  ten.type = TYPE_INT;
+  ten.int_val = 10;
+  ret->type = TYPE_INT;
+  ret->int_val = 0;
+  for(; *str; str++) {
+    if(*str < '0' || *str > '9') {
+      return 0;
+    }
+    int64_t digit = negative ? '0' - *str : *str - '0';
+    int64_t val;
+    if(ret->type == TYPE_INT && !__builtin_mul_overflow(ret->int_val, 10, &val) && !__builtin_add_overflow(val, digit, &val)) {
+      ret->int_val = val;
+    } else {
+      struct Type d;
+      d.type = TYPE_INT;
+      d.int_val = digit;
+      bigMul(ret, &ten, ret);
+      bigAdd(ret, &d, ret);
+    }
+  }
+  return 1;
+}
+
+static int native_int(Type args, int arg_size, Type ret) {
+  if(args[0].type == TYPE_INT || args[0].type == TYPE_BIGINT) {
+    *ret = args[0];
+  } else if(args[0].type != TYPE_STRING) {
+    fprintf(stderr, "type error of int\n");
+    return 1;
+  } else if(!parseInt(args[0].string, ret)) {
+    fprintf(stderr, "int: not a number: %s\n", args[0].string);
+    return 1;
+  }
+  return 0;
+}
+
+static int native_float(Type args, int arg_size, Type ret) {
+  if(args[0].type == TYPE_STRING) {
+    char* end;
+    ret->type = TYPE_FLOAT;
+    ret->double_val = strtod(args[0].string, &end);
+    if(end == args[0].string || *end != '\0') {
+      fprintf(stderr, "float: not a number: %s\n", args[0].string);
+      return 1;
+    }
+    return 0;
+  }
+  if(!toDouble(&args[0], &ret->double_val)) {
+    fprintf(stderr, "type error of float\n");
+    return 1;
+  }
+  ret->type = TYPE_FLOAT;
+  return 0;
+}
+
+/* processor time in seconds, for timing inside scripts */
+static int native_clock(Type args, int arg_size, Type ret) {
+  ret->type = TYPE_FLOAT;
+  ret->double_val = (double)clock() / CLOCKS_PER_SEC;
+  return 0;
+}
+
+void initNatives() {
+  registerNative("len", 1, TYPE_INT, native_len);
+  registerNative("map", 1, TYPE_MAP, native_map);
+  registerNative("sqrt", 1, TYPE_FLOAT, native_sqrt);
+  registerNative("floor", 1, TYPE_INT, native_floor);
+  registerNative("abs", 1, NATIVE_ANY, native_abs);
+  registerNative("int", 1, TYPE_INT, native_int);
+  registerNative("float", 1, TYPE_FLOAT, native_float);
+  registerNative("clock", 0, TYPE_FLOAT, native_clock);
+  registerArrayNatives();
+  registerIoNatives();
+}
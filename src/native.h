@@ -0,0 +1,50 @@
+#ifndef __NATIVE__
+#define __NATIVE__
+
+/* native function registry. a native receives its arguments as a span
+ * of the caller's operand stack in source order and writes its result
+ * to ret. ret_type declares the result: a TYPE_* tag, NATIVE_ANY when it
+ * depends on the arguments, or NATIVE_VOID to push nothing. the
+ * verifier relies on it, so a native must honor it. a non-zero return
+ * reports a runtime error and stops the VM.
+ *
+ * calls are bound by name at compile time, so an embedder registers its
+ * functions after initNatives() and before compile(). arg_size -1
+ * accepts any number of arguments */
+
+#define NATIVE_VOID -1
+#define NATIVE_ANY -2
+#define NATIVE_VARARGS -1
+
+struct Type;
+
+typedef int (*native_func_t)(struct Type* args, int arg_size, struct Type* ret);
+
+struct NativeEntry {
+  const char* name;
+  int arg_size;
+  int ret_type;
+  native_func_t func;
+};
+
+extern struct NativeEntry* native_table;
+
+#define NCALL_ID(OPERAND) ((OPERAND) & 0xffff)
+#define NCALL_ARGC(OPERAND) ((OPERAND) >> 16)
+#define NATIVE_MAX 0xffff
+
+void initNatives();
+int registerNative(const char* name, int arg_size, int ret_type, native_func_t func);
+int getNative(const char* name);
+int getNativeArgSize(int id);
+int getNativeRetType(int id);
+const char* getNativeName(int id);
+
+void registerArrayNatives();
+void registerIoNatives();
+
+struct Heap;
+/* drops the streams a script's heap owns before the heap is freed */
+void closeHeapStreams(struct Heap* heap);
+
+#endif
@@ -0,0 +1,138 @@
+/* clock_gettime and mmap */
+#define _DEFAULT_SOURCE
+
+#include "perf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_CLOSE 3
+#define EM_X86_64 62
+
+/* the layouts of the jitdump specification in the perf sources */
+struct JitHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JitRecord {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+struct JitCodeLoad {
+  struct JitRecord record;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+static struct PerfOutput {
+  FILE* map;
+  int dump;
+  void* marker;
+  size_t marker_size;
+  uint64_t code_index;
+} perf = { NULL, -1, NULL, 0, 0 };
+
+static uint64_t timestamp(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int openJitDump(void) {
+  const char* dir = getenv("JITDUMPDIR");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/jit-%d.dump", dir ? dir : "/tmp", (int)getpid());
+  perf.dump = open(path, O_CREAT|O_TRUNC|O_RDWR, 0644);
+  if(perf.dump < 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  struct JitHeader header = {JITDUMP_MAGIC, JITDUMP_VERSION, sizeof(struct JitHeader), EM_X86_64, 0, (uint32_t)getpid(), timestamp(), 0};
+  if(write(perf.dump, &header, sizeof(header)) != sizeof(header)) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return 1;
+  }
+  /* perf record only notices the dump through an executable mapping */
+  perf.marker_size = sysconf(_SC_PAGESIZE);
+  perf.marker = mmap(NULL, perf.marker_size, PROT_READ|PROT_EXEC, MAP_PRIVATE, perf.dump, 0);
+  if(perf.marker == MAP_FAILED) {
+    perf.marker = NULL;
+    fprintf(stderr, "cannot map %s\n", path);
+    return 1;
+  }
+  return 0;
+}
+
+int openPerfOutput(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+  perf.map = fopen(path, "w");
+  if(perf.map == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  return openJitDump();
+}
+
+void writePerfCode(const char* name, const void* code, size_t size) {
+  if(perf.map == NULL) {
+    return;
+  }
+  fprintf(perf.map, "%lx %lx %s\n", (unsigned long)(uintptr_t)code, (unsigned long)size, name);
+  size_t name_size = strlen(name) + 1;
+  struct JitCodeLoad load;
+  load.record.id = JIT_CODE_LOAD;
+  load.record.total_size = (uint32_t)(sizeof(load) + name_size + size);
+  load.record.timestamp = timestamp();
+  load.pid = (uint32_t)getpid();
+  load.tid = load.pid;
+  load.vma = (uint64_t)(uintptr_t)code;
+  load.code_addr = load.vma;
+  load.code_size = size;
+  load.code_index = perf.code_index++;
+  if(write(perf.dump, &load, sizeof(load)) != sizeof(load)
+      || write(perf.dump, name, name_size) != (ssize_t)name_size
+      || write(perf.dump, code, size) != (ssize_t)size) {
+    fprintf(stderr, "cannot write the jitdump record of %s\n", name);
+  }
+}
+
+void closePerfOutput(void) {
+  if(perf.map == NULL) {
+    return;
+  }
+  struct JitRecord close_record = {JIT_CODE_CLOSE, sizeof(struct JitRecord), timestamp()};
+  if(write(perf.dump, &close_record, sizeof(close_record)) != sizeof(close_record)) {
+    fprintf(stderr, "cannot write the jitdump close record\n");
+  }
+  if(perf.marker) {
+    munmap(perf.marker, perf.marker_size);
+  }
+  close(perf.dump);
+  fclose(perf.map);
+  perf.map = NULL;
+  perf.dump = -1;
+  perf.marker = NULL;
+}
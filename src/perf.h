@@ -0,0 +1,17 @@
+#ifndef __PERF__
+#define __PERF__
+
+#include <stddef.h>
+
+/* linux perf support for generated code. every block is written as a
+ * line of /tmp/perf-<pid>.map, which perf report reads as is, and as a
+ * code load record of jit-<pid>.dump in $JITDUMPDIR or /tmp. the dump
+ * stays mapped executable while the program runs so perf record sees
+ * it; perf inject --jit then turns the records into symbols (record
+ * with -k mono, the records carry CLOCK_MONOTONIC times) */
+
+int openPerfOutput(void);
+void writePerfCode(const char* name, const void* code, size_t size);
+void closePerfOutput(void);
+
+#endif
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "runtime.h"
+#include "heap.h"
+
+void printValue(struct Type* val) {
+  if(val->type == TYPE_INT) {
+    printf("%" PRId64, val->int_val);
+  } else if(val->type == TYPE_BIGINT) {
+    printBigInt(val->bigint);
+  } else if(val->type == TYPE_FLOAT) {
+    printf("%f", val->double_val);
+  } else if(val->type == TYPE_STRING) {
+    printf("%s", val->string);
+  } else if(val->type == TYPE_BOOL) {
+    if(val->bool_val) {
+      printf("true");
+    } else {
+      printf("false");
+    }
+  } else if(val->type == TYPE_ARRAY) {
+    ScriptCArray a = val->array;
+    printf("[");
+    for(int i = 0; i < a->length; i++) {
+      if(i > 0) {
+        printf(", ");
+      }
+      if(a->elem_type == ARRAY_INT) {
+        printf("%" PRId64, a->ints[i]);
+      } else {
+        printf("%f", a->doubles[i]);
+      }
+    }
+    printf("]");
+  } else if(val->type == TYPE_MAP) {
+    struct Type key;
+    struct MapEntry* entry = NULL;
+    int first = 1;
+    printf("{");
+    while((entry = nextMapEntry(val->map, entry)) != NULL) {
+      if(!first) {
+        printf(", ");
+      }
+      first = 0;
+      printValue(getMapEntryKey(entry, &key));
+      printf(": ");
+      printValue(getMapEntryValue(entry));
+    }
+    printf("}");
+  }
+}
+
+VMContext sc_frames;
+
+/* compiled code has no frames to unwind: the error ends the program */
+static void fail(const char* message) {
+  fprintf(stderr, "%s\n", message);
+  exit(0);
+}
+
+static inline int isInteger(struct Type* val) {
+  return val->type == TYPE_INT || val->type == TYPE_BIGINT;
+}
+
+void sc_init(void) {
+  initNatives();
+}
+
+void sc_exit(void) {
+  fflush(stdout);
+  disposeHeap();
+}
+
+struct Type sc_add(struct Type left, struct Type right) {
+  struct Type ret;
+  int64_t val;
+  if(right.type == TYPE_INT && left.type == TYPE_INT && !__builtin_add_overflow(left.int_val, right.int_val, &val)) {
+    return sc_int(val);
+  } else if(isInteger(&right) && isInteger(&left)) {
+    heapSafepoint(sc_frames);
+    bigAdd(&left, &right, &ret);
+    return ret;
+  } else if(right.type == TYPE_FLOAT && left.type == TYPE_FLOAT) {
+    return sc_float(left.double_val + right.double_val);
+  } else if(right.type == TYPE_STRING && left.type == TYPE_STRING) {
+    size_t left_len = strlen(left.string);
+    size_t right_len = strlen(right.string);
+    char* str = allocString(sc_frames, left_len+right_len+1);
+    memcpy(str, left.string, left_len);
+    memcpy(str+left_len, right.string, right_len+1);
+    return sc_string(str);
+  }
+  fail("type error of add expression");
+  return ret;
+}
+
+struct Type sc_sub(struct Type left, struct Type right) {
+  struct Type ret;
+  int64_t val;
+  if(right.type == TYPE_INT && left.type == TYPE_INT && !__builtin_sub_overflow(left.int_val, right.int_val, &val)) {
+    return sc_int(val);
+  } else if(isInteger(&right) && isInteger(&left)) {
+    heapSafepoint(sc_frames);
+    bigSub(&left, &right, &ret);
+    return ret;
+  } else if(right.type == TYPE_FLOAT && left.type == TYPE_FLOAT) {
+    return sc_float(left.double_val - right.double_val);
+  }
+  fail("type error of sub expression");
+  return ret;
+}
+
+struct Type sc_mul(struct Type left, struct Type right) {
+  struct Type ret;
+  int64_t val;
+  if(right.type == TYPE_INT && left.type == TYPE_INT && !__builtin_mul_overflow(left.int_val, right.int_val, &val)) {
+    return sc_int(val);
+  } else if(isInteger(&right) && isInteger(&left)) {
+    heapSafepoint(sc_frames);
+    bigMul(&left, &right, &ret);
+    return ret;
+  } else if(right.type == TYPE_FLOAT && left.type == TYPE_FLOAT) {
+    return sc_float(left.double_val * right.double_val);
+  }
+  fail("type error of mul expression");
+  return ret;
+}
+
+struct Type sc_div(struct Type left, struct Type right) {
+  struct Type ret;
+  if(right.type == TYPE_INT && left.type == TYPE_INT && (uint64_t)right.int_val + 1 > 1) {
+    return sc_int(left.int_val / right.int_val);
+  } else if(isInteger(&right) && isInteger(&left)) {
+    heapSafepoint(sc_frames);
+    if(bigDiv(&left, &right, &ret)) {
+      fail("division by zero");
+    }
+    return ret;
+  } else if(right.type == TYPE_FLOAT && left.type == TYPE_FLOAT) {
+    return sc_float(left.double_val / right.double_val);
+  }
+  fail("type error of div expression");
+  return ret;
+}
+
+struct Type sc_minus(struct Type val) {
+  struct Type ret;
+  if(val.type == TYPE_INT && val.int_val != INT64_MIN) {
+    return sc_int(-val.int_val);
+  } else if(isInteger(&val)) {
+    heapSafepoint(sc_frames);
+    bigNeg(&val, &ret);
+    return ret;
+  } else if(val.type == TYPE_FLOAT) {
+    return sc_float(-val.double_val);
+  }
+  fail("type error of add expression");
+  return ret;
+}
+
+/* the order of left and right as a sign, for the compare ops. eq and ne
+ * also take strings and bools; the messages are the vm's */
+static int compare(struct Type* left, struct Type* right, int equality, const char* message) {
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    return (left->int_val > right->int_val) - (left->int_val < right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    int order = bigCompare(left, right);
+    return (order > 0) - (order < 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    /* unordered floats are neither equal nor in any order */
+    if(left->double_val != left->double_val || right->double_val != right->double_val) {
+      return 2;
+    }
+    return (left->double_val > right->double_val) - (left->double_val < right->double_val);
+  } else if(equality && right->type == TYPE_STRING && left->type == TYPE_STRING) {
+    return strcmp(left->string, right->string) != 0;
+  } else if(equality && right->type == TYPE_BOOL && left->type == TYPE_BOOL) {
+    return left->bool_val != right->bool_val;
+  }
+  fail(message);
+  return 0;
+}
+
+struct Type sc_gt(struct Type left, struct Type right) {
+  return sc_bool(compare(&left, &right, 0, "type error of gt expression") == 1);
+}
+
+struct Type sc_ge(struct Type left, struct Type right) {
+  int order = compare(&left, &right, 0, "type error of ge expression");
+  return sc_bool(order == 0 || order == 1);
+}
+
+struct Type sc_lt(struct Type left, struct Type right) {
+  return sc_bool(compare(&left, &right, 0, "type error of lt expression") == -1);
+}
+
+struct Type sc_le(struct Type left, struct Type right) {
+  int order = compare(&left, &right, 0, "type error of le expression");
+  return sc_bool(order == 0 || order == -1);
+}
+
+struct Type sc_eq(struct Type left, struct Type right) {
+  return sc_bool(compare(&left, &right, 1, "type error of le expression") == 0);
+}
+
+struct Type sc_ne(struct Type left, struct Type right) {
+  return sc_bool(compare(&left, &right, 1, "type error of le expression") != 0);
+}
+
+/* like ifcmp, a condition that is not a bool is reported but still
+ * tested */
+int sc_truth(struct Type val) {
+  if(val.type != TYPE_BOOL) {
+    fprintf(stderr, "type error of ifcmp\n");
+  }
+  return val.bool_val;
+}
+
+/* the key a switch dispatches on; a bigint matches no case */
+int64_t sc_switchInt(struct Type val) {
+  if(val.type == TYPE_BIGINT) {
+    return INT64_MIN;
+  }
+  if(val.type != TYPE_INT) {
+    fail("type error of switch");
+  }
+  return val.int_val;
+}
+
+int32_t sc_switchHash(struct Type val) {
+  if(val.type != TYPE_STRING) {
+    fail("type error of switch");
+  }
+  return caseHash(val.string);
+}
+
+/* a load of a local not assigned on every path */
+struct Type sc_loadl(struct Type val) {
+  if(val.type == TYPE_UNSET) {
+    fail("variable read before assignment");
+  }
+  return val;
+}
+
+struct Type sc_incSlow(struct Type val, int64_t inc) {
+  struct Type ret;
+  if(!isInteger(&val)) {
+    fail("type error of add expression");
+  }
+  struct Type step = sc_int(inc);
+  heapSafepoint(sc_frames);
+  bigAdd(&val, &step, &ret);
+  return ret;
+}
+
+static struct Type mapGet(struct Type* map, struct Type* key) {
+  if(!isMapKey(key)) {
+    fail("type error of map key");
+  }
+  struct Type* val = getMap(map->map, key);
+  if(val == NULL) {
+    fail("key not found in map");
+  }
+  return *val;
+}
+
+static void mapPut(struct Type* map, struct Type* key, struct Type* val) {
+  if(!isMapKey(key)) {
+    fail("type error of map key");
+  }
+  if(putMap(map->map, key, val) < 0) {
+    fprintf(stderr, "map is full at %d entries\n", MAP_MAX_CAPACITY);
+    exit(0);
+  }
+}
+
+static void checkIndex(struct Type* array, struct Type* index) {
+  if(array->type != TYPE_ARRAY || index->type != TYPE_INT) {
+    fail("type error of index expression");
+  }
+  if((uint64_t)index->int_val >= (uint64_t)array->array->length) {
+    fprintf(stderr, "array index out of range (%" PRId64 ")\n", index->int_val);
+    exit(0);
+  }
+}
+
+struct Type sc_aloadSlow(struct Type array, struct Type index) {
+  if(array.type == TYPE_MAP) {
+    return mapGet(&array, &index);
+  }
+  checkIndex(&array, &index);
+  ScriptCArray a = array.array;
+  if(a->elem_type == ARRAY_INT) {
+    return sc_int(a->ints[index.int_val]);
+  }
+  return sc_float(a->doubles[index.int_val]);
+}
+
+void sc_astoreSlow(struct Type array, struct Type index, struct Type val) {
+  if(array.type == TYPE_MAP) {
+    mapPut(&array, &index, &val);
+    return;
+  }
+  checkIndex(&array, &index);
+  ScriptCArray a = array.array;
+  if(a->elem_type == ARRAY_INT && val.type == TYPE_INT) {
+    a->ints[index.int_val] = val.int_val;
+  } else if(a->elem_type == ARRAY_INT && val.type == TYPE_BIGINT) {
+    fail("value out of range of int array");
+  } else if(a->elem_type == ARRAY_FLOAT && val.type == TYPE_FLOAT) {
+    a->doubles[index.int_val] = val.double_val;
+  } else if(a->elem_type == ARRAY_FLOAT && val.type == TYPE_INT) {
+    a->doubles[index.int_val] = val.int_val;
+  } else {
+    fail("type error of array store");
+  }
+}
+
+struct Type sc_mget(struct Type map, struct Type key) {
+  if(map.type != TYPE_MAP) {
+    fail("type error of get: first argument is not a map");
+  }
+  return mapGet(&map, &key);
+}
+
+void sc_mput(struct Type map, struct Type key, struct Type val) {
+  if(map.type != TYPE_MAP) {
+    fail("type error of put: first argument is not a map");
+  }
+  mapPut(&map, &key, &val);
+}
+
+struct Type sc_mhas(struct Type map, struct Type key) {
+  if(map.type != TYPE_MAP || !isMapKey(&key)) {
+    fail("type error of contains");
+  }
+  return sc_bool(getMap(map.map, &key) != NULL);
+}
+
+void sc_mdel(struct Type map, struct Type key) {
+  if(map.type != TYPE_MAP || !isMapKey(&key)) {
+    fail("type error of delete");
+  }
+  deleteMap(map.map, &key);
+}
+
+void sc_write(struct Type val) {
+  printValue(&val);
+  printf("\n");
+}
+
+struct Type sc_ncall(int id, struct Type* args, int arg_size) {
+  struct Type ret;
+  setHeapRoots(sc_frames);
+  if(native_table[id].func(args, arg_size, &ret)) {
+    exit(0);
+  }
+  return ret;
+}
@@ -0,0 +1,165 @@
+#ifndef __RUNTIME__
+#define __RUNTIME__
+
+#include <stdint.h>
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+
+/* runtime of scripts compiled to C (-C, see aot.h). it lives in
+ * libscriptc.a together with the heap, bigints, maps, arrays and the
+ * natives. values are struct Type passed by value and every operation
+ * takes the path of its vm handler with the same error message; after
+ * an error the program exits with status 0, as scriptC does once
+ * vm_execute stops. the typed int forms the verifier selects are inline
+ * and only call out for bigints and overflow.
+ *
+ * a compiled function keeps the slots that may hold a string, array,
+ * map or bigint in one array and links it into sc_frames while it runs;
+ * those arrays are the roots of a collection, as the frames of the
+ * VMContext chain are in the vm. the runtime collects before it
+ * allocates, while the operands are still in their slots */
+
+extern VMContext sc_frames;
+
+void printValue(struct Type* val);
+
+void sc_init(void);
+void sc_exit(void);
+
+struct Type sc_add(struct Type left, struct Type right);
+struct Type sc_sub(struct Type left, struct Type right);
+struct Type sc_mul(struct Type left, struct Type right);
+struct Type sc_div(struct Type left, struct Type right);
+struct Type sc_minus(struct Type val);
+struct Type sc_gt(struct Type left, struct Type right);
+struct Type sc_ge(struct Type left, struct Type right);
+struct Type sc_lt(struct Type left, struct Type right);
+struct Type sc_le(struct Type left, struct Type right);
+struct Type sc_eq(struct Type left, struct Type right);
+struct Type sc_ne(struct Type left, struct Type right);
+int sc_truth(struct Type val);
+int64_t sc_switchInt(struct Type val);
+int32_t sc_switchHash(struct Type val);
+struct Type sc_incSlow(struct Type val, int64_t inc);
+struct Type sc_loadl(struct Type val);
+struct Type sc_aloadSlow(struct Type array, struct Type index);
+void sc_astoreSlow(struct Type array, struct Type index, struct Type val);
+struct Type sc_mget(struct Type map, struct Type key);
+void sc_mput(struct Type map, struct Type key, struct Type val);
+struct Type sc_mhas(struct Type map, struct Type key);
+void sc_mdel(struct Type map, struct Type key);
+void sc_write(struct Type val);
+struct Type sc_ncall(int id, struct Type* args, int arg_size);
+
+static inline void sc_enter(VMContext frame, struct Type* slots, int size) {
+  frame->var_list_base = slots;
+  frame->stack_pointer = slots + size;
+  frame->prev = sc_frames;
+  sc_frames = frame;
+}
+
+static inline void sc_leave(VMContext frame) {
+  sc_frames = frame->prev;
+}
+
+static inline struct Type sc_int(int64_t val) {
+  struct Type ret;
+  ret.type = TYPE_INT;
+  ret.int_val = val;
+  return ret;
+}
+
+static inline struct Type sc_float(double val) {
+  struct Type ret;
+  ret.type = TYPE_FLOAT;
+  ret.double_val = val;
+  return ret;
+}
+
+static inline struct Type sc_string(char* val) {
+  struct Type ret;
+  ret.type = TYPE_STRING;
+  ret.string = val;
+  return ret;
+}
+
+static inline struct Type sc_bool(int val) {
+  struct Type ret;
+  ret.type = TYPE_BOOL;
+  ret.bool_val = val;
+  return ret;
+}
+
+#define SC_INT_ARITH(NAME, OVERFLOW, SLOW)\
+static inline struct Type sc_##NAME(struct Type left, struct Type right) {\
+  int64_t val;\
+  if(left.type == TYPE_INT && right.type == TYPE_INT && !OVERFLOW(left.int_val, right.int_val, &val)) {\
+    return sc_int(val);\
+  }\
+  return SLOW(left, right);\
+}
+
+#define SC_INT_COMPARE(NAME, OP, SLOW)\
+static inline struct Type sc_##NAME(struct Type left, struct Type right) {\
+  if(left.type == TYPE_INT && right.type == TYPE_INT) {\
+    return sc_bool(left.int_val OP right.int_val);\
+  }\
+  return SLOW(left, right);\
+}
+
+SC_INT_ARITH(iadd, __builtin_add_overflow, sc_add)
+SC_INT_ARITH(isub, __builtin_sub_overflow, sc_sub)
+SC_INT_ARITH(imul, __builtin_mul_overflow, sc_mul)
+SC_INT_COMPARE(ilt, <, sc_lt)
+SC_INT_COMPARE(igt, >, sc_gt)
+SC_INT_COMPARE(ile, <=, sc_le)
+SC_INT_COMPARE(ige, >=, sc_ge)
+SC_INT_COMPARE(ieq, ==, sc_eq)
+SC_INT_COMPARE(ine, !=, sc_ne)
+
+#undef SC_INT_ARITH
+#undef SC_INT_COMPARE
+
+/* divisors 0 and -1 take the slow path, as in the vm */
+static inline struct Type sc_idiv(struct Type left, struct Type right) {
+  if(left.type == TYPE_INT && right.type == TYPE_INT && (uint64_t)right.int_val + 1 > 1) {
+    return sc_int(left.int_val / right.int_val);
+  }
+  return sc_div(left, right);
+}
+
+static inline struct Type sc_inc(struct Type val, int64_t inc) {
+  int64_t sum;
+  if(val.type == TYPE_INT && !__builtin_add_overflow(val.int_val, inc, &sum)) {
+    return sc_int(sum);
+  }
+  return sc_incSlow(val, inc);
+}
+
+static inline struct Type sc_aload(struct Type array, struct Type index) {
+  if(array.type == TYPE_ARRAY && index.type == TYPE_INT && (uint64_t)index.int_val < (uint64_t)array.array->length) {
+    if(array.array->elem_type == ARRAY_INT) {
+      return sc_int(array.array->ints[index.int_val]);
+    }
+    return sc_float(array.array->doubles[index.int_val]);
+  }
+  return sc_aloadSlow(array, index);
+}
+
+static inline void sc_astore(struct Type array, struct Type index, struct Type val) {
+  if(array.type == TYPE_ARRAY && index.type == TYPE_INT && (uint64_t)index.int_val < (uint64_t)array.array->length) {
+    ScriptCArray a = array.array;
+    if(a->elem_type == ARRAY_INT && val.type == TYPE_INT) {
+      a->ints[index.int_val] = val.int_val;
+      return;
+    }
+    if(a->elem_type == ARRAY_FLOAT && val.type == TYPE_FLOAT) {
+      a->doubles[index.int_val] = val.double_val;
+      return;
+    }
+  }
+  sc_astoreSlow(array, index, val);
+}
+
+#endif
@@ -0,0 +1,250 @@
+/* clock_gettime */
+#define _DEFAULT_SOURCE
+
+#include "compiler.h"
+#include "vm.h"
+#include "heap.h"
+#include "native.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+struct Task {
+  Program program;
+  struct VMThread thread;
+  struct Heap* heap;
+  long status;
+  long slices;
+  double latency;
+};
+
+typedef struct Task* Task;
+
+/* ring of tasks: the owner takes from the head and requeues at the
+ * tail, thieves take from the tail */
+struct RunQueue {
+  pthread_mutex_t lock;
+  Task* tasks;
+  int head;
+  int size;
+  int capacity;
+};
+
+struct Worker {
+  pthread_t thread;
+  int id;
+  struct RunQueue queue;
+  long slices;
+  long steals;
+};
+
+static struct Scheduler {
+  struct Worker* workers;
+  int worker_size;
+  long budget;
+  int remaining;
+  double start;
+} scheduler;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void pushTask(struct RunQueue* queue, Task task) {
+  pthread_mutex_lock(&queue->lock);
+  queue->tasks[(queue->head + queue->size) % queue->capacity] = task;
+  queue->size++;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static Task popTask(struct RunQueue* queue) {
+  Task task = NULL;
+  pthread_mutex_lock(&queue->lock);
+  if(queue->size) {
+    task = queue->tasks[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+static Task stealTask(struct RunQueue* queue) {
+  Task task = NULL;
+  pthread_mutex_lock(&queue->lock);
+  if(queue->size) {
+    queue->size--;
+    task = queue->tasks[(queue->head + queue->size) % queue->capacity];
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return task;
+}
+
+static Task findTask(struct Worker* worker) {
+  Task task = popTask(&worker->queue);
+  for(int i = 1; task == NULL && i < scheduler.worker_size; i++) {
+    task = stealTask(&scheduler.workers[(worker->id + i) % scheduler.worker_size].queue);
+    if(task) {
+      worker->steals++;
+    }
+  }
+  return task;
+}
+
+static void finishTask(Task task, long status) {
+  task->status = status;
+  task->latency = now() - scheduler.start;
+  /* main returns into exit, so a finished task has no frames left; a
+   * failed one leaves its frames with the thread */
+  if(status != 0) {
+    fprintf(stderr, "script %s failed\n", task->program->name);
+    while(task->thread.ctx) {
+      VMContext prev = task->thread.ctx->prev;
+      disposeVMContext(task->thread.ctx);
+      task->thread.ctx = prev;
+    }
+  }
+  closeHeapStreams(task->heap);
+  freeHeap(task->heap);
+  task->heap = NULL;
+  __atomic_fetch_sub(&scheduler.remaining, 1, __ATOMIC_RELEASE);
+}
+
+static void* workerMain(void* data) {
+  struct Worker* worker = (struct Worker*)data;
+  while(__atomic_load_n(&scheduler.remaining, __ATOMIC_ACQUIRE) > 0) {
+    Task task = findTask(worker);
+    if(task == NULL) {
+      sched_yield();
+      continue;
+    }
+    Program program = task->program;
+    task->thread.budget = scheduler.budget;
+    setHeap(task->heap);
+    long status = vm_run(&task->thread, program->code, program->pool, program->frames);
+    setHeap(NULL);
+    task->slices++;
+    worker->slices++;
+    if(status == VM_YIELD) {
+      pushTask(&worker->queue, task);
+    } else {
+      finishTask(task, status);
+    }
+  }
+  return NULL;
+}
+
+static int compareDouble(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(double* sorted, int size, int p) {
+  int i = (int)((long)size * p / 100);
+  return sorted[i < size ? i : size - 1];
+}
+
+static void printLatency(const char* name, double* latencies, int size) {
+  qsort(latencies, size, sizeof(double), compareDouble);
+  fprintf(stderr, "%-12s: %d tasks, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n", name, size,
+      percentile(latencies, size, 50) * 1e3, percentile(latencies, size, 90) * 1e3,
+      percentile(latencies, size, 99) * 1e3, latencies[size - 1] * 1e3);
+}
+
+static void printReport(Task tasks, int task_size, Program programs, int program_size, double wall) {
+  long slices = 0;
+  long steals = 0;
+  int failures = 0;
+  for(int i = 0; i < scheduler.worker_size; i++) {
+    slices += scheduler.workers[i].slices;
+    steals += scheduler.workers[i].steals;
+  }
+  double* latencies = (double*)malloc(sizeof(double)*task_size);
+  for(int i = 0; i < task_size; i++) {
+    latencies[i] = tasks[i].latency;
+    failures += tasks[i].status != 0;
+  }
+  fprintf(stderr, "@@@@ Scheduler @@@@\n");
+  fprintf(stderr, "tasks       : %d on %d workers, budget %ld, %d failed\n", task_size, scheduler.worker_size, scheduler.budget, failures);
+  fprintf(stderr, "throughput  : %.1f tasks/s in %.3f s\n", task_size / wall, wall);
+  fprintf(stderr, "slices      : %ld, %ld stolen\n", slices, steals);
+  printLatency("latency", latencies, task_size);
+  /* a file given more than once weighs the mix, its rows are merged */
+  for(int p = 0; p < program_size; p++) {
+    int seen = 0;
+    for(int q = 0; q < p; q++) {
+      seen |= !strcmp(programs[q].name, programs[p].name);
+    }
+    if(seen) {
+      continue;
+    }
+    int size = 0;
+    for(int i = 0; i < task_size; i++) {
+      if(!strcmp(tasks[i].program->name, programs[p].name)) {
+        latencies[size++] = tasks[i].latency;
+      }
+    }
+    printLatency(programs[p].name, latencies, size);
+  }
+  free(latencies);
+}
+
+/* instances of every program are interleaved and dealt to the workers
+ * round robin; latency counts from the start of the run */
+int runScheduler(Program programs, int program_size, int instances, int workers, long budget) {
+  int task_size = program_size * instances;
+  Task tasks = (Task)calloc(task_size, sizeof(struct Task));
+  scheduler.workers = (struct Worker*)calloc(workers, sizeof(struct Worker));
+  scheduler.worker_size = workers;
+  scheduler.budget = budget;
+  scheduler.remaining = task_size;
+  for(int i = 0; i < workers; i++) {
+    struct Worker* worker = &scheduler.workers[i];
+    worker->id = i;
+    pthread_mutex_init(&worker->queue.lock, NULL);
+    worker->queue.capacity = task_size;
+    worker->queue.tasks = (Task*)malloc(sizeof(Task)*task_size);
+  }
+  for(int i = 0; i < task_size; i++) {
+    Task task = &tasks[i];
+    Program program = &programs[i % program_size];
+    FrameInfo frames = program->frames;
+    task->program = program;
+    task->heap = createHeap();
+    task->thread.ctx = frames ? createFrame(NULL, 0, frames[0].var_size, frames[0].stack_size) : createVMContext(NULL, 0);
+    task->thread.pc = 1;
+    pushTask(&scheduler.workers[i % workers].queue, task);
+  }
+  scheduler.start = now();
+  for(int i = 1; i < workers; i++) {
+    if(pthread_create(&scheduler.workers[i].thread, NULL, workerMain, &scheduler.workers[i])) {
+      fprintf(stderr, "cannot start worker %d\n", i);
+      exit(1);
+    }
+  }
+  workerMain(&scheduler.workers[0]);
+  for(int i = 1; i < workers; i++) {
+    pthread_join(scheduler.workers[i].thread, NULL);
+  }
+  double wall = now() - scheduler.start;
+  printReport(tasks, task_size, programs, program_size, wall);
+  int failed = 0;
+  for(int i = 0; i < task_size; i++) {
+    failed |= tasks[i].status != 0;
+  }
+  for(int i = 0; i < workers; i++) {
+    pthread_mutex_destroy(&scheduler.workers[i].queue.lock);
+    free(scheduler.workers[i].queue.tasks);
+  }
+  free(scheduler.workers);
+  free(tasks);
+  return failed;
+}
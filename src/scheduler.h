@@ -0,0 +1,26 @@
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+#include "compiler.h"
+#include "vm.h"
+
+/* M:N scheduler: runs many independent instances of compiled scripts
+ * on a few worker threads. every instance is a task with its own
+ * VMContext chain and heap. a worker runs the task at the front of its
+ * queue until its budget of backward jumps and calls is spent, then
+ * puts it at the back, so every script gets its turn. a worker with an
+ * empty queue steals from the back of another one. the instances of a
+ * program share its code, which eager compilation leaves read-only */
+
+struct Program {
+	const char* name;
+	VMInstruction code;
+	ConstPool pool;
+	FrameInfo frames;
+};
+
+typedef struct Program* Program;
+
+int runScheduler(Program programs, int program_size, int instances, int workers, long budget);
+
+#endif
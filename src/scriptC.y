@@ -5,12 +5,23 @@
 #include "ast.h"
 #include "compiler.h"
 #include "vm.h"
+#include "native.h"
+#include "verify.h"
+#include "lexer.h"
+#include "heap.h"
+#include "scheduler.h"
+#include "perf.h"
+#include "stats.h"
+#include "trace.h"
+#include "aot.h"
+#include "layout.h"
+#include "import.h"
+#include "snapshot.h"
 #define YYDEBUG 1
 
 Node ast;
 int yyerror(char const *str);
 
-int yylex(void);
 
 %}
 
@@ -19,17 +30,20 @@ int yylex(void);
 }
 
 %start Program
-%token DEF PRINT IF ELSE WHILE RETURN BREAK CONTINUE FOR
-%token LE GE EQ NE ADDEQ SUBEQ MULEQ DIVEQ INC DEC
+%token DEF PRINT IF ELSE WHILE RETURN BREAK CONTINUE FOR CONST IMPORT
+%token SWITCH CASE DEFAULT
+%token LE GE EQ NE AND OR ADDEQ SUBEQ MULEQ DIVEQ INC DEC
 %token<node> IDENTIFIER NONE TRUE FALSE INT FLOAT STRING
 
 %type<node> Program Source
 %type<node> Statement ExpressionStatement SimpleStatement
-%type<node> PrintStatement ReturnStatement
+%type<node> PrintStatement ReturnStatement ConstDeclaration ImportDeclaration
 %type<node> CompoundStatement IfStatement WhileStatement ForStatement Block
+%type<node> SwitchStatement SwitchBody SwitchEntry
 %type<node> BreakStatement ContinueStatement
 %type<node> FunctionDefinition Arguments FunctionBody StatementList
-%type<node> Expression AssignmentExpression CompExpression PostfixExpression
+%type<node> Expression AssignmentExpression OrExpression AndExpression CompExpression
+%type<node> PostfixExpression
 %type<node> ArithExpr Term Factor
 %type<node> Literal NumericLiteral NullLiteral BooleanLiteral StringLiteral
 %type<node> FunctionCall CallArgs
@@ -47,6 +61,8 @@ Source
 
 Statement
   : FunctionDefinition {$$ = $1;}
+  | ConstDeclaration {$$ = $1;}
+  | ImportDeclaration {$$ = $1;}
   | ExpressionStatement {$$ = $1;}
   | SimpleStatement {$$ = $1;}
   | CompoundStatement {$$ = $1;}
@@ -59,6 +75,14 @@ SimpleStatement
   | ContinueStatement {$$ = $1;}
   ;
 
+ConstDeclaration
+  : CONST IDENTIFIER '=' Expression ';' {$$ = createExprNode(SC_CONST, $2, $4);}
+  ;
+
+ImportDeclaration
+  : IMPORT STRING ';' {$$ = createUnaryNode(SC_IMPORT, $2);}
+  ;
+
 ReturnStatement
   : RETURN Expression ';' {$$ = createReturnNode($2);}
   ;
@@ -79,6 +103,7 @@ CompoundStatement
   : IfStatement {$$ = $1;}
   | WhileStatement {$$ = $1;}
   | ForStatement {$$ = $1;}
+  | SwitchStatement {$$ = $1;}
   ;
 
 IfStatement
@@ -96,12 +121,29 @@ ForStatement
   | FOR '(' ExpressionStatement ExpressionStatement Expression ')' Block {$$ = createForNode($3, $4, $5, $7);}
   ;
 
+SwitchStatement
+  : SWITCH Expression '{' SwitchBody '}' {$$ = createSwitchNode($2, $4);}
+  | SWITCH Expression '{' '}' {$$ = createSwitchNode($2, createEmptyListNode(SC_STATEMENTLIST));}
+  ;
+
+SwitchBody
+  : SwitchEntry {$$ = createListNode(SC_STATEMENTLIST, $1);}
+  | SwitchBody SwitchEntry { appendList($1->list, $2); $$ = $1; }
+  ;
+
+SwitchEntry
+  : CASE Expression ':' {$$ = createUnaryNode(SC_CASE, $2);}
+  | DEFAULT ':' {$$ = createUnaryNode(SC_CASE, NULL);}
+  | Statement {$$ = $1;}
+  ;
+
 Block
   : '{' StatementList '}' {$$ = createBlockNode($2);}
   ;
 
 FunctionDefinition
   : DEF IDENTIFIER '(' Arguments ')' FunctionBody {$$ = createFuncDefNode($2, $4, $6);}
+  | DEF IDENTIFIER '(' ')' FunctionBody {$$ = createFuncDefNode($2, createEmptyListNode(SC_ARGS), $5);}
   ;
 
 FunctionBody
@@ -129,11 +171,21 @@ Expression
   ;
 
 AssignmentExpression
-  : AssignmentExpression '=' CompExpression {$$ = createExprNode(SC_ASSIGN, $1, $3);}
-  | AssignmentExpression ADDEQ CompExpression {$$ = createExprNode(SC_ASSIGNADD, $1, $3);}
-  | AssignmentExpression SUBEQ CompExpression {$$ = createExprNode(SC_ASSIGNSUB, $1, $3);}
-  | AssignmentExpression MULEQ CompExpression {$$ = createExprNode(SC_ASSIGNMUL, $1, $3);}
-  | AssignmentExpression DIVEQ CompExpression {$$ = createExprNode(SC_ASSIGNDIV, $1, $3);}
+  : AssignmentExpression '=' OrExpression {$$ = createExprNode(SC_ASSIGN, $1, $3);}
+  | AssignmentExpression ADDEQ OrExpression {$$ = createExprNode(SC_ASSIGNADD, $1, $3);}
+  | AssignmentExpression SUBEQ OrExpression {$$ = createExprNode(SC_ASSIGNSUB, $1, $3);}
+  | AssignmentExpression MULEQ OrExpression {$$ = createExprNode(SC_ASSIGNMUL, $1, $3);}
+  | AssignmentExpression DIVEQ OrExpression {$$ = createExprNode(SC_ASSIGNDIV, $1, $3);}
+  | OrExpression {$$ = $1;}
+  ;
+
+OrExpression
+  : OrExpression OR AndExpression {$$ = createExprNode(SC_OR, $1, $3);}
+  | AndExpression {$$ = $1;}
+  ;
+
+AndExpression
+  : AndExpression AND CompExpression {$$ = createExprNode(SC_AND, $1, $3);}
   | CompExpression {$$ = $1;}
   ;
 
@@ -163,11 +215,13 @@ Factor
   : PostfixExpression {$$ = $1;}
   | '+' Factor {$$ = createUnaryNode(SC_PLUS, $2);}
   | '-' Factor {$$ = createUnaryNode(SC_MINUS, $2);}
+  | '!' Factor {$$ = createUnaryNode(SC_NOT, $2);}
   ;
 
 PostfixExpression
   : PostfixExpression INC {$$ = createUnaryNode(SC_INC, $1);}
   | PostfixExpression DEC {$$ = createUnaryNode(SC_DEC, $1);}
+  | PostfixExpression '[' Expression ']' {$$ = createIndexNode($1, $3);}
   | Literal {$$ = $1;}
   ;
 
@@ -201,6 +255,7 @@ StringLiteral
 
 FunctionCall
   : IDENTIFIER '(' CallArgs ')' {$$ = createFuncCallNode($1, $3);}
+  | IDENTIFIER '(' ')' {$$ = createFuncCallNode($1, createEmptyListNode(SC_ARGS));}
 
 CallArgs
   : AssignmentExpression {$$ = createListNode(SC_ARGS, $1);}
@@ -211,67 +266,397 @@ CallArgs
 int
 yyerror(char const *str)
 {
-  extern char *yytext;
-  fprintf(stderr, "parser error near %s\n", yytext);
+  fprintf(stderr, "parser error near %.*s\n", tokenLength(), tokenText());
   return 0;
 }
 
 int sc_debug;
+int sc_optimize;
+int sc_dispatch;
+int sc_threads;
+int sc_stats;
+int sc_trace;
+
+/* compiles a script for the scheduler. its source stays mapped until
+ * exit because the constant pool points into it */
+static int compileProgram(const char* file, Program program)
+{
+  if (openSource(file)) {
+    fprintf(stderr, "File [%s] is not found!\n", file);
+    return 1;
+  }
+  if (yyparse()) {
+    fprintf(stderr, "Error ! Error ! Error !\n");
+    return 1;
+  }
+  if (loadImports(ast, file)) {
+    return 1;
+  }
+  Module module = createModule();
+  createCompilerContext(NULL);
+  ScriptCInstruction insts = compile(ast);
+  program->name = file;
+  program->pool = module->pool;
+  program->frames = verifyModule(insts, module);
+  program->code = prepareVM(insts, module->code_length, program->frames);
+  disposeInstruction(insts);
+  disposeNode(ast);
+  return 0;
+}
+
+/* the run of a restored snapshot, from its marker to the end */
+static int runSnapshot(struct Snapshot* snapshot, const char* input_file, int stats, int heap_stats)
+{
+  initNatives();
+  if (stats) {
+    beginPhase("prepare");
+  }
+  vm_entry = snapshot->entry;
+  VMInstruction code = prepareVM(snapshot->insts, snapshot->code_length, snapshot->frames);
+  if (stats) {
+    endPhase();
+    beginPhase("execute");
+  }
+  vm_execute(snapshot->ctx, code, &snapshot->pool, snapshot->frames);
+  if (stats) {
+    endPhase();
+    printStats(input_file);
+    closeStats();
+  }
+  if (heap_stats) {
+    printHeapStats();
+  }
+  disposeHeap();
+  disposeTraces();
+  free(snapshot->pool.strings);
+  free(code);
+  return 0;
+}
+
+static int schedulePrograms(const char* input_file, char *const files[], int file_size, int instances, int workers, long budget)
+{
+  Program programs = (Program)calloc(file_size + 1, sizeof(struct Program));
+  int program_size = 0;
+  if (sc_dispatch == DISPATCH_CONTEXT) {
+    fprintf(stderr, "context threading cannot be preempted, using call threading\n");
+    sc_dispatch = DISPATCH_CALL;
+  }
+  initNatives();
+  if (input_file && compileProgram(input_file, &programs[program_size++])) {
+    return 1;
+  }
+  for (int i = 0; i < file_size; i++) {
+    if (compileProgram(files[i], &programs[program_size++])) {
+      return 1;
+    }
+  }
+  if (program_size == 0) {
+    fprintf(stderr, "no script to schedule\n");
+    return 1;
+  }
+  int status = runScheduler(programs, program_size, instances, workers, budget);
+  for (int i = 0; i < program_size; i++) {
+    free(programs[i].code);
+    free(programs[i].frames);
+  }
+  free(programs);
+  return status;
+}
 
 int main(int argc, char *const argv[])
 {
   extern int yyparse(void);
-  extern FILE *yyin;
   extern Node ast;
   const char *input_file = NULL;
   int input_size = 0;
   const char *orig_argv0 = argv[0];
   int opt;
+  int lex_only = 0;
+  int lazy = 1;
+  int heap_stats = 0;
+  int workers = 0;
+  int instances = 1;
+  long budget = 10000;
+  int perf = 0;
+  int stats = 0;
+  int trace = 0;
+  const char *c_output = NULL;
+  const char *profile_output = NULL;
+  const char *snapshot_file = NULL;
   sc_debug = 0;
+  sc_optimize = 1;
+  sc_dispatch = DISPATCH_DIRECT;
+  sc_threads = 0;
+  sc_stats = 0;
+  sc_trace = 0;
 
-  while ((opt = getopt(argc, argv, "i:gh")) != -1) {
+  while ((opt = getopt(argc, argv, "i:O:t:j:w:n:b:C:R:U:S:eglmpPsTh")) != -1) {
     switch (opt) {
       case 'i':
         input_file = optarg;
-    		if (!(yyin = fopen(input_file, "r"))) {
-    			fprintf(stderr, "File [%s] is not found!\n", argv[1]);
-    			return 1;
-    		}
         break;
       case 'h':
         fprintf(stderr, "Usage: ./scriptC [option] ...\n");
         fprintf(stderr, "Options and argument:\n");
         fprintf(stderr, "-i $file : program read script file\n");
         fprintf(stderr, "-g       : program print debug infomation\n");
+        fprintf(stderr, "-O $level : optimization level (0 disables optimization)\n");
+        fprintf(stderr, "-t $core : interpreter core (direct, switch, call, context)\n");
+        fprintf(stderr, "-e       : compile every function before running instead of on first call\n");
+        fprintf(stderr, "-j $n    : compile functions on n threads with -e (default: one per cpu)\n");
+        fprintf(stderr, "-l       : program only lex the script and print the throughput\n");
+        fprintf(stderr, "-m       : program print heap and collector statistics at exit\n");
+        fprintf(stderr, "-p       : write /tmp/perf-<pid>.map and a jitdump for the generated code\n");
+        fprintf(stderr, "-P       : -p, and call every script function through a named native trampoline\n");
+        fprintf(stderr, "-s       : print time and cpu counters of every phase of the run as json\n");
+        fprintf(stderr, "-T       : record hot loops and run them as type specialized traces\n");
+        fprintf(stderr, "-C $file : compile the script to C instead of running it, build the output\n");
+        fprintf(stderr, "           with gcc -O2 -std=c99 -I src $file src/libscriptc.a -lm -pthread\n");
+        fprintf(stderr, "-R $file : count the calls of every function and write them to file (runs -e,\n");
+        fprintf(stderr, "           on the direct core unless -t switch)\n");
+        fprintf(stderr, "-U $file : lay the functions out by the call counts of a -R file (implies -e)\n");
+        fprintf(stderr, "-S $file : start from the snapshot of the script in file, or write it there when\n");
+        fprintf(stderr, "           the script reaches snapshot() (implies -e)\n");
+        fprintf(stderr, "-w $n    : run the -i script and every file argument on n worker threads\n");
+        fprintf(stderr, "-n $count : run count instances of each script under -w (default: 1)\n");
+        fprintf(stderr, "-b $budget : backward jumps and calls per time slice under -w (default: 10000)\n");
         fprintf(stderr, "-h       : program print this infomation\n");
         return 0;
       case 'g':
         sc_debug = 1;
         break;
+      case 'e':
+        lazy = 0;
+        break;
+      case 'j':
+        sc_threads = atoi(optarg);
+        break;
+      case 'l':
+        lex_only = 1;
+        break;
+      case 'm':
+        heap_stats = 1;
+        break;
+      case 'p':
+        perf = perf ? perf : 1;
+        break;
+      case 'P':
+        perf = 2;
+        break;
+      case 's':
+        stats = 1;
+        break;
+      case 'T':
+        trace = 1;
+        break;
+      case 'C':
+        c_output = optarg;
+        break;
+      case 'R':
+        profile_output = optarg;
+        break;
+      case 'U':
+        if(loadProfile(optarg)) {
+          return 1;
+        }
+        lazy = 0;
+        break;
+      case 'S':
+        snapshot_file = optarg;
+        lazy = 0;
+        break;
+      case 'w':
+        workers = atoi(optarg);
+        break;
+      case 'n':
+        instances = atoi(optarg);
+        break;
+      case 'b':
+        budget = atol(optarg);
+        break;
+      case 'O':
+        sc_optimize = atoi(optarg);
+        break;
+      case 't':
+        sc_dispatch = getDispatch(optarg);
+        if(sc_dispatch < 0) {
+          fprintf(stderr, "unknown interpreter core: %s\n", optarg);
+          return 1;
+        }
+        break;
       default: /* '?' */
-        yyin = stdin;
+        input_file = NULL;
         break;
     }
   }
 
+  if (workers > 0) {
+    if (instances < 1 || budget < 1) {
+      fprintf(stderr, "the instance count and the budget must be positive\n");
+      return 1;
+    }
+    return schedulePrograms(input_file, argv + optind, argc - optind, instances, workers, budget);
+  }
+
+  if (snapshot_file && (input_file == NULL || c_output || profile_output || perf)) {
+    fprintf(stderr, "-S needs -i and cannot be combined with -C, -R, -p or -P\n");
+    return 1;
+  }
+  if (stats) {
+    openStats();
+  }
+  /* a snapshot of the unchanged script starts at its marker */
+  if (snapshot_file) {
+    struct Snapshot snapshot;
+    if (stats) {
+      beginPhase("restore");
+    }
+    int restored = !restoreSnapshot(snapshot_file, input_file, &snapshot);
+    if (stats) {
+      endPhase();
+    }
+    if (restored) {
+      sc_trace = trace && sc_dispatch != DISPATCH_CONTEXT;
+      return runSnapshot(&snapshot, input_file, stats, heap_stats);
+    }
+  }
+
+  if (openSource(input_file)) {
+    fprintf(stderr, "File [%s] is not found!\n", input_file);
+    return 1;
+  }
+  if (lex_only) {
+    benchmarkLexer();
+    closeSource();
+    return 0;
+  }
+
+  if (stats) {
+    beginPhase("parse");
+  }
   if (yyparse()) {
       fprintf(stderr, "Error ! Error ! Error !\n");
       exit(1);
   }
+  if (stats) {
+    endPhase();
+  }
 
   if(sc_debug) {
     fprintf(stderr, "@@@@ Dump AST @@@@\n");
     printNode(ast, 0);
     fprintf(stderr, "\n");
   }
-  createModule();
-  CompilerContext cctx = createCompilerContext(NULL);
-  ScriptCInstruction insts = compile(ast);
-  VMContext ctx = createVMContext(NULL, 0);
-  prepareVM(ctx, insts, cctx->code_length);
-  vm_execute(ctx, insts);
+  initNatives();
+  if (loadImports(ast, input_file)) {
+    return 1;
+  }
+  Module module = createModule();
+  createCompilerContext(NULL);
+  if(c_output) {
+    ScriptCInstruction insts = compile(ast);
+    /* the verifier picks the unchecked forms the C code is made of */
+    if(sc_optimize) {
+      free(verifyModule(insts, module));
+    }
+    int status = compileToC(c_output, input_file, insts, module);
+    disposeInstruction(insts);
+    disposeNode(ast);
+    closeSource();
+    return status;
+  }
+  FrameInfo frames = NULL;
+  ScriptCInstruction insts = NULL;
+  VMContext ctx;
+  VMInstruction code;
+  /* the context threaded code is emitted once for the whole module,
+   * with its jumps as native jumps that never enter a trace */
+  if(sc_dispatch == DISPATCH_CONTEXT) {
+    lazy = 0;
+    trace = 0;
+  }
+  /* the profile counts the calls of the eagerly linked code in the
+   * cores that can count */
+  if(profile_output) {
+    lazy = 0;
+    trace = 0;
+    if(sc_dispatch != DISPATCH_SWITCH) {
+      sc_dispatch = DISPATCH_DIRECT;
+    }
+  }
+  sc_trace = trace;
+  if(perf && openPerfOutput()) {
+    return 1;
+  }
+  if(stats) {
+    beginPhase("compile");
+  }
+  if(lazy) {
+    compileLazy(ast);
+    if(perf) {
+      preparePerf(module, perf == 2);
+    }
+    if(stats) {
+      endPhase();
+      beginPhase("prepare");
+    }
+    frames = (FrameInfo)calloc(module->size, sizeof(struct FrameInfo));
+    code = prepareLazyVM(module, frames);
+    ctx = createFrame(NULL, 0, frames[0].var_size, frames[0].stack_size);
+  } else {
+    insts = compile(ast);
+    if(perf) {
+      preparePerf(module, perf == 2);
+    }
+    if(stats) {
+      endPhase();
+      beginPhase("prepare");
+    }
+    frames = verifyModule(insts, module);
+    ctx = createFrame(NULL, 0, frames[0].var_size, frames[0].stack_size);
+    if(profile_output) {
+      vm_calls = (long*)calloc(module->code_length, sizeof(long));
+    }
+    /* the marker saves the code as linked, so it is kept until the end */
+    if(snapshot_file) {
+      armSnapshot(snapshot_file, input_file, insts, module, frames);
+    }
+    code = prepareVM(insts, module->code_length, frames);
+    if(!snapshot_file) {
+      disposeInstruction(insts);
+    }
+  }
+  /* lazily linked functions are linked while executing */
+  if(stats) {
+    endPhase();
+    beginPhase("execute");
+  }
+  vm_execute(ctx, code, module->pool, frames);
+  if(stats) {
+    endPhase();
+    printStats(input_file);
+    closeStats();
+  }
+  if(profile_output && writeProfile(profile_output, module, vm_calls)) {
+    return 1;
+  }
+  free(vm_calls);
+  if(heap_stats) {
+    printHeapStats();
+  }
+  disposeHeap();
+  disposeTraces();
+  closePerfOutput();
   disposeNode(ast);
-  disposeInstruction(insts);
-  fclose(yyin);
+  free(frames);
+  if(snapshot_file) {
+    disposeInstruction(insts);
+  }
+  if(lazy) {
+    disposeLazyVM();
+  } else {
+    free(code);
+  }
+  closeSource();
   return 0;
 }
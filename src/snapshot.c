@@ -0,0 +1,510 @@
+/* realpath and st_mtim */
+#define _DEFAULT_SOURCE
+
+#include "compiler.h"
+#include "vm.h"
+#include "import.h"
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "SCS1"
+/* another build of scriptC may number the ops and lay out the structs
+ * differently */
+#define SNAPSHOT_BUILD __DATE__ " " __TIME__
+
+/* the file is a run of 8 byte words, and every string, array and table
+ * in it is padded to a whole word, so each can be used where it lies:
+ *
+ *   magic, -O level, build, the script and its imports with their stamps
+ *   code length, entry, frame count, frames, instructions
+ *   the long, double and string pools
+ *   the arrays and bigints, then the maps and their entries
+ *   the locals and the operand stack of the top level frame
+ *
+ * a value is its type and a word: the int, double or bool, the index
+ * of its array, bigint or map, or the length of the string after it.
+ * the arrays and bigints come first so that every map can be made
+ * before any entry refers to it */
+
+struct SnapshotTarget {
+  char* path;
+  char* script;
+  ScriptCInstruction insts;
+  long code_length;
+  ConstPool pool;
+  FrameInfo frames;
+  int frame_size;
+};
+
+static struct SnapshotTarget* target;
+
+/* the arrays, bigints and maps a snapshot reaches, by address */
+static ScriptCMap object_ids;
+static struct Type* others;
+static int other_size;
+static ScriptCMap* maps;
+static int map_size;
+
+struct Reader {
+  char* data;
+  size_t size;
+  size_t pos;
+  int error;
+};
+
+static void writeWord(FILE* file, int64_t val) {
+  fwrite(&val, sizeof(val), 1, file);
+}
+
+static void writePadded(FILE* file, const void* data, size_t len) {
+  static const char zeros[8];
+  fwrite(data, 1, len, file);
+  fwrite(zeros, 1, (8 - len % 8) % 8, file);
+}
+
+static void writeString(FILE* file, const char* str) {
+  size_t len = strlen(str);
+  writeWord(file, len);
+  writePadded(file, str, len + 1);
+}
+
+static int64_t readWord(struct Reader* r) {
+  int64_t val = 0;
+  if(r->pos + sizeof(val) > r->size) {
+    r->error = 1;
+    return 0;
+  }
+  memcpy(&val, r->data + r->pos, sizeof(val));
+  r->pos += sizeof(val);
+  return val;
+}
+
+static char* readPadded(struct Reader* r, size_t len) {
+  size_t padded = len + (8 - len % 8) % 8;
+  if(r->error || padded < len || padded > r->size - r->pos) {
+    r->error = 1;
+    return NULL;
+  }
+  char* data = r->data + r->pos;
+  r->pos += padded;
+  return data;
+}
+
+static char* readString(struct Reader* r) {
+  int64_t len = readWord(r);
+  char* str = len >= 0 ? readPadded(r, (size_t)len + 1) : NULL;
+  if(str == NULL || str[len] != '\0') {
+    r->error = 1;
+    return NULL;
+  }
+  return str;
+}
+
+/* realpath of the script, then every import */
+static int writeSources(FILE* file, const char* script) {
+  char resolved[PATH_MAX];
+  if(realpath(script, resolved) == NULL) {
+    return 1;
+  }
+  int count = 1;
+  while(getObjectPath(count - 1)) {
+    count++;
+  }
+  writeWord(file, count);
+  for(int i = 0; i < count; i++) {
+    const char* path = i == 0 ? resolved : getObjectPath(i - 1);
+    struct SourceStamp stamp;
+    if(stampSource(path, &stamp)) {
+      return 1;
+    }
+    writeString(file, path);
+    writePadded(file, &stamp, sizeof(stamp));
+  }
+  return 0;
+}
+
+static int checkSources(struct Reader* r, const char* script) {
+  char resolved[PATH_MAX];
+  int64_t count = readWord(r);
+  if(realpath(script, resolved) == NULL || count < 1) {
+    return 1;
+  }
+  for(int64_t i = 0; i < count; i++) {
+    const char* path = readString(r);
+    char* recorded = readPadded(r, sizeof(struct SourceStamp));
+    struct SourceStamp stamp;
+    if(recorded == NULL || (i == 0 && strcmp(path, resolved))
+      || stampSource(path, &stamp) || memcmp(recorded, &stamp, sizeof(stamp))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int isObject(int type) {
+  return type == TYPE_ARRAY || type == TYPE_MAP || type == TYPE_BIGINT;
+}
+
+static struct Type objectKey(Type val) {
+  struct Type key;
+  key.type = TYPE_INT;
+  key.int_val = (int64_t)(intptr_t)(val->type == TYPE_MAP ? (void*)val->map
+    : val->type == TYPE_ARRAY ? (void*)val->array : (void*)val->bigint);
+  return key;
+}
+
+static void collectValue(Type val) {
+  if(!isObject(val->type)) {
+    return;
+  }
+  struct Type key = objectKey(val);
+  if(getMap(object_ids, &key)) {
+    return;
+  }
+  struct Type id;
+  id.type = val->type;
+  if(val->type != TYPE_MAP) {
+    id.int_val = other_size;
+    others = (struct Type*)realloc(others, sizeof(struct Type)*(other_size+1));
+    others[other_size++] = *val;
+    putMap(object_ids, &key, &id);
+    return;
+  }
+  id.int_val = map_size;
+  maps = (ScriptCMap*)realloc(maps, sizeof(ScriptCMap)*(map_size+1));
+  maps[map_size++] = val->map;
+  putMap(object_ids, &key, &id);
+  for(struct MapEntry* entry = nextMapEntry(val->map, NULL); entry; entry = nextMapEntry(val->map, entry)) {
+    collectValue(getMapEntryValue(entry));
+  }
+}
+
+static void writeValue(FILE* file, Type val) {
+  writeWord(file, val->type);
+  if(isObject(val->type)) {
+    struct Type key = objectKey(val);
+    Type id = getMap(object_ids, &key);
+    writeWord(file, id->int_val + (val->type == TYPE_MAP ? other_size : 0));
+  } else if(val->type == TYPE_STRING) {
+    writeString(file, val->string);
+  } else if(val->type == TYPE_FLOAT) {
+    writePadded(file, &val->double_val, sizeof(double));
+  } else if(val->type == TYPE_BOOL) {
+    writeWord(file, val->bool_val);
+  } else {
+    writeWord(file, val->int_val);
+  }
+}
+
+static int readValue(struct Reader* r, Type val, struct Type* objects, int64_t object_size) {
+  int64_t type = readWord(r);
+  val->type = (int)type;
+  if(isObject(val->type)) {
+    int64_t id = readWord(r);
+    if(id < 0 || id >= object_size || objects[id].type != val->type) {
+      return 1;
+    }
+    *val = objects[id];
+  } else if(type == TYPE_STRING) {
+    val->string = readString(r);
+  } else if(type == TYPE_FLOAT) {
+    char* data = readPadded(r, sizeof(double));
+    if(data) {
+      memcpy(&val->double_val, data, sizeof(double));
+    }
+  } else if(type == TYPE_BOOL) {
+    val->bool_val = (int)readWord(r);
+  } else if(type == TYPE_INT || type == TYPE_UNSET) {
+    val->int_val = readWord(r);
+  } else {
+    return 1;
+  }
+  return r->error;
+}
+
+static void writeObjects(FILE* file) {
+  writeWord(file, other_size);
+  for(int i = 0; i < other_size; i++) {
+    writeWord(file, others[i].type);
+    if(others[i].type == TYPE_ARRAY) {
+      ScriptCArray array = others[i].array;
+      size_t elem = array->elem_type == ARRAY_INT ? sizeof(int64_t) : sizeof(double);
+      writeWord(file, array->elem_type);
+      writeWord(file, array->length);
+      /* with the zero element past the end that createArray makes */
+      writePadded(file, array->ints, elem * ((size_t)array->length + 1));
+    } else {
+      ScriptCBigInt big = others[i].bigint;
+      writeWord(file, big->size);
+      writePadded(file, big, sizeof(struct ScriptCBigInt) + sizeof(uint32_t) * big->size);
+    }
+  }
+  writeWord(file, map_size);
+  for(int i = 0; i < map_size; i++) {
+    writeWord(file, maps[i]->size);
+  }
+  for(int i = 0; i < map_size; i++) {
+    for(struct MapEntry* entry = nextMapEntry(maps[i], NULL); entry; entry = nextMapEntry(maps[i], entry)) {
+      struct Type key;
+      writeValue(file, getMapEntryKey(entry, &key));
+      writeValue(file, getMapEntryValue(entry));
+    }
+  }
+}
+
+/* arrays and bigints stay in the mapping; a map is made with room for
+ * its entries and filled once every object exists */
+static struct Type* readObjects(struct Reader* r, int64_t* object_size) {
+  int64_t count = readWord(r);
+  if(r->error || count < 0 || count > (int64_t)(r->size / 8)) {
+    return NULL;
+  }
+  struct Type* objects = (struct Type*)malloc(sizeof(struct Type)*(count+1));
+  for(int64_t i = 0; i < count; i++) {
+    objects[i].type = (int)readWord(r);
+    if(objects[i].type == TYPE_ARRAY) {
+      int elem_type = (int)readWord(r);
+      int64_t length = readWord(r);
+      size_t elem = elem_type == ARRAY_INT ? sizeof(int64_t) : sizeof(double);
+      char* data = length >= 0 && length < INT32_MAX ? readPadded(r, elem * ((size_t)length + 1)) : NULL;
+      if(data == NULL) {
+        free(objects);
+        return NULL;
+      }
+      ScriptCArray array = (ScriptCArray)malloc(sizeof(struct ScriptCArray));
+      array->elem_type = elem_type;
+      array->length = (int)length;
+      array->ints = (int64_t*)data;
+      objects[i].array = array;
+    } else if(objects[i].type == TYPE_BIGINT) {
+      int64_t size = readWord(r);
+      char* data = size >= 0 && size < INT32_MAX ? readPadded(r, sizeof(struct ScriptCBigInt) + sizeof(uint32_t) * size) : NULL;
+      if(data == NULL) {
+        free(objects);
+        return NULL;
+      }
+      objects[i].bigint = (ScriptCBigInt)data;
+    } else {
+      free(objects);
+      return NULL;
+    }
+  }
+  int64_t maps_count = readWord(r);
+  if(r->error || maps_count < 0 || maps_count > (int64_t)(r->size / 8)) {
+    free(objects);
+    return NULL;
+  }
+  objects = (struct Type*)realloc(objects, sizeof(struct Type)*(count+maps_count+1));
+  int64_t* sizes = (int64_t*)malloc(sizeof(int64_t)*(maps_count+1));
+  for(int64_t i = 0; i < maps_count; i++) {
+    sizes[i] = readWord(r);
+    objects[count+i].type = TYPE_MAP;
+    objects[count+i].map = createMap(NULL, sizes[i] > 0 && sizes[i] < INT32_MAX ? (int)sizes[i] : 0);
+  }
+  *object_size = count + maps_count;
+  for(int64_t i = 0; i < maps_count && !r->error; i++) {
+    for(int64_t j = 0; j < sizes[i]; j++) {
+      struct Type key, value;
+      if(readValue(r, &key, objects, *object_size) || readValue(r, &value, objects, *object_size) || !isMapKey(&key)) {
+        r->error = 1;
+        break;
+      }
+      putMap(objects[count+i].map, &key, &value);
+    }
+  }
+  free(sizes);
+  if(r->error) {
+    free(objects);
+    return NULL;
+  }
+  return objects;
+}
+
+void armSnapshot(const char* path, const char* script, ScriptCInstruction insts, Module module, FrameInfo frames) {
+  target = (struct SnapshotTarget*)malloc(sizeof(struct SnapshotTarget));
+  target->path = strdup(path);
+  target->script = strdup(script);
+  target->insts = insts;
+  target->code_length = module->code_length;
+  target->pool = module->pool;
+  target->frames = frames;
+  target->frame_size = frames ? module->size : 0;
+}
+
+/* written aside and renamed like a cached object. a snapshot that
+ * cannot be written leaves the run as it was */
+void takeSnapshot(VMContext ctx, long entry) {
+  if(target == NULL) {
+    return;
+  }
+  struct SnapshotTarget* snap = target;
+  target = NULL;
+  int var_size = snap->frames ? snap->frames[0].var_size : VAR_MAX;
+  int depth = (int)(ctx->stack_pointer - ctx->stack_pointer_base);
+  object_ids = createMap(NULL, 0);
+  for(int i = 0; i < var_size; i++) {
+    collectValue(&ctx->var_list[i]);
+  }
+  for(int i = 0; i < depth; i++) {
+    collectValue(&ctx->stack_pointer_base[i]);
+  }
+
+  char* temp = (char*)malloc(strlen(snap->path)+5);
+  sprintf(temp, "%s.tmp", snap->path);
+  FILE* file = fopen(temp, "wb");
+  int error = file == NULL;
+  if(file) {
+    ConstPool pool = snap->pool;
+    fwrite(SNAPSHOT_MAGIC, 1, 4, file);
+    int32_t level = sc_optimize;
+    fwrite(&level, sizeof(level), 1, file);
+    writeString(file, SNAPSHOT_BUILD);
+    error = writeSources(file, snap->script);
+    writeWord(file, snap->code_length);
+    writeWord(file, entry);
+    writeWord(file, snap->frame_size);
+    writePadded(file, snap->frames, sizeof(struct FrameInfo) * snap->frame_size);
+    writePadded(file, snap->insts, sizeof(struct ScriptCInstruction) * snap->code_length);
+    writeWord(file, pool->long_size);
+    writePadded(file, pool->longs, sizeof(int64_t) * pool->long_size);
+    writeWord(file, pool->double_size);
+    writePadded(file, pool->doubles, sizeof(double) * pool->double_size);
+    writeWord(file, pool->string_size);
+    for(int i = 0; i < pool->string_size; i++) {
+      writeString(file, pool->strings[i]);
+    }
+    writeObjects(file);
+    writeWord(file, var_size);
+    for(int i = 0; i < var_size; i++) {
+      writeValue(file, &ctx->var_list[i]);
+    }
+    writeWord(file, depth);
+    for(int i = 0; i < depth; i++) {
+      writeValue(file, &ctx->stack_pointer_base[i]);
+    }
+    error = fclose(file) || error;
+  }
+  if(error || rename(temp, snap->path)) {
+    fprintf(stderr, "cannot write snapshot %s\n", snap->path);
+    remove(temp);
+  } else if(sc_debug) {
+    fprintf(stderr, "snapshot: %s at %ld, %d objects\n", snap->path, entry, other_size + map_size);
+  }
+  free(temp);
+  /* the id map is left to the collector */
+  object_ids = NULL;
+  free(others);
+  free(maps);
+  others = NULL;
+  maps = NULL;
+  other_size = 0;
+  map_size = 0;
+  free(snap->path);
+  free(snap->script);
+  free(snap);
+}
+
+static int readSnapshot(struct Reader* r, const char* script, struct Snapshot* snapshot) {
+  snapshot->pool.strings = NULL;
+  char* head = readPadded(r, 8);
+  int32_t level;
+  if(head == NULL || memcmp(head, SNAPSHOT_MAGIC, 4)) {
+    return 1;
+  }
+  memcpy(&level, head + 4, sizeof(level));
+  char* build = readString(r);
+  if(level != sc_optimize || build == NULL || strcmp(build, SNAPSHOT_BUILD) || checkSources(r, script)) {
+    return 1;
+  }
+  snapshot->code_length = readWord(r);
+  snapshot->entry = readWord(r);
+  int64_t frame_size = readWord(r);
+  if(snapshot->code_length < 2 || snapshot->entry < 1 || snapshot->entry >= snapshot->code_length
+    || frame_size < 0 || frame_size > snapshot->code_length) {
+    return 1;
+  }
+  snapshot->frames = frame_size ? (FrameInfo)readPadded(r, sizeof(struct FrameInfo) * frame_size) : NULL;
+  snapshot->insts = (ScriptCInstruction)readPadded(r, sizeof(struct ScriptCInstruction) * snapshot->code_length);
+  ConstPool pool = &snapshot->pool;
+  pool->long_size = (int)readWord(r);
+  pool->longs = (int64_t*)readPadded(r, sizeof(int64_t) * pool->long_size);
+  pool->double_size = (int)readWord(r);
+  pool->doubles = (double*)readPadded(r, sizeof(double) * pool->double_size);
+  pool->string_size = (int)readWord(r);
+  if(r->error || pool->string_size < 0 || pool->string_size > (int64_t)(r->size / 8)) {
+    return 1;
+  }
+  pool->capacity = pool->string_size;
+  pool->strings = (char**)malloc(sizeof(char*)*(pool->string_size+1));
+  for(int i = 0; i < pool->string_size; i++) {
+    pool->strings[i] = readString(r);
+  }
+  int64_t object_size = 0;
+  struct Type* objects = r->error ? NULL : readObjects(r, &object_size);
+  if(objects == NULL) {
+    return 1;
+  }
+  int64_t var_size = readWord(r);
+  VMContext ctx = snapshot->frames ? createFrame(NULL, 0, snapshot->frames[0].var_size, snapshot->frames[0].stack_size)
+    : createVMContext(NULL, 0);
+  int stack_size = snapshot->frames ? snapshot->frames[0].stack_size : VM_CONTEXT_MAX_STACK_LENGTH;
+  if(var_size != (snapshot->frames ? snapshot->frames[0].var_size : VAR_MAX)) {
+    r->error = 1;
+  }
+  for(int64_t i = 0; i < var_size && !r->error; i++) {
+    r->error = readValue(r, &ctx->var_list[i], objects, object_size);
+  }
+  int64_t depth = readWord(r);
+  if(depth < 0 || depth > stack_size) {
+    r->error = 1;
+  }
+  for(int64_t i = 0; i < depth && !r->error; i++) {
+    r->error = readValue(r, ctx->stack_pointer++, objects, object_size);
+  }
+  free(objects);
+  if(r->error) {
+    disposeVMContext(ctx);
+    return 1;
+  }
+  snapshot->ctx = ctx;
+  return 0;
+}
+
+/* 1 when there is no snapshot of this script to start from. the file
+ * stays mapped for the rest of the run */
+int restoreSnapshot(const char* path, const char* script, struct Snapshot* snapshot) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 1;
+  }
+  struct stat st;
+  struct Reader r = {NULL, 0, 0, 0};
+  if(fstat(fd, &st) == 0 && st.st_size > 0) {
+    r.size = st.st_size;
+    r.data = (char*)mmap(NULL, r.size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(r.data == NULL || r.data == MAP_FAILED) {
+    return 1;
+  }
+  if(readSnapshot(&r, script, snapshot)) {
+    if(sc_debug) {
+      fprintf(stderr, "snapshot: %s is stale\n", path);
+    }
+    free(snapshot->pool.strings);
+    munmap(r.data, r.size);
+    return 1;
+  }
+  if(sc_debug) {
+    fprintf(stderr, "snapshot: restore %s at %ld\n", path, snapshot->entry);
+  }
+  return 0;
+}
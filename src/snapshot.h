@@ -0,0 +1,41 @@
+#ifndef __SNAPSHOT__
+#define __SNAPSHOT__
+
+#include "compiler.h"
+#include "vm.h"
+
+/* snapshot(); in the top level code marks the point where a script is
+ * done setting up. run with -S file, the first run that reaches the
+ * marker writes the linked code, the constant pool and the locals and
+ * operand stack of the top level frame to file, with the arrays, maps,
+ * bigints and strings they reach, and goes on. a later run of the same
+ * script maps the file and starts at the instruction after the marker,
+ * without parsing, compiling or running the code before it. without -S
+ * the marker does nothing.
+ *
+ * a snapshot is the state of one build of scriptC at one -O level and
+ * stays valid while the script and every file it imports are unchanged;
+ * otherwise the run starts over and writes it again. the output of the
+ * code before the marker is not replayed, and what lives outside the
+ * frame is not saved: streams opened before the marker are closed in
+ * the restored run.
+ *
+ * the restored code, constants, strings, array elements and bigints
+ * stay in the private mapping of the file, so they are paged in as the
+ * script touches them. maps are built again, since they grow in place */
+
+struct Snapshot {
+  ScriptCInstruction insts;
+  long code_length;
+  struct ConstPool pool;
+  FrameInfo frames;
+  VMContext ctx;
+  /* the instruction after the marker */
+  long entry;
+};
+
+void armSnapshot(const char* path, const char* script, ScriptCInstruction insts, Module module, FrameInfo frames);
+void takeSnapshot(VMContext ctx, long entry);
+int restoreSnapshot(const char* path, const char* script, struct Snapshot* snapshot);
+
+#endif
@@ -0,0 +1,173 @@
+/* syscall and clock_gettime */
+#define _DEFAULT_SOURCE
+
+#include "compiler.h"
+#include "vm.h"
+#include "heap.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define COUNTER_EACH(COUNTER)\
+  COUNTER(cycles, PERF_COUNT_HW_CPU_CYCLES)\
+  COUNTER(instructions, PERF_COUNT_HW_INSTRUCTIONS)\
+  COUNTER(branch_misses, PERF_COUNT_HW_BRANCH_MISSES)\
+  COUNTER(cache_misses, PERF_COUNT_HW_CACHE_MISSES)
+
+enum {
+#define DEFINE_COUNTER(NAME, CONFIG) COUNTER_##NAME,
+  COUNTER_EACH(DEFINE_COUNTER)
+#undef DEFINE_COUNTER
+  COUNTER_SIZE
+};
+
+static const char* const counter_names[] = {
+#define DEFINE_NAME(NAME, CONFIG) #NAME,
+  COUNTER_EACH(DEFINE_NAME)
+#undef DEFINE_NAME
+};
+
+static const uint64_t counter_configs[] = {
+#define DEFINE_CONFIG(NAME, CONFIG) CONFIG,
+  COUNTER_EACH(DEFINE_CONFIG)
+#undef DEFINE_CONFIG
+};
+
+struct Phase {
+  const char* name;
+  double wall;
+  uint64_t counters[COUNTER_SIZE];
+};
+
+static struct Stats {
+  int fds[COUNTER_SIZE];
+  int error;
+  struct Phase phases[STATS_MAX_PHASES];
+  int phase_size;
+  struct timespec start;
+  uint64_t start_counters[COUNTER_SIZE];
+} stats;
+
+static int openCounter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void readCounters(uint64_t* values) {
+  for(int i = 0; i < COUNTER_SIZE; i++) {
+    values[i] = 0;
+    if(stats.fds[i] >= 0 && read(stats.fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+      values[i] = 0;
+    }
+  }
+}
+
+void openStats(void) {
+  stats.error = 0;
+  for(int i = 0; i < COUNTER_SIZE; i++) {
+    stats.fds[i] = openCounter(counter_configs[i]);
+    if(stats.fds[i] < 0 && stats.error == 0) {
+      stats.error = errno;
+    }
+  }
+  stats.phase_size = 0;
+  sc_stats = 1;
+}
+
+void beginPhase(const char* name) {
+  if(stats.phase_size == STATS_MAX_PHASES) {
+    return;
+  }
+  stats.phases[stats.phase_size].name = name;
+  clock_gettime(CLOCK_MONOTONIC, &stats.start);
+  readCounters(stats.start_counters);
+}
+
+void endPhase(void) {
+  if(stats.phase_size == STATS_MAX_PHASES) {
+    return;
+  }
+  uint64_t counters[COUNTER_SIZE];
+  struct timespec end;
+  readCounters(counters);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  struct Phase* phase = &stats.phases[stats.phase_size++];
+  phase->wall = (double)(end.tv_sec - stats.start.tv_sec) * 1e3 + (double)(end.tv_nsec - stats.start.tv_nsec) / 1e6;
+  for(int i = 0; i < COUNTER_SIZE; i++) {
+    phase->counters[i] = counters[i] - stats.start_counters[i];
+  }
+}
+
+static void printString(const char* str) {
+  fputc('"', stderr);
+  for(; *str; str++) {
+    if(*str == '"' || *str == '\\') {
+      fputc('\\', stderr);
+    }
+    if((unsigned char)*str < 0x20) {
+      fprintf(stderr, "\\u%04x", *str);
+    } else {
+      fputc(*str, stderr);
+    }
+  }
+  fputc('"', stderr);
+}
+
+/* the dispatch count is null for context threading, whose native code
+ * has no dispatch to count */
+void printStats(const char* script) {
+  fprintf(stderr, "{\n  \"script\": ");
+  printString(script ? script : "<stdin>");
+  fprintf(stderr, ",\n  \"core\": \"%s\",\n  \"counters\": ", getDispatchName(sc_dispatch));
+  if(stats.error) {
+    fprintf(stderr, "false,\n  \"counter_error\": ");
+    printString(strerror(stats.error));
+  } else {
+    fprintf(stderr, "true");
+  }
+  fprintf(stderr, ",\n  \"phases\": [");
+  for(int p = 0; p < stats.phase_size; p++) {
+    struct Phase* phase = &stats.phases[p];
+    fprintf(stderr, "%s\n    {\"name\": \"%s\", \"wall_ms\": %.3f", p ? "," : "", phase->name, phase->wall);
+    for(int i = 0; i < COUNTER_SIZE; i++) {
+      if(stats.fds[i] >= 0) {
+        fprintf(stderr, ", \"%s\": %llu", counter_names[i], (unsigned long long)phase->counters[i]);
+      } else {
+        fprintf(stderr, ", \"%s\": null", counter_names[i]);
+      }
+    }
+    fprintf(stderr, "}");
+  }
+  fprintf(stderr, "\n  ],\n  \"vm\": {\"dispatched\": ");
+  if(sc_dispatch == DISPATCH_CONTEXT) {
+    fprintf(stderr, "null");
+  } else {
+    fprintf(stderr, "%ld", vm_stats.dispatched);
+  }
+  fprintf(stderr, ", \"frames\": %ld, \"frame_bytes\": %ld, \"heap_bytes\": %zu}\n}\n",
+      vm_stats.frames, vm_stats.frame_bytes, heapAllocatedBytes());
+}
+
+void closeStats(void) {
+  for(int i = 0; i < COUNTER_SIZE; i++) {
+    if(stats.fds[i] >= 0) {
+      close(stats.fds[i]);
+    }
+    stats.fds[i] = -1;
+  }
+}
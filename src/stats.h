@@ -0,0 +1,17 @@
+#ifndef __STATS__
+#define __STATS__
+
+/* -s: wall time and hardware counters around each phase of a run,
+ * printed as one JSON object on stderr. the counters come from
+ * perf_event_open for this thread in user space; a counter the kernel
+ * refuses is reported as null and the wall times remain */
+
+#define STATS_MAX_PHASES 8
+
+void openStats(void);
+void beginPhase(const char* name);
+void endPhase(void);
+void printStats(const char* script);
+void closeStats(void);
+
+#endif
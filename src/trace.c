@@ -0,0 +1,868 @@
+#include "compiler.h"
+#include "vm.h"
+#include "array.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* trace ops name frame slots: the locals followed by the operand stack.
+ * a k form takes its right operand from k. the compares are guards that
+ * leave the trace unless the result is expect; the array stores take
+ * the value from dst */
+#define TRACE_OP_EACH(OP)\
+  OP(loop)\
+  OP(move)\
+  OP(movek)\
+  OP(guard)\
+  OP(iadd) OP(iaddk)\
+  OP(isub) OP(isubk)\
+  OP(imul) OP(imulk)\
+  OP(idiv) OP(idivk)\
+  OP(dadd) OP(daddk)\
+  OP(dsub) OP(dsubk)\
+  OP(dmul) OP(dmulk)\
+  OP(ddiv) OP(ddivk)\
+  OP(ilt) OP(iltk)\
+  OP(ile) OP(ilek)\
+  OP(igt) OP(igtk)\
+  OP(ige) OP(igek)\
+  OP(ieq) OP(ieqk)\
+  OP(ine) OP(inek)\
+  OP(dlt) OP(dltk)\
+  OP(dle) OP(dlek)\
+  OP(dgt) OP(dgtk)\
+  OP(dge) OP(dgek)\
+  OP(deq) OP(deqk)\
+  OP(dne) OP(dnek)\
+  OP(ineg)\
+  OP(dneg)\
+  OP(iaload)\
+  OP(daload)\
+  OP(iastore)\
+  OP(iastorek)\
+  OP(dastore)\
+  OP(dastorei)
+
+enum trace_opcode {
+#define DEFINE_ENUM(NAME) T##NAME,
+  TRACE_OP_EACH(DEFINE_ENUM)
+#undef DEFINE_ENUM
+};
+
+struct TraceOp {
+  int op;
+  int dst;
+  int a;
+  int b;
+  int exit;
+  int expect;
+  struct Type k;
+};
+
+/* where the interpreter finds a stack slot at an exit: copied from a
+ * slot and tagged, or a constant when slot is -1 */
+struct TraceValue {
+  int slot;
+  int type;
+  struct Type k;
+};
+
+struct TraceExit {
+  long resume;
+  int depth;
+  struct TraceValue* stack;
+  /* local and type pairs of the tags that differ from the entry */
+  int* tags;
+  int tag_size;
+};
+
+struct TraceGuard {
+  int local;
+  int type;
+};
+
+struct Trace {
+  long header;
+  long anchor;
+  struct TraceOp* ops;
+  int op_size;
+  struct TraceExit* exits;
+  int exit_size;
+  struct TraceGuard* guards;
+  int guard_size;
+  long entries;
+  long iterations;
+};
+
+/* the recorder keeps the operand stack symbolically: a value lives in a
+ * slot, is a constant, or is a compare its ifcmp will turn into a guard */
+#define VALUE_SLOT 0
+#define VALUE_CONST 1
+#define VALUE_COMPARE 2
+
+struct Value {
+  int kind;
+  int slot;
+  int type;
+  struct Type k;
+};
+
+struct TraceRecorder {
+  long header;
+  long anchor;
+  int var_size;
+  int length;
+  const char* error;
+  struct Value* stack;
+  int depth;
+  /* per local: the type guarded at entry and the type now, -1 if none */
+  int* guards;
+  int* types;
+  struct TraceOp* ops;
+  int op_size;
+  int op_capacity;
+  struct TraceExit* exits;
+  /* the local types at each exit until endTrace turns them into tags */
+  int** exit_types;
+  int exit_size;
+  int exit_capacity;
+  int produced;
+  int compare;
+  struct Value compare_left;
+  struct Value compare_right;
+};
+
+static struct TraceSlot* trace_slots;
+static long trace_slot_size;
+
+static const char* const trace_opnames[] = {
+#define DEFINE_NAME(NAME) #NAME,
+  TRACE_OP_EACH(DEFINE_NAME)
+#undef DEFINE_NAME
+};
+
+struct TraceSlot* traceSlot(long index) {
+  if(index >= trace_slot_size) {
+    long size = trace_slot_size ? trace_slot_size : 1024;
+    while(size <= index) {
+      size *= 2;
+    }
+    trace_slots = (struct TraceSlot*)realloc(trace_slots, sizeof(struct TraceSlot)*size);
+    memset(trace_slots + trace_slot_size, 0, sizeof(struct TraceSlot)*(size - trace_slot_size));
+    trace_slot_size = size;
+  }
+  return &trace_slots[index];
+}
+
+TraceRecorder beginTrace(long header, long anchor, VMContext ctx) {
+  TraceRecorder rec = (TraceRecorder)calloc(1, sizeof(struct TraceRecorder));
+  rec->header = header;
+  rec->anchor = anchor;
+  rec->var_size = (int)(ctx->stack_pointer_base - ctx->var_list_base);
+  rec->stack = (struct Value*)malloc(sizeof(struct Value)*VM_CONTEXT_MAX_STACK_LENGTH);
+  rec->guards = (int*)malloc(sizeof(int)*(rec->var_size+1));
+  rec->types = (int*)malloc(sizeof(int)*(rec->var_size+1));
+  for(int i = 0; i < rec->var_size; i++) {
+    rec->guards[i] = -1;
+    rec->types[i] = -1;
+  }
+  rec->produced = -1;
+  if(ctx->stack_pointer != ctx->stack_pointer_base) {
+    rec->error = "operand stack not empty at the loop header";
+  }
+  return rec;
+}
+
+static int fail(TraceRecorder rec, const char* error) {
+  if(rec->error == NULL) {
+    rec->error = error;
+  }
+  return 0;
+}
+
+static int emit(TraceRecorder rec, int op, int dst, int a, int b) {
+  if(rec->op_size == rec->op_capacity) {
+    rec->op_capacity = rec->op_capacity ? rec->op_capacity * 2 : 64;
+    rec->ops = (struct TraceOp*)realloc(rec->ops, sizeof(struct TraceOp)*rec->op_capacity);
+  }
+  struct TraceOp* t = &rec->ops[rec->op_size];
+  memset(t, 0, sizeof(struct TraceOp));
+  t->op = op;
+  t->dst = dst;
+  t->a = a;
+  t->b = b;
+  t->exit = -1;
+  rec->produced = -1;
+  return rec->op_size++;
+}
+
+/* the exit to resume at with the operand stack as it is now */
+static int snapshot(TraceRecorder rec, long resume) {
+  if(rec->exit_size == rec->exit_capacity) {
+    rec->exit_capacity = rec->exit_capacity ? rec->exit_capacity * 2 : 16;
+    rec->exits = (struct TraceExit*)realloc(rec->exits, sizeof(struct TraceExit)*rec->exit_capacity);
+    rec->exit_types = (int**)realloc(rec->exit_types, sizeof(int*)*rec->exit_capacity);
+  }
+  struct TraceExit* exit = &rec->exits[rec->exit_size];
+  exit->resume = resume;
+  exit->depth = rec->depth;
+  exit->stack = (struct TraceValue*)malloc(sizeof(struct TraceValue)*(rec->depth+1));
+  exit->tags = NULL;
+  exit->tag_size = 0;
+  for(int i = 0; i < rec->depth; i++) {
+    struct Value* v = &rec->stack[i];
+    if(v->kind == VALUE_COMPARE) {
+      rec->error = "compare result kept on the stack";
+    }
+    exit->stack[i].slot = v->kind == VALUE_SLOT ? v->slot : -1;
+    exit->stack[i].type = v->type;
+    exit->stack[i].k = v->k;
+  }
+  rec->exit_types[rec->exit_size] = (int*)malloc(sizeof(int)*(rec->var_size+1));
+  memcpy(rec->exit_types[rec->exit_size], rec->types, sizeof(int)*rec->var_size);
+  return rec->exit_size++;
+}
+
+static void push(TraceRecorder rec, int kind, int slot, int type) {
+  struct Value* v = &rec->stack[rec->depth++];
+  memset(v, 0, sizeof(struct Value));
+  v->kind = kind;
+  v->slot = slot;
+  v->type = type;
+}
+
+static void pushConst(TraceRecorder rec, struct Type k) {
+  push(rec, VALUE_CONST, -1, k.type);
+  rec->stack[rec->depth-1].k = k;
+}
+
+/* the slot of stack value i, a constant goes to its own stack slot */
+static int materialize(TraceRecorder rec, int i) {
+  struct Value* v = &rec->stack[i];
+  if(v->kind == VALUE_CONST) {
+    int op = emit(rec, Tmovek, rec->var_size + i, -1, -1);
+    rec->ops[op].k = v->k;
+    v->kind = VALUE_SLOT;
+    v->slot = rec->var_size + i;
+  }
+  return v->slot;
+}
+
+/* stack values still reading a local are copied before it is written */
+static void flushLocal(TraceRecorder rec, int local) {
+  for(int i = 0; i < rec->depth; i++) {
+    struct Value* v = &rec->stack[i];
+    if(v->kind == VALUE_SLOT && v->slot == local) {
+      emit(rec, Tmove, rec->var_size + i, local, -1);
+      v->slot = rec->var_size + i;
+    }
+  }
+}
+
+static int readLocal(TraceRecorder rec, int local, int observed) {
+  if(rec->types[local] != -1) {
+    return rec->types[local] == observed;
+  }
+  if(rec->guards[local] == -1) {
+    rec->guards[local] = observed;
+  }
+  return rec->guards[local] == observed;
+}
+
+static int numericType(Type left, Type right) {
+  if(left->type == right->type && (left->type == TYPE_INT || left->type == TYPE_FLOAT)) {
+    return left->type;
+  }
+  return -1;
+}
+
+/* kind indexes add, sub, mul, div */
+static int recordArith(TraceRecorder rec, long index, int kind, VMContext ctx) {
+  static const int int_ops[] = {Tiadd, Tisub, Timul, Tidiv};
+  static const int double_ops[] = {Tdadd, Tdsub, Tdmul, Tddiv};
+  int type = numericType(ctx->stack_pointer - 2, ctx->stack_pointer - 1);
+  if(type < 0) {
+    return fail(rec, "arithmetic on other than two ints or two floats");
+  }
+  int exit = type == TYPE_INT ? snapshot(rec, index) : -1;
+  int d = rec->depth;
+  struct Value left = rec->stack[d-2];
+  struct Value right = rec->stack[d-1];
+  if(left.kind == VALUE_CONST && right.kind != VALUE_CONST && (kind == 0 || kind == 2)) {
+    struct Value tmp = left;
+    left = right;
+    right = tmp;
+  }
+  rec->stack[d-2] = left;
+  rec->stack[d-1] = right;
+  int a = materialize(rec, d-2);
+  int base = type == TYPE_INT ? int_ops[kind] : double_ops[kind];
+  int dst = rec->var_size + d - 2;
+  int op;
+  if(right.kind == VALUE_CONST) {
+    op = emit(rec, base + 1, dst, a, -1);
+    rec->ops[op].k = right.k;
+  } else {
+    op = emit(rec, base, dst, a, right.slot);
+  }
+  rec->ops[op].exit = exit;
+  rec->depth -= 2;
+  push(rec, VALUE_SLOT, dst, type);
+  rec->produced = op;
+  return 1;
+}
+
+/* kind indexes lt, le, gt, ge, eq, ne */
+static int recordCompare(TraceRecorder rec, int kind, VMContext ctx) {
+  static const int int_ops[] = {Tilt, Tile, Tigt, Tige, Tieq, Tine};
+  static const int double_ops[] = {Tdlt, Tdle, Tdgt, Tdge, Tdeq, Tdne};
+  static const int swapped[] = {2, 3, 0, 1, 4, 5};
+  int type = numericType(ctx->stack_pointer - 2, ctx->stack_pointer - 1);
+  if(type < 0) {
+    return fail(rec, "compare of other than two ints or two floats");
+  }
+  int d = rec->depth;
+  struct Value left = rec->stack[d-2];
+  struct Value right = rec->stack[d-1];
+  if(left.kind == VALUE_CONST && right.kind != VALUE_CONST) {
+    rec->compare_left = right;
+    rec->compare_right = left;
+    kind = swapped[kind];
+  } else {
+    materialize(rec, d-2);
+    rec->compare_left = rec->stack[d-2];
+    rec->compare_right = right;
+  }
+  rec->compare = type == TYPE_INT ? int_ops[kind] : double_ops[kind];
+  rec->depth -= 2;
+  push(rec, VALUE_COMPARE, -1, TYPE_BOOL);
+  return 1;
+}
+
+static int recordBranch(TraceRecorder rec, long index, int32_t target, VMContext ctx) {
+  Type top = ctx->stack_pointer - 1;
+  if(top->type != TYPE_BOOL) {
+    return fail(rec, "branch on other than a bool");
+  }
+  int taken = !top->bool_val;
+  long follow = taken ? target : index + 1;
+  long other = taken ? index + 1 : target;
+  if(follow < rec->header || follow > rec->anchor) {
+    return fail(rec, "the loop ended while recording");
+  }
+  struct Value cond = rec->stack[--rec->depth];
+  if(cond.kind == VALUE_CONST) {
+    return 1;
+  }
+  int exit = snapshot(rec, other);
+  int op;
+  if(cond.kind == VALUE_COMPARE) {
+    if(rec->compare_right.kind == VALUE_CONST) {
+      op = emit(rec, rec->compare + 1, -1, rec->compare_left.slot, -1);
+      rec->ops[op].k = rec->compare_right.k;
+    } else {
+      op = emit(rec, rec->compare, -1, rec->compare_left.slot, rec->compare_right.slot);
+    }
+  } else {
+    op = emit(rec, Tguard, -1, cond.slot, -1);
+  }
+  rec->ops[op].expect = !taken;
+  rec->ops[op].exit = exit;
+  return 1;
+}
+
+static int recordStore(TraceRecorder rec, int local) {
+  struct Value val = rec->stack[--rec->depth];
+  if(val.kind == VALUE_COMPARE) {
+    return fail(rec, "compare result kept in a local");
+  }
+  flushLocal(rec, local);
+  if(val.kind == VALUE_CONST) {
+    int op = emit(rec, Tmovek, local, -1, -1);
+    rec->ops[op].k = val.k;
+  } else if(val.slot >= rec->var_size && rec->produced == rec->op_size - 1 && rec->ops[rec->produced].dst == val.slot) {
+    /* the op that made the value writes the local itself */
+    rec->ops[rec->produced].dst = local;
+  } else if(val.slot != local) {
+    emit(rec, Tmove, local, val.slot, -1);
+  }
+  rec->produced = -1;
+  rec->types[local] = val.type;
+  return 1;
+}
+
+static int recordLoad(TraceRecorder rec, Type array, Type index) {
+  if(array->type != TYPE_ARRAY || index->type != TYPE_INT) {
+    return fail(rec, "index into other than an array");
+  }
+  int d = rec->depth;
+  int a = rec->stack[d-2].slot;
+  int b = materialize(rec, d-1);
+  int dst = rec->var_size + d - 2;
+  int type = array->array->elem_type == ARRAY_INT ? TYPE_INT : TYPE_FLOAT;
+  int op = emit(rec, type == TYPE_INT ? Tiaload : Tdaload, dst, a, b);
+  rec->depth -= 2;
+  push(rec, VALUE_SLOT, dst, type);
+  rec->produced = op;
+  return op;
+}
+
+static int recordArrayStore(TraceRecorder rec, Type array, Type index, Type val) {
+  if(array->type != TYPE_ARRAY || index->type != TYPE_INT) {
+    return fail(rec, "index into other than an array");
+  }
+  int d = rec->depth;
+  int elem_type = array->array->elem_type;
+  int op;
+  if(elem_type == ARRAY_INT && val->type != TYPE_INT) {
+    return fail(rec, "store of other than an int into an int array");
+  }
+  if(elem_type == ARRAY_FLOAT && val->type != TYPE_INT && val->type != TYPE_FLOAT) {
+    return fail(rec, "store of other than a number into a float array");
+  }
+  int a = rec->stack[d-3].slot;
+  int b = materialize(rec, d-2);
+  struct Value* v = &rec->stack[d-1];
+  if(elem_type == ARRAY_INT && v->kind == VALUE_CONST) {
+    op = emit(rec, Tiastorek, -1, a, b);
+    rec->ops[op].k = v->k;
+  } else {
+    int value = materialize(rec, d-1);
+    int code = elem_type == ARRAY_INT ? Tiastore : val->type == TYPE_FLOAT ? Tdastore : Tdastorei;
+    op = emit(rec, code, value, a, b);
+  }
+  rec->depth -= 3;
+  return op;
+}
+
+/* called before the instruction at index runs, with the frame as the
+ * instruction will see it. 0 stops the recording before it */
+int recordTrace(TraceRecorder rec, long index, int op, int32_t operand, VMContext ctx, ConstPool pool) {
+  if(rec->error) {
+    return 0;
+  }
+  if(++rec->length > TRACE_MAX_LENGTH) {
+    return fail(rec, "loop body too long");
+  }
+  if(ctx->stack_pointer - ctx->stack_pointer_base != rec->depth) {
+    return fail(rec, "operand stack out of step");
+  }
+  struct Type k;
+  memset(&k, 0, sizeof(k));
+  switch(op) {
+    case Iiconst:
+    case Ilconst:
+      k.type = TYPE_INT;
+      k.int_val = op == Iiconst ? operand : pool->longs[operand];
+      pushConst(rec, k);
+      return 1;
+    case Idconst:
+      k.type = TYPE_FLOAT;
+      k.double_val = pool->doubles[operand];
+      pushConst(rec, k);
+      return 1;
+    case Isconst:
+      k.type = TYPE_STRING;
+      k.string = pool->strings[operand];
+      pushConst(rec, k);
+      return 1;
+    case Ibconst:
+      k.type = TYPE_BOOL;
+      k.bool_val = operand;
+      pushConst(rec, k);
+      return 1;
+    case Iloadl:
+    case Iloadl_u: {
+      int type = ctx->var_list[operand].type;
+      if(type < TYPE_INT || type > TYPE_BIGINT) {
+        return fail(rec, "load of a local without a type");
+      }
+      if(!readLocal(rec, operand, type)) {
+        return fail(rec, "local changes its type");
+      }
+      push(rec, VALUE_SLOT, operand, type);
+      return 1;
+    }
+    case Istorel:
+    case Istorel_u:
+      return recordStore(rec, operand);
+    case Iiinc: {
+      int local = INC_VAR(operand);
+      if(ctx->var_list[local].type != TYPE_INT || !readLocal(rec, local, TYPE_INT)) {
+        return fail(rec, "increment of other than an int");
+      }
+      flushLocal(rec, local);
+      int exit = snapshot(rec, index);
+      int t = emit(rec, Tiaddk, local, local, -1);
+      rec->ops[t].k.type = TYPE_INT;
+      rec->ops[t].k.int_val = INC_VAL(operand);
+      rec->ops[t].exit = exit;
+      rec->types[local] = TYPE_INT;
+      return 1;
+    }
+    case Ijump:
+      if(operand <= index || operand > rec->anchor) {
+        return fail(rec, "jump out of the loop or into an inner loop");
+      }
+      return 1;
+    case Iifcmp:
+    case Iifcmp_u:
+      return recordBranch(rec, index, operand, ctx);
+    case Ilt: case Iilt: case Idlt:
+      return recordCompare(rec, 0, ctx);
+    case Ile: case Iile: case Idle:
+      return recordCompare(rec, 1, ctx);
+    case Igt: case Iigt: case Idgt:
+      return recordCompare(rec, 2, ctx);
+    case Ige: case Iige: case Idge:
+      return recordCompare(rec, 3, ctx);
+    case Ieq: case Iieq: case Ideq:
+      return recordCompare(rec, 4, ctx);
+    case Ine: case Iine: case Idne:
+      return recordCompare(rec, 5, ctx);
+    case Iadd: case Iiadd: case Idadd:
+      return recordArith(rec, index, 0, ctx);
+    case Isub: case Iisub: case Idsub:
+      return recordArith(rec, index, 1, ctx);
+    case Imul: case Iimul: case Idmul:
+      return recordArith(rec, index, 2, ctx);
+    case Idiv: case Iidiv: case Iddiv:
+      return recordArith(rec, index, 3, ctx);
+    case Iminus: {
+      Type top = ctx->stack_pointer - 1;
+      if(top->type != TYPE_INT && top->type != TYPE_FLOAT) {
+        return fail(rec, "negation of other than an int or a float");
+      }
+      int exit = top->type == TYPE_INT ? snapshot(rec, index) : -1;
+      int d = rec->depth;
+      int a = materialize(rec, d-1);
+      int t = emit(rec, top->type == TYPE_INT ? Tineg : Tdneg, rec->var_size + d - 1, a, -1);
+      rec->ops[t].exit = exit;
+      rec->stack[d-1].slot = rec->var_size + d - 1;
+      rec->produced = t;
+      return 1;
+    }
+    case Iaload: {
+      int exit = snapshot(rec, index);
+      int t = recordLoad(rec, ctx->stack_pointer - 2, ctx->stack_pointer - 1);
+      if(rec->error) {
+        return 0;
+      }
+      rec->ops[t].exit = exit;
+      return 1;
+    }
+    case Iastore: {
+      int exit = snapshot(rec, index);
+      int t = recordArrayStore(rec, ctx->stack_pointer - 3, ctx->stack_pointer - 2, ctx->stack_pointer - 1);
+      if(rec->error) {
+        return 0;
+      }
+      rec->ops[t].exit = exit;
+      return 1;
+    }
+  }
+  return fail(rec, "instruction that is not traced");
+}
+
+static void disposeRecorder(TraceRecorder rec) {
+  for(int i = 0; i < rec->exit_size; i++) {
+    free(rec->exit_types[i]);
+  }
+  free(rec->exit_types);
+  free(rec->stack);
+  free(rec->guards);
+  free(rec->types);
+  free(rec);
+}
+
+static void disposeTrace(Trace trace) {
+  for(int i = 0; i < trace->exit_size; i++) {
+    free(trace->exits[i].stack);
+    free(trace->exits[i].tags);
+  }
+  free(trace->exits);
+  free(trace->ops);
+  free(trace->guards);
+  free(trace);
+}
+
+static void dumpTrace(Trace trace) {
+  fprintf(stderr, "trace: loop %ld-%ld: %d ops, %d guards at entry, %d exits\n",
+      trace->header, trace->anchor, trace->op_size, trace->guard_size, trace->exit_size);
+  for(int i = 0; i < trace->op_size; i++) {
+    struct TraceOp* t = &trace->ops[i];
+    fprintf(stderr, "  [%d] %s %d %d %d", i, trace_opnames[t->op], t->dst, t->a, t->b);
+    if(t->exit >= 0) {
+      fprintf(stderr, " exit %ld", trace->exits[t->exit].resume);
+    }
+    fprintf(stderr, "\n");
+  }
+}
+
+/* closed is set when the recording got back to the loop instruction.
+ * the locals written in the loop become entry guards of their final
+ * type, and every exit learns which tags it has to fix */
+Trace endTrace(TraceRecorder rec, int closed) {
+  if(!closed) {
+    fail(rec, "recording stopped");
+  } else if(rec->depth != 0) {
+    fail(rec, "operand stack not empty at the loop instruction");
+  }
+  for(int i = 0; !rec->error && i < rec->var_size; i++) {
+    if(rec->types[i] != -1 && rec->guards[i] != -1 && rec->guards[i] != rec->types[i]) {
+      fail(rec, "local changes its type around the loop");
+    }
+  }
+  if(rec->error) {
+    if(sc_debug) {
+      fprintf(stderr, "trace: loop %ld-%ld: %s\n", rec->header, rec->anchor, rec->error);
+    }
+    for(int i = 0; i < rec->exit_size; i++) {
+      free(rec->exits[i].stack);
+    }
+    free(rec->exits);
+    free(rec->ops);
+    disposeRecorder(rec);
+    return NULL;
+  }
+  int loop = emit(rec, Tloop, -1, -1, -1);
+  rec->ops[loop].exit = snapshot(rec, rec->header);
+  Trace trace = (Trace)calloc(1, sizeof(struct Trace));
+  trace->header = rec->header;
+  trace->anchor = rec->anchor;
+  trace->guards = (struct TraceGuard*)malloc(sizeof(struct TraceGuard)*(rec->var_size+1));
+  for(int i = 0; i < rec->var_size; i++) {
+    int type = rec->types[i] != -1 ? rec->types[i] : rec->guards[i];
+    if(type != -1) {
+      trace->guards[trace->guard_size].local = i;
+      trace->guards[trace->guard_size].type = type;
+      trace->guard_size++;
+    }
+  }
+  for(int e = 0; e < rec->exit_size; e++) {
+    struct TraceExit* exit = &rec->exits[e];
+    int* types = rec->exit_types[e];
+    exit->tags = (int*)malloc(sizeof(int)*(2*rec->var_size+1));
+    for(int i = 0; i < rec->var_size; i++) {
+      if(types[i] != -1 && types[i] != rec->types[i]) {
+        exit->tags[exit->tag_size*2] = i;
+        exit->tags[exit->tag_size*2+1] = types[i];
+        exit->tag_size++;
+      }
+    }
+  }
+  trace->ops = rec->ops;
+  trace->op_size = rec->op_size;
+  trace->exits = rec->exits;
+  trace->exit_size = rec->exit_size;
+  disposeRecorder(rec);
+  if(sc_debug) {
+    dumpTrace(trace);
+  }
+  return trace;
+}
+
+/* the interpreter state at an exit */
+static long leaveTrace(struct TraceExit* exit, VMContext ctx) {
+  Type s = ctx->var_list_base;
+  Type stack = ctx->stack_pointer_base;
+  for(int i = 0; i < exit->depth; i++) {
+    struct TraceValue* v = &exit->stack[i];
+    if(v->slot < 0) {
+      stack[i] = v->k;
+    } else {
+      stack[i].string = s[v->slot].string;
+      stack[i].type = v->type;
+    }
+  }
+  for(int i = 0; i < exit->tag_size; i++) {
+    s[exit->tags[i*2]].type = exit->tags[i*2+1];
+  }
+  ctx->stack_pointer = stack + exit->depth;
+  return exit->resume;
+}
+
+#define TRACE_INT_ARITH(NAME, BUILTIN)\
+  case T##NAME:\
+    if(BUILTIN(s[op->a].int_val, s[op->b].int_val, &val)) {\
+      goto side_exit;\
+    }\
+    s[op->dst].int_val = val;\
+    op++;\
+    continue;\
+  case T##NAME##k:\
+    if(BUILTIN(s[op->a].int_val, op->k.int_val, &val)) {\
+      goto side_exit;\
+    }\
+    s[op->dst].int_val = val;\
+    op++;\
+    continue;
+
+#define TRACE_DOUBLE_ARITH(NAME, OPERATOR)\
+  case T##NAME:\
+    s[op->dst].double_val = s[op->a].double_val OPERATOR s[op->b].double_val;\
+    op++;\
+    continue;\
+  case T##NAME##k:\
+    s[op->dst].double_val = s[op->a].double_val OPERATOR op->k.double_val;\
+    op++;\
+    continue;
+
+#define TRACE_COMPARE(NAME, FIELD, OPERATOR)\
+  case T##NAME:\
+    if((s[op->a].FIELD OPERATOR s[op->b].FIELD) != op->expect) {\
+      goto side_exit;\
+    }\
+    op++;\
+    continue;\
+  case T##NAME##k:\
+    if((s[op->a].FIELD OPERATOR op->k.FIELD) != op->expect) {\
+      goto side_exit;\
+    }\
+    op++;\
+    continue;
+
+/* the code index the core goes on at, or -1 once the trace does not
+ * pay off */
+long runTrace(Trace trace, VMContext ctx, long* budget) {
+  if(trace->entries >= TRACE_MIN_ENTRIES && trace->iterations < trace->entries) {
+    return -1;
+  }
+  trace->entries++;
+  Type s = ctx->var_list_base;
+  for(int i = 0; i < trace->guard_size; i++) {
+    if(s[trace->guards[i].local].type != trace->guards[i].type) {
+      return trace->header;
+    }
+  }
+  struct TraceOp* op = trace->ops;
+  long left = *budget;
+  long iterations = 0;
+  int64_t val;
+  for(;;) {
+    switch(op->op) {
+      case Tloop:
+        iterations++;
+        if(--left < 0) {
+          goto side_exit;
+        }
+        op = trace->ops;
+        continue;
+      case Tmove:
+        s[op->dst].string = s[op->a].string;
+        op++;
+        continue;
+      case Tmovek:
+        s[op->dst] = op->k;
+        op++;
+        continue;
+      case Tguard:
+        if((s[op->a].bool_val != 0) != op->expect) {
+          goto side_exit;
+        }
+        op++;
+        continue;
+      TRACE_INT_ARITH(iadd, __builtin_add_overflow)
+      TRACE_INT_ARITH(isub, __builtin_sub_overflow)
+      TRACE_INT_ARITH(imul, __builtin_mul_overflow)
+      /* 0 and -1 leave: division by zero and INT64_MIN / -1 */
+      case Tidiv:
+        if((uint64_t)s[op->b].int_val + 1 <= 1) {
+          goto side_exit;
+        }
+        s[op->dst].int_val = s[op->a].int_val / s[op->b].int_val;
+        op++;
+        continue;
+      case Tidivk:
+        if((uint64_t)op->k.int_val + 1 <= 1) {
+          goto side_exit;
+        }
+        s[op->dst].int_val = s[op->a].int_val / op->k.int_val;
+        op++;
+        continue;
+      TRACE_DOUBLE_ARITH(dadd, +)
+      TRACE_DOUBLE_ARITH(dsub, -)
+      TRACE_DOUBLE_ARITH(dmul, *)
+      TRACE_DOUBLE_ARITH(ddiv, /)
+      TRACE_COMPARE(ilt, int_val, <)
+      TRACE_COMPARE(ile, int_val, <=)
+      TRACE_COMPARE(igt, int_val, >)
+      TRACE_COMPARE(ige, int_val, >=)
+      TRACE_COMPARE(ieq, int_val, ==)
+      TRACE_COMPARE(ine, int_val, !=)
+      TRACE_COMPARE(dlt, double_val, <)
+      TRACE_COMPARE(dle, double_val, <=)
+      TRACE_COMPARE(dgt, double_val, >)
+      TRACE_COMPARE(dge, double_val, >=)
+      TRACE_COMPARE(deq, double_val, ==)
+      TRACE_COMPARE(dne, double_val, !=)
+      case Tineg:
+        if(s[op->a].int_val == INT64_MIN) {
+          goto side_exit;
+        }
+        s[op->dst].int_val = -s[op->a].int_val;
+        op++;
+        continue;
+      case Tdneg:
+        s[op->dst].double_val = -s[op->a].double_val;
+        op++;
+        continue;
+      case Tiaload:
+      case Tdaload: {
+        ScriptCArray array = s[op->a].array;
+        int64_t index = s[op->b].int_val;
+        if(array->elem_type != (op->op == Tiaload ? ARRAY_INT : ARRAY_FLOAT) || (uint64_t)index >= (uint64_t)array->length) {
+          goto side_exit;
+        }
+        if(op->op == Tiaload) {
+          s[op->dst].int_val = array->ints[index];
+        } else {
+          s[op->dst].double_val = array->doubles[index];
+        }
+        op++;
+        continue;
+      }
+      case Tiastore:
+      case Tiastorek: {
+        ScriptCArray array = s[op->a].array;
+        int64_t index = s[op->b].int_val;
+        int64_t value = op->op == Tiastore ? s[op->dst].int_val : op->k.int_val;
+        if(array->elem_type != ARRAY_INT || (uint64_t)index >= (uint64_t)array->length) {
+          goto side_exit;
+        }
+        array->ints[index] = value;
+        op++;
+        continue;
+      }
+      case Tdastore:
+      case Tdastorei: {
+        ScriptCArray array = s[op->a].array;
+        int64_t index = s[op->b].int_val;
+        if(array->elem_type != ARRAY_FLOAT || (uint64_t)index >= (uint64_t)array->length) {
+          goto side_exit;
+        }
+        array->doubles[index] = op->op == Tdastore ? s[op->dst].double_val : (double)s[op->dst].int_val;
+        op++;
+        continue;
+      }
+    }
+  }
+side_exit:
+  trace->iterations += iterations;
+  *budget = left;
+  return leaveTrace(&trace->exits[op->exit], ctx);
+}
+
+void disposeTraces(void) {
+  for(long i = 0; i < trace_slot_size; i++) {
+    if(trace_slots[i].trace) {
+      disposeTrace(trace_slots[i].trace);
+    }
+  }
+  free(trace_slots);
+  trace_slots = NULL;
+  trace_slot_size = 0;
+}
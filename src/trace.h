@@ -0,0 +1,56 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include "compiler.h"
+#include "vm.h"
+
+/* traces of hot loops (-T). a backward jump becomes a loop instruction
+ * that counts how often it closes its loop; at TRACE_HOT_LOOP the vm
+ * runs the next iteration through the recorder, which sees each
+ * instruction with the types of its operands and the way each branch
+ * goes. the recording compiles to trace ops specialized to those types
+ * that read and write the frame slots directly, so loads, constants and
+ * stores fold into the ops and a compare and its branch into one guard.
+ *
+ * the trace replaces the loop instruction and runs whole iterations
+ * until a guard fails: a branch going the other way, an int overflow,
+ * a division by 0 or -1, an index out of range or an array of the other
+ * element type. the exit writes back the operand stack and the type
+ * tags the interpreter expects at that instruction and the core goes on
+ * there, so the slow path and its errors are the interpreter's. types
+ * are guarded once per entry: every local the trace reads before it
+ * writes it, and every local it writes, which must keep its type around
+ * the loop. a trace that runs less than an iteration per entry on
+ * average goes back to being a plain jump.
+ *
+ * only innermost loops without calls, output, strings, maps or bigints
+ * are traced; anything else stops the recording and the loop stays
+ * interpreted */
+
+#ifndef TRACE_HOT_LOOP
+#define TRACE_HOT_LOOP 64
+#endif
+
+#define TRACE_MAX_LENGTH 512
+#define TRACE_MIN_ENTRIES 64
+
+struct Trace;
+struct TraceRecorder;
+
+typedef struct Trace* Trace;
+typedef struct TraceRecorder* TraceRecorder;
+
+/* per loop instruction, indexed by its position in the code */
+struct TraceSlot {
+	int count;
+	Trace trace;
+};
+
+struct TraceSlot* traceSlot(long index);
+TraceRecorder beginTrace(long header, long anchor, VMContext ctx);
+int recordTrace(TraceRecorder rec, long index, int op, int32_t operand, VMContext ctx, ConstPool pool);
+Trace endTrace(TraceRecorder rec, int closed);
+long runTrace(Trace trace, VMContext ctx, long* budget);
+void disposeTraces(void);
+
+#endif
@@ -0,0 +1,561 @@
+#include "compiler.h"
+#include "vm.h"
+#include "native.h"
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* lattice of the type pass: a TYPE_* tag, any valid tag, or a local
+ * that may not be written yet on some path. TYPE_INT stands for any
+ * integer, as int arithmetic promotes to a bigint on overflow */
+#define VT_ANY -1
+#define VT_UNDEF -2
+
+struct FuncShape {
+  long begin;
+  long end;
+  int params;
+  int returns;
+  int var_size;
+  int stack_size;
+  int* depth;
+  const char* error;
+  int shaped;
+  int quickened;
+};
+
+typedef struct FuncShape* FuncShape;
+
+static int findFunction(Module module, long call_point) {
+  int low = 0;
+  int high = module->size - 1;
+  while(low <= high) {
+    int mid = (low + high) / 2;
+    if(module->codePoints[mid] == call_point) {
+      return mid;
+    }
+    if(module->codePoints[mid] < call_point) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return -1;
+}
+
+/* structural checks that need no data flow: operands, jump targets,
+ * the parameter prologue and the return kind. a jump may target the
+ * end of the function as long as it is unreachable */
+static void scanFunction(ScriptCInstruction insts, Module module, FuncShape shape) {
+  long i = shape->begin;
+  shape->params = 0;
+  shape->returns = -1;
+  shape->var_size = 0;
+  while(i < shape->end && insts[i].op == Istorea) {
+    shape->params++;
+    i++;
+  }
+  for(i = shape->begin; i < shape->end; i++) {
+    ScriptCInstruction inst = &insts[i];
+    int var_id = -1;
+    switch(inst->op) {
+      case Istorea:
+        if(i >= shape->begin + shape->params) {
+          shape->error = "storea outside the prologue";
+          return;
+        }
+        var_id = inst->var_id;
+        break;
+      case Iloadl: case Istorel:
+        var_id = inst->var_id;
+        break;
+      case Iiinc:
+        var_id = inst->inc_var;
+        break;
+      case Ijump: case Iifcmp:
+        if(inst->jump < shape->begin || inst->jump > shape->end) {
+          shape->error = "jump out of the function";
+          return;
+        }
+        break;
+      case Icase:
+        if(inst->case_jump < shape->begin || inst->case_jump > shape->end) {
+          shape->error = "jump out of the function";
+          return;
+        }
+        break;
+      case Itableswitch: case Ilookupswitch: case Ihashswitch:
+        if(i + 1 == shape->end || insts[i+1].op != Icase) {
+          shape->error = "switch without cases";
+          return;
+        }
+        break;
+      case Icall:
+        if(findFunction(module, inst->call_point) < 1) {
+          shape->error = "call to an unknown function";
+          return;
+        }
+        break;
+      case Ilcall:
+        if(inst->func_id < 1 || inst->func_id >= module->size) {
+          shape->error = "call to an unknown function";
+          return;
+        }
+        break;
+      case Iret:
+      case Iret_void:
+        if(shape->returns == -1) {
+          shape->returns = inst->op == Iret;
+        } else if(shape->returns != (inst->op == Iret)) {
+          shape->error = "mixed return kinds";
+          return;
+        }
+        break;
+      case Iexit:
+        shape->error = "exit inside a function";
+        return;
+    }
+    if(var_id < -1) {
+      shape->error = "local out of range";
+      return;
+    }
+    if(var_id >= shape->var_size) {
+      shape->var_size = var_id + 1;
+    }
+  }
+  shape->shaped = 1;
+}
+
+/* pops and pushes of one instruction, 0 when unknown */
+static int stackEffect(ScriptCInstruction inst, Module module, FuncShape shapes, int* pops, int* push) {
+  *pops = 0;
+  *push = 0;
+  switch(inst->op) {
+    case Iiconst: case Ilconst: case Idconst: case Isconst: case Ibconst: case Iloadl:
+      *push = 1;
+      break;
+    case Istorel: case Iwrite: case Iret: case Iifcmp:
+    case Itableswitch: case Ilookupswitch: case Ihashswitch:
+      *pops = 1;
+      break;
+    case Istorea: case Iiinc: case Ijump: case Icase: case Iret_void: case Isnapshot:
+      break;
+    case Icall: {
+      FuncShape callee = &shapes[findFunction(module, inst->call_point)];
+      if(!callee->shaped) {
+        return 0;
+      }
+      *pops = callee->params;
+      *push = callee->returns == 1;
+      break;
+    }
+    case Ilcall:
+      *pops = inst->arg_size;
+      *push = module->returns[inst->func_id];
+      break;
+    case Incall:
+      *pops = inst->arg_size;
+      *push = getNativeRetType(inst->func_id) != NATIVE_VOID;
+      break;
+    case Iaload: case Imget: case Imhas:
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+    case Iadd: case Isub: case Imul: case Idiv:
+      *pops = 2;
+      *push = 1;
+      break;
+    case Iminus:
+      *pops = 1;
+      *push = 1;
+      break;
+    case Iastore: case Imput:
+      *pops = 3;
+      break;
+    case Imdel:
+      *pops = 2;
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+static int successors(ScriptCInstruction insts, long i, long* succ) {
+  switch(insts[i].op) {
+    case Ijump:
+      succ[0] = insts[i].jump;
+      return 1;
+    case Iifcmp:
+      succ[0] = i + 1;
+      succ[1] = insts[i].jump;
+      return 2;
+    case Icase:
+      succ[0] = i + 1;
+      succ[1] = insts[i].case_jump;
+      return 2;
+    case Iret: case Iret_void: case Iexit:
+      return 0;
+  }
+  succ[0] = i + 1;
+  return 1;
+}
+
+/* pass 1: one operand stack depth per instruction */
+static int checkDepth(ScriptCInstruction insts, Module module, FuncShape shapes, FuncShape shape) {
+  long size = shape->end - shape->begin;
+  int* depth = shape->depth = (int*)malloc(sizeof(int)*size);
+  long* worklist = (long*)malloc(sizeof(long)*(size+1));
+  int top = 0;
+  int max_depth = 0;
+  for(long i = 0; i < size; i++) {
+    depth[i] = -1;
+  }
+  depth[0] = 0;
+  worklist[top++] = shape->begin;
+  while(top > 0) {
+    long i = worklist[--top];
+    int pops;
+    int push;
+    if(!stackEffect(&insts[i], module, shapes, &pops, &push)) {
+      shape->error = "unknown stack effect";
+      break;
+    }
+    int d = depth[i - shape->begin];
+    if(pops > d) {
+      shape->error = "stack underflow";
+      break;
+    }
+    d = d - pops + push;
+    if(d > max_depth) {
+      max_depth = d;
+    }
+    long succ[2];
+    int succ_size = successors(insts, i, succ);
+    for(int j = 0; j < succ_size; j++) {
+      long s = succ[j] - shape->begin;
+      if(s == size) {
+        shape->error = "falls off the end";
+        break;
+      }
+      if(depth[s] == -1) {
+        depth[s] = d;
+        worklist[top++] = succ[j];
+      } else if(depth[s] != d) {
+        shape->error = "stack depth differs at a merge";
+        break;
+      }
+    }
+    if(shape->error) {
+      break;
+    }
+  }
+  free(worklist);
+  shape->stack_size = max_depth;
+  return shape->error == NULL;
+}
+
+static int mergeType(int a, int b) {
+  if(a == b) {
+    return a;
+  }
+  if(a == VT_UNDEF || b == VT_UNDEF) {
+    return VT_UNDEF;
+  }
+  return VT_ANY;
+}
+
+static int arithType(int op, int left, int right) {
+  if(left == right && (left == TYPE_INT || left == TYPE_FLOAT)) {
+    return left;
+  }
+  if(op == Iadd && left == TYPE_STRING && right == TYPE_STRING) {
+    return TYPE_STRING;
+  }
+  return VT_ANY;
+}
+
+/* applies one instruction to a state of locals followed by the stack;
+ * sp indexes the state, so it starts at var_size */
+static int transfer(ScriptCInstruction inst, Module module, FuncShape shapes, int* state, int sp) {
+  switch(inst->op) {
+    case Iiconst: case Ilconst: state[sp++] = TYPE_INT; break;
+    case Idconst: state[sp++] = TYPE_FLOAT; break;
+    case Isconst: state[sp++] = TYPE_STRING; break;
+    case Ibconst: state[sp++] = TYPE_BOOL; break;
+    case Iloadl: {
+      /* a load that may see an unset local stays checked and stops */
+      int t = state[inst->var_id];
+      state[sp++] = t == VT_UNDEF ? VT_ANY : t;
+      break;
+    }
+    case Istorel:
+      state[inst->var_id] = state[--sp];
+      break;
+    case Istorea:
+      state[inst->var_id] = VT_ANY;
+      break;
+    case Iiinc:
+      state[inst->inc_var] = TYPE_INT;
+      break;
+    case Iwrite: case Iret: case Iifcmp:
+    case Itableswitch: case Ilookupswitch: case Ihashswitch:
+      sp--;
+      break;
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+      sp -= 2;
+      state[sp++] = TYPE_BOOL;
+      break;
+    case Iadd: case Isub: case Imul: case Idiv:
+      sp -= 2;
+      state[sp] = arithType(inst->op, state[sp], state[sp+1]);
+      sp++;
+      break;
+    case Iminus:
+      if(state[sp-1] != TYPE_INT && state[sp-1] != TYPE_FLOAT) {
+        state[sp-1] = VT_ANY;
+      }
+      break;
+    case Iaload: case Imget:
+      sp -= 2;
+      state[sp++] = VT_ANY;
+      break;
+    case Imhas:
+      sp -= 2;
+      state[sp++] = TYPE_BOOL;
+      break;
+    case Iastore: case Imput:
+      sp -= 3;
+      break;
+    case Imdel:
+      sp -= 2;
+      break;
+    case Icall: {
+      FuncShape callee = &shapes[findFunction(module, inst->call_point)];
+      sp -= callee->params;
+      if(callee->returns == 1) {
+        state[sp++] = VT_ANY;
+      }
+      break;
+    }
+    case Ilcall:
+      sp -= inst->arg_size;
+      if(module->returns[inst->func_id]) {
+        state[sp++] = VT_ANY;
+      }
+      break;
+    case Incall: {
+      int ret_type = getNativeRetType(inst->func_id);
+      sp -= inst->arg_size;
+      if(ret_type != NATIVE_VOID) {
+        state[sp++] = ret_type == NATIVE_ANY ? VT_ANY : ret_type;
+      }
+      break;
+    }
+  }
+  return sp;
+}
+
+static int quickenBinary(int op, int left, int right) {
+  static const int int_ops[][2] = {
+    {Iadd, Iiadd}, {Isub, Iisub}, {Imul, Iimul}, {Idiv, Iidiv},
+    {Ilt, Iilt}, {Igt, Iigt}, {Ile, Iile}, {Ige, Iige}, {Ieq, Iieq}, {Ine, Iine},
+  };
+  static const int double_ops[][2] = {
+    {Iadd, Idadd}, {Isub, Idsub}, {Imul, Idmul}, {Idiv, Iddiv},
+    {Ilt, Idlt}, {Igt, Idgt}, {Ile, Idle}, {Ige, Idge}, {Ieq, Ideq}, {Ine, Idne},
+  };
+  if(left != right || (left != TYPE_INT && left != TYPE_FLOAT)) {
+    return op;
+  }
+  for(int i = 0; i < 10; i++) {
+    if(int_ops[i][0] == op) {
+      return left == TYPE_INT ? int_ops[i][1] : double_ops[i][1];
+    }
+  }
+  return op;
+}
+
+/* picks the unchecked form of an instruction from its input state */
+static int quicken(ScriptCInstruction inst, Module module, int* state, int sp) {
+  int op = inst->op;
+  switch(inst->op) {
+    case Iloadl:
+      if(state[inst->var_id] != VT_UNDEF) {
+        inst->op = Iloadl_u;
+      }
+      break;
+    case Istorel:
+      inst->op = Istorel_u;
+      break;
+    case Istorea:
+      inst->op = Istorea_u;
+      break;
+    case Iifcmp:
+      if(state[sp-1] == TYPE_BOOL) {
+        inst->op = Iifcmp_u;
+      }
+      break;
+    case Icall:
+      inst->func_id = findFunction(module, inst->call_point);
+      inst->op = Ifcall;
+      break;
+    case Igt: case Ige: case Ilt: case Ile: case Ieq: case Ine:
+    case Iadd: case Isub: case Imul: case Idiv:
+      inst->op = quickenBinary(inst->op, state[sp-2], state[sp-1]);
+      break;
+  }
+  return inst->op != op;
+}
+
+/* pass 2: types of locals and stack slots to a fixed point, then the
+ * rewrite from the final states */
+static void inferTypes(ScriptCInstruction insts, Module module, FuncShape shapes, FuncShape shape) {
+  int* depth = shape->depth;
+  long size = shape->end - shape->begin;
+  int width = shape->var_size + shape->stack_size;
+  int* states = (int*)malloc(sizeof(int)*(size*width+1));
+  int* visited = (int*)calloc(size, sizeof(int));
+  int* queued = (int*)calloc(size, sizeof(int));
+  int* cur = (int*)malloc(sizeof(int)*(width+1));
+  long* worklist = (long*)malloc(sizeof(long)*(size+1));
+  int top = 0;
+  for(int j = 0; j < width; j++) {
+    states[j] = VT_UNDEF;
+  }
+  visited[0] = 1;
+  queued[0] = 1;
+  worklist[top++] = 0;
+  while(top > 0) {
+    long i = worklist[--top];
+    queued[i] = 0;
+    memcpy(cur, &states[i*width], sizeof(int)*width);
+    transfer(&insts[shape->begin+i], module, shapes, cur, shape->var_size + depth[i]);
+    long succ[2];
+    int succ_size = successors(insts, shape->begin+i, succ);
+    for(int j = 0; j < succ_size; j++) {
+      long s = succ[j] - shape->begin;
+      int* in = &states[s*width];
+      int changed = 0;
+      if(!visited[s]) {
+        memcpy(in, cur, sizeof(int)*width);
+        visited[s] = 1;
+        changed = 1;
+      } else {
+        for(int k = 0; k < shape->var_size + depth[s]; k++) {
+          int t = mergeType(in[k], cur[k]);
+          if(t != in[k]) {
+            in[k] = t;
+            changed = 1;
+          }
+        }
+      }
+      if(changed && !queued[s]) {
+        queued[s] = 1;
+        worklist[top++] = s;
+      }
+    }
+  }
+  for(long i = 0; i < size; i++) {
+    if(visited[i]) {
+      shape->quickened += quicken(&insts[shape->begin+i], module, &states[i*width], shape->var_size + depth[i]);
+    }
+  }
+  free(states);
+  free(visited);
+  free(queued);
+  free(cur);
+  free(worklist);
+}
+
+static void dumpShape(int i, FuncShape shape) {
+  if(i == 0) {
+    fprintf(stderr, "@@@@ Verify @@@@\n");
+  }
+  fprintf(stderr, "verify: function %d: ok (locals %d, stack %d, %d of %ld unchecked)\n",
+      i, shape->var_size, shape->stack_size, shape->quickened, shape->end - shape->begin);
+}
+
+/* the frame of a function comes from its verified shape, so code the
+ * verifier rejects cannot run */
+static void rejectShape(Module module, int id, FuncShape shape) {
+  fprintf(stderr, "Error: cannot verify %s: %s\n", id > 0 && module->names[id] ? module->names[id] : "the top level code", shape->error);
+  exit(1);
+}
+
+/* without -O the instructions stay checked and only the calls learn
+ * the frame of their callee */
+static void linkCalls(ScriptCInstruction insts, Module module, FuncShape shape) {
+  for(long i = shape->begin; i < shape->end; i++) {
+    if(shape->depth[i - shape->begin] != -1 && insts[i].op == Icall) {
+      insts[i].func_id = findFunction(module, insts[i].call_point);
+      insts[i].op = Ifcall;
+      shape->quickened++;
+    }
+  }
+}
+
+FrameInfo verifyModule(ScriptCInstruction insts, Module module) {
+  FuncShape shapes = (FuncShape)calloc(module->size, sizeof(struct FuncShape));
+  FrameInfo frames = (FrameInfo)malloc(sizeof(struct FrameInfo)*module->size);
+  for(int i = 0; i < module->size; i++) {
+    /* index 0 of the top level code is the exit its ret_void returns to */
+    shapes[i].begin = i == 0 ? 1 : module->codePoints[i];
+    shapes[i].end = i + 1 < module->size ? module->codePoints[i+1] : module->code_length;
+    scanFunction(insts, module, &shapes[i]);
+    if(i == 0 && !shapes[i].error && (shapes[i].params > 0 || shapes[i].returns == 1)) {
+      shapes[i].error = "top level code takes arguments or returns a value";
+    }
+    if(shapes[i].error) {
+      rejectShape(module, i, &shapes[i]);
+    }
+  }
+  for(int i = 0; i < module->size; i++) {
+    if(!checkDepth(insts, module, shapes, &shapes[i])) {
+      rejectShape(module, i, &shapes[i]);
+    }
+  }
+  /* quickening rewrites call sites, so every shape is settled first */
+  for(int i = 0; i < module->size; i++) {
+    FuncShape shape = &shapes[i];
+    if(sc_optimize) {
+      inferTypes(insts, module, shapes, shape);
+    } else {
+      linkCalls(insts, module, shape);
+    }
+    frames[i].entry = shape->begin;
+    frames[i].var_size = shape->var_size;
+    frames[i].stack_size = shape->stack_size;
+    if(sc_debug) {
+      dumpShape(i, shape);
+    }
+    free(shape->depth);
+  }
+  free(shapes);
+  return frames;
+}
+
+/* a lazily linked function on its own: its code starts at index 0 and
+ * its calls are lcall, whose effects come from the callee signatures */
+void verifyFunction(ScriptCInstruction insts, long length, Module module, int id, FrameInfo frame) {
+  struct FuncShape shape;
+  memset(&shape, 0, sizeof(shape));
+  shape.begin = id == 0 ? 1 : 0;
+  shape.end = length;
+  scanFunction(insts, module, &shape);
+  if(id == 0 && !shape.error && (shape.params > 0 || shape.returns == 1)) {
+    shape.error = "top level code takes arguments or returns a value";
+  }
+  if(shape.error || !checkDepth(insts, module, NULL, &shape)) {
+    rejectShape(module, id, &shape);
+  }
+  if(sc_optimize) {
+    inferTypes(insts, module, NULL, &shape);
+  }
+  frame->var_size = shape.var_size;
+  frame->stack_size = shape.stack_size;
+  if(sc_debug) {
+    dumpShape(id, &shape);
+  }
+  free(shape.depth);
+}
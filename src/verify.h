@@ -0,0 +1,19 @@
+#ifndef __VERIFY__
+#define __VERIFY__
+
+#include "compiler.h"
+#include "vm.h"
+
+/* bytecode verifier. each function is checked on its own: every jump
+ * stays inside it, the operand stack has one depth at every merge and
+ * never underflows, and the type of each stack slot and local is
+ * inferred. with -O the instructions are rewritten to the unchecked
+ * opcodes where the types are known; without it they stay checked. a
+ * function that fails is a compile error. the result gives every
+ * function its entry and exact frame size, index 0 being the top level
+ * code */
+
+FrameInfo verifyModule(ScriptCInstruction insts, Module module);
+void verifyFunction(ScriptCInstruction insts, long length, Module module, int id, FrameInfo frame);
+
+#endif
@@ -1,42 +1,140 @@
+/* MAP_ANONYMOUS for the context threaded code */
+#define _DEFAULT_SOURCE
+
 #include "compiler.h"
 #include "vm.h"
+#include "native.h"
+#include "verify.h"
+#include "heap.h"
+#include "perf.h"
+#include "trace.h"
+#include "runtime.h"
+#include "snapshot.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <inttypes.h>
+#include <limits.h>
 
-#define VM_CONTEXT_MAX_STACK_LENGTH 1024
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#define VM_CONTEXT_THREADING 1
+#endif
 
-VMContext createVMContext(VMContext prev, long retPoint) {
+struct VMStats vm_stats;
+long* vm_calls;
+long vm_entry = 1;
+
+#define VM_COUNTED (sc_stats || vm_calls)
+
+/* locals and operand stack share one allocation */
+VMContext createFrame(VMContext prev, long retPoint, int var_size, int stack_size) {
   VMContext ctx = (VMContext)malloc(sizeof(struct VMContext));
-  ctx->var_list_base = (Type)malloc(sizeof(struct Type)*VAR_MAX);
+  ctx->var_list_base = (Type)malloc(sizeof(struct Type)*(var_size+stack_size+1));
+  if(sc_stats) {
+    vm_stats.frames++;
+    vm_stats.frame_bytes += sizeof(struct VMContext) + sizeof(struct Type)*(var_size+stack_size+1);
+  }
+  /* the collector scans the locals, so they start out with a tag */
+  for(int i = 0; i < var_size; i++) {
+    ctx->var_list_base[i].type = TYPE_UNSET;
+  }
   ctx->var_list = &ctx->var_list_base[0];
-  ctx->stack_pointer_base = (Type)malloc(sizeof(struct Type)*VM_CONTEXT_MAX_STACK_LENGTH);
+  ctx->stack_pointer_base = ctx->var_list_base + var_size;
   ctx->stack_pointer = &ctx->stack_pointer_base[0];
   ctx->prev = prev;
   ctx->retPoint = retPoint;
   return ctx;
 }
 
+VMContext createVMContext(VMContext prev, long retPoint) {
+  return createFrame(prev, retPoint, VAR_MAX, VM_CONTEXT_MAX_STACK_LENGTH);
+}
+
 void disposeVMContext(VMContext ctx) {
   free(ctx->var_list_base);
-  free(ctx->stack_pointer_base);
   free(ctx);
 }
 
+struct BuiltinEntry {
+  const char* name;
+  int op;
+  int arg_size;
+};
+
+static const struct BuiltinEntry builtins[] = {
+#define DEFINE_BUILTIN(NAME, OP, ARGS) {#NAME, I##OP, ARGS},
+  BUILTIN_EACH(DEFINE_BUILTIN)
+#undef DEFINE_BUILTIN
+};
+
+#define BUILTIN_SIZE ((int)(sizeof(builtins)/sizeof(builtins[0])))
+
+int getBuiltin(const char* name) {
+  for(int i = 0; i < BUILTIN_SIZE; i++) {
+    if(!strcmp(name, builtins[i].name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int getBuiltinOp(int id) {
+  return builtins[id].op;
+}
+
+int getBuiltinArgSize(int id) {
+  return builtins[id].arg_size;
+}
+
 static inline VMContext call_back(VMContext ctx) {
   return ctx->prev;
 }
 
-void prepareVM(VMContext ctx, ScriptCInstruction inst, long code_length) {
-  const void **table = (const void **)vm_execute(ctx, NULL);
-  for(long i = 0; i < code_length; i++) {
-    inst->addr = (const void*)table[inst->op];
-    ++inst;
+static int32_t encodeOperand(ScriptCInstruction inst) {
+  switch(inst->op) {
+    case Icall:
+      return (int32_t)inst->call_point;
+    case Ilcall:
+    case Ifcall:
+      return inst->func_id;
+    case Ijump:
+    case Iifcmp:
+    case Iifcmp_u:
+      return (int32_t)inst->jump;
+    case Icase:
+      return inst->case_jump;
+    case Itableswitch:
+    case Ilookupswitch:
+    case Ihashswitch:
+      return inst->const_id;
+    case Iiconst:
+      return (int32_t)inst->int_val;
+    case Ibconst:
+      return inst->bool_val;
+    case Ilconst:
+    case Idconst:
+    case Isconst:
+      return inst->const_id;
+    case Iloadl:
+    case Istorea:
+    case Istorel:
+    case Iloadl_u:
+    case Istorea_u:
+    case Istorel_u:
+      return inst->var_id;
+    case Iiinc:
+      /* a negative step is shifted unsigned and INC_VAL shifts it back */
+      return (int32_t)(((uint32_t)inst->inc_val << 8) | (uint32_t)inst->inc_var);
+    case Incall:
+      return (inst->arg_size << 16) | inst->func_id;
   }
+  return 0;
 }
 
-static inline void push_i(VMContext ctx, int val) {
+static inline void push_i(VMContext ctx, int64_t val) {
   (ctx->stack_pointer)->int_val = val;
   (ctx->stack_pointer)->type = TYPE_INT;
   ctx->stack_pointer++;
@@ -60,19 +158,239 @@ static inline void push_b(VMContext ctx, int val) {
   ctx->stack_pointer++;
 }
 
+static inline void push_a(VMContext ctx, ScriptCArray val) {
+  (ctx->stack_pointer)->array = val;
+  (ctx->stack_pointer)->type = TYPE_ARRAY;
+  ctx->stack_pointer++;
+}
+
+static inline void push_m(VMContext ctx, ScriptCMap val) {
+  (ctx->stack_pointer)->map = val;
+  (ctx->stack_pointer)->type = TYPE_MAP;
+  ctx->stack_pointer++;
+}
+
+static inline void push_big(VMContext ctx, ScriptCBigInt val) {
+  (ctx->stack_pointer)->bigint = val;
+  (ctx->stack_pointer)->type = TYPE_BIGINT;
+  ctx->stack_pointer++;
+}
+
+static inline int isInteger(Type val) {
+  return val->type == TYPE_INT || val->type == TYPE_BIGINT;
+}
+
 static inline Type pop_sp(VMContext ctx) {
   return --ctx->stack_pointer;
 }
 
+static int mapGet(VMContext ctx, Type map, Type key) {
+  if(!isMapKey(key)) {
+    fprintf(stderr, "type error of map key\n");
+    return 1;
+  }
+  Type val = getMap(map->map, key);
+  if(val == NULL) {
+    fprintf(stderr, "key not found in map\n");
+    return 1;
+  }
+  *ctx->stack_pointer++ = *val;
+  return 0;
+}
+
+static int mapPut(Type map, Type key, Type val) {
+  if(!isMapKey(key)) {
+    fprintf(stderr, "type error of map key\n");
+    return 1;
+  }
+  if(putMap(map->map, key, val) < 0) {
+    fprintf(stderr, "map is full at %d entries\n", MAP_MAX_CAPACITY);
+    return 1;
+  }
+  return 0;
+}
+
+/* the entry of a lookupswitch or hashswitch for key: a run of the pool
+ * holds the number of cases and then their sorted keys. a key missing
+ * picks the default, the entry after the cases */
+static inline long findCase(const int64_t* keys, int64_t key) {
+  long low = 0;
+  long high = keys[0] - 1;
+  while(low <= high) {
+    long mid = (low + high) / 2;
+    if(keys[1 + mid] == key) {
+      return mid;
+    }
+    if(keys[1 + mid] < key) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return keys[0];
+}
+
+static long runDirect(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames);
+static long runDirectCounted(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames);
+static long recordLoop(VMContext ctx, VMInstruction inst, ConstPool pool, FrameInfo frames, long anchor);
+
+/* perf support: preparePerf names the generated code after the script
+ * functions. with trampolines every verified script call is a tcall,
+ * which enters the callee through a native stub of its own that runs it
+ * in a nested core, so each script frame is a native frame for perf */
+
+#define TRAMPOLINE_SIZE 32
+/* nested cores past this depth would overflow the native stack, deeper
+ * calls stay in the current core and are attributed to its function */
+#define TRAMPOLINE_MAX_DEPTH 4096
+
+typedef long (*Trampoline)(VMContext callee, long id);
+
+static Module perf_module;
+static unsigned char* perf_trampolines;
+static VMInstruction perf_code;
+static ConstPool perf_pool;
+static FrameInfo perf_frames;
+static int perf_depth;
+
+static Module vm_module;
+static VMInstruction vm_code;
+static long vm_code_capacity;
+
+static void writePerfFunction(int id, const void* code, size_t size) {
+  char name[256];
+  const char* func = perf_module->names[id];
+  snprintf(name, sizeof(name), "scriptC::%s", func ? func : "main");
+  writePerfCode(name, code, size);
+}
+
+static inline long callTrampoline(VMContext callee, long id) {
+  Trampoline trampoline = (Trampoline)(perf_trampolines + id * TRAMPOLINE_SIZE);
+  return trampoline(callee, id);
+}
+
+/* the callee frame returns to 0, whose exit ends the nested core */
+static long enterFunction(VMContext callee, long id) {
+  struct VMThread thread = {callee, perf_frames[id].entry, LONG_MAX};
+  perf_depth++;
+  long status = vm_run(&thread, vm_module ? vm_code : perf_code, perf_pool, perf_frames);
+  perf_depth--;
+  return status;
+}
+
+/* code starting at base; jumps of lazily linked code are relative to it */
+static void encodeCode(VMInstruction code, ScriptCInstruction inst, long length, long base) {
+  const int32_t *table = (const int32_t *)(VM_COUNTED ? runDirectCounted : runDirect)(NULL, NULL, NULL, NULL);
+  for(long i = 0; i < length; i++) {
+    int op = inst[i].op == Ifcall && perf_trampolines ? Itcall : inst[i].op;
+    if(op == Ijump && sc_trace && inst[i].jump <= i) {
+      op = Iloop;
+    }
+    code[i].handler = sc_dispatch == DISPATCH_DIRECT ? table[op] : op;
+    code[i].operand = encodeOperand(&inst[i]);
+    if(inst[i].op == Ijump || inst[i].op == Iifcmp || inst[i].op == Iifcmp_u || inst[i].op == Icase) {
+      code[i].operand += base;
+    }
+  }
+}
+
+/* lazy linking: prepareLazyVM links the top level code alone and lcall
+ * links each function when it is first called, appending it to the
+ * code. the code and the constant pool may move then, so lcall reloads
+ * them; frames has a slot for every function from the start */
+
+static void loadFunction(int id, FrameInfo frames) {
+  long length;
+  ScriptCInstruction insts = linkFunction(id, &length);
+  long base = vm_module->codePoints[id];
+  FrameInfo frame = &frames[id];
+  verifyFunction(insts, length, vm_module, id, frame);
+  frame->entry = id == 0 ? base + 1 : base;
+  if(vm_module->code_length > vm_code_capacity) {
+    while(vm_code_capacity < vm_module->code_length) {
+      vm_code_capacity = vm_code_capacity ? vm_code_capacity * 2 : 1024;
+    }
+    vm_code = (VMInstruction)realloc(vm_code, sizeof(struct VMInstruction)*vm_code_capacity);
+  }
+  encodeCode(vm_code + base, insts, length, base);
+  free(insts);
+}
+
+
+/* the type specialized handlers of vmops.h. each core defines OP, JUMP
+ * and DISPATCH_NEXT before these expand */
+
+#define TYPED_BINARY(NAME, FIELD, OPERATOR) OP(NAME) {\
+    Type right = --ctx->stack_pointer;\
+    Type left = ctx->stack_pointer - 1;\
+    left->FIELD = left->FIELD OPERATOR right->FIELD;\
+    DISPATCH_NEXT;\
+  }
+
+#define TYPED_COMPARE(NAME, FIELD, OPERATOR) OP(NAME) {\
+    Type right = --ctx->stack_pointer;\
+    Type left = ctx->stack_pointer - 1;\
+    left->bool_val = left->FIELD OPERATOR right->FIELD;\
+    left->type = TYPE_BOOL;\
+    DISPATCH_NEXT;\
+  }
+
+/* the verifier types bigints as ints, so the int forms keep a tag test */
+#define TYPED_INT_ARITH(NAME, BUILTIN, SLOW) OP(NAME) {\
+    Type right = --ctx->stack_pointer;\
+    Type left = ctx->stack_pointer - 1;\
+    int64_t val;\
+    if(left->type == TYPE_INT && right->type == TYPE_INT && !BUILTIN(left->int_val, right->int_val, &val)) {\
+      left->int_val = val;\
+    } else {\
+      SLOW(left, right, left);\
+      heapSafepoint(ctx);\
+    }\
+    DISPATCH_NEXT;\
+  }
+
+#define TYPED_INT_COMPARE(NAME, OPERATOR) OP(NAME) {\
+    Type right = --ctx->stack_pointer;\
+    Type left = ctx->stack_pointer - 1;\
+    if(left->type == TYPE_INT && right->type == TYPE_INT) {\
+      left->bool_val = left->int_val OPERATOR right->int_val;\
+    } else {\
+      left->bool_val = bigCompare(left, right) OPERATOR 0;\
+    }\
+    left->type = TYPE_BOOL;\
+    DISPATCH_NEXT;\
+  }
+
+/* the direct and switch cores keep the code and the constant pool
+ * sections in locals */
+#define RELOAD {\
+    inst = vm_code;\
+    pool_longs = pool->longs;\
+    pool_doubles = pool->doubles;\
+    pool_strings = pool->strings;\
+  }
+
+/* direct threading: every handler ends in its own indirect jump to the
+ * next one. the handler field is the offset of its label from exit */
+
+#define OP(NAME) OP_##NAME:
+#define GET_ADDR(PC) (const void*)(handler_base + (PC)->handler)
 #define JUMP(dst) goto *GET_ADDR(pc = dst)
-#define GET_ADDR(PC) (PC)->addr
 #define DISPATCH_NEXT goto *GET_ADDR(++pc)
+#define HANDLER(NAME) (int32_t)(&&OP_##NAME - &&OP_exit)
+#define COUNT_CALL(dst)
+#define CASE_TARGET(entry) (inst + (entry)->operand)
 
-#define OP(OP) OP_##OP:
+#define CORE_LOCALS\
+  const int64_t* pool_longs = pool->longs;\
+  const double* pool_doubles = pool->doubles;\
+  char** pool_strings = pool->strings;\
+  VMContext ctx = thread->ctx;\
+  long budget = thread->budget;
 
-long vm_execute(VMContext ctx, ScriptCInstruction inst) {
-  static const void *table[] = {
-#define DEFINE_TABLE(NAME) &&OP_##NAME,
+static long runDirect(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  static const int32_t table[] = {
+#define DEFINE_TABLE(NAME) &&OP_##NAME - &&OP_exit,
     IR_EACH(DEFINE_TABLE)
 #undef DEFINE_TABLE
   };
@@ -81,297 +399,574 @@ long vm_execute(VMContext ctx, ScriptCInstruction inst) {
     return (long)table;
   }
 
-  register ScriptCInstruction pc = inst+1;
+  const char* handler_base = (const char*)&&OP_exit;
+  CORE_LOCALS
+  register VMInstruction pc = inst + thread->pc;
 
   goto *GET_ADDR(pc);
 
-  OP(exit) {
-    return 0;
-  }
-  OP(call) {
-    ctx = createVMContext(ctx, pc-inst+1);
-    JUMP(inst + pc->call_point);
-  }
-  OP(ret) {
-    long retPoint = ctx->retPoint;
-    Type top = pop_sp(ctx);
-    VMContext next = call_back(ctx);
-    if(top->type == TYPE_INT) {
-      push_i(next, top->int_val);
-    } else if(top->type == TYPE_FLOAT) {
-      push_d(next, top->double_val);
-    } else if(top->type == TYPE_STRING) {
-      push_s(next, top->string);
-    } else if(top->type == TYPE_BOOL) {
-      push_b(next, top->bool_val);
-    } else {
-      fprintf(stderr, "type error of return statement\n");
-      return 1;
-    }
-    disposeVMContext(ctx);
-    ctx = next;
-    JUMP(inst + retPoint);
-  }
-  OP(ret_void) {
-    long retPoint = ctx->retPoint;
-    VMContext next = call_back(ctx);
-    disposeVMContext(ctx);
-    ctx = next;
-    JUMP(inst + retPoint);
-  }
-  OP(iconst) {
-    push_i(ctx, pc->int_val);
-    DISPATCH_NEXT;
-  }
-  OP(dconst) {
-    push_d(ctx, pc->double_val);
-    DISPATCH_NEXT;
-  }
-  OP(sconst) {
-    push_s(ctx, pc->string);
-    DISPATCH_NEXT;
-  }
-  OP(bconst) {
-    push_b(ctx, pc->bool_val);
-    DISPATCH_NEXT;
-  }
-  OP(jump) {
-    JUMP(inst + pc->jump);
-  }
-  OP(ifcmp) {
-    Type top = pop_sp(ctx);
-    if(top->type != TYPE_BOOL) {
-      fprintf(stderr, "type error of ifcmp\n");
-    }
-    if(!top->bool_val) {
-      JUMP(inst + pc->jump);
-    }
-    DISPATCH_NEXT;
-  }
-  OP(gt) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val > right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val > right->double_val);
-    } else {
-      fprintf(stderr, "type error of gt expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(ge) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val >= right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val >= right->double_val);
-    } else {
-      fprintf(stderr, "type error of ge expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(lt) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val < right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val < right->double_val);
-    } else {
-      fprintf(stderr, "type error of lt expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(le) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val <= right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val <= right->double_val);
-    } else {
-      fprintf(stderr, "type error of le expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(eq) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val == right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val == right->double_val);
-    } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
-      push_b(ctx, !strcmp(left->string, right->string));
-    } else if(right->type == TYPE_BOOL && left->type == TYPE_BOOL) {
-      push_b(ctx, left->bool_val == right->bool_val);
-    } else {
-      fprintf(stderr, "type error of le expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(ne) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_b(ctx, left->int_val != right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_b(ctx, left->double_val != right->double_val);
-    } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
-      push_b(ctx, strcmp(left->string, right->string));
-    } else if(right->type == TYPE_BOOL && left->type == TYPE_BOOL) {
-      push_b(ctx, left->bool_val != right->bool_val);
-    } else {
-      fprintf(stderr, "type error of le expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(add) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_i(ctx, left->int_val + right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_d(ctx, left->double_val + right->double_val);
-    } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
-      strcat(left->string, right->string);
-      push_s(ctx, left->string);
-    } else {
-      fprintf(stderr, "type error of add expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(sub) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_i(ctx, left->int_val - right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_d(ctx, left->double_val - right->double_val);
-    } else {
-      fprintf(stderr, "type error of sub expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(mul) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_i(ctx, left->int_val * right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_d(ctx, left->double_val * right->double_val);
-    } else {
-      fprintf(stderr, "type error of mul expression\n");
-      return 1;
-    }
-    DISPATCH_NEXT;
-  }
-  OP(div) {
-    Type right = pop_sp(ctx);
-    Type left = pop_sp(ctx);
-    if(right->type == TYPE_INT && left->type == TYPE_INT) {
-      push_i(ctx, left->int_val / right->int_val);
-    } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
-      push_d(ctx, left->double_val / right->double_val);
-    } else {
-      fprintf(stderr, "type error of div expression\n");
-      return 1;
+#include "vmops.h"
+
+  return 0;
+}
+
+#undef JUMP
+#undef DISPATCH_NEXT
+
+/* -s runs copies of the direct and switch cores that count every
+ * dispatch, so the plain cores pay nothing for it. the copy has labels
+ * of its own and encodeCode takes its table while sc_stats is set.
+ * with vm_calls set they count the calls of every entry point too */
+
+#define JUMP(dst) { vm_stats.dispatched++; goto *GET_ADDR(pc = dst); }
+#define DISPATCH_NEXT { vm_stats.dispatched++; goto *GET_ADDR(++pc); }
+#undef COUNT_CALL
+#define COUNT_CALL(dst) if(vm_calls) vm_calls[(dst) - inst]++;
+
+static long runDirectCounted(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  static const int32_t table[] = {
+#define DEFINE_TABLE(NAME) &&OP_##NAME - &&OP_exit,
+    IR_EACH(DEFINE_TABLE)
+#undef DEFINE_TABLE
+  };
+
+  if(inst == NULL) {
+    return (long)table;
+  }
+
+  const char* handler_base = (const char*)&&OP_exit;
+  CORE_LOCALS
+  register VMInstruction pc = inst + thread->pc;
+
+  vm_stats.dispatched++;
+  goto *GET_ADDR(pc);
+
+#include "vmops.h"
+
+  return 0;
+}
+
+#undef OP
+#undef GET_ADDR
+#undef JUMP
+#undef DISPATCH_NEXT
+#undef HANDLER
+
+/* switch dispatch: all handlers share the one indirect jump of the
+ * switch. the handler field is the opcode */
+
+#define OP(NAME) case I##NAME:
+#define JUMP(dst) { pc = dst; goto dispatch; }
+#define DISPATCH_NEXT { pc++; goto dispatch; }
+#define HANDLER(NAME) I##NAME
+#undef COUNT_CALL
+#define COUNT_CALL(dst)
+
+static long runSwitch(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  CORE_LOCALS
+  VMInstruction pc = inst + thread->pc;
+
+dispatch:
+  switch(pc->handler) {
+#include "vmops.h"
+  }
+  fprintf(stderr, "unknown opcode %d\n", pc->handler);
+  return 1;
+}
+
+#undef COUNT_CALL
+#define COUNT_CALL(dst) if(vm_calls) vm_calls[(dst) - inst]++;
+
+static long runSwitchCounted(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  CORE_LOCALS
+  VMInstruction pc = inst + thread->pc;
+
+dispatch:
+  vm_stats.dispatched++;
+  switch(pc->handler) {
+#include "vmops.h"
+  }
+  fprintf(stderr, "unknown opcode %d\n", pc->handler);
+  return 1;
+}
+
+#undef OP
+#undef JUMP
+#undef DISPATCH_NEXT
+#undef HANDLER
+#undef RELOAD
+#undef CORE_LOCALS
+#undef COUNT_CALL
+#define COUNT_CALL(dst)
+
+/* call threading: every handler is a function and a loop calls them one
+ * after another. ctx and pc live in the VMState between two calls, the
+ * handler field is the opcode. a switch goes on at the case entry it
+ * picks, whose jump the context threaded code emits natively */
+
+#define HANDLER_NEXT -1
+
+struct VMState {
+  VMContext ctx;
+  VMInstruction pc;
+  VMInstruction inst;
+  ConstPool pool;
+  FrameInfo frames;
+  void* native_sp;
+  struct VMThread* thread;
+  long budget;
+};
+
+typedef int (*VMHandler)(struct VMState* st, VMContext ctx, VMInstruction pc);
+
+#undef CASE_TARGET
+#define CASE_TARGET(entry) (entry)
+#define OP(NAME) static int op_##NAME(struct VMState* st, VMContext ctx, VMInstruction pc)
+#define JUMP(dst) { st->ctx = ctx; st->pc = dst; return HANDLER_NEXT; }
+#define DISPATCH_NEXT { st->ctx = ctx; st->pc = pc + 1; return HANDLER_NEXT; }
+#define HANDLER(NAME) I##NAME
+#define RELOAD { inst = vm_code; }
+#define inst (st->inst)
+#define frames (st->frames)
+#define pool (st->pool)
+#define pool_longs (pool->longs)
+#define pool_doubles (pool->doubles)
+#define pool_strings (pool->strings)
+#define thread (st->thread)
+#define budget (st->budget)
+
+#include "vmops.h"
+
+#undef OP
+#undef JUMP
+#undef DISPATCH_NEXT
+#undef HANDLER
+#undef RELOAD
+#undef CASE_TARGET
+#undef inst
+#undef frames
+#undef pool_longs
+#undef pool_doubles
+#undef pool_strings
+#undef thread
+#undef budget
+#undef pool
+
+static const VMHandler handlers[] = {
+#define DEFINE_HANDLER(NAME) op_##NAME,
+  IR_EACH(DEFINE_HANDLER)
+#undef DEFINE_HANDLER
+};
+
+static long runCallThreaded(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  struct VMState st = {thread->ctx, inst + thread->pc, inst, pool, frames, NULL, thread, thread->budget};
+  int status;
+  if(sc_stats) {
+    do {
+      vm_stats.dispatched++;
+      status = handlers[st.pc->handler](&st, st.ctx, st.pc);
+    } while(status == HANDLER_NEXT);
+    return status;
+  }
+  do {
+    status = handlers[st.pc->handler](&st, st.ctx, st.pc);
+  } while(status == HANDLER_NEXT);
+  return status;
+}
+
+/* the opcode of an instruction whatever core it was encoded for */
+static int decodeOp(VMInstruction pc) {
+  if(sc_dispatch != DISPATCH_DIRECT) {
+    return pc->handler;
+  }
+  const int32_t *table = (const int32_t *)(VM_COUNTED ? runDirectCounted : runDirect)(NULL, NULL, NULL, NULL);
+  for(int op = 0; op < (int)(sizeof(handlers)/sizeof(handlers[0])); op++) {
+    if(table[op] == pc->handler) {
+      return op;
     }
-    DISPATCH_NEXT;
-  }
-  OP(minus) {
-    Type left = pop_sp(ctx);
-    if(left->type == TYPE_INT) {
-      push_i(ctx, -left->int_val);
-    } else if(left->type == TYPE_FLOAT) {
-      push_d(ctx, -left->double_val);
-    } else {
-      fprintf(stderr, "type error of add expression\n");
-      return 1;
+  }
+  return -1;
+}
+
+/* runs the next iteration of the loop closed at anchor one handler at a
+ * time under the trace recorder, so any core can record. it stops
+ * before the first instruction the recorder refuses and returns where
+ * the core goes on, the anchor when the loop was closed, or -1 when an
+ * instruction failed */
+static long recordLoop(VMContext ctx, VMInstruction inst, ConstPool pool, FrameInfo frames, long anchor) {
+  long header = inst[anchor].operand;
+  struct VMState st = {ctx, inst + header, inst, pool, frames, NULL, NULL, LONG_MAX};
+  TraceRecorder rec = beginTrace(header, anchor, ctx);
+  while(st.pc != inst + anchor) {
+    int op = decodeOp(st.pc);
+    if(op < 0 || !recordTrace(rec, st.pc - inst, op, st.pc->operand, st.ctx, pool)) {
+      break;
     }
-    DISPATCH_NEXT;
-  }
-  OP(loadl) {
-    Type val = ctx->var_list+pc->var_id;
-    if(val->type == TYPE_INT) {
-      push_i(ctx, val->int_val);
-    } else if(val->type == TYPE_FLOAT) {
-      push_d(ctx, val->double_val);
-    } else if(val->type == TYPE_STRING) {
-      push_s(ctx, val->string);
-    } else if(val->type == TYPE_BOOL) {
-      push_b(ctx, val->bool_val);
-    } else {
-      fprintf(stderr, "type error of loadl\n");
-      return 1;
+    if(handlers[op](&st, st.ctx, st.pc) != HANDLER_NEXT) {
+      endTrace(rec, 0);
+      return -1;
     }
-    DISPATCH_NEXT;
-  }
-  OP(storea) {
-    Type val = ctx->var_list+pc->var_id;
-    Type top = pop_sp(ctx->prev);
-    if(top->type == TYPE_INT) {
-      val->int_val = top->int_val;
-    } else if(top->type == TYPE_FLOAT) {
-      val->double_val = top->double_val;
-    } else if(top->type == TYPE_STRING) {
-      val->string = top->string;
-    } else if(top->type == TYPE_BOOL) {
-      val->bool_val = top->bool_val;
-    } else {
-      fprintf(stderr, "type error of storel\n");
-      return 1;
+  }
+  traceSlot(anchor)->trace = endTrace(rec, st.pc == inst + anchor);
+  return st.pc - inst;
+}
+
+#ifdef VM_CONTEXT_THREADING
+
+/* context threading: prepareVM emits x86-64 code that makes one native
+ * call per instruction into the handler functions above, so dispatch is
+ * a return the CPU predicts. jumps and branches become native jumps and
+ * script calls and returns a native call and ret. the code keeps the
+ * VMState in r12 and the instruction array in r13 */
+
+#define CONTEXT_STUB_SIZE 64
+#define CONTEXT_INSTRUCTION_SIZE 64
+
+typedef int (*ContextEntry)(struct VMState* st, VMInstruction inst);
+
+static unsigned char* context_code;
+
+struct Emitter {
+  unsigned char* p;
+  unsigned char* leave;
+  unsigned char** labels;
+  unsigned char** fixups;
+  long* fixup_targets;
+  long fixup_size;
+};
+
+static void emitBytes(struct Emitter* e, const unsigned char* bytes, int size) {
+  memcpy(e->p, bytes, size);
+  e->p += size;
+}
+
+static void emitByte(struct Emitter* e, int byte) {
+  *e->p++ = (unsigned char)byte;
+}
+
+static void emitInt(struct Emitter* e, int32_t val) {
+  memcpy(e->p, &val, sizeof(val));
+  e->p += sizeof(val);
+}
+
+/* rel32 to an instruction, patched once every label is known */
+static void emitBranch(struct Emitter* e, long target) {
+  e->fixups[e->fixup_size] = e->p;
+  e->fixup_targets[e->fixup_size++] = target;
+  emitInt(e, 0);
+}
+
+/* handler(st, st->ctx, inst + index), leaving on anything but HANDLER_NEXT */
+static void emitHandlerCall(struct Emitter* e, int op, long index) {
+  static const unsigned char load_state[] = {0x4c, 0x89, 0xe7}; /* mov %r12,%rdi */
+  static const unsigned char load_ctx[] = {0x49, 0x8b, 0x74, 0x24}; /* mov disp8(%r12),%rsi */
+  static const unsigned char load_pc[] = {0x49, 0x8d, 0x95}; /* lea disp32(%r13),%rdx */
+  static const unsigned char check[] = {0x83, 0xf8, 0xff, 0x0f, 0x85}; /* cmp $-1,%eax; jne rel32 */
+  emitBytes(e, load_state, sizeof(load_state));
+  emitBytes(e, load_ctx, sizeof(load_ctx));
+  emitByte(e, offsetof(struct VMState, ctx));
+  emitBytes(e, load_pc, sizeof(load_pc));
+  emitInt(e, (int32_t)(index * sizeof(struct VMInstruction)));
+  unsigned char* handler = (unsigned char*)handlers[op];
+  int64_t rel = handler - (e->p + 5);
+  if(rel == (int32_t)rel) {
+    emitByte(e, 0xe8); /* call rel32 */
+    emitInt(e, (int32_t)rel);
+  } else {
+    emitByte(e, 0x48); /* movabs $handler,%rax; call *%rax */
+    emitByte(e, 0xb8);
+    memcpy(e->p, &handler, sizeof(handler));
+    e->p += sizeof(handler);
+    emitByte(e, 0xff);
+    emitByte(e, 0xd0);
+  }
+  emitBytes(e, check, sizeof(check));
+  emitInt(e, (int32_t)(e->leave - (e->p + 4)));
+}
+
+/* script calls keep the native stack 16 byte aligned for the handlers */
+static void emitScriptCall(struct Emitter* e, long target) {
+  static const unsigned char align[] = {0x48, 0x83, 0xec, 0x08}; /* sub $8,%rsp */
+  static const unsigned char unalign[] = {0x48, 0x83, 0xc4, 0x08}; /* add $8,%rsp */
+  emitBytes(e, align, sizeof(align));
+  emitByte(e, 0xe8);
+  emitBranch(e, target);
+  emitBytes(e, unalign, sizeof(unalign));
+}
+
+/* the handler of a switch left st->pc at the case entry it picked. the
+ * entries after the switch are native jumps of 5 bytes each, so the
+ * entry index finds its jump. with the jump to the default this takes
+ * less than two instructions' room */
+static void emitCaseJump(struct Emitter* e, long index) {
+  static const unsigned char load_pc[] = {0x49, 0x8b, 0x44, 0x24}; /* mov disp8(%r12),%rax */
+  static const unsigned char to_index[] = {
+    0x4c, 0x29, 0xe8, /* sub %r13,%rax */
+    0x48, 0xc1, 0xe8, 0x03, /* shr $3,%rax */
+    0x48, 0x2d /* sub $imm32,%rax */
+  };
+  static const unsigned char to_code[] = {
+    0x48, 0x8d, 0x04, 0x80, /* lea (%rax,%rax,4),%rax */
+    0x48, 0x8d, 0x0d /* lea rel32(%rip),%rcx */
+  };
+  static const unsigned char jump[] = {
+    0x48, 0x01, 0xc8, /* add %rcx,%rax */
+    0xff, 0xe0 /* jmp *%rax */
+  };
+  emitBytes(e, load_pc, sizeof(load_pc));
+  emitByte(e, offsetof(struct VMState, pc));
+  emitBytes(e, to_index, sizeof(to_index));
+  emitInt(e, (int32_t)(index + 1));
+  emitBytes(e, to_code, sizeof(to_code));
+  emitBranch(e, index + 1);
+  emitBytes(e, jump, sizeof(jump));
+}
+
+static void buildContextCode(VMInstruction code, long code_length, FrameInfo frames) {
+  static const unsigned char enter[] = {
+    0x41, 0x54, /* push %r12 */
+    0x41, 0x55, /* push %r13 */
+    0x48, 0x83, 0xec, 0x08, /* sub $8,%rsp */
+    0x49, 0x89, 0xfc, /* mov %rdi,%r12 */
+    0x49, 0x89, 0xf5, /* mov %rsi,%r13 */
+    0x49, 0x89, 0x64, 0x24 /* mov %rsp,disp8(%r12) */
+  };
+  static const unsigned char leave[] = {
+    0x49, 0x8b, 0x64, 0x24 /* mov disp8(%r12),%rsp */
+  };
+  static const unsigned char leave_tail[] = {
+    0x48, 0x83, 0xc4, 0x08, /* add $8,%rsp */
+    0x41, 0x5d, /* pop %r13 */
+    0x41, 0x5c, /* pop %r12 */
+    0xc3 /* ret */
+  };
+  static const unsigned char compare_pc[] = {
+    0x49, 0x39, 0x44, 0x24 /* cmp %rax,disp8(%r12) */
+  };
+  size_t size = CONTEXT_STUB_SIZE + (code_length+1)*CONTEXT_INSTRUCTION_SIZE;
+  unsigned char* buf = (unsigned char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(buf == MAP_FAILED) {
+    fprintf(stderr, "cannot map the context threaded code\n");
+    exit(1);
+  }
+  struct Emitter e;
+  e.p = buf;
+  e.labels = (unsigned char**)malloc(sizeof(unsigned char*)*(code_length+1));
+  e.fixups = (unsigned char**)malloc(sizeof(unsigned char*)*(code_length+1));
+  e.fixup_targets = (long*)malloc(sizeof(long)*(code_length+1));
+  e.fixup_size = 0;
+
+  /* entry: keep the native stack pointer for leaving on an error and
+   * call the top level code; its ret_void comes back here */
+  emitBytes(&e, enter, sizeof(enter));
+  emitByte(&e, offsetof(struct VMState, native_sp));
+  emitScriptCall(&e, vm_entry);
+  emitByte(&e, 0x31); /* xor %eax,%eax */
+  emitByte(&e, 0xc0);
+  e.leave = e.p;
+  emitBytes(&e, leave, sizeof(leave));
+  emitByte(&e, offsetof(struct VMState, native_sp));
+  emitBytes(&e, leave_tail, sizeof(leave_tail));
+
+  for(long i = 0; i < code_length; i++) {
+    int op = code[i].handler;
+    long target = code[i].operand;
+    e.labels[i] = e.p;
+    switch(op) {
+      case Ijump:
+      case Icase:
+        emitByte(&e, 0xe9);
+        emitBranch(&e, target);
+        break;
+      case Itableswitch:
+      case Ilookupswitch:
+      case Ihashswitch:
+        emitHandlerCall(&e, op, i);
+        emitCaseJump(&e, i);
+        break;
+      case Iifcmp:
+      case Iifcmp_u:
+        /* the handler left st->pc at the target when the branch is taken */
+        emitHandlerCall(&e, op, i);
+        emitByte(&e, 0x49); /* lea disp32(%r13),%rax */
+        emitByte(&e, 0x8d);
+        emitByte(&e, 0x85);
+        emitInt(&e, (int32_t)(target * sizeof(struct VMInstruction)));
+        emitBytes(&e, compare_pc, sizeof(compare_pc));
+        emitByte(&e, offsetof(struct VMState, pc));
+        emitByte(&e, 0x0f); /* je rel32 */
+        emitByte(&e, 0x84);
+        emitBranch(&e, target);
+        break;
+      case Icall:
+        emitHandlerCall(&e, op, i);
+        emitScriptCall(&e, target);
+        break;
+      case Ifcall:
+        emitHandlerCall(&e, op, i);
+        emitScriptCall(&e, frames[target].entry);
+        break;
+      case Iret:
+      case Iret_void:
+        emitHandlerCall(&e, op, i);
+        emitByte(&e, 0xc3); /* ret */
+        break;
+      default:
+        emitHandlerCall(&e, op, i);
+        break;
     }
-    DISPATCH_NEXT;
-  }
-  OP(storel) {
-    Type val = ctx->var_list+pc->var_id;
-    Type top = pop_sp(ctx);
-    if(top->type == TYPE_INT) {
-      val->int_val = top->int_val;
-      val->type = TYPE_INT;
-    } else if(top->type == TYPE_FLOAT) {
-      val->double_val = top->double_val;
-      val->type = TYPE_FLOAT;
-    } else if(top->type == TYPE_STRING) {
-      val->string = top->string;
-      val->type = TYPE_STRING;
-    } else if(top->type == TYPE_BOOL) {
-      val->bool_val = top->bool_val;
-      val->type = TYPE_BOOL;
-    } else {
-      fprintf(stderr, "type error of storel\n");
-      return 1;
+  }
+  /* a dead jump to the end of the last function */
+  e.labels[code_length] = e.p;
+  emitByte(&e, 0x0f); /* ud2 */
+  emitByte(&e, 0x0b);
+
+  for(long i = 0; i < e.fixup_size; i++) {
+    unsigned char* field = e.fixups[i];
+    int32_t rel = (int32_t)(e.labels[e.fixup_targets[i]] - (field + 4));
+    memcpy(field, &rel, sizeof(rel));
+  }
+  if(sc_debug) {
+    fprintf(stderr, "context code: %ld bytes for %ld instructions\n", (long)(e.p - buf), code_length);
+  }
+  if(perf_module) {
+    writePerfCode("scriptC::context_entry", buf, e.labels[0] - buf);
+    for(int id = 0; id < perf_module->size; id++) {
+      long begin = perf_module->codePoints[id];
+      long end = id + 1 < perf_module->size ? perf_module->codePoints[id+1] : code_length;
+      writePerfFunction(id, e.labels[begin], e.labels[end] - e.labels[begin]);
     }
-    DISPATCH_NEXT;
-  }
-  OP(write) {
-    Type val = pop_sp(ctx);
-    if(val->type == TYPE_INT) {
-      printf("%d\n", val->int_val);
-    } else if(val->type == TYPE_FLOAT) {
-      printf("%f\n", val->double_val);
-    } else if(val->type == TYPE_STRING) {
-      printf("%s\n", val->string);
-    } else if(val->type == TYPE_BOOL) {
-      if(val->bool_val) {
-        printf("true\n");
-      } else {
-        printf("false\n");
-      }
+  }
+  free(e.labels);
+  free(e.fixups);
+  free(e.fixup_targets);
+  if(mprotect(buf, size, PROT_READ|PROT_EXEC)) {
+    fprintf(stderr, "cannot make the context threaded code executable\n");
+    exit(1);
+  }
+  context_code = buf;
+}
+
+/* the native code never enters the jump and call handlers, so it runs
+ * to the end whatever the budget */
+static long runContextThreaded(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  struct VMState st = {thread->ctx, inst + thread->pc, inst, pool, frames, NULL, thread, LONG_MAX};
+  ContextEntry entry = (ContextEntry)context_code;
+  return entry(&st, inst);
+}
+
+#endif
+
+static const char* const dispatch_names[] = {"direct", "switch", "call", "context"};
+
+int getDispatch(const char* name) {
+  for(int i = 0; i < (int)(sizeof(dispatch_names)/sizeof(dispatch_names[0])); i++) {
+    if(!strcmp(name, dispatch_names[i])) {
+      return i;
     }
-    DISPATCH_NEXT;
   }
+  return -1;
+}
 
-  return 0;
+const char* getDispatchName(int dispatch) {
+  return dispatch_names[dispatch];
+}
+
+VMInstruction prepareVM(ScriptCInstruction inst, long code_length, FrameInfo frames) {
+#ifndef VM_CONTEXT_THREADING
+  if(sc_dispatch == DISPATCH_CONTEXT) {
+    fprintf(stderr, "context threading needs an x86-64 host, using call threading\n");
+    sc_dispatch = DISPATCH_CALL;
+  }
+#endif
+  VMInstruction code = (VMInstruction)malloc(sizeof(struct VMInstruction)*code_length);
+  encodeCode(code, inst, code_length, 0);
+#ifdef VM_CONTEXT_THREADING
+  if(sc_dispatch == DISPATCH_CONTEXT) {
+    buildContextCode(code, code_length, frames);
+  }
+#endif
+  return code;
+}
+
+/* context threading emits its native code once, so main links every
+ * function up front for it */
+VMInstruction prepareLazyVM(Module module, FrameInfo frames) {
+  vm_module = module;
+  loadFunction(0, frames);
+  return vm_code;
+}
+
+#ifdef VM_CONTEXT_THREADING
+
+/* push %rbp; mov %rsp,%rbp; movabs $enterFunction,%rax; call *%rax;
+ * pop %rbp; ret. the frame pointer lets perf unwind through the stubs */
+static void buildTrampolines(Module module) {
+  static const unsigned char enter[] = {0x55, 0x48, 0x89, 0xe5, 0x48, 0xb8};
+  static const unsigned char leave[] = {0xff, 0xd0, 0x5d, 0xc3};
+  size_t size = (size_t)module->size * TRAMPOLINE_SIZE;
+  unsigned char* buf = (unsigned char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(buf == MAP_FAILED) {
+    fprintf(stderr, "cannot map the perf trampolines\n");
+    exit(1);
+  }
+  Trampoline helper = enterFunction;
+  for(int id = 0; id < module->size; id++) {
+    unsigned char* p = buf + (size_t)id * TRAMPOLINE_SIZE;
+    memcpy(p, enter, sizeof(enter));
+    memcpy(p + sizeof(enter), &helper, sizeof(helper));
+    memcpy(p + sizeof(enter) + sizeof(helper), leave, sizeof(leave));
+  }
+  if(mprotect(buf, size, PROT_READ|PROT_EXEC)) {
+    fprintf(stderr, "cannot make the perf trampolines executable\n");
+    exit(1);
+  }
+  perf_trampolines = buf;
+  for(int id = 0; id < module->size; id++) {
+    writePerfFunction(id, buf + (size_t)id * TRAMPOLINE_SIZE, TRAMPOLINE_SIZE);
+  }
+}
+
+#endif
+
+/* called before the code is prepared. trampolines are for the
+ * interpreting cores, the context threaded code is named directly */
+void preparePerf(Module module, int trampolines) {
+  perf_module = module;
+  if(!trampolines || sc_dispatch == DISPATCH_CONTEXT) {
+    return;
+  }
+#ifdef VM_CONTEXT_THREADING
+  buildTrampolines(module);
+#else
+  fprintf(stderr, "perf trampolines need an x86-64 host\n");
+#endif
+}
+
+void disposeLazyVM(void) {
+  free(vm_code);
+  vm_code = NULL;
+  vm_code_capacity = 0;
+}
+
+long vm_run(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  switch(sc_dispatch) {
+    case DISPATCH_SWITCH:
+      return VM_COUNTED ? runSwitchCounted(thread, inst, pool, frames) : runSwitch(thread, inst, pool, frames);
+    case DISPATCH_CALL:
+      return runCallThreaded(thread, inst, pool, frames);
+#ifdef VM_CONTEXT_THREADING
+    case DISPATCH_CONTEXT:
+      return runContextThreaded(thread, inst, pool, frames);
+#endif
+  }
+  return VM_COUNTED ? runDirectCounted(thread, inst, pool, frames) : runDirect(thread, inst, pool, frames);
+}
+
+long vm_execute(VMContext ctx, VMInstruction inst, ConstPool pool, FrameInfo frames) {
+  struct VMThread thread = {ctx, vm_entry, LONG_MAX};
+  perf_code = inst;
+  perf_pool = pool;
+  perf_frames = frames;
+  return vm_run(&thread, inst, pool, frames);
 }
@@ -1,19 +1,38 @@
 #ifndef __VM__
 #define __VM__
 
+#include <stdint.h>
+#include "array.h"
+#include "map.h"
+#include "bigint.h"
+
 extern int sc_debug;
+extern int sc_optimize;
+extern int sc_dispatch;
+extern int sc_stats;
+extern int sc_trace;
 
 #define IR_EACH(OP)\
 	OP(exit)\
 	OP(call)\
+  OP(lcall)\
+  OP(tcall)\
+  OP(loop)\
+  OP(trace)\
+	OP(ncall)\
 	OP(ret)\
 	OP(ret_void)\
 	OP(iconst)\
+  OP(lconst)\
   OP(dconst)\
   OP(sconst)\
   OP(bconst)\
 	OP(jump)\
 	OP(ifcmp)\
+	OP(tableswitch)\
+	OP(lookupswitch)\
+	OP(hashswitch)\
+	OP(case)\
 	OP(gt)\
 	OP(ge)\
 	OP(lt)\
@@ -28,7 +47,61 @@ extern int sc_debug;
   OP(loadl)\
   OP(storea)\
   OP(storel)\
-  OP(write)
+  OP(iinc)\
+  OP(aload)\
+  OP(astore)\
+  OP(mget)\
+  OP(mput)\
+  OP(mhas)\
+  OP(mdel)\
+  OP(write)\
+  OP(snapshot)\
+  OP(fcall)\
+  OP(loadl_u)\
+  OP(storel_u)\
+  OP(storea_u)\
+  OP(ifcmp_u)\
+  OP(iadd)\
+  OP(isub)\
+  OP(imul)\
+  OP(idiv)\
+  OP(ilt)\
+  OP(igt)\
+  OP(ile)\
+  OP(ige)\
+  OP(ieq)\
+  OP(ine)\
+  OP(dadd)\
+  OP(dsub)\
+  OP(dmul)\
+  OP(ddiv)\
+  OP(dlt)\
+  OP(dgt)\
+  OP(dle)\
+  OP(dge)\
+  OP(deq)\
+  OP(dne)
+
+/* lcall calls a function by index before it is linked: it links the
+ * callee on first use and rewrites itself to fcall. tcall is fcall
+ * through the perf trampoline of the callee, see preparePerf. loop is
+ * a backward jump while tracing and trace the loop it closes once it
+ * has a trace, see trace.h.
+ *
+ * a switch pops its value and is followed by one case per entry of its
+ * table and a jump to the default. it continues at the target of the
+ * case it picks; its operand indexes a run of the long pool holding the
+ * number of cases, then the lowest key of a tableswitch or the sorted
+ * keys of a lookupswitch or hashswitch. the keys of a hashswitch are
+ * caseHash of the strings and the targets compare the string. a case
+ * is a branch that its switch took or not as far as the verifier is
+ * concerned, and a jump when it is dispatched. snapshot is the marker
+ * of the builtin snapshot(), see snapshot.h
+ *
+ * opcodes from fcall on are otherwise only selected by the verifier:
+ * they skip the type tag checks and fcall allocates the callee frame
+ * exactly. the int forms still test for a bigint operand and for
+ * overflow, and take the bigint path then */
 
 enum nezvm_opcode {
 #define DEFINE_ENUM(NAME) I##NAME,
@@ -37,18 +110,35 @@ enum nezvm_opcode {
   OP_ERROR = -1
 };
 
+/* builtin functions with a dedicated opcode: name, opcode, arguments.
+ * everything else callable by name lives in the native registry */
+#define BUILTIN_EACH(BUILTIN)\
+  BUILTIN(get, mget, 2)\
+  BUILTIN(put, mput, 3)\
+  BUILTIN(contains, mhas, 2)\
+  BUILTIN(delete, mdel, 2)\
+  BUILTIN(snapshot, snapshot, 0)
+
 #define TYPE_INT 0
 #define TYPE_FLOAT 1
 #define TYPE_STRING 2
 #define TYPE_BOOL 3
+#define TYPE_ARRAY 4
+#define TYPE_MAP 5
+#define TYPE_BIGINT 6
+/* a local not assigned yet; the checked loadl stops on it */
+#define TYPE_UNSET 7
 
 struct Type {
 	int type;
 	union {
-		int int_val;
+		int64_t int_val;
 		double double_val;
 		char* string;
 		int bool_val;
+		struct ScriptCArray* array;
+		struct ScriptCMap* map;
+		struct ScriptCBigInt* bigint;
 	};
 };
 
@@ -61,12 +151,93 @@ struct VMContext {
 	long retPoint;
 };
 
+/* compact instruction: the handler is an offset from the first opcode
+ * handler and the operand is an immediate, a local, a code index or an
+ * index into the module's constant pool */
+struct VMInstruction {
+	int32_t handler;
+	int32_t operand;
+};
+
+#define VM_CONTEXT_MAX_STACK_LENGTH 1024
+
+/* interpreter cores, selected with -t. direct threading jumps from
+ * handler to handler through computed gotos, switch dispatch shares the
+ * jump of one switch, call threading calls a function per instruction
+ * from a loop and context threading emits a native call per instruction
+ * (x86-64 only, call threading elsewhere) */
+#define DISPATCH_DIRECT 0
+#define DISPATCH_SWITCH 1
+#define DISPATCH_CALL 2
+#define DISPATCH_CONTEXT 3
+
+/* FNV-1a, the key of a string case */
+static inline int32_t caseHash(const char* str) {
+  uint32_t h = 2166136261u;
+  for(; *str; str++) {
+    h = (h ^ (unsigned char)*str) * 16777619u;
+  }
+  return (int32_t)h;
+}
+
+/* iinc packs its local in the low byte and its step above. the step
+ * comes back by an arithmetic shift, as gcc and clang do for int32_t */
+#define INC_VAR(OPERAND) ((OPERAND) & 0xff)
+#define INC_VAL(OPERAND) ((int32_t)(OPERAND) >> 8)
+
+/* per function frame layout computed by the verifier */
+struct FrameInfo {
+	long entry;
+	int var_size;
+	int stack_size;
+};
+
+/* a script run that can stop and go on later. vm_run spends one unit of
+ * budget on every backward jump and every script call and returns
+ * VM_YIELD when it runs out, with ctx and pc saying where to resume */
+#define VM_YIELD 2
+
+struct VMThread {
+	struct VMContext* ctx;
+	long pc;
+	long budget;
+};
+
+/* what -s counts while sc_stats is set: the instructions the core
+ * dispatched and the frames it created */
+struct VMStats {
+	long dispatched;
+	long frames;
+	long frame_bytes;
+};
+
+extern struct VMStats vm_stats;
+
+/* -R: the calls of each code index, counted by the -s cores while set */
+extern long* vm_calls;
+
+/* where vm_execute enters the top level code: index 1, or the
+ * instruction after the marker of a restored snapshot */
+extern long vm_entry;
+
 typedef struct Type* Type;
 typedef struct VMContext* VMContext;
+typedef struct VMInstruction* VMInstruction;
+typedef struct FrameInfo* FrameInfo;
 
 VMContext createVMContext(VMContext prev, long retPoint);
+VMContext createFrame(VMContext prev, long retPoint, int var_size, int stack_size);
 void disposeVMContext(VMContext ctx);
-void prepareVM(VMContext ctx, ScriptCInstruction inst, long code_length);
-long vm_execute(VMContext ctx, ScriptCInstruction inst);
+int getDispatch(const char* name);
+const char* getDispatchName(int dispatch);
+VMInstruction prepareVM(ScriptCInstruction inst, long code_length, FrameInfo frames);
+VMInstruction prepareLazyVM(Module module, FrameInfo frames);
+void disposeLazyVM(void);
+void preparePerf(Module module, int trampolines);
+long vm_execute(VMContext ctx, VMInstruction inst, ConstPool pool, FrameInfo frames);
+long vm_run(struct VMThread* thread, VMInstruction inst, ConstPool pool, FrameInfo frames);
+int getBuiltin(const char* name);
+int getBuiltinOp(int id);
+int getBuiltinArgSize(int id);
 
 #endif
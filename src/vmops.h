@@ -0,0 +1,687 @@
+/* opcode handlers shared by the interpreter cores in vm.c. there is no
+ * include guard: vm.c includes this once per core after defining
+ * OP(NAME) to open a handler, DISPATCH_NEXT to continue with the next
+ * instruction, JUMP(dst) to continue at dst, HANDLER(NAME) to the
+ * handler field of an opcode and RELOAD to pick up the code and pool
+ * after a function was linked. a handler returns 0 to stop the program
+ * and leaves through VM_ERROR on an error. the names it may use are
+ * ctx, pc, inst, frames, the constant pool sections pool_longs,
+ * pool_doubles and pool_strings, pool for the trace recorder, and
+ * budget and thread for SPEND_BUDGET and VM_ERROR.
+ * COUNT_CALL(dst) records a call of dst for the -R profile and
+ * CASE_TARGET(entry) is where a switch goes on for one of its entries */
+
+/* backward jumps and calls spend the budget; when it is gone the core
+ * leaves with VM_YIELD and vm_run picks up at dst next time */
+#define SPEND_BUDGET(dst) if(--budget < 0) {\
+    thread->ctx = ctx;\
+    thread->pc = (dst) - inst;\
+    return VM_YIELD;\
+  }
+
+/* an error returns 1 and leaves the frames with the thread, so the
+ * scheduler can free a failed task; the trace recorder has no thread */
+#define VM_ERROR { if(thread) thread->ctx = ctx; return 1; }
+
+OP(exit) {
+  return 0;
+}
+OP(call) {
+  COUNT_CALL(inst + pc->operand);
+  ctx = createVMContext(ctx, pc-inst+1);
+  SPEND_BUDGET(inst + pc->operand);
+  JUMP(inst + pc->operand);
+}
+OP(lcall) {
+  if(frames[pc->operand].entry == 0) {
+    long index = pc - inst;
+    loadFunction(pc->operand, frames);
+    RELOAD;
+    pc = inst + index;
+  }
+  pc->handler = perf_trampolines ? HANDLER(tcall) : HANDLER(fcall);
+  JUMP(pc);
+}
+OP(tcall) {
+  long index = pc - inst;
+  FrameInfo frame = &frames[pc->operand];
+  COUNT_CALL(inst + frame->entry);
+  if(perf_depth >= TRAMPOLINE_MAX_DEPTH) {
+    ctx = createFrame(ctx, index+1, frame->var_size, frame->stack_size);
+    JUMP(inst + frame->entry);
+  }
+  if(callTrampoline(createFrame(ctx, 0, frame->var_size, frame->stack_size), pc->operand)) {
+    VM_ERROR;
+  }
+  /* the callee may have linked functions and moved the code */
+  if(vm_module) {
+    RELOAD;
+    pc = inst + index;
+  }
+  DISPATCH_NEXT;
+}
+OP(loop) {
+  SPEND_BUDGET(inst + pc->operand);
+  struct TraceSlot* slot = traceSlot(pc - inst);
+  if(++slot->count >= TRACE_HOT_LOOP) {
+    /* the recorder runs the next iteration, then the trace takes over */
+    long next = recordLoop(ctx, inst, pool, frames, pc - inst);
+    if(next < 0) {
+      VM_ERROR;
+    }
+    pc->handler = traceSlot(pc - inst)->trace ? HANDLER(trace) : HANDLER(jump);
+    JUMP(inst + next);
+  }
+  JUMP(inst + pc->operand);
+}
+OP(trace) {
+  SPEND_BUDGET(inst + pc->operand);
+  long left = budget;
+  long next = runTrace(traceSlot(pc - inst)->trace, ctx, &left);
+  budget = left;
+  if(next < 0) {
+    pc->handler = HANDLER(jump);
+    next = pc->operand;
+  }
+  JUMP(inst + next);
+}
+OP(ncall) {
+  int arg_size = NCALL_ARGC(pc->operand);
+  Type args = ctx->stack_pointer - arg_size;
+  struct NativeEntry* native = &native_table[NCALL_ID(pc->operand)];
+  struct Type ret;
+  setHeapRoots(ctx);
+  if(native->func(args, arg_size, &ret)) {
+    VM_ERROR;
+  }
+  ctx->stack_pointer = args;
+  if(native->ret_type != NATIVE_VOID) {
+    *ctx->stack_pointer++ = ret;
+  }
+  DISPATCH_NEXT;
+}
+OP(ret) {
+  long retPoint = ctx->retPoint;
+  Type top = pop_sp(ctx);
+  VMContext next = call_back(ctx);
+  if(top->type == TYPE_INT) {
+    push_i(next, top->int_val);
+  } else if(top->type == TYPE_FLOAT) {
+    push_d(next, top->double_val);
+  } else if(top->type == TYPE_STRING) {
+    push_s(next, top->string);
+  } else if(top->type == TYPE_BOOL) {
+    push_b(next, top->bool_val);
+  } else if(top->type == TYPE_ARRAY) {
+    push_a(next, top->array);
+  } else if(top->type == TYPE_MAP) {
+    push_m(next, top->map);
+  } else if(top->type == TYPE_BIGINT) {
+    push_big(next, top->bigint);
+  } else {
+    fprintf(stderr, "type error of return statement\n");
+    VM_ERROR;
+  }
+  disposeVMContext(ctx);
+  ctx = next;
+  JUMP(inst + retPoint);
+}
+OP(ret_void) {
+  long retPoint = ctx->retPoint;
+  VMContext next = call_back(ctx);
+  disposeVMContext(ctx);
+  ctx = next;
+  JUMP(inst + retPoint);
+}
+OP(iconst) {
+  push_i(ctx, pc->operand);
+  DISPATCH_NEXT;
+}
+OP(lconst) {
+  push_i(ctx, pool_longs[pc->operand]);
+  DISPATCH_NEXT;
+}
+OP(dconst) {
+  push_d(ctx, pool_doubles[pc->operand]);
+  DISPATCH_NEXT;
+}
+OP(sconst) {
+  push_s(ctx, pool_strings[pc->operand]);
+  DISPATCH_NEXT;
+}
+OP(bconst) {
+  push_b(ctx, pc->operand);
+  DISPATCH_NEXT;
+}
+OP(jump) {
+  if(pc->operand < pc - inst) {
+    SPEND_BUDGET(inst + pc->operand);
+  }
+  JUMP(inst + pc->operand);
+}
+OP(ifcmp) {
+  Type top = pop_sp(ctx);
+  if(top->type != TYPE_BOOL) {
+    fprintf(stderr, "type error of ifcmp\n");
+  }
+  if(!top->bool_val) {
+    JUMP(inst + pc->operand);
+  }
+  DISPATCH_NEXT;
+}
+OP(tableswitch) {
+  Type top = pop_sp(ctx);
+  const int64_t* keys = pool_longs + pc->operand;
+  int64_t entry = keys[0];
+  if(top->type == TYPE_INT) {
+    if((uint64_t)top->int_val - (uint64_t)keys[1] < (uint64_t)keys[0]) {
+      entry = top->int_val - keys[1];
+    }
+  } else if(top->type != TYPE_BIGINT) {
+    fprintf(stderr, "type error of switch\n");
+    VM_ERROR;
+  }
+  JUMP(CASE_TARGET(pc + 1 + entry));
+}
+OP(lookupswitch) {
+  Type top = pop_sp(ctx);
+  const int64_t* keys = pool_longs + pc->operand;
+  long entry = keys[0];
+  if(top->type == TYPE_INT) {
+    entry = findCase(keys, top->int_val);
+  } else if(top->type != TYPE_BIGINT) {
+    fprintf(stderr, "type error of switch\n");
+    VM_ERROR;
+  }
+  JUMP(CASE_TARGET(pc + 1 + entry));
+}
+OP(hashswitch) {
+  Type top = pop_sp(ctx);
+  if(top->type != TYPE_STRING) {
+    fprintf(stderr, "type error of switch\n");
+    VM_ERROR;
+  }
+  JUMP(CASE_TARGET(pc + 1 + findCase(pool_longs + pc->operand, caseHash(top->string))));
+}
+OP(case) {
+  JUMP(inst + pc->operand);
+}
+OP(gt) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val > right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) > 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val > right->double_val);
+  } else {
+    fprintf(stderr, "type error of gt expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(ge) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val >= right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) >= 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val >= right->double_val);
+  } else {
+    fprintf(stderr, "type error of ge expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(lt) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val < right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) < 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val < right->double_val);
+  } else {
+    fprintf(stderr, "type error of lt expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(le) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val <= right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) <= 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val <= right->double_val);
+  } else {
+    fprintf(stderr, "type error of le expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(eq) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val == right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) == 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val == right->double_val);
+  } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
+    push_b(ctx, !strcmp(left->string, right->string));
+  } else if(right->type == TYPE_BOOL && left->type == TYPE_BOOL) {
+    push_b(ctx, left->bool_val == right->bool_val);
+  } else {
+    fprintf(stderr, "type error of le expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(ne) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  if(right->type == TYPE_INT && left->type == TYPE_INT) {
+    push_b(ctx, left->int_val != right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    push_b(ctx, bigCompare(left, right) != 0);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_b(ctx, left->double_val != right->double_val);
+  } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
+    push_b(ctx, strcmp(left->string, right->string));
+  } else if(right->type == TYPE_BOOL && left->type == TYPE_BOOL) {
+    push_b(ctx, left->bool_val != right->bool_val);
+  } else {
+    fprintf(stderr, "type error of le expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(add) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  int64_t val;
+  if(right->type == TYPE_INT && left->type == TYPE_INT && !__builtin_add_overflow(left->int_val, right->int_val, &val)) {
+    push_i(ctx, val);
+  } else if(isInteger(right) && isInteger(left)) {
+    bigAdd(left, right, ctx->stack_pointer++);
+    heapSafepoint(ctx);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_d(ctx, left->double_val + right->double_val);
+  } else if(right->type == TYPE_STRING && left->type == TYPE_STRING) {
+    size_t left_len = strlen(left->string);
+    size_t right_len = strlen(right->string);
+    /* the operands stay on the stack while a collection may run */
+    ctx->stack_pointer += 2;
+    char* str = allocString(ctx, left_len+right_len+1);
+    ctx->stack_pointer -= 2;
+    memcpy(str, left->string, left_len);
+    memcpy(str+left_len, right->string, right_len+1);
+    push_s(ctx, str);
+  } else {
+    fprintf(stderr, "type error of add expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(sub) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  int64_t val;
+  if(right->type == TYPE_INT && left->type == TYPE_INT && !__builtin_sub_overflow(left->int_val, right->int_val, &val)) {
+    push_i(ctx, val);
+  } else if(isInteger(right) && isInteger(left)) {
+    bigSub(left, right, ctx->stack_pointer++);
+    heapSafepoint(ctx);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_d(ctx, left->double_val - right->double_val);
+  } else {
+    fprintf(stderr, "type error of sub expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(mul) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  int64_t val;
+  if(right->type == TYPE_INT && left->type == TYPE_INT && !__builtin_mul_overflow(left->int_val, right->int_val, &val)) {
+    push_i(ctx, val);
+  } else if(isInteger(right) && isInteger(left)) {
+    bigMul(left, right, ctx->stack_pointer++);
+    heapSafepoint(ctx);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_d(ctx, left->double_val * right->double_val);
+  } else {
+    fprintf(stderr, "type error of mul expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(div) {
+  Type right = pop_sp(ctx);
+  Type left = pop_sp(ctx);
+  /* divisors 0 and -1 leave the fast path: division by zero and
+   * INT64_MIN / -1 are handled by bigDiv */
+  if(right->type == TYPE_INT && left->type == TYPE_INT && (uint64_t)right->int_val + 1 > 1) {
+    push_i(ctx, left->int_val / right->int_val);
+  } else if(isInteger(right) && isInteger(left)) {
+    if(bigDiv(left, right, ctx->stack_pointer++)) {
+      fprintf(stderr, "division by zero\n");
+      VM_ERROR;
+    }
+    heapSafepoint(ctx);
+  } else if(right->type == TYPE_FLOAT && left->type == TYPE_FLOAT) {
+    push_d(ctx, left->double_val / right->double_val);
+  } else {
+    fprintf(stderr, "type error of div expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(minus) {
+  Type left = pop_sp(ctx);
+  if(left->type == TYPE_INT && left->int_val != INT64_MIN) {
+    push_i(ctx, -left->int_val);
+  } else if(isInteger(left)) {
+    bigNeg(left, ctx->stack_pointer++);
+    heapSafepoint(ctx);
+  } else if(left->type == TYPE_FLOAT) {
+    push_d(ctx, -left->double_val);
+  } else {
+    fprintf(stderr, "type error of add expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(loadl) {
+  Type val = ctx->var_list+pc->operand;
+  if(val->type == TYPE_INT) {
+    push_i(ctx, val->int_val);
+  } else if(val->type == TYPE_FLOAT) {
+    push_d(ctx, val->double_val);
+  } else if(val->type == TYPE_STRING) {
+    push_s(ctx, val->string);
+  } else if(val->type == TYPE_BOOL) {
+    push_b(ctx, val->bool_val);
+  } else if(val->type == TYPE_ARRAY) {
+    push_a(ctx, val->array);
+  } else if(val->type == TYPE_MAP) {
+    push_m(ctx, val->map);
+  } else if(val->type == TYPE_BIGINT) {
+    push_big(ctx, val->bigint);
+  } else if(val->type == TYPE_UNSET) {
+    fprintf(stderr, "variable read before assignment\n");
+    VM_ERROR;
+  } else {
+    fprintf(stderr, "type error of loadl\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(storea) {
+  Type val = ctx->var_list+pc->operand;
+  Type top = pop_sp(ctx->prev);
+  if(top->type == TYPE_INT) {
+    val->int_val = top->int_val;
+    val->type = TYPE_INT;
+  } else if(top->type == TYPE_FLOAT) {
+    val->double_val = top->double_val;
+    val->type = TYPE_FLOAT;
+  } else if(top->type == TYPE_STRING) {
+    val->string = top->string;
+    val->type = TYPE_STRING;
+  } else if(top->type == TYPE_BOOL) {
+    val->bool_val = top->bool_val;
+    val->type = TYPE_BOOL;
+  } else if(top->type == TYPE_ARRAY) {
+    val->array = top->array;
+    val->type = TYPE_ARRAY;
+  } else if(top->type == TYPE_MAP) {
+    val->map = top->map;
+    val->type = TYPE_MAP;
+  } else if(top->type == TYPE_BIGINT) {
+    val->bigint = top->bigint;
+    val->type = TYPE_BIGINT;
+  } else {
+    fprintf(stderr, "type error of storel\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(storel) {
+  Type val = ctx->var_list+pc->operand;
+  Type top = pop_sp(ctx);
+  if(top->type == TYPE_INT) {
+    val->int_val = top->int_val;
+    val->type = TYPE_INT;
+  } else if(top->type == TYPE_FLOAT) {
+    val->double_val = top->double_val;
+    val->type = TYPE_FLOAT;
+  } else if(top->type == TYPE_STRING) {
+    val->string = top->string;
+    val->type = TYPE_STRING;
+  } else if(top->type == TYPE_BOOL) {
+    val->bool_val = top->bool_val;
+    val->type = TYPE_BOOL;
+  } else if(top->type == TYPE_ARRAY) {
+    val->array = top->array;
+    val->type = TYPE_ARRAY;
+  } else if(top->type == TYPE_MAP) {
+    val->map = top->map;
+    val->type = TYPE_MAP;
+  } else if(top->type == TYPE_BIGINT) {
+    val->bigint = top->bigint;
+    val->type = TYPE_BIGINT;
+  } else {
+    fprintf(stderr, "type error of storel\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(iinc) {
+  Type val = ctx->var_list+INC_VAR(pc->operand);
+  int64_t sum;
+  if(val->type == TYPE_INT && !__builtin_add_overflow(val->int_val, (int64_t)INC_VAL(pc->operand), &sum)) {
+    val->int_val = sum;
+  } else if(isInteger(val)) {
+    struct Type inc;
+    inc.type = TYPE_INT;
+    inc.int_val = INC_VAL(pc->operand);
+    bigAdd(val, &inc, val);
+    heapSafepoint(ctx);
+  } else {
+    fprintf(stderr, "type error of add expression\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(aload) {
+  Type index = pop_sp(ctx);
+  Type array = pop_sp(ctx);
+  if(array->type == TYPE_MAP) {
+    if(mapGet(ctx, array, index)) {
+      VM_ERROR;
+    }
+    DISPATCH_NEXT;
+  }
+  if(array->type != TYPE_ARRAY || index->type != TYPE_INT) {
+    fprintf(stderr, "type error of index expression\n");
+    VM_ERROR;
+  }
+  ScriptCArray a = array->array;
+  if((uint64_t)index->int_val >= (uint64_t)a->length) {
+    fprintf(stderr, "array index out of range (%" PRId64 ")\n", index->int_val);
+    VM_ERROR;
+  }
+  if(a->elem_type == ARRAY_INT) {
+    push_i(ctx, a->ints[index->int_val]);
+  } else {
+    push_d(ctx, a->doubles[index->int_val]);
+  }
+  DISPATCH_NEXT;
+}
+OP(astore) {
+  Type val = pop_sp(ctx);
+  Type index = pop_sp(ctx);
+  Type array = pop_sp(ctx);
+  if(array->type == TYPE_MAP) {
+    if(mapPut(array, index, val)) {
+      VM_ERROR;
+    }
+    DISPATCH_NEXT;
+  }
+  if(array->type != TYPE_ARRAY || index->type != TYPE_INT) {
+    fprintf(stderr, "type error of index expression\n");
+    VM_ERROR;
+  }
+  ScriptCArray a = array->array;
+  if((uint64_t)index->int_val >= (uint64_t)a->length) {
+    fprintf(stderr, "array index out of range (%" PRId64 ")\n", index->int_val);
+    VM_ERROR;
+  }
+  if(a->elem_type == ARRAY_INT && val->type == TYPE_INT) {
+    a->ints[index->int_val] = val->int_val;
+  } else if(a->elem_type == ARRAY_INT && val->type == TYPE_BIGINT) {
+    fprintf(stderr, "value out of range of int array\n");
+    VM_ERROR;
+  } else if(a->elem_type == ARRAY_FLOAT && val->type == TYPE_FLOAT) {
+    a->doubles[index->int_val] = val->double_val;
+  } else if(a->elem_type == ARRAY_FLOAT && val->type == TYPE_INT) {
+    a->doubles[index->int_val] = val->int_val;
+  } else {
+    fprintf(stderr, "type error of array store\n");
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(mget) {
+  Type key = pop_sp(ctx);
+  Type map = pop_sp(ctx);
+  if(map->type != TYPE_MAP) {
+    fprintf(stderr, "type error of get: first argument is not a map\n");
+    VM_ERROR;
+  }
+  if(mapGet(ctx, map, key)) {
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(mput) {
+  Type val = pop_sp(ctx);
+  Type key = pop_sp(ctx);
+  Type map = pop_sp(ctx);
+  if(map->type != TYPE_MAP) {
+    fprintf(stderr, "type error of put: first argument is not a map\n");
+    VM_ERROR;
+  }
+  if(mapPut(map, key, val)) {
+    VM_ERROR;
+  }
+  DISPATCH_NEXT;
+}
+OP(mhas) {
+  Type key = pop_sp(ctx);
+  Type map = pop_sp(ctx);
+  if(map->type != TYPE_MAP || !isMapKey(key)) {
+    fprintf(stderr, "type error of contains\n");
+    VM_ERROR;
+  }
+  push_b(ctx, getMap(map->map, key) != NULL);
+  DISPATCH_NEXT;
+}
+OP(mdel) {
+  Type key = pop_sp(ctx);
+  Type map = pop_sp(ctx);
+  if(map->type != TYPE_MAP || !isMapKey(key)) {
+    fprintf(stderr, "type error of delete\n");
+    VM_ERROR;
+  }
+  deleteMap(map->map, key);
+  DISPATCH_NEXT;
+}
+OP(write) {
+  Type val = pop_sp(ctx);
+  /* one line at a time when scheduled scripts share stdout */
+  flockfile(stdout);
+  printValue(val);
+  printf("\n");
+  funlockfile(stdout);
+  DISPATCH_NEXT;
+}
+OP(snapshot) {
+  takeSnapshot(ctx, pc - inst + 1);
+  DISPATCH_NEXT;
+}
+OP(fcall) {
+  FrameInfo frame = &frames[pc->operand];
+  COUNT_CALL(inst + frame->entry);
+  ctx = createFrame(ctx, pc-inst+1, frame->var_size, frame->stack_size);
+  SPEND_BUDGET(inst + frame->entry);
+  JUMP(inst + frame->entry);
+}
+OP(loadl_u) {
+  Type val = ctx->var_list+pc->operand;
+  Type top = ctx->stack_pointer++;
+  top->type = val->type;
+  top->string = val->string;
+  DISPATCH_NEXT;
+}
+OP(storel_u) {
+  Type val = ctx->var_list+pc->operand;
+  Type top = --ctx->stack_pointer;
+  val->type = top->type;
+  val->string = top->string;
+  DISPATCH_NEXT;
+}
+OP(storea_u) {
+  ctx->var_list[pc->operand] = *--ctx->prev->stack_pointer;
+  DISPATCH_NEXT;
+}
+OP(ifcmp_u) {
+  if(!(--ctx->stack_pointer)->bool_val) {
+    JUMP(inst + pc->operand);
+  }
+  DISPATCH_NEXT;
+}
+TYPED_INT_ARITH(iadd, __builtin_add_overflow, bigAdd)
+TYPED_INT_ARITH(isub, __builtin_sub_overflow, bigSub)
+TYPED_INT_ARITH(imul, __builtin_mul_overflow, bigMul)
+OP(idiv) {
+  Type right = --ctx->stack_pointer;
+  Type left = ctx->stack_pointer - 1;
+  if(left->type == TYPE_INT && right->type == TYPE_INT && (uint64_t)right->int_val + 1 > 1) {
+    left->int_val /= right->int_val;
+  } else if(bigDiv(left, right, left)) {
+    fprintf(stderr, "division by zero\n");
+    VM_ERROR;
+  } else {
+    heapSafepoint(ctx);
+  }
+  DISPATCH_NEXT;
+}
+TYPED_INT_COMPARE(ilt, <)
+TYPED_INT_COMPARE(igt, >)
+TYPED_INT_COMPARE(ile, <=)
+TYPED_INT_COMPARE(ige, >=)
+TYPED_INT_COMPARE(ieq, ==)
+TYPED_INT_COMPARE(ine, !=)
+TYPED_BINARY(dadd, double_val, +)
+TYPED_BINARY(dsub, double_val, -)
+TYPED_BINARY(dmul, double_val, *)
+TYPED_BINARY(ddiv, double_val, /)
+TYPED_COMPARE(dlt, double_val, <)
+TYPED_COMPARE(dgt, double_val, >)
+TYPED_COMPARE(dle, double_val, <=)
+TYPED_COMPARE(dge, double_val, >=)
+TYPED_COMPARE(deq, double_val, ==)
+TYPED_COMPARE(dne, double_val, !=)
+
+#undef SPEND_BUDGET